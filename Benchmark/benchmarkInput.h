@@ -0,0 +1,26 @@
+//
+//  benchmarkInput.h
+//  Benchmark
+//
+//  Created by Lun on 2017/9/20.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+@class CPUModel;
+
+// Input of the tools is float32 pixels in the layout of the input of a model, i.e. BGR, one channel after
+// another, input_size x input_size, but not normalized, so that the same pixels can be given to models
+// whose normalization is or is not folded into the first layer.
+
+double now_seconds(void);
+
+// pixels uniformly in [0, 256), the same seed gives the same pixels
+void fill_random_pixels(float *pixels, size_t count, unsigned seed);
+
+// pixels of a file of whole images, which are repeated if there are fewer of them than batch
+BOOL read_pixels(const char *path, float *pixels, int inputNum, int batch);
+
+// (pixel - inputMean[c]) * inputScale[c] of the model, as CPUSession preprocesses images
+void normalize_pixels(const float *pixels, float *data, CPUModel *model, int batch);
@@ -0,0 +1,51 @@
+//
+//  benchmarkInput.m
+//  Benchmark
+//
+//  Created by Lun on 2017/9/20.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "benchmarkInput.h"
+#import <time.h>
+#import "CPUModel.h"
+
+double now_seconds(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+void fill_random_pixels(float *pixels, size_t count, unsigned seed) {
+    for (size_t i = 0; i < count; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        pixels[i] = (seed >> 8) % 256;
+    }
+}
+
+BOOL read_pixels(const char *path, float *pixels, int inputNum, int batch) {
+    NSData *file = [NSData dataWithContentsOfFile:@(path)];
+    size_t imageBytes = sizeof(float) * inputNum;
+    if (!file || file.length < imageBytes || file.length % imageBytes) {
+        fprintf(stderr, "Error: %s should hold whole images of %d floats\n", path, inputNum);
+        return NO;
+    }
+
+    size_t images = file.length / imageBytes;
+    for (int image = 0; image < batch; image++) {
+        memcpy(pixels + image * inputNum, (const char *)file.bytes + image % images * imageBytes, imageBytes);
+    }
+    return YES;
+}
+
+void normalize_pixels(const float *pixels, float *data, CPUModel *model, int batch) {
+    int channelNum = model.inputSize * model.inputSize;
+    for (int image = 0; image < batch; image++) {
+        for (int c = 0; c < 3; c++) {
+            size_t offset = (size_t)image * model.inputNum + c * channelNum;
+            for (int i = 0; i < channelNum; i++) {
+                data[offset + i] = (pixels[offset + i] - model.inputMean[c]) * model.inputScale[c];
+            }
+        }
+    }
+}
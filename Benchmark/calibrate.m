@@ -0,0 +1,318 @@
+//
+//  calibrate.m
+//  Benchmark
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <getopt.h>
+#import <math.h>
+#import "CPUModel.h"
+#import "CPUSession.h"
+#import "CPULayer.h"
+#import "benchmarkInput.h"
+
+// Forwards calibration images through a float model, and finds the range of every image that uint8 should cover,
+// which Convert/quantize_weights.py writes into the JSON as output_range of the layer owning the image. Ranges are
+// recorded under owners of images only: layers writing into the image of another layer, e.g. branches of an
+// inception module writing into its concat, have no range of their own, and are quantized with that of the owner.
+// Ranges clipped below the largest magnitude lose a few outliers, but quantize everything else more finely:
+// the threshold of |x| is either the one whose quantized histogram diverges least from the histogram of the
+// layer (kl, the default), a percentile of |x|, or the largest |x| itself (max).
+
+#define HISTOGRAM_BINS 2048
+
+typedef NS_ENUM (NSInteger, CalibrationMethod) {
+    eCalibrationKL = 0,
+    eCalibrationPercentile,
+    eCalibrationMax,
+};
+
+struct calibrate_options {
+    const char *model;
+    const char *data;
+    const char *input;
+    const char *output;
+    int images;         // all images of the input, or 32 random ones by default
+    int batch;
+    unsigned seed;
+    CalibrationMethod method;
+    double percentile;
+};
+
+// statistics of the output of one layer over all images
+struct layer_statistics {
+    float min;
+    float max;
+    double histogram[HISTOGRAM_BINS];     // of |x| in [0, max(|min|, |max|)]
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s -m model.json -d model.dat [options]\n"
+            "  -m, --model FILE            description of the float net\n"
+            "  -d, --data FILE             its weights and biases\n"
+            "  -i, --input FILE            float32 pixels of calibration images, BGR, one channel after another; random if not given\n"
+            "  -n, --images N              images to forward, all of the input or 32 random ones by default\n"
+            "  -b, --batch N               images forwarded at once, 8 by default\n"
+            "      --seed N                seed of random pixels, 1 by default\n"
+            "      --method kl|percentile|max  how ranges are clipped, kl by default\n"
+            "      --percentile X          percentile of |x| of the percentile method, 99.99 by default\n"
+            "  -o, --output FILE           ranges as JSON, - for stdout, which is the default\n",
+            program);
+}
+
+// position of the last step writing each image, which is complete after it, e.g. of a concat, keyed by its owner
+static NSDictionary<NSString *, NSNumber *> *last_positions(CPUModel *model) {
+    NSMutableDictionary<NSString *, NSNumber *> *positions = [[NSMutableDictionary alloc] init];
+    for (int position = 0; position < model.stepsCount; position++) {
+        [positions setObject:@(position) forKey:[model destinationOfStep:[model stepAtPosition:position]].name];
+    }
+    return [positions copy];
+}
+
+// forward all images batch by batch, calling block with the complete output of each destination of each batch
+static void forward_images(CPUModel *model, NSData *file, const struct calibrate_options *options,
+                           void (^block)(NSString *layer, const float *output, size_t count)) {
+    CPUSession *session = [[CPUSession alloc] initWithModel:model threadsCount:0];
+    NSDictionary<NSString *, NSNumber *> *lastPositions = last_positions(model);
+    float *pixels = malloc(sizeof(float) * model.inputNum * options->batch);
+    float *data = malloc(sizeof(float) * model.inputNum * options->batch);
+    size_t imageBytes = sizeof(float) * model.inputNum;
+    size_t fileImages = file.length / imageBytes;
+
+    for (int first = 0; first < options->images; first += options->batch) {
+        int batch = MIN(options->batch, options->images - first);
+        if (file) {
+            for (int image = 0; image < batch; image++) {
+                memcpy(pixels + (size_t)image * model.inputNum, (const char *)file.bytes + (first + image) % fileImages * imageBytes, imageBytes);
+            }
+        } else {
+            fill_random_pixels(pixels, (size_t)model.inputNum * batch, options->seed + first);
+        }
+        normalize_pixels(pixels, data, model, batch);
+
+        __block int position = 0;
+        [session forwardWithImageData:data batch:batch outputHandler:^(CPULayer *destination, const float *output) {
+            if ([lastPositions[destination.name] intValue] == position++) {
+                block(destination.name, output, (size_t)destination.outputNum * batch);
+            }
+        }];
+        fprintf(stderr, "\rforwarded %d / %d images", first + batch, options->images);
+    }
+    fprintf(stderr, "\n");
+
+    free(data);
+    free(pixels);
+}
+
+static double bin_width(const struct layer_statistics *statistics) {
+    double magnitude = MAX(fabs(statistics->min), fabs(statistics->max));
+    return magnitude > 0? magnitude / HISTOGRAM_BINS : 1;
+}
+
+// the threshold whose histogram, quantized into levels bins, has the least KL divergence from the histogram
+// clipped to it, with all outliers in its last bin; bins empty in the histogram stay empty when quantized
+static double kl_threshold(const struct layer_statistics *statistics, int levels) {
+    const double *histogram = statistics->histogram;
+    double total = 0;
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        total += histogram[i];
+    }
+    if (total <= 0) return 0;
+
+    double *p = malloc(sizeof(double) * HISTOGRAM_BINS);
+    double *q = malloc(sizeof(double) * HISTOGRAM_BINS);
+    double bestDivergence = INFINITY;
+    int bestBins = HISTOGRAM_BINS;
+    for (int bins = levels; bins <= HISTOGRAM_BINS; bins++) {
+        double outliers = 0;
+        for (int i = bins; i < HISTOGRAM_BINS; i++) {
+            outliers += histogram[i];
+        }
+        memcpy(p, histogram, sizeof(double) * bins);
+        p[bins - 1] += outliers;
+
+        // each level spreads its count evenly over the non-empty bins it covers
+        for (int level = 0; level < levels; level++) {
+            int begin = (int)((double)level * bins / levels), end = (int)((double)(level + 1) * bins / levels);
+            double sum = 0;
+            int nonEmpty = 0;
+            for (int i = begin; i < end; i++) {
+                sum += histogram[i];
+                nonEmpty += histogram[i] > 0;
+            }
+            for (int i = begin; i < end; i++) {
+                q[i] = histogram[i] > 0? sum / nonEmpty : 0;
+            }
+        }
+
+        double divergence = 0, pSum = 0, qSum = 0;
+        for (int i = 0; i < bins; i++) {
+            pSum += p[i];
+            qSum += q[i];
+        }
+        for (int i = 0; i < bins; i++) {
+            if (p[i] <= 0) continue;
+            double qi = q[i] > 0? q[i] / qSum : 1e-12;
+            divergence += p[i] / pSum * log(p[i] / pSum / qi);
+        }
+        if (divergence < bestDivergence) {
+            bestDivergence = divergence;
+            bestBins = bins;
+        }
+    }
+    free(q);
+    free(p);
+
+    return bestBins * bin_width(statistics);
+}
+
+static double percentile_threshold(const struct layer_statistics *statistics, double percentile) {
+    double total = 0, sum = 0;
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        total += statistics->histogram[i];
+    }
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        sum += statistics->histogram[i];
+        if (sum >= total * percentile / 100.0) return (i + 1) * bin_width(statistics);
+    }
+    return HISTOGRAM_BINS * bin_width(statistics);
+}
+
+// outputs that are never negative, e.g. of ReLU, use all 255 steps of uint8 for [0, threshold], others about half
+static NSArray<NSNumber *> *range_of_layer(const struct layer_statistics *statistics, const struct calibrate_options *options) {
+    BOOL nonNegative = statistics->min >= 0;
+    double threshold;
+    switch (options->method) {
+        case eCalibrationKL:            threshold = kl_threshold(statistics, nonNegative? 255 : 128); break;
+        case eCalibrationPercentile:    threshold = percentile_threshold(statistics, options->percentile); break;
+        default:                        threshold = INFINITY; break;
+    }
+    return @[@(MAX(statistics->min, -threshold)), @(MIN(statistics->max, threshold))];
+}
+
+static BOOL parse_options(int argc, char *argv[], struct calibrate_options *options) {
+    enum { OPTION_SEED = 256, OPTION_METHOD, OPTION_PERCENTILE };
+    static const struct option longOptions[] = {
+        { "model",      required_argument,  NULL, 'm' },
+        { "data",       required_argument,  NULL, 'd' },
+        { "input",      required_argument,  NULL, 'i' },
+        { "images",     required_argument,  NULL, 'n' },
+        { "batch",      required_argument,  NULL, 'b' },
+        { "seed",       required_argument,  NULL, OPTION_SEED },
+        { "method",     required_argument,  NULL, OPTION_METHOD },
+        { "percentile", required_argument,  NULL, OPTION_PERCENTILE },
+        { "output",     required_argument,  NULL, 'o' },
+        { "help",       no_argument,        NULL, 'h' },
+        { NULL,         0,                  NULL, 0 },
+    };
+
+    *options = (struct calibrate_options){ .batch = 8, .seed = 1, .method = eCalibrationKL, .percentile = 99.99 };
+    int option;
+    while ((option = getopt_long(argc, argv, "m:d:i:n:b:o:h", longOptions, NULL)) != -1) {
+        switch (option) {
+            case 'm': options->model = optarg; break;
+            case 'd': options->data = optarg; break;
+            case 'i': options->input = optarg; break;
+            case 'n': options->images = atoi(optarg); break;
+            case 'b': options->batch = atoi(optarg); break;
+            case OPTION_SEED: options->seed = (unsigned)strtoul(optarg, NULL, 10); break;
+            case OPTION_METHOD:
+                if (!strcmp(optarg, "kl")) options->method = eCalibrationKL;
+                else if (!strcmp(optarg, "percentile")) options->method = eCalibrationPercentile;
+                else if (!strcmp(optarg, "max")) options->method = eCalibrationMax;
+                else return NO;
+                break;
+            case OPTION_PERCENTILE: options->percentile = atof(optarg); break;
+            case 'o': options->output = optarg; break;
+            default: return NO;
+        }
+    }
+
+    return options->model && options->data && optind == argc && options->images >= 0 && options->batch > 0 &&
+           options->percentile > 0 && options->percentile <= 100;
+}
+
+int main(int argc, char *argv[]) {
+    @autoreleasepool {
+        struct calibrate_options options;
+        if (!parse_options(argc, argv, &options)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        // every layer keeps its own output, so that all of them get a range
+        CPUModel *model = [[CPUModel alloc] initWithDescriptionFile:@(options.model)
+                                                           dataFile:@(options.data)
+                                                            options:@{CPUModelOptionOptimizeGraph: @NO}];
+        if (!model) {
+            fprintf(stderr, "Error: failed to load %s with %s\n", options.model, options.data);
+            return 1;
+        }
+
+        NSData *file = nil;
+        if (options.input) {
+            file = [NSData dataWithContentsOfFile:@(options.input) options:NSDataReadingMappedIfSafe error:NULL];
+            size_t imageBytes = sizeof(float) * model.inputNum;
+            if (!file || file.length < imageBytes || file.length % imageBytes) {
+                fprintf(stderr, "Error: %s should hold whole images of %d floats\n", options.input, model.inputNum);
+                return 1;
+            }
+            if (!options.images) options.images = (int)(file.length / imageBytes);
+        } else if (!options.images) {
+            options.images = 32;
+        }
+
+        // ranges first, then histograms of |x| within them
+        NSMutableDictionary<NSString *, NSMutableData *> *statistics = [[NSMutableDictionary alloc] init];
+        forward_images(model, file, &options, ^(NSString *layer, const float *output, size_t count) {
+            if (!statistics[layer]) {
+                NSMutableData *entry = [[NSMutableData alloc] initWithLength:sizeof(struct layer_statistics)];
+                ((struct layer_statistics *)entry.mutableBytes)->min = INFINITY;
+                ((struct layer_statistics *)entry.mutableBytes)->max = -INFINITY;
+                [statistics setObject:entry forKey:layer];
+            }
+            struct layer_statistics *entry = statistics[layer].mutableBytes;
+            for (size_t i = 0; i < count; i++) {
+                entry->min = MIN(entry->min, output[i]);
+                entry->max = MAX(entry->max, output[i]);
+            }
+        });
+        if (options.method != eCalibrationMax) {
+            forward_images(model, file, &options, ^(NSString *layer, const float *output, size_t count) {
+                struct layer_statistics *entry = statistics[layer].mutableBytes;
+                double width = bin_width(entry);
+                for (size_t i = 0; i < count; i++) {
+                    int bin = (int)(fabsf(output[i]) / width);
+                    entry->histogram[MIN(bin, HISTOGRAM_BINS - 1)]++;
+                }
+            });
+        }
+
+        static const char *methods[] = { "kl", "percentile", "max" };
+        NSMutableDictionary<NSString *, NSArray<NSNumber *> *> *ranges = [[NSMutableDictionary alloc] init];
+        for (NSString *layer in statistics) {
+            const struct layer_statistics *entry = statistics[layer].bytes;
+            NSArray<NSNumber *> *range = range_of_layer(entry, &options);
+            [ranges setObject:range forKey:layer];
+            fprintf(stderr, "%-32.32s [%12.4g, %12.4g] of [%12.4g, %12.4g]\n",
+                    layer.UTF8String, range[0].doubleValue, range[1].doubleValue, entry->min, entry->max);
+        }
+
+        NSDictionary *report = @{@"method": @(methods[options.method]),
+                                 @"images": @(options.images),
+                                 @"ranges": ranges};
+        NSData *json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:NULL];
+        if (!options.output || !strcmp(options.output, "-")) {
+            fwrite(json.bytes, 1, json.length, stdout);
+            fputc('\n', stdout);
+        } else if (![json writeToFile:@(options.output) atomically:YES]) {
+            fprintf(stderr, "Error: failed to write %s\n", options.output);
+            return 1;
+        }
+        return 0;
+    }
+}
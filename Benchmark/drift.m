@@ -0,0 +1,394 @@
+//
+//  drift.m
+//  Benchmark
+//
+//  Created by Lun on 2017/9/20.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <getopt.h>
+#import <math.h>
+#import "CPUModel.h"
+#import "CPUSession.h"
+#import "CPULayer.h"
+#import "benchmarkInput.h"
+
+// Forwards the same images through a reference model and a candidate, e.g. with other options, another data file
+// or a build with approximate kernels, and compares the output of every layer both of them have, then the top-1
+// and top-5 predictions. Exits with 2 when a tolerance is exceeded, so that it can gate fast paths in scripts.
+//
+// Kernels chosen at compile time can not be run side by side: outputs of the reference can be saved with --save
+// by one build, and compared with --against by another.
+
+#define TOP_K 5
+
+struct drift_options {
+    const char *model;
+    const char *data;
+    const char *candidateModel;     // the reference model if NULL
+    const char *candidateData;
+    const char *referenceOptions;   // JSON objects of options of CPUModel
+    const char *candidateOptions;
+    const char *input;
+    const char *save;
+    const char *against;
+    const char *output;
+    int batch;
+    unsigned seed;
+    double maxAbs;
+    double maxRel;
+    double minCosine;
+    double minTop1;
+    double minTop5;
+};
+
+// what a model outputs for a batch of pixels, which is also what --save writes
+@interface Forwarding : NSObject
+
+@property (strong, nonatomic) NSArray<NSString *> *order;                   // destinations in the order they are written
+@property (strong, nonatomic) NSDictionary<NSString *, NSData *> *outputs;  // whole batches of floats
+@property (strong, nonatomic) NSData *probs;
+@property (assign, nonatomic) int probsNum;
+
+@end
+
+@implementation Forwarding
+
+@end
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s -m model.json|model.gnm -d model.dat [options]\n"
+            "  -m, --model FILE            reference description, JSON or compiled\n"
+            "  -d, --data FILE             reference weights and biases\n"
+            "  -M, --candidate-model FILE  candidate description, the reference one by default\n"
+            "  -D, --candidate-data FILE   candidate weights and biases, the reference ones by default\n"
+            "      --reference-options JSON    options of CPUModel, e.g. '{\"optimize_graph\": false}'\n"
+            "  -c, --candidate-options JSON    options of the candidate CPUModel\n"
+            "  -i, --input FILE            float32 pixels of images, BGR, one channel after another; random if not given\n"
+            "  -b, --batch N               images, 4 by default\n"
+            "      --seed N                seed of random pixels, 1 by default\n"
+            "      --save FILE             only forward the reference, and save pixels and outputs\n"
+            "      --against FILE          compare the candidate with saved outputs instead of the reference model\n"
+            "  -o, --output FILE           write the comparison as JSON, - for stdout\n"
+            "      --max-abs X             largest absolute error of any layer, unlimited by default\n"
+            "      --max-rel X             largest absolute error over the largest magnitude of a layer, unlimited by default\n"
+            "      --min-cosine X          least cosine similarity of any layer, 0.999 by default\n"
+            "      --min-top1 X            least fraction of images with the same top-1, 1 by default\n"
+            "      --min-top5 X            least fraction of images with the same set of top-5, 0 by default\n",
+            program);
+}
+
+static void top_indices(const float *probs, int count, int *indices, int k) {
+    for (int i = 0; i < k; i++) {
+        int top = -1;
+        for (int j = 0; j < count; j++) {
+            BOOL taken = NO;
+            for (int l = 0; l < i; l++) {
+                if (indices[l] == j) taken = YES;
+            }
+            if (!taken && (top < 0 || probs[j] > probs[top])) top = j;
+        }
+        indices[i] = top;
+    }
+}
+
+static BOOL same_sets(const int *a, const int *b, int k) {
+    for (int i = 0; i < k; i++) {
+        BOOL found = NO;
+        for (int j = 0; j < k; j++) {
+            if (a[i] == b[j]) found = YES;
+        }
+        if (!found) return NO;
+    }
+    return YES;
+}
+
+static NSDictionary *parse_json_object(const char *argument) {
+    if (!argument) return nil;
+    id object = [NSJSONSerialization JSONObjectWithData:[@(argument) dataUsingEncoding:NSUTF8StringEncoding] options:0 error:NULL];
+    return [object isKindOfClass:[NSDictionary class]]? object : nil;
+}
+
+static CPUModel *load_model(const char *model, const char *data, const char *optionsJSON) {
+    NSDictionary *options = parse_json_object(optionsJSON);
+    if (optionsJSON && !options) {
+        fprintf(stderr, "Error: options should be a JSON object, not %s\n", optionsJSON);
+        return nil;
+    }
+    NSString *modelFile = @(model);
+    if ([modelFile.pathExtension isEqualToString:@"gnm"]) {
+        return [[CPUModel alloc] initWithCompiledFile:modelFile dataFile:@(data) options:options];
+    }
+    return [[CPUModel alloc] initWithDescriptionFile:modelFile dataFile:@(data) options:options];
+}
+
+static Forwarding *forward(CPUModel *model, const float *pixels, int batch) {
+    CPUSession *session = [[CPUSession alloc] initWithModel:model threadsCount:0];
+    float *data = malloc(sizeof(float) * model.inputNum * batch);
+    normalize_pixels(pixels, data, model, batch);
+
+    NSMutableArray<NSString *> *order = [[NSMutableArray alloc] init];
+    NSMutableDictionary<NSString *, NSData *> *outputs = [[NSMutableDictionary alloc] init];
+    [session forwardWithImageData:data batch:batch outputHandler:^(CPULayer *destination, const float *output) {
+        if (!outputs[destination.name]) [order addObject:destination.name];
+        [outputs setObject:[NSData dataWithBytes:output length:sizeof(float) * destination.outputNum * batch] forKey:destination.name];
+    }];
+    free(data);
+
+    Forwarding *forwarding = [[Forwarding alloc] init];
+    forwarding.order = [order copy];
+    forwarding.outputs = [outputs copy];
+    forwarding.probs = [NSData dataWithBytes:[session probsOfImage:0] length:sizeof(float) * model.probsNum * batch];
+    forwarding.probsNum = model.probsNum;
+    return forwarding;
+}
+
+static BOOL save_forwarding(Forwarding *forwarding, NSData *pixels, int batch, const char *path) {
+    NSDictionary *saved = @{@"batch": @(batch),
+                            @"pixels": pixels,
+                            @"order": forwarding.order,
+                            @"outputs": forwarding.outputs,
+                            @"probs": forwarding.probs,
+                            @"probs_num": @(forwarding.probsNum)};
+    NSData *data = [NSPropertyListSerialization dataWithPropertyList:saved format:NSPropertyListBinaryFormat_v1_0 options:0 error:NULL];
+    return [data writeToFile:@(path) atomically:YES];
+}
+
+static Forwarding *load_forwarding(const char *path, NSData **pixels, int *batch) {
+    NSData *data = [NSData dataWithContentsOfFile:@(path)];
+    NSDictionary *saved = data? [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:NULL] : nil;
+    if (![saved isKindOfClass:[NSDictionary class]] || !saved[@"pixels"] || !saved[@"outputs"] || !saved[@"probs"]) return nil;
+
+    *pixels = saved[@"pixels"];
+    *batch = [saved[@"batch"] intValue];
+    Forwarding *forwarding = [[Forwarding alloc] init];
+    forwarding.order = saved[@"order"];
+    forwarding.outputs = saved[@"outputs"];
+    forwarding.probs = saved[@"probs"];
+    forwarding.probsNum = [saved[@"probs_num"] intValue];
+    return forwarding;
+}
+
+// relative error is the largest absolute error over the largest magnitude of the reference,
+// which stays meaningful for layers with many outputs near 0
+static NSDictionary *compare_outputs(NSString *layer, NSData *reference, NSData *candidate, const struct drift_options *options) {
+    const float *x = reference.bytes, *y = candidate.bytes;
+    size_t count = reference.length / sizeof(float);
+    double maxAbs = 0, maxMagnitude = 0, dot = 0, xx = 0, yy = 0;
+    for (size_t i = 0; i < count; i++) {
+        double error = fabs((double)x[i] - y[i]);
+        if (error > maxAbs || isnan(error)) maxAbs = error;     // NaN stays
+        maxMagnitude = MAX(maxMagnitude, fabs(x[i]));
+        dot += (double)x[i] * y[i];
+        xx += (double)x[i] * x[i];
+        yy += (double)y[i] * y[i];
+    }
+    double maxRel = maxMagnitude > 0? maxAbs / maxMagnitude : maxAbs;
+    double cosine = xx > 0 && yy > 0? dot / sqrt(xx * yy) : (xx == yy? 1 : 0);
+    BOOL passed = maxAbs <= options->maxAbs && maxRel <= options->maxRel && cosine >= options->minCosine;
+
+    return @{@"layer": layer,
+             @"count": @(count),
+             @"max_abs": @(maxAbs),
+             @"max_rel": @(maxRel),
+             @"cosine": @(cosine),
+             @"passed": @(passed)};
+}
+
+// JSON has no infinity or NaN
+static id json_number(double value) {
+    return isfinite(value)? @(value) : [NSNull null];
+}
+
+static NSDictionary *json_layer(NSDictionary *layer) {
+    NSMutableDictionary *json = [layer mutableCopy];
+    for (NSString *key in @[@"max_abs", @"max_rel", @"cosine"]) {
+        [json setObject:json_number([layer[key] doubleValue]) forKey:key];
+    }
+    return [json copy];
+}
+
+static double parse_double(const char *argument) {
+    char *end;
+    double value = strtod(argument, &end);
+    return *end? NAN : value;
+}
+
+static BOOL parse_options(int argc, char *argv[], struct drift_options *options) {
+    enum { OPTION_REFERENCE_OPTIONS = 256, OPTION_SEED, OPTION_SAVE, OPTION_AGAINST,
+           OPTION_MAX_ABS, OPTION_MAX_REL, OPTION_MIN_COSINE, OPTION_MIN_TOP1, OPTION_MIN_TOP5 };
+    static const struct option longOptions[] = {
+        { "model",              required_argument,  NULL, 'm' },
+        { "data",               required_argument,  NULL, 'd' },
+        { "candidate-model",    required_argument,  NULL, 'M' },
+        { "candidate-data",     required_argument,  NULL, 'D' },
+        { "reference-options",  required_argument,  NULL, OPTION_REFERENCE_OPTIONS },
+        { "candidate-options",  required_argument,  NULL, 'c' },
+        { "input",              required_argument,  NULL, 'i' },
+        { "batch",              required_argument,  NULL, 'b' },
+        { "seed",               required_argument,  NULL, OPTION_SEED },
+        { "save",               required_argument,  NULL, OPTION_SAVE },
+        { "against",            required_argument,  NULL, OPTION_AGAINST },
+        { "output",             required_argument,  NULL, 'o' },
+        { "max-abs",            required_argument,  NULL, OPTION_MAX_ABS },
+        { "max-rel",            required_argument,  NULL, OPTION_MAX_REL },
+        { "min-cosine",         required_argument,  NULL, OPTION_MIN_COSINE },
+        { "min-top1",           required_argument,  NULL, OPTION_MIN_TOP1 },
+        { "min-top5",           required_argument,  NULL, OPTION_MIN_TOP5 },
+        { "help",               no_argument,        NULL, 'h' },
+        { NULL,                 0,                  NULL, 0 },
+    };
+
+    *options = (struct drift_options){ .batch = 4, .seed = 1,
+                                       .maxAbs = INFINITY, .maxRel = INFINITY, .minCosine = 0.999, .minTop1 = 1, .minTop5 = 0 };
+    int option;
+    while ((option = getopt_long(argc, argv, "m:d:M:D:c:i:b:o:h", longOptions, NULL)) != -1) {
+        switch (option) {
+            case 'm': options->model = optarg; break;
+            case 'd': options->data = optarg; break;
+            case 'M': options->candidateModel = optarg; break;
+            case 'D': options->candidateData = optarg; break;
+            case OPTION_REFERENCE_OPTIONS: options->referenceOptions = optarg; break;
+            case 'c': options->candidateOptions = optarg; break;
+            case 'i': options->input = optarg; break;
+            case 'b': options->batch = atoi(optarg); break;
+            case OPTION_SEED: options->seed = (unsigned)strtoul(optarg, NULL, 10); break;
+            case OPTION_SAVE: options->save = optarg; break;
+            case OPTION_AGAINST: options->against = optarg; break;
+            case 'o': options->output = optarg; break;
+            case OPTION_MAX_ABS: options->maxAbs = parse_double(optarg); break;
+            case OPTION_MAX_REL: options->maxRel = parse_double(optarg); break;
+            case OPTION_MIN_COSINE: options->minCosine = parse_double(optarg); break;
+            case OPTION_MIN_TOP1: options->minTop1 = parse_double(optarg); break;
+            case OPTION_MIN_TOP5: options->minTop5 = parse_double(optarg); break;
+            default: return NO;
+        }
+    }
+
+    if (!options->candidateModel) options->candidateModel = options->model;
+    if (!options->candidateData) options->candidateData = options->data;
+    return options->model && options->data && optind == argc && options->batch > 0 && !(options->save && options->against) &&
+           !isnan(options->maxAbs) && !isnan(options->maxRel) && !isnan(options->minCosine) && !isnan(options->minTop1) && !isnan(options->minTop5);
+}
+
+int main(int argc, char *argv[]) {
+    @autoreleasepool {
+        struct drift_options options;
+        if (!parse_options(argc, argv, &options)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        // the reference is either forwarded here or loaded with the pixels it was forwarded with
+        Forwarding *reference = nil;
+        NSData *pixels = nil;
+        int batch = options.batch;
+        if (options.against) {
+            if (!(reference = load_forwarding(options.against, &pixels, &batch))) {
+                fprintf(stderr, "Error: failed to read saved outputs from %s\n", options.against);
+                return 1;
+            }
+        } else {
+            CPUModel *model = load_model(options.model, options.data, options.referenceOptions);
+            if (!model) {
+                fprintf(stderr, "Error: failed to load %s with %s\n", options.model, options.data);
+                return 1;
+            }
+            NSMutableData *data = [[NSMutableData alloc] initWithLength:sizeof(float) * model.inputNum * batch];
+            if (options.input) {
+                if (!read_pixels(options.input, data.mutableBytes, model.inputNum, batch)) return 1;
+            } else {
+                fill_random_pixels(data.mutableBytes, (size_t)model.inputNum * batch, options.seed);
+            }
+            pixels = [data copy];
+            reference = forward(model, pixels.bytes, batch);
+
+            if (options.save) {
+                if (!save_forwarding(reference, pixels, batch, options.save)) {
+                    fprintf(stderr, "Error: failed to write %s\n", options.save);
+                    return 1;
+                }
+                fprintf(stderr, "Saved outputs of %lu layers of %d images to %s\n", (unsigned long)reference.order.count, batch, options.save);
+                return 0;
+            }
+        }
+
+        CPUModel *model = load_model(options.candidateModel, options.candidateData, options.candidateOptions);
+        if (!model) {
+            fprintf(stderr, "Error: failed to load %s with %s\n", options.candidateModel, options.candidateData);
+            return 1;
+        }
+        if (pixels.length != sizeof(float) * model.inputNum * batch || model.probsNum != reference.probsNum) {
+            fprintf(stderr, "Error: the candidate takes or gives a different number of floats than the reference\n");
+            return 1;
+        }
+        Forwarding *candidate = forward(model, pixels.bytes, batch);
+
+        // layers only one of them has, e.g. those fused by the graph optimizer, are skipped
+        FILE *table = options.output && !strcmp(options.output, "-")? stderr : stdout;
+        fprintf(table, "%-32s %10s %12s %12s %12s\n", "layer", "floats", "max abs", "max rel", "cosine");
+        NSMutableArray<NSDictionary *> *layers = [[NSMutableArray alloc] init];
+        NSMutableArray<NSString *> *skipped = [[NSMutableArray alloc] init];
+        BOOL passed = YES;
+        for (NSString *layer in reference.order) {
+            NSData *output = candidate.outputs[layer];
+            if (!output || output.length != reference.outputs[layer].length) {
+                [skipped addObject:layer];
+                continue;
+            }
+            NSDictionary *comparison = compare_outputs(layer, reference.outputs[layer], output, &options);
+            [layers addObject:comparison];
+            passed &= [comparison[@"passed"] boolValue];
+            fprintf(table, "%-32.32s %10lu %12.4g %12.4g %12.8f%s\n",
+                    layer.UTF8String,
+                    [comparison[@"count"] unsignedLongValue],
+                    [comparison[@"max_abs"] doubleValue],
+                    [comparison[@"max_rel"] doubleValue],
+                    [comparison[@"cosine"] doubleValue],
+                    [comparison[@"passed"] boolValue]? "" : "  FAIL");
+        }
+
+        int top1 = 0, top5 = 0;
+        int k = MIN(TOP_K, reference.probsNum);
+        for (int image = 0; image < batch; image++) {
+            int referenceTop[TOP_K], candidateTop[TOP_K];
+            top_indices((const float *)reference.probs.bytes + image * reference.probsNum, reference.probsNum, referenceTop, k);
+            top_indices((const float *)candidate.probs.bytes + image * candidate.probsNum, candidate.probsNum, candidateTop, k);
+            top1 += referenceTop[0] == candidateTop[0];
+            top5 += same_sets(referenceTop, candidateTop, k);
+        }
+        double top1Agreement = (double)top1 / batch, top5Agreement = (double)top5 / batch;
+        passed &= top1Agreement >= options.minTop1 && top5Agreement >= options.minTop5;
+        if (skipped.count) fprintf(table, "skipped %lu layers the candidate does not have\n", (unsigned long)skipped.count);
+        fprintf(table, "top-1 agreement %d / %d, top-5 agreement %d / %d: %s\n", top1, batch, top5, batch, passed? "passed" : "FAILED");
+
+        if (options.output) {
+            NSMutableArray<NSDictionary *> *jsonLayers = [[NSMutableArray alloc] initWithCapacity:layers.count];
+            for (NSDictionary *layer in layers) {
+                [jsonLayers addObject:json_layer(layer)];
+            }
+            NSDictionary *report = @{@"images": @(batch),
+                                     @"passed": @(passed),
+                                     @"tolerances": @{@"max_abs": json_number(options.maxAbs),
+                                                      @"max_rel": json_number(options.maxRel),
+                                                      @"min_cosine": json_number(options.minCosine),
+                                                      @"min_top1": json_number(options.minTop1),
+                                                      @"min_top5": json_number(options.minTop5)},
+                                     @"top1_agreement": @(top1Agreement),
+                                     @"top5_agreement": @(top5Agreement),
+                                     @"layers": jsonLayers,
+                                     @"skipped": skipped};
+            NSData *json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:NULL];
+            if (!strcmp(options.output, "-")) {
+                fwrite(json.bytes, 1, json.length, stdout);
+                fputc('\n', stdout);
+            } else if (![json writeToFile:@(options.output) atomically:YES]) {
+                fprintf(stderr, "Error: failed to write %s\n", options.output);
+                return 1;
+            }
+        }
+        return passed? 0 : 2;
+    }
+}
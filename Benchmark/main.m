@@ -0,0 +1,246 @@
+//
+//  main.m
+//  Benchmark
+//
+//  Created by Lun on 2017/9/19.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <getopt.h>
+#import <math.h>
+#import "CPUModel.h"
+#import "CPUSession.h"
+#import "benchmarkInput.h"
+
+// Forwards a model on the CPU without any UI, e.g. on a Linux server, and reports latency percentiles
+// and throughput for one or more numbers of threads, as a table and as JSON to be charted over time.
+
+struct benchmark_options {
+    const char *model;          // .json or .gnm
+    const char *data;
+    const char *input;          // float32 pixels, see benchmarkInput.h, random if NULL
+    const char *output;         // JSON results, "-" for stdout
+    int warmup;
+    int iterations;
+    int batch;
+    int threads;
+    int inputSize;              // input_size of the model if 0
+    BOOL sweep;                 // every number of threads from 1 to threads
+    unsigned seed;
+};
+
+static void print_usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s -m model.json|model.gnm -d model.dat [options]\n"
+            "  -m, --model FILE        description of the net, JSON or compiled\n"
+            "  -d, --data FILE         weights and biases\n"
+            "  -i, --input FILE        float32 pixels of images, BGR, one channel after another; random if not given\n"
+            "  -w, --warmup N          forwardings before measuring, 5 by default\n"
+            "  -n, --iterations N      measured forwardings, 50 by default\n"
+            "  -b, --batch N           images in each forwarding, 1 by default\n"
+            "  -t, --threads N         threads, all cores by default\n"
+            "  -r, --input-size N      forward at another input size, for fully convolutional nets loaded from JSON\n"
+            "  -s, --sweep             measure every number of threads from 1 to N\n"
+            "      --seed N            seed of random pixels, 1 by default\n"
+            "  -o, --output FILE       write results as JSON, - for stdout\n",
+            program);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// nearest rank of sorted values
+static double percentile(const double *sorted, int count, double p) {
+    int rank = (int)ceil(p / 100 * count);
+    return sorted[MIN(MAX(rank, 1), count) - 1];
+}
+
+static int top_index(const float *probs, int count) {
+    int top = 0;
+    for (int i = 1; i < count; i++) {
+        if (probs[i] > probs[top]) top = i;
+    }
+    return top;
+}
+
+static NSDictionary *measure(CPUModel *model, const float *input, int threads, const struct benchmark_options *options) {
+    CPUSession *session = [[CPUSession alloc] initWithModel:model threadsCount:threads];
+
+    // the first forwarding of a session allocates its arena, and the first one of a model faults its weights in
+    double startTime = now_seconds();
+    [session forwardWithImageData:input batch:options->batch];
+    double firstTime = now_seconds() - startTime;
+    for (int i = 0; i < options->warmup; i++) {
+        [session forwardWithImageData:input batch:options->batch];
+    }
+
+    double *latencies = malloc(sizeof(double) * options->iterations);
+    double total = 0;
+    for (int i = 0; i < options->iterations; i++) {
+        startTime = now_seconds();
+        [session forwardWithImageData:input batch:options->batch];
+        latencies[i] = now_seconds() - startTime;
+        total += latencies[i];
+    }
+
+    double mean = total / options->iterations, variance = 0;
+    for (int i = 0; i < options->iterations; i++) {
+        variance += (latencies[i] - mean) * (latencies[i] - mean);
+    }
+    qsort(latencies, options->iterations, sizeof(double), compare_doubles);
+
+    int top = top_index([session probsOfImage:0], model.probsNum);
+    NSDictionary *result = @{@"threads": @(threads),
+                             @"first_ms": @(firstTime * 1000),
+                             @"mean_ms": @(mean * 1000),
+                             @"stddev_ms": @(sqrt(variance / options->iterations) * 1000),
+                             @"min_ms": @(latencies[0] * 1000),
+                             @"p50_ms": @(percentile(latencies, options->iterations, 50) * 1000),
+                             @"p90_ms": @(percentile(latencies, options->iterations, 90) * 1000),
+                             @"p99_ms": @(percentile(latencies, options->iterations, 99) * 1000),
+                             @"max_ms": @(latencies[options->iterations - 1] * 1000),
+                             @"images_per_second": @(options->batch * options->iterations / total),
+                             @"top1": @(top),
+                             @"top1_label": top < model.labels.count? model.labels[top] : @""};
+    free(latencies);
+    return result;
+}
+
+static BOOL parse_options(int argc, char *argv[], struct benchmark_options *options) {
+    static const struct option longOptions[] = {
+        { "model",      required_argument,  NULL, 'm' },
+        { "data",       required_argument,  NULL, 'd' },
+        { "input",      required_argument,  NULL, 'i' },
+        { "warmup",     required_argument,  NULL, 'w' },
+        { "iterations", required_argument,  NULL, 'n' },
+        { "batch",      required_argument,  NULL, 'b' },
+        { "threads",    required_argument,  NULL, 't' },
+        { "input-size", required_argument,  NULL, 'r' },
+        { "sweep",      no_argument,        NULL, 's' },
+        { "seed",       required_argument,  NULL, 'S' },
+        { "output",     required_argument,  NULL, 'o' },
+        { "help",       no_argument,        NULL, 'h' },
+        { NULL,         0,                  NULL, 0 },
+    };
+
+    *options = (struct benchmark_options){ .warmup = 5, .iterations = 50, .batch = 1, .seed = 1 };
+    int option;
+    while ((option = getopt_long(argc, argv, "m:d:i:w:n:b:t:r:so:h", longOptions, NULL)) != -1) {
+        switch (option) {
+            case 'm': options->model = optarg; break;
+            case 'd': options->data = optarg; break;
+            case 'i': options->input = optarg; break;
+            case 'w': options->warmup = atoi(optarg); break;
+            case 'n': options->iterations = atoi(optarg); break;
+            case 'b': options->batch = atoi(optarg); break;
+            case 't': options->threads = atoi(optarg); break;
+            case 'r': options->inputSize = atoi(optarg); break;
+            case 's': options->sweep = YES; break;
+            case 'S': options->seed = (unsigned)strtoul(optarg, NULL, 10); break;
+            case 'o': options->output = optarg; break;
+            default: return NO;
+        }
+    }
+
+    if (!options->threads) options->threads = (int)[NSProcessInfo processInfo].activeProcessorCount;
+    return options->model && options->data && optind == argc &&
+           options->warmup >= 0 && options->iterations > 0 && options->batch > 0 && options->threads > 0 && options->inputSize >= 0;
+}
+
+int main(int argc, char *argv[]) {
+    @autoreleasepool {
+        struct benchmark_options options;
+        if (!parse_options(argc, argv, &options)) {
+            print_usage(argv[0]);
+            return 1;
+        }
+
+        NSString *modelFile = @(options.model);
+        NSString *dataFile = @(options.data);
+        double startTime = now_seconds();
+        CPUModel *model = [modelFile.pathExtension isEqualToString:@"gnm"]?
+            [[CPUModel alloc] initWithCompiledFile:modelFile dataFile:dataFile options:nil] :
+            [[CPUModel alloc] initWithDescriptionFile:modelFile dataFile:dataFile];
+        if (model && options.inputSize) model = [model modelWithInputSize:options.inputSize];
+        double loadTime = now_seconds() - startTime;
+        if (!model) {
+            fprintf(stderr, "Error: failed to load %s with %s\n", options.model, options.data);
+            return 1;
+        }
+
+        float *input = malloc(sizeof(float) * model.inputNum * options.batch);
+        if (options.input) {
+            if (!read_pixels(options.input, input, model.inputNum, options.batch)) return 1;
+        } else {
+            fill_random_pixels(input, (size_t)model.inputNum * options.batch, options.seed);
+        }
+        normalize_pixels(input, input, model, options.batch);
+
+        // a table for people goes to stderr when JSON takes stdout
+        FILE *table = options.output && !strcmp(options.output, "-")? stderr : stdout;
+        fprintf(table, "%s: %d steps, input size %d, batch %d, %d warmup and %d measured iterations, %s input, loaded in %.2f ms\n",
+                modelFile.lastPathComponent.UTF8String, model.stepsCount, model.inputSize, options.batch, options.warmup, options.iterations,
+                options.input? "given" : "random", loadTime * 1000);
+        fprintf(table, "%7s %9s %9s %9s %9s %9s %9s %10s %7s %6s\n",
+                "threads", "first", "mean", "p50", "p90", "p99", "max", "images/s", "speedup", "eff");
+
+        // speedup and efficiency are of throughput, relative to the first number of threads measured
+        NSMutableArray<NSDictionary *> *results = [[NSMutableArray alloc] init];
+        double baseThroughput = 0;
+        int baseThreads = options.sweep? 1 : options.threads;
+        for (int threads = baseThreads; threads <= options.threads; threads++) {
+            NSMutableDictionary *result = [measure(model, input, threads, &options) mutableCopy];
+            double throughput = [result[@"images_per_second"] doubleValue];
+            if (!results.count) baseThroughput = throughput;
+            [result setObject:@(throughput / baseThroughput) forKey:@"speedup"];
+            [result setObject:@(throughput / baseThroughput * baseThreads / threads) forKey:@"efficiency"];
+            [results addObject:[result copy]];
+
+            fprintf(table, "%7d %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %10.2f %7.2f %5.0f%%\n",
+                    threads,
+                    [result[@"first_ms"] doubleValue],
+                    [result[@"mean_ms"] doubleValue],
+                    [result[@"p50_ms"] doubleValue],
+                    [result[@"p90_ms"] doubleValue],
+                    [result[@"p99_ms"] doubleValue],
+                    [result[@"max_ms"] doubleValue],
+                    throughput,
+                    [result[@"speedup"] doubleValue],
+                    [result[@"efficiency"] doubleValue] * 100);
+        }
+        free(input);
+
+        if (options.output) {
+            NSProcessInfo *process = [NSProcessInfo processInfo];
+            NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+            formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+            formatter.timeZone = [NSTimeZone timeZoneForSecondsFromGMT:0];
+            formatter.dateFormat = @"yyyy-MM-dd'T'HH:mm:ss'Z'";
+            NSDictionary *report = @{@"date": [formatter stringFromDate:[NSDate date]],
+                                     @"host": @{@"name": process.hostName,
+                                                @"os": process.operatingSystemVersionString,
+                                                @"cores": @(process.activeProcessorCount)},
+                                     @"model": modelFile.lastPathComponent,
+                                     @"steps": @(model.stepsCount),
+                                     @"input_size": @(model.inputSize),
+                                     @"input": options.input? @(options.input) : @"random",
+                                     @"batch": @(options.batch),
+                                     @"warmup": @(options.warmup),
+                                     @"iterations": @(options.iterations),
+                                     @"load_ms": @(loadTime * 1000),
+                                     @"results": results};
+            NSData *json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted error:NULL];
+            if (!strcmp(options.output, "-")) {
+                fwrite(json.bytes, 1, json.length, stdout);
+                fputc('\n', stdout);
+            } else if (![json writeToFile:@(options.output) atomically:YES]) {
+                fprintf(stderr, "Error: failed to write %s\n", options.output);
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
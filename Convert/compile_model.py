@@ -0,0 +1,146 @@
+import os
+import sys
+import json
+import struct
+
+# keep in sync with GeneralNet/compiledModel.h
+MAGIC = 0x4d4e4e47
+VERSION = 1
+
+HEADER_FORMAT = '<8I7Q'
+LAYER_FORMAT = '<3Ii2Q10i2f2i'
+STEP_FORMAT = '<3I'
+
+LAYER_TYPES = {'Convolution': 1,
+               'FullyConnected': 2,
+               'PoolingMax': 3,
+               'PoolingAverage': 4,
+               'LocalResponseNormalization': 6,
+               'SoftMax': 7,
+               'Concat': 8
+               }
+POOLING_GLOBAL_AVERAGE = 5
+
+IMAGE_TYPES = {'None': 0,
+               'Temporary': 1,
+               'Permanent': 2
+               }
+
+
+def align(offset):
+    return (offset + 7) // 8 * 8
+
+
+class StringTable(object):
+    def __init__(self):
+        self.data = b''
+        self.offsets = {}
+
+    def add(self, string):
+        if string not in self.offsets:
+            self.offsets[string] = len(self.data)
+            self.data += string.encode('utf-8') + b'\0'
+        return self.offsets[string]
+
+
+def pack_layer(info, strings):
+    layer_type = LAYER_TYPES[info['layer_type']]
+    kernel_size = info.get('kernel_size', 0)
+    stride = info.get('stride', 0)
+    pad = info.get('pad', 0)
+
+    # global pooling covers the whole input
+    if layer_type == LAYER_TYPES['PoolingAverage'] and info.get('global', False):
+        layer_type = POOLING_GLOBAL_AVERAGE
+        kernel_size = stride = info['input_size']
+    if layer_type in (LAYER_TYPES['PoolingAverage'], POOLING_GLOBAL_AVERAGE):
+        pad = 0
+
+    output_area = info['output_size'] * info['output_size']
+    image_type = IMAGE_TYPES[info['image_type']]
+    output_num = info['output_channel'] * output_area if image_type else 0
+
+    return struct.pack(LAYER_FORMAT,
+                       strings.add(info['name']),
+                       layer_type,
+                       image_type,
+                       info['read_count'] if 'read_count' in info else -1,
+                       info.get('weight_offset', 0),
+                       info.get('bias_offset', 0),
+                       info.get('group', 1),
+                       info['input_channel'],
+                       info['output_channel'],
+                       info['input_size'],
+                       info['output_size'],
+                       kernel_size,
+                       pad,
+                       stride,
+                       1 if info.get('activation') == 'ReLU' else 0,
+                       info.get('local_size', 0),
+                       info.get('alpha', 0.0),
+                       info.get('beta', 0.0),
+                       output_num,
+                       info.get('destination_channel_offset', 0) * output_area
+                       )
+
+
+def compile_model(json_path, output_path):
+    with open(json_path, 'r') as f:
+        json_dict = json.load(f)
+
+    layer_info = json_dict['layer_info']
+    inout_info = json_dict['inout_info']
+    labels = json_dict.get('labels', [])
+    indices = dict((info['name'], index) for index, info in enumerate(layer_info))
+    quantized = [info['name'] for info in layer_info if info.get('weight_type') == 'int8']
+    if quantized:
+        print("Error: %s is quantized by quantize_weights.py (e.g. %s), which compiled models do not support" % (json_path, quantized[0]))
+        exit(-1)
+
+    strings = StringTable()
+    layers = b''.join(pack_layer(info, strings) for info in layer_info)
+    steps = b''.join(struct.pack(STEP_FORMAT, indices[kernel], indices[src], indices[dst])
+                     for kernel, src, dst in json_dict['encode_seq'])
+    label_offsets = struct.pack('<%dI' % len(labels), *[strings.add(label) for label in labels])
+
+    # tables one after another, each 8-byte aligned
+    layers_offset = align(struct.calcsize(HEADER_FORMAT))
+    steps_offset = align(layers_offset + len(layers))
+    labels_offset = align(steps_offset + len(steps))
+    strings_offset = align(labels_offset + len(label_offsets))
+    file_size = strings_offset + len(strings.data)
+
+    header = struct.pack(HEADER_FORMAT,
+                         MAGIC,
+                         VERSION,
+                         len(layer_info),
+                         len(json_dict['encode_seq']),
+                         len(labels),
+                         indices[inout_info['first_layer']],
+                         indices[inout_info['last_layer']],
+                         inout_info['input_size'],
+                         inout_info['file_size'],
+                         file_size,
+                         layers_offset,
+                         steps_offset,
+                         labels_offset,
+                         strings_offset,
+                         len(strings.data)
+                         )
+
+    with open(output_path, 'wb') as f:
+        for offset, table in ((0, header), (layers_offset, layers), (steps_offset, steps),
+                              (labels_offset, label_offsets), (strings_offset, strings.data)):
+            f.write(b'\0' * (offset - f.tell()))
+            f.write(table)
+
+    print('%s: %d layers, %d steps, %d labels, %d bytes' % (output_path, len(layer_info),
+                                                          len(json_dict['encode_seq']) + 1, len(labels), file_size))
+
+
+if __name__ == '__main__':
+    args = sys.argv[1:]
+    if len(args) not in (1, 2):
+        print('usage: %s model.json [model.gnm]' % os.path.basename(__file__))
+        exit(-1)
+    compile_model(args[0], args[1] if len(args) == 2 else os.path.splitext(args[0])[0] + '.gnm')
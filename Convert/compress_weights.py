@@ -0,0 +1,107 @@
+import os
+import sys
+import json
+import zlib
+import struct
+import argparse
+
+# Compresses a .dat of weights and biases into a container that CPUModel decompresses at load time,
+# in parallel, chunk by chunk. A chunk starts at every weight and bias offset of the JSON, and large
+# layers are split further; each chunk is compressed on its own, bytes of its floats grouped by their
+# position first, so that signs and exponents, which vary little, are deflated together.
+
+# keep in sync with GeneralNet/weightContainer.h
+MAGIC = 0x5a574e47
+VERSION = 1
+
+HEADER_FORMAT = '<4I2Q'
+CHUNK_FORMAT = '<2I4Q'
+
+CODEC_STORED = 0
+CODEC_SHUFFLE_DEFLATE = 1
+
+
+def align(offset):
+    return (offset + 7) // 8 * 8
+
+
+def chunk_ranges(json_dict, raw_size, max_chunk_size):
+    infos = json_dict['layer_info'] + [info for exit_dict in json_dict.get('exits', []) for info in exit_dict['layer_info']]
+    boundaries = set([0, raw_size])
+    for info in infos:
+        for key in ('weight_offset', 'weight_scale_offset', 'bias_offset'):
+            if key in info and 0 < info[key] * 4 < raw_size:
+                boundaries.add(info[key] * 4)
+    boundaries = sorted(boundaries)
+
+    ranges = []
+    for begin, end in zip(boundaries[:-1], boundaries[1:]):
+        count = (end - begin + max_chunk_size - 1) // max_chunk_size
+        step = (end - begin) // count // 4 * 4
+        for i in range(count):
+            ranges.append((begin + i * step, end if i == count - 1 else begin + (i + 1) * step))
+    return ranges
+
+
+def compress_chunk(raw, level):
+    if len(raw) % 4 == 0:
+        shuffled = b''.join(raw[byte::4] for byte in range(4))
+        compressed = zlib.compress(shuffled, level)
+        if len(compressed) < len(raw):
+            return CODEC_SHUFFLE_DEFLATE, compressed
+    return CODEC_STORED, raw
+
+
+def compress_weights(json_path, data_path, output_path, max_chunk_size, level):
+    with open(json_path, 'r') as f:
+        json_dict = json.load(f)
+    with open(data_path, 'rb') as f:
+        data = f.read()
+
+    raw_size = json_dict['inout_info']['file_size']
+    if len(data) != raw_size:
+        print("Error: %s has %d bytes, but file_size is %d bytes" % (data_path, len(data), raw_size))
+        exit(-1)
+
+    ranges = chunk_ranges(json_dict, raw_size, max_chunk_size)
+    chunks = [compress_chunk(data[begin:end], level) for begin, end in ranges]
+
+    # chunks one after another after the chunk table, each 8-byte aligned
+    offset = align(struct.calcsize(HEADER_FORMAT) + struct.calcsize(CHUNK_FORMAT) * len(chunks))
+    table = b''
+    offsets = []
+    for (begin, end), (codec, chunk) in zip(ranges, chunks):
+        table += struct.pack(CHUNK_FORMAT, codec, 0, begin, end - begin, offset, len(chunk))
+        offsets.append(offset)
+        offset = align(offset + len(chunk))
+    file_size = offsets[-1] + len(chunks[-1][1]) if chunks else offset
+
+    header = struct.pack(HEADER_FORMAT, MAGIC, VERSION, len(chunks), 0, raw_size, file_size)
+    with open(output_path, 'wb') as f:
+        f.write(header)
+        f.write(table)
+        for offset, (codec, chunk) in zip(offsets, chunks):
+            f.write(b'\0' * (offset - f.tell()))
+            f.write(chunk)
+
+    stored = sum(1 for codec, chunk in chunks if codec == CODEC_STORED)
+    print('%s: %d chunks (%d stored), %d bytes, %.1f%% of %d bytes' % (output_path, len(chunks), stored, file_size,
+                                                                      100.0 * file_size / max(raw_size, 1), raw_size))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compress a .dat of weights and biases into a container read by CPUModel.')
+    parser.add_argument('json_path', help='description of the net, e.g. googlenet.json, whose layers give the chunks')
+    parser.add_argument('data_path', help='the .dat to compress')
+    parser.add_argument('output_path', nargs='?', help='the container to write, the .dat with .gnz by default')
+    parser.add_argument('--chunk-size', type=int, default=4, help='largest chunk in MB, 4 by default')
+    parser.add_argument('--level', type=int, default=6, help='level of deflate from 1 to 9, 6 by default')
+    args = parser.parse_args()
+    if args.chunk_size <= 0 or not 1 <= args.level <= 9:
+        print("usage: %s: chunk size should be positive, and level in [1, 9]" % os.path.basename(__file__))
+        exit(-1)
+    output_path = args.output_path or os.path.splitext(args.data_path)[0] + '.gnz'
+    compress_weights(args.json_path, args.data_path, output_path, args.chunk_size << 20, args.level)
+
+if __name__ == '__main__':
+    main()
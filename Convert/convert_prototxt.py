@@ -80,7 +80,7 @@ def generate_param_txt(prototxt_path, labels_path, json_filename):
         elif layer.type == 'Pooling' and layer.pooling_param.pool == 1:
             new_layer.type = LayerType.pave
 
-        elif layer.type == 'Softmax':
+        elif layer.type == 'Softmax' or layer.type == 'SoftmaxWithLoss':
             new_layer.type = LayerType.sft
             new_layer.out_size = 1
 
@@ -93,7 +93,7 @@ def generate_param_txt(prototxt_path, labels_path, json_filename):
         elif layer.type == 'ReLU':
             relu_list.append(layer.bottom[0])
 
-        elif layer.type == 'Dropout':
+        elif layer.type == 'Dropout' or layer.type == 'Accuracy':
             pass
 
         else:
@@ -188,6 +188,46 @@ def generate_param_txt(prototxt_path, labels_path, json_filename):
             for layer1 in concat_layer_dict[layer0.name]:
                 concat_offset_dict[layer0.name].append(layer1.out_channel + concat_offset_dict[layer0.name][-1])
 
+# find exits, i.e. auxiliary classifiers like loss1 and loss2 of GoogLeNet
+# layers that the last layer does not depend on belong to the exit of the softmax layer reading them,
+# and the exit branches off at the layer of the main net they read
+    layers_dict = dict((layer.name, layer) for layer in layers_list)
+
+    def bottoms_of(layer):
+        if layer.type == LayerType.concat:
+            return list(concat_name_dict[layer.name])
+        return layer.type != LayerType.input and [layer.bottom] or []
+
+    main_names = set()
+    pending = [layers_list[-1].name]
+    while pending:
+        name = pending.pop()
+        if name not in main_names:
+            main_names.add(name)
+            pending.extend(bottoms_of(layers_dict[name]))
+
+    # exit_of{string(name of a layer of an exit) : string(name of the softmax layer of the exit)}
+    exit_of = {}
+    # exit_branch_dict{string(name of the softmax layer of an exit) : string(name of its branch layer)}
+    exit_branch_dict = {}
+    exit_names = [layer.name for layer in layers_list if layer.type == LayerType.sft and layer.name not in main_names]
+    for exit_name in exit_names:
+        pending = [exit_name]
+        while pending:
+            name = pending.pop()
+            if name in main_names:
+                if exit_branch_dict.setdefault(exit_name, name) != name:
+                    print 'Unsupported exit: ' + exit_name + ', it reads both ' + exit_branch_dict[exit_name] + ' and ' + name
+                    exit(-1)
+            elif name not in exit_of:
+                exit_of[name] = exit_name
+                pending.extend(bottoms_of(layers_dict[name]))
+
+    for layer in layers_list[1:]:
+        if layer.name not in main_names and layer.name not in exit_of:
+            print 'Unsupported layer: ' + layer.name + ', neither the last layer nor any softmax layer reads it'
+            exit(-1)
+
 # generate JSON
 # data layer will be excluded
     json_dict = {}
@@ -195,12 +235,19 @@ def generate_param_txt(prototxt_path, labels_path, json_filename):
     data_file_offset = 0
     layer_info = []
     encode_seq = []
+    exits_dict = dict((name, {'name': name,
+                              'branch_layer': exit_branch_dict[name],
+                              'last_layer': name,
+                              'layer_info': [],
+                              'encode_seq': []}) for name in exit_names)
 
     for layer in layers_list[1:]:
 
-        # used to set the readCount
+        # used to set the readCount, exits do not count as readers of their branch layers
         as_bottom = 0
         for top_layer in layers_list[1:]:
+            if exit_of.get(top_layer.name) != exit_of.get(layer.name):
+                continue
             if top_layer.type == LayerType.concat and layer.name in concat_name_dict[top_layer.name]:
                 as_bottom += 1
             elif top_layer.bottom == layer.name:
@@ -309,6 +356,8 @@ def generate_param_txt(prototxt_path, labels_path, json_filename):
         layer.param_dict['name'] = layer.name
         layer.param_dict['output_channel'] = layer.out_channel
         layer.param_dict['output_size'] = layer.out_size
+        layer.param_dict['input_channel'] = layer.in_channel
+        layer.param_dict['input_size'] = layers_dict[bottoms_of(layer)[0]].out_size
 
         # for creating MPSImage
         if layer.name in concat_parent_dict.keys():
@@ -320,6 +369,13 @@ def generate_param_txt(prototxt_path, labels_path, json_filename):
             layer.param_dict['image_type'] = 'Temporary'
             layer.param_dict['read_count'] = as_bottom
 
+        # data offsets go on in the order of the prototxt, so that layers of exits find their own parameters
+        if layer.name in exit_of:
+            exits_dict[exit_of[layer.name]]['layer_info'].append(layer.param_dict)
+            if layer.type != LayerType.concat:
+                exits_dict[exit_of[layer.name]]['encode_seq'].append([layer.name, layer.bottom, layer.name])
+            continue
+
         layer_info.append(layer.param_dict)
 
         # [kernel, src, dst]
@@ -331,6 +387,7 @@ def generate_param_txt(prototxt_path, labels_path, json_filename):
 
     json_dict['layer_info'] = layer_info
     json_dict['encode_seq'] = encode_seq[1:]    # encoding from outer source should be handled elsewhere
+    json_dict['exits'] = [exits_dict[name] for name in exit_names]     # encoding of an exit starts from its branch layer
 
     # get labels
     with open(labels_path, 'r') as f:
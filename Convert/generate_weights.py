@@ -0,0 +1,82 @@
+import os
+import sys
+import json
+import math
+import array
+import random
+import zlib
+import argparse
+
+# Writes a .dat of random weights and biases for any description of a net, so that it can be
+# forwarded and benchmarked without its caffemodel. Weights of convolution and fully connected
+# layers are drawn from N(0, 2 / fan_in) (He initialization), which keeps activations of ReLU nets
+# in a realistic range layer after layer. Each layer has its own generator seeded by the seed and
+# its name, so the same seed gives the same file, and a layer gets the same weights in any net.
+# Layers of exits are written too, and floats not used by any layer are left 0.
+
+
+def fan_in(info):
+    if info['layer_type'] == 'FullyConnected':
+        return info['input_channel'] * info['input_size'] * info['input_size']
+    return info['input_channel'] // info.get('group', 1) * info['kernel_size'] * info['kernel_size']
+
+
+def random_floats(generator, count, std, sparsity):
+    gauss = generator.gauss
+    if sparsity <= 0:
+        return array.array('f', [gauss(0.0, std) for _ in range(count)])
+
+    # surviving weights are scaled up so that the variance of outputs does not change
+    std /= math.sqrt(1.0 - sparsity)
+    uniform = generator.random
+    return array.array('f', [gauss(0.0, std) if uniform() >= sparsity else 0.0 for _ in range(count)])
+
+
+def generate_weights(json_path, output_path, seed, sparsity, bias_std):
+    with open(json_path, 'r') as f:
+        json_dict = json.load(f)
+
+    file_size = json_dict['inout_info']['file_size']
+    infos = json_dict['layer_info'] + [info for exit_dict in json_dict.get('exits', []) for info in exit_dict['layer_info']]
+    layers = [info for info in infos if info['layer_type'] in ('Convolution', 'FullyConnected')]
+
+    with open(output_path, 'wb') as f:
+        f.truncate(file_size)
+        for info in layers:
+            weight_count = info['output_channel'] * fan_in(info)
+            bias_count = info['output_channel']
+            for offset, count in ((info['weight_offset'], weight_count), (info['bias_offset'], bias_count)):
+                if (offset + count) * 4 > file_size:
+                    print("Error: %s needs floats %d to %d, but file_size is %d bytes" % (info['name'], offset, offset + count, file_size))
+                    exit(-1)
+
+            generator = random.Random(seed << 32 | zlib.crc32(info['name'].encode('utf-8')) & 0xffffffff)
+            weights = random_floats(generator, weight_count, math.sqrt(2.0 / fan_in(info)), sparsity)
+            biases = random_floats(generator, bias_count, bias_std, 0) if bias_std > 0 else array.array('f', [0.0] * bias_count)
+
+            # .dat is little endian like the devices reading it
+            for offset, values in ((info['weight_offset'], weights), (info['bias_offset'], biases)):
+                if sys.byteorder != 'little':
+                    values.byteswap()
+                f.seek(offset * 4)
+                values.tofile(f)
+            print("%-32s %10d weights %6d biases" % (info['name'], weight_count, bias_count))
+
+    print("Done writing %s, %d bytes." % (output_path, file_size))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Write random weights and biases for a net described by a JSON file.')
+    parser.add_argument('json_path', help='description of the net, e.g. googlenet.json')
+    parser.add_argument('output_path', help='the .dat to write')
+    parser.add_argument('--seed', type=int, default=1, help='the same seed gives the same file, 1 by default')
+    parser.add_argument('--sparsity', type=float, default=0.0, help='fraction of weights that are 0, 0 by default')
+    parser.add_argument('--bias-std', type=float, default=0.01, help='standard deviation of biases, 0.01 by default')
+    args = parser.parse_args()
+    if not 0 <= args.sparsity < 1:
+        print("usage: %s: sparsity should be in [0, 1)" % os.path.basename(__file__))
+        exit(-1)
+    generate_weights(args.json_path, args.output_path, args.seed, args.sparsity, args.bias_std)
+
+if __name__ == '__main__':
+    main()
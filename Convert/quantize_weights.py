@@ -0,0 +1,132 @@
+import os
+import sys
+import json
+import array
+import argparse
+
+# Quantizes a net for GeneralNet/CPUQuantizedLayer.h: weights of convolution and fully connected layers become
+# int8 in [-127, 127] with a float scale for each output channel, stored as int8 weights (padded to whole floats),
+# then scales, then float biases; each of these layers gets "weight_type": "int8" and "weight_scale_offset".
+# Every image found in the calibration written by Benchmark/calibrate.m gets its "output_range" on the layer owning
+# it, which decides the uint8 it is held in; layers writing into the image of another layer, e.g. of a concat, use it. Layers of exits, and those given to --float, keep float weights.
+
+
+def fan_in(info):
+    if info['layer_type'] == 'FullyConnected':
+        return info['input_channel'] * info['input_size'] * info['input_size']
+    return info['input_channel'] // info.get('group', 1) * info['kernel_size'] * info['kernel_size']
+
+
+def round_half_away(x):
+    return int(x + 0.5) if x >= 0 else -int(-x + 0.5)
+
+
+def quantize_rows(weights, rows):
+    columns = len(weights) // rows
+    quantized = array.array('b', bytes(len(weights)))
+    scales = array.array('f', [1.0] * rows)
+    for row in range(rows):
+        begin = row * columns
+        magnitude = max(abs(w) for w in weights[begin:begin + columns]) if columns else 0.0
+        scale = magnitude / 127.0 if magnitude > 0 else 1.0
+        for i in range(begin, begin + columns):
+            quantized[i] = max(-127, min(127, round_half_away(weights[i] / scale)))
+        scales[row] = scale
+    return quantized, scales
+
+
+def read_floats(data, offset, count):
+    values = array.array('f', data[offset * 4:(offset + count) * 4])
+    if sys.byteorder != 'little':
+        values.byteswap()
+    return values
+
+
+def to_bytes(values):
+    if sys.byteorder != 'little' and values.itemsize > 1:
+        values = array.array(values.typecode, values)
+        values.byteswap()
+    raw = values.tobytes()
+    return raw + b'\0' * (-len(raw) % 4)
+
+
+def quantize_weights(json_path, data_path, calibration_path, output_json_path, output_data_path, float_layers):
+    with open(json_path, 'r') as f:
+        json_dict = json.load(f)
+    with open(data_path, 'rb') as f:
+        data = f.read()
+    with open(calibration_path, 'r') as f:
+        ranges = json.load(f)['ranges']
+
+    if len(data) != json_dict['inout_info']['file_size']:
+        print("Error: %s has %d bytes, but file_size is %d bytes" % (data_path, len(data), json_dict['inout_info']['file_size']))
+        exit(-1)
+
+    # layers are written one after another, in the order of layer_info then exits
+    output = bytearray()
+    exit_infos = [info for exit_dict in json_dict.get('exits', []) for info in exit_dict['layer_info']]
+    exit_ids = set(id(info) for info in exit_infos)
+    float_bytes = 0
+    for info in json_dict['layer_info'] + exit_infos:
+        if info['layer_type'] not in ('Convolution', 'FullyConnected'):
+            continue
+        weights = read_floats(data, info['weight_offset'], info['output_channel'] * fan_in(info))
+        biases = read_floats(data, info['bias_offset'], info['output_channel'])
+        float_bytes += (len(weights) + len(biases)) * 4
+
+        if id(info) in exit_ids or info['name'] in float_layers:
+            info['weight_offset'] = len(output) // 4
+            output += to_bytes(weights)
+            info['bias_offset'] = len(output) // 4
+            output += to_bytes(biases)
+            print("%-32s %10d weights kept as floats" % (info['name'], len(weights)))
+            continue
+
+        quantized, scales = quantize_rows(weights, info['output_channel'])
+        info['weight_type'] = 'int8'
+        info['weight_offset'] = len(output) // 4
+        output += to_bytes(quantized)
+        info['weight_scale_offset'] = len(output) // 4
+        output += to_bytes(scales)
+        info['bias_offset'] = len(output) // 4
+        output += to_bytes(biases)
+        print("%-32s %10d weights in int8, scales in [%g, %g]" % (info['name'], len(weights), min(scales), max(scales)))
+
+    # ranges are of images, so layers writing into another image, e.g. branches of a concat, take the range of its owner
+    owners = dict((kernel, dst) for kernel, src, dst in json_dict['encode_seq'])
+    missing = []
+    for info in json_dict['layer_info'] + exit_infos:
+        if info['name'] in ranges:
+            info['output_range'] = ranges[info['name']]
+        elif id(info) not in exit_ids and owners.get(info['name'], info['name']) not in ranges:
+            missing.append(info['name'])
+    if missing:
+        print("Warning: no range of %s, whose outputs stay floats" % ', '.join(missing))
+
+    json_dict['inout_info']['file_size'] = len(output)
+    with open(output_json_path, 'w') as f:
+        f.write(json.dumps(json_dict))
+    with open(output_data_path, 'wb') as f:
+        f.write(output)
+
+    print("Done writing %s and %s, %d bytes instead of %d bytes of weights and biases." % (output_json_path, output_data_path,
+                                                                                           len(output), float_bytes))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Quantize weights of a net to int8, with output ranges from Benchmark/calibrate.')
+    parser.add_argument('json_path', help='description of the float net, e.g. googlenet.json')
+    parser.add_argument('data_path', help='its weights and biases')
+    parser.add_argument('calibration_path', help='ranges of outputs written by Benchmark/calibrate')
+    parser.add_argument('output_json_path', nargs='?', help='the quantized description, the JSON with _int8 by default')
+    parser.add_argument('output_data_path', nargs='?', help='the quantized .dat, the .dat with _int8 by default')
+    parser.add_argument('--float', dest='float_layers', default='', help='comma separated layers keeping float weights')
+    args = parser.parse_args()
+
+    output_json_path = args.output_json_path or os.path.splitext(args.json_path)[0] + '_int8.json'
+    output_data_path = args.output_data_path or os.path.splitext(args.data_path)[0] + '_int8.dat'
+    float_layers = set(name for name in args.float_layers.split(',') if name)
+    quantize_weights(args.json_path, args.data_path, args.calibration_path, output_json_path, output_data_path, float_layers)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,89 @@
+//
+//  CPUCascade.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/21.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#if __has_include(<UIKit/UIKit.h>)
+#import <UIKit/UIKit.h>
+#endif
+#import "imagePreprocess.h"
+
+@class CPUModel;
+
+// when the answer of a stage is confident enough to stop there
+typedef NS_ENUM (NSInteger, CascadeRules) {
+    eCascadeTopProbability  = 1,    // top-1 probability >= threshold
+    eCascadeMargin          = 2,    // top-1 probability - top-2 probability >= threshold
+    eCascadeEntropy         = 3,    // entropy of probabilities in nats <= threshold
+};
+
+// Models from the cheapest to the most expensive, e.g. SqueezeNet then GoogLeNet. An image is forwarded by the
+// first model, and goes on to the next one only if the answer is not confident by the rule of that stage; the last
+// stage always answers. Each model has its own session and is preprocessed for separately, so models can have
+// different input sizes and normalizations, but their labels should be the same.
+//
+// Rules read probabilities, so models should end with softmax, i.e. not be loaded with CPUModelOptionArgmaxOnly.
+// Like CPUSession, a cascade should only be used by one thread at a time.
+@interface CPUCascade : NSObject {
+@protected
+    NSArray<CPUModel *> *m_Models;
+    NSArray *m_Sessions;
+    CascadeRules *m_Rules;
+    float *m_Thresholds;
+    float *m_ImageData;         // input of each stage in turn
+    int m_StagesCount;
+    int m_AnsweringStage;       // of the last image
+    int m_Requests;
+    int *m_ReachedCounts;       // images forwarded by each stage
+    int *m_AnsweredCounts;      // images answered by each stage
+    NSTimeInterval *m_StageTimes;
+    NSTimeInterval m_TotalTime;
+}
+
+@property (readonly, nonatomic) int stagesCount;
+
+// stage that answered the last image
+@property (readonly, nonatomic) int answeringStage;
+
+// every stage but the last one stops at top-1 probability >= 0.5 until it is set
+// threadsCount is the number of threads used by each session, 0 for all cores
+- (instancetype)initWithModels:(NSArray<CPUModel *> *)models
+                  threadsCount:(size_t)threadsCount;
+
+- (void)setRule:(CascadeRules)rule
+      threshold:(float)threshold
+        ofStage:(int)stage;
+
+// confidence of probabilities by a rule, larger is more confident except for entropy
++ (float)confidenceOfProbs:(const float *)probs
+                     count:(int)count
+                      rule:(CascadeRules)rule;
+
+// forward one image of interleaved 8-bit pixels through as many stages as needed, returns the answering stage
+- (int)forwardWithPixels:(const uint8_t *)pixels
+                   width:(size_t)width
+                  height:(size_t)height
+             bytesPerRow:(size_t)bytesPerRow
+                  format:(preprocess_pixel_format)format;
+
+#if __has_include(<UIKit/UIKit.h>)
+- (int)forwardWithImage:(UIImage *)image;
+#endif
+
+// probabilities given by the answering stage for the last image, and their count
+- (const float *)probs;
+- (int)probsNum;
+
+- (NSString *)labelsOfTopProbs;
+
+// {"requests", "escalation_rate", "average_latency_ms", "stages": [{"reached", "answered", "average_ms"}, ...]}
+// escalation_rate is the fraction of images that went on past the first stage, average_ms is per image reaching the stage
+- (NSDictionary<NSString *, id> *)statistics;
+
+- (void)resetStatistics;
+
+@end
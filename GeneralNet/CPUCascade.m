@@ -0,0 +1,175 @@
+//
+//  CPUCascade.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/21.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPUCascade.h"
+#import "CPUModel.h"
+#import "CPUSession.h"
+
+@implementation CPUCascade
+
+- (instancetype)initWithModels:(NSArray<CPUModel *> *)models
+                  threadsCount:(size_t)threadsCount {
+    NSAssert(models.count > 0, @"Error: a cascade needs at least one model");
+    if (self = [super init]) {
+        m_Models = [models copy];
+        m_StagesCount = (int)models.count;
+
+        NSMutableArray *sessions = [[NSMutableArray alloc] initWithCapacity:m_StagesCount];
+        int maxInputNum = 0;
+        for (CPUModel *model in models) {
+            [sessions addObject:[[CPUSession alloc] initWithModel:model threadsCount:threadsCount]];
+            maxInputNum = MAX(maxInputNum, model.inputNum);
+        }
+        m_Sessions = [sessions copy];
+        m_ImageData = malloc(sizeof(float) * maxInputNum);
+
+        m_Rules = malloc(sizeof(CascadeRules) * m_StagesCount);
+        m_Thresholds = malloc(sizeof(float) * m_StagesCount);
+        for (int stage = 0; stage < m_StagesCount; stage++) {
+            m_Rules[stage] = eCascadeTopProbability;
+            m_Thresholds[stage] = 0.5;
+        }
+
+        m_ReachedCounts = calloc(m_StagesCount, sizeof(int));
+        m_AnsweredCounts = calloc(m_StagesCount, sizeof(int));
+        m_StageTimes = calloc(m_StagesCount, sizeof(NSTimeInterval));
+    }
+
+    return self;
+}
+
+- (int)stagesCount {
+    return m_StagesCount;
+}
+
+- (int)answeringStage {
+    return m_AnsweringStage;
+}
+
+- (void)setRule:(CascadeRules)rule
+      threshold:(float)threshold
+        ofStage:(int)stage {
+    NSAssert(stage >= 0 && stage < m_StagesCount, @"Error: there is no stage %d", stage);
+    m_Rules[stage] = rule;
+    m_Thresholds[stage] = threshold;
+}
+
++ (float)confidenceOfProbs:(const float *)probs
+                     count:(int)count
+                      rule:(CascadeRules)rule {
+    if (rule == eCascadeEntropy) {
+        float entropy = 0;
+        for (int i = 0; i < count; i++) {
+            if (probs[i] > 0) entropy -= probs[i] * logf(probs[i]);
+        }
+        return entropy;
+    }
+
+    float first = 0, second = 0;
+    for (int i = 0; i < count; i++) {
+        if (probs[i] > first) {
+            second = first;
+            first = probs[i];
+        } else if (probs[i] > second) {
+            second = probs[i];
+        }
+    }
+    return rule == eCascadeMargin? first - second : first;
+}
+
+- (BOOL)isConfident:(const float *)probs
+            ofStage:(int)stage {
+    float confidence = [CPUCascade confidenceOfProbs:probs count:m_Models[stage].probsNum rule:m_Rules[stage]];
+    return m_Rules[stage] == eCascadeEntropy? confidence <= m_Thresholds[stage] : confidence >= m_Thresholds[stage];
+}
+
+// preprocess is called with the session of each stage reached, since inputs of models differ
+- (int)forwardWithPreprocess:(void (^)(CPUSession *session, float *data))preprocess {
+    NSDate *startTime = [NSDate date];
+    int stage = 0;
+    for (; stage < m_StagesCount; stage++) {
+        CPUSession *session = m_Sessions[stage];
+        NSDate *stageTime = [NSDate date];
+        preprocess(session, m_ImageData);
+        [session forwardWithImageData:m_ImageData batch:1];
+        m_StageTimes[stage] -= [stageTime timeIntervalSinceNow];
+        m_ReachedCounts[stage]++;
+
+        if (stage == m_StagesCount - 1 || [self isConfident:[session probsOfImage:0] ofStage:stage]) break;
+    }
+
+    m_AnsweredCounts[stage]++;
+    m_AnsweringStage = stage;
+    m_Requests++;
+    m_TotalTime -= [startTime timeIntervalSinceNow];
+    return stage;
+}
+
+- (int)forwardWithPixels:(const uint8_t *)pixels
+                   width:(size_t)width
+                  height:(size_t)height
+             bytesPerRow:(size_t)bytesPerRow
+                  format:(preprocess_pixel_format)format {
+    return [self forwardWithPreprocess:^(CPUSession *session, float *data) {
+        [session preprocessPixels:pixels width:width height:height bytesPerRow:bytesPerRow format:format toData:data];
+    }];
+}
+
+#if __has_include(<UIKit/UIKit.h>)
+- (int)forwardWithImage:(UIImage *)image {
+    return [self forwardWithPreprocess:^(CPUSession *session, float *data) {
+        [session preprocessImage:image toData:data];
+    }];
+}
+#endif
+
+- (const float *)probs {
+    return [(CPUSession *)m_Sessions[m_AnsweringStage] probsOfImage:0];
+}
+
+- (int)probsNum {
+    return m_Models[m_AnsweringStage].probsNum;
+}
+
+- (NSString *)labelsOfTopProbs {
+    return [(CPUSession *)m_Sessions[m_AnsweringStage] labelsOfTopProbsInBatch:5][0];
+}
+
+- (NSDictionary<NSString *, id> *)statistics {
+    NSMutableArray<NSDictionary<NSString *, id> *> *stages = [[NSMutableArray alloc] initWithCapacity:m_StagesCount];
+    for (int stage = 0; stage < m_StagesCount; stage++) {
+        [stages addObject:@{@"reached": @(m_ReachedCounts[stage]),
+                            @"answered": @(m_AnsweredCounts[stage]),
+                            @"average_ms": @(m_ReachedCounts[stage]? m_StageTimes[stage] / m_ReachedCounts[stage] * 1000 : 0)}];
+    }
+
+    int escalated = m_StagesCount > 1? m_ReachedCounts[1] : 0;
+    return @{@"requests": @(m_Requests),
+             @"escalation_rate": @(m_Requests? (double)escalated / m_Requests : 0),
+             @"average_latency_ms": @(m_Requests? m_TotalTime / m_Requests * 1000 : 0),
+             @"stages": [stages copy]};
+}
+
+- (void)resetStatistics {
+    m_Requests = 0;
+    m_TotalTime = 0;
+    memset(m_ReachedCounts, 0, sizeof(int) * m_StagesCount);
+    memset(m_AnsweredCounts, 0, sizeof(int) * m_StagesCount);
+    memset(m_StageTimes, 0, sizeof(NSTimeInterval) * m_StagesCount);
+}
+
+- (void)dealloc {
+    free(m_ImageData);
+    free(m_Rules);
+    free(m_Thresholds);
+    free(m_ReachedCounts);
+    free(m_AnsweredCounts);
+    free(m_StageTimes);
+}
+
+@end
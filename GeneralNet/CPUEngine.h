@@ -0,0 +1,81 @@
+//
+//  CPUEngine.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/14.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <pthread.h>
+
+@class CPUModel;
+@class CPUResultCache;
+
+typedef uint64_t CPUTicket;     // 0 is never a valid ticket
+
+// probs holds batch x probsNum floats
+typedef void (^CPUEngineCompletion)(CPUTicket ticket, NSData *probs);
+
+// Runs requests asynchronously on worker threads owned by the engine, each of them forwarding with its
+// own CPUSession of the same model. Requests wait in a bounded queue: submitting blocks (or fails, for
+// the try version) while the queue is full, so that producers can not run far ahead of inference.
+//
+// Completions are delivered in one of two ways:
+// - with a callback queue, each completion block is dispatched to it as soon as its request finishes
+// - without one, finished completions wait in the engine, completionFd becomes readable, and
+//   -drainCompletions runs them on the calling thread, which suits a poll / select loop
+@interface CPUEngine : NSObject {
+@protected
+    CPUModel *m_Model;
+    NSArray *m_Sessions;
+    dispatch_queue_t m_CallbackQueue;
+    pthread_t *m_Workers;
+    int m_WorkersCount;
+
+    pthread_mutex_t m_Mutex;
+    pthread_cond_t m_NotEmpty;
+    pthread_cond_t m_NotFull;
+    NSMutableArray *m_Requests;         // waiting to run, guarded by m_Mutex
+    int m_QueueCapacity;
+    CPUTicket m_NextTicket;
+    BOOL m_Stopping;
+
+    NSMutableArray *m_Completions;      // finished but not drained, guarded by m_Mutex
+    int m_CompletionPipe[2];
+}
+
+@property (readonly, nonatomic) CPUModel *model;
+
+// readable while finished completions wait to be drained, -1 if there is a callback queue
+@property (readonly, nonatomic) int completionFd;
+
+// shared by the sessions of all workers, see -[CPUSession resultCache]; it should be set before submitting
+@property (strong, nonatomic) CPUResultCache *resultCache;
+
+// threadsPerWorker is the number of threads used by the session of each worker, 0 for all cores
+// callbackQueue can be nil, see above
+- (instancetype)initWithModel:(CPUModel *)model
+                 workersCount:(int)workersCount
+             threadsPerWorker:(size_t)threadsPerWorker
+                queueCapacity:(int)queueCapacity
+                callbackQueue:(dispatch_queue_t)callbackQueue;
+
+// imageData is a batch of images preprocessed by -[CPUSession preprocessImage:toData:], and is copied before returning
+// blocks while the queue is full
+- (CPUTicket)submitImageData:(const float *)imageData
+                       batch:(int)batch
+                  completion:(CPUEngineCompletion)completion;
+
+// returns 0 without submitting if the queue is full
+- (CPUTicket)trySubmitImageData:(const float *)imageData
+                          batch:(int)batch
+                     completion:(CPUEngineCompletion)completion;
+
+// number of requests waiting to run
+- (int)pendingCount;
+
+// runs finished completions on the calling thread, returns how many were run
+- (int)drainCompletions;
+
+@end
@@ -0,0 +1,246 @@
+//
+//  CPUEngine.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/14.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <fcntl.h>
+#import <unistd.h>
+#import "CPUEngine.h"
+#import "CPUModel.h"
+#import "CPUSession.h"
+
+@interface CPUEngineRequest : NSObject
+
+@property (assign, nonatomic) CPUTicket ticket;
+@property (strong, nonatomic) NSData *imageData;
+@property (assign, nonatomic) int batch;
+@property (copy, nonatomic) CPUEngineCompletion completion;
+@property (strong, nonatomic) NSData *probs;
+
+@end
+
+@implementation CPUEngineRequest
+
+@end
+
+@interface CPUEngine ()
+
+- (void)runWorker:(int)index;
+
+@end
+
+struct engine_worker {
+    __unsafe_unretained CPUEngine *engine;
+    int index;
+};
+
+static void *run_worker(void *argument) {
+    struct engine_worker worker = *(struct engine_worker *)argument;
+    free(argument);
+    [worker.engine runWorker:worker.index];
+    return NULL;
+}
+
+@implementation CPUEngine
+
+- (instancetype)initWithModel:(CPUModel *)model
+                 workersCount:(int)workersCount
+             threadsPerWorker:(size_t)threadsPerWorker
+                queueCapacity:(int)queueCapacity
+                callbackQueue:(dispatch_queue_t)callbackQueue {
+    if (self = [super init]) {
+        NSAssert(workersCount > 0 && queueCapacity > 0, @"Error: need at least one worker and a queue of at least one request");
+        m_Model = model;
+        m_CallbackQueue = callbackQueue;
+        m_QueueCapacity = queueCapacity;
+        m_NextTicket = 1;
+        m_Requests = [[NSMutableArray alloc] initWithCapacity:queueCapacity];
+        m_Completions = [[NSMutableArray alloc] init];
+        pthread_mutex_init(&m_Mutex, NULL);
+        pthread_cond_init(&m_NotEmpty, NULL);
+        pthread_cond_init(&m_NotFull, NULL);
+
+        // both ends are non-blocking: a full pipe is readable anyway, so a byte that does not fit can be dropped
+        m_CompletionPipe[0] = m_CompletionPipe[1] = -1;
+        if (!callbackQueue) {
+            int error = pipe(m_CompletionPipe);
+            NSAssert(error == 0, @"Error: failed to create completion pipe with errno = %d", errno);
+            fcntl(m_CompletionPipe[0], F_SETFL, fcntl(m_CompletionPipe[0], F_GETFL) | O_NONBLOCK);
+            fcntl(m_CompletionPipe[1], F_SETFL, fcntl(m_CompletionPipe[1], F_GETFL) | O_NONBLOCK);
+        }
+
+        NSMutableArray *sessions = [[NSMutableArray alloc] initWithCapacity:workersCount];
+        for (int i = 0; i < workersCount; i++) {
+            [sessions addObject:[[CPUSession alloc] initWithModel:model threadsCount:threadsPerWorker]];
+        }
+        m_Sessions = [sessions copy];
+
+        m_WorkersCount = workersCount;
+        m_Workers = malloc(sizeof(pthread_t) * workersCount);
+        for (int i = 0; i < workersCount; i++) {
+            struct engine_worker *worker = malloc(sizeof(struct engine_worker));
+            *worker = (struct engine_worker){ .engine = self, .index = i };
+            int error = pthread_create(&m_Workers[i], NULL, run_worker, worker);
+            NSAssert(error == 0, @"Error: failed to create worker %d with errno = %d", i, error);
+        }
+    }
+
+    return self;
+}
+
+- (CPUModel *)model {
+    return m_Model;
+}
+
+- (int)completionFd {
+    return m_CompletionPipe[0];
+}
+
+- (CPUResultCache *)resultCache {
+    return [(CPUSession *)m_Sessions[0] resultCache];
+}
+
+- (void)setResultCache:(CPUResultCache *)resultCache {
+    for (CPUSession *session in m_Sessions) {
+        session.resultCache = resultCache;
+    }
+}
+
+- (CPUTicket)submitImageData:(const float *)imageData
+                       batch:(int)batch
+                  completion:(CPUEngineCompletion)completion {
+    return [self submitImageData:imageData batch:batch completion:completion wait:YES];
+}
+
+- (CPUTicket)trySubmitImageData:(const float *)imageData
+                          batch:(int)batch
+                     completion:(CPUEngineCompletion)completion {
+    return [self submitImageData:imageData batch:batch completion:completion wait:NO];
+}
+
+- (CPUTicket)submitImageData:(const float *)imageData
+                       batch:(int)batch
+                  completion:(CPUEngineCompletion)completion
+                        wait:(BOOL)wait {
+    CPUEngineRequest *request = [[CPUEngineRequest alloc] init];
+    request.imageData = [NSData dataWithBytes:imageData length:sizeof(float) * m_Model.inputNum * batch];
+    request.batch = batch;
+    request.completion = completion;
+
+    pthread_mutex_lock(&m_Mutex);
+    while (m_Requests.count >= m_QueueCapacity && wait && !m_Stopping) {
+        pthread_cond_wait(&m_NotFull, &m_Mutex);
+    }
+    if (m_Requests.count >= m_QueueCapacity || m_Stopping) {
+        pthread_mutex_unlock(&m_Mutex);
+        return 0;
+    }
+    request.ticket = m_NextTicket++;
+    [m_Requests addObject:request];
+    pthread_cond_signal(&m_NotEmpty);
+    pthread_mutex_unlock(&m_Mutex);
+
+    return request.ticket;
+}
+
+- (int)pendingCount {
+    pthread_mutex_lock(&m_Mutex);
+    int count = (int)m_Requests.count;
+    pthread_mutex_unlock(&m_Mutex);
+    return count;
+}
+
+- (void)runWorker:(int)index {
+    CPUSession *session = m_Sessions[index];
+
+    // requests still in the queue are finished before quitting
+    while (true) {
+        pthread_mutex_lock(&m_Mutex);
+        while (!m_Requests.count && !m_Stopping) {
+            pthread_cond_wait(&m_NotEmpty, &m_Mutex);
+        }
+        if (!m_Requests.count) {
+            pthread_mutex_unlock(&m_Mutex);
+            break;
+        }
+        CPUEngineRequest *request = m_Requests[0];
+        [m_Requests removeObjectAtIndex:0];
+        pthread_cond_signal(&m_NotFull);
+        pthread_mutex_unlock(&m_Mutex);
+
+        @autoreleasepool {
+            [session forwardWithImageData:request.imageData.bytes batch:request.batch];
+            request.imageData = nil;
+
+            // images of a batch answered by the cache or by exits are not next to each other
+            NSMutableData *probs = [[NSMutableData alloc] initWithLength:sizeof(float) * m_Model.probsNum * request.batch];
+            for (int i = 0; i < request.batch; i++) {
+                memcpy((float *)probs.mutableBytes + i * m_Model.probsNum, [session probsOfImage:i], sizeof(float) * m_Model.probsNum);
+            }
+            request.probs = probs;
+            [self completeRequest:request];
+        }
+    }
+}
+
+- (void)completeRequest:(CPUEngineRequest *)request {
+    if (m_CallbackQueue) {
+        dispatch_async(m_CallbackQueue, ^{
+            request.completion(request.ticket, request.probs);
+        });
+        return;
+    }
+
+    pthread_mutex_lock(&m_Mutex);
+    [m_Completions addObject:request];
+    pthread_mutex_unlock(&m_Mutex);
+    char byte = 0;
+    ssize_t written = write(m_CompletionPipe[1], &byte, 1);
+    (void)written;
+}
+
+- (int)drainCompletions {
+
+    // empty the pipe before taking completions, so that a completion added in between
+    // leaves the pipe readable instead of waiting unnoticed
+    char bytes[64];
+    if (m_CompletionPipe[0] >= 0) {
+        while (read(m_CompletionPipe[0], bytes, sizeof(bytes)) > 0);
+    }
+
+    pthread_mutex_lock(&m_Mutex);
+    NSArray<CPUEngineRequest *> *completions = [m_Completions copy];
+    [m_Completions removeAllObjects];
+    pthread_mutex_unlock(&m_Mutex);
+
+    for (CPUEngineRequest *request in completions) {
+        request.completion(request.ticket, request.probs);
+    }
+    return (int)completions.count;
+}
+
+- (void)dealloc {
+
+    // wake up everyone waiting, and wait for workers to finish the queue
+    pthread_mutex_lock(&m_Mutex);
+    m_Stopping = YES;
+    pthread_cond_broadcast(&m_NotEmpty);
+    pthread_cond_broadcast(&m_NotFull);
+    pthread_mutex_unlock(&m_Mutex);
+    for (int i = 0; i < m_WorkersCount; i++) {
+        pthread_join(m_Workers[i], NULL);
+    }
+
+    // release pointers
+    free(m_Workers);
+    pthread_cond_destroy(&m_NotFull);
+    pthread_cond_destroy(&m_NotEmpty);
+    pthread_mutex_destroy(&m_Mutex);
+    if (m_CompletionPipe[0] >= 0) close(m_CompletionPipe[0]);
+    if (m_CompletionPipe[1] >= 0) close(m_CompletionPipe[1]);
+}
+
+@end
@@ -7,19 +7,82 @@
 //
 
 #import <Foundation/Foundation.h>
+#import "pthreadpool.h"
+
+// rows [begin, end) of one image, in all of its channels
+typedef struct row_range {
+    int begin;
+    int end;
+} row_range;
 
 @interface CPULayer : NSObject
 
+// layers are not changed after CPUModel is constructed, so that they can be shared by sessions forwarding concurrently
+// all memory written during forwarding (output, scratch) and the threadpool are passed in by the caller
+
 @property (readonly, nonatomic) NSString *name;
-@property (assign, nonatomic) float *output;
 @property (assign, nonatomic) int destinationOffset;
 @property (assign, nonatomic) int outputNum;
+@property (assign, nonatomic) int inputNum;             // distance between images in a batch of input
+@property (assign, nonatomic) int destinationStride;    // distance between images in a batch of output
+@property (assign, nonatomic) BOOL inPlace;             // output shares the buffer of input
+@property (assign, nonatomic) BOOL ownsImage;           // has a buffer for its output, NO if it writes into another image
+@property (assign, nonatomic) int readCount;            // steps reading the output, -1 if not counted (e.g. the output of the net)
+@property (assign, nonatomic) float outputMin;          // range of the output over calibration images, for quantized nets
+@property (assign, nonatomic) float outputMax;          // equal to outputMin if not calibrated
+@property (assign, nonatomic) BOOL quantizedImage;      // its image holds uint8 of the range instead of floats, see CPUQuantizedLayer.h
 
 - (instancetype)initWithName:(NSString *)name;
 
+// whether -forwardWithInput:output:scratch: still works when output == input, NO by default
+- (BOOL)canComputeInPlace;
+
+// floating point operations to forward one image, 0 by default
+- (double)flops;
+
+// bytes read and written to forward a batch of images, counting every element of inputs, outputs, parameters
+// and scratch memory once, which ignores caches; 0 by default
+- (double)bytesForBatch:(int)batch;
+
+// weights and biases read when forwarding, e.g. for prefetching them, none by default
+- (void)enumerateParametersUsingBlock:(void (^)(const float *parameters, size_t count))block;
+
+// number of floats of temporary memory needed to forward a batch of images
+// the memory is only valid during the call, and is 0 by default
+- (size_t)scratchNumForBatch:(int)batch;
+
 // subclass of CPULayer should overwrite this method
 - (void)forwardWithInput:(const float *)input
-                  output:(float *)output;
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool;
+
+// images are stored one after another, the default implementation forwards them one by one
+// subclass of CPULayer can overwrite this method to process the whole batch together
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool;
+
+// for forwarding only what changed since the last frame of a video, see CPUVideoSession
+
+// rows of output of one image, 1 by default, e.g. for fully connected layers
+- (int)rowsCount;
+
+// rows of output that read any of rows of input, all of them by default
+- (row_range)outputRowsOfInputRows:(row_range)rows;
+
+// floats of scratch memory for -forwardRows:, the same as for a batch of 1 by default
+- (size_t)rowsScratchNum;
+
+// forward only rows of the output of one image, leaving other rows as they are; returns NO without
+// forwarding anything if the layer can only forward whole images, which is the default
+- (BOOL)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+         threadpool:(pthreadpool_t)threadpool;
 
 @end
 
@@ -36,16 +99,19 @@
     int m_Stride;
     int m_Group;
     BOOL m_ReLU;
-    float m_Zero;
-    float *m_ColData;
     int m_M;
     int m_N;
     int m_K;
     int m_InputPerGroup;
     int m_OutputPerGroup;
     int m_WeightPerGroup;
+    float *m_FoldedWeight;      // owned copies of weight and bias after folding the input normalization
+    float *m_FoldedBiases;
+    float *m_PadValues;         // value of padding of each input channel, 0 if NULL
 }
 
+@property (readonly, nonatomic) BOOL doReLU;
+
 - (instancetype)initWithName:(NSString *)name
                       weight:(float *)weight
                         bias:(float *)bias
@@ -57,8 +123,12 @@
                   kernelSize:(int)kernelSize
                          pad:(int)pad
                       stride:(int)stride
-                      doReLU:(BOOL)doReLU
-                     colData:(float *)colData;
+                      doReLU:(BOOL)doReLU;
+
+// make the layer take unnormalized input, where the input it used to take is (input - mean[c]) * scale[c]
+// scale goes into the weights and mean into the biases, padding becomes mean so that borders stay exact
+- (void)foldInputMean:(const float *)mean
+                scale:(const float *)scale;
 
 @end
 
@@ -70,7 +140,6 @@
     int m_OutputChannel;
     int m_InputSize;
     BOOL m_ReLU;
-    float m_Zero;
     int m_M;
     int m_N;
 }
@@ -102,6 +171,14 @@ typedef NS_ENUM (NSInteger, PoolingLayerTypes) {
     int m_Stride;
 }
 
+@property (readonly, nonatomic) PoolingLayerTypes poolingType;
+@property (readonly, nonatomic) int inputChannel;
+@property (readonly, nonatomic) int inputSize;
+@property (readonly, nonatomic) int outputSize;
+@property (readonly, nonatomic) int kernelSize;
+@property (readonly, nonatomic) int pad;
+@property (readonly, nonatomic) int stride;
+
 - (instancetype)initWithName:(NSString *)name
                  poolingType:(PoolingLayerTypes)poolingType
                 inputChannel:(int)inputChannel
@@ -114,20 +191,34 @@ typedef NS_ENUM (NSInteger, PoolingLayerTypes) {
 
 @end
 
+// a convolution layer whose output is only read by a pooling layer, fused by CPUModel at load time
+// output of the convolution is kept in scratch memory, and ReLU is applied after max pooling, on fewer elements
+@interface CPUConvolutionPoolingLayer : CPULayer {
+@protected
+    CPUConvolutionLayer *m_Convolution;
+    CPUPoolingLayer *m_Pooling;
+    BOOL m_ReLUAfterPooling;
+}
+
+@property (readonly, nonatomic) BOOL reluAfterPooling;     // ReLU of convolution is applied to the pooled output
+
+// takes the name, output and destination of pooling
+- (instancetype)initWithConvolution:(CPUConvolutionLayer *)convolution
+                            pooling:(CPUPoolingLayer *)pooling;
+
+@end
+
 @interface CPULocalResponseNormalizationLayer : CPULayer {
 @protected
     int m_InputChannel;
     int m_InputSize;
     float m_AlphaOverN;
-    float *m_Beta;
+    float m_Beta;
     float m_Delta;
     int m_LocalSize;
     int m_Pad;
-    float m_One;
     int m_InputPerChannel;
     int m_PaddedPerChannel;
-    float *m_MidShort;
-    float *m_MidLong;
 }
 
 - (instancetype)initWithName:(NSString *)name
@@ -143,7 +234,6 @@ typedef NS_ENUM (NSInteger, PoolingLayerTypes) {
 @interface CPUSoftMaxLayer : CPULayer {
 @protected
     int m_InputChannel;
-    float *m_Mid;
 }
 
 - (instancetype)initWithName:(NSString *)name
@@ -7,14 +7,53 @@
 //
 
 #import "CPULayer.h"
-#import <Accelerate/Accelerate.h>
+#import "vectorMath.h"
 #import "gemmHandler.h"
 
+@interface CPUPoolingLayer ()
+
+// rows of input read by rows of output, not for global pooling
+- (row_range)inputRowsOfOutputRows:(row_range)rows;
+
+@end
+
+@interface CPUConvolutionLayer ()
+
+// the same as forwarding without the layer's own ReLU decision, so that a fused layer can apply it after pooling
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+                    relu:(BOOL)relu
+              threadpool:(pthreadpool_t)threadpool;
+
+- (void)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+               relu:(BOOL)relu
+         threadpool:(pthreadpool_t)threadpool;
+
+@end
+
+static int floor_divide(int a, int b) {
+    return a >= 0? a / b : -((-a + b - 1) / b);
+}
+
+// output rows of a window of kernel rows sliding by stride over input padded by pad, which overlap rows of input
+// (output row y reads input rows [y * stride - pad, y * stride - pad + kernel))
+static row_range window_output_rows(row_range rows, int kernel, int stride, int pad, int outputRows) {
+    int begin = floor_divide(rows.begin + pad - kernel, stride) + 1;
+    int end = floor_divide(rows.end - 1 + pad, stride) + 1;
+    return (row_range){ MAX(begin, 0), MIN(end, outputRows) };
+}
+
 @implementation CPULayer
 
 - (instancetype)initWithName:(NSString *)name {
     if (self = [super init]) {
         _name = name;
+        _readCount = -1;
     }
     
     return self;
@@ -24,19 +63,71 @@
     return [_name hash];
 }
 
+- (BOOL)canComputeInPlace {
+    return NO;
+}
+
+- (double)flops {
+    return 0;
+}
+
+- (double)bytesForBatch:(int)batch {
+    return 0;
+}
+
+- (void)enumerateParametersUsingBlock:(void (^)(const float *, size_t))block {
+}
+
+- (size_t)scratchNumForBatch:(int)batch {
+    return 0;
+}
+
 - (void)forwardWithInput:(const float *)input
-                  output:(float *)output {
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
     // subclass of CPULayer should overwrite this method
 }
 
-- (void)dealloc {
-    if (_output) free(_output);
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool {
+    for (int batchIndex = 0; batchIndex < batch; batchIndex++) {
+        [self forwardWithInput:input + batchIndex * _inputNum
+                        output:output + batchIndex * _destinationStride
+                       scratch:scratch
+                    threadpool:threadpool];
+    }
+}
+
+- (int)rowsCount {
+    return 1;
+}
+
+- (row_range)outputRowsOfInputRows:(row_range)rows {
+    return (row_range){ 0, [self rowsCount] };
+}
+
+- (size_t)rowsScratchNum {
+    return [self scratchNumForBatch:1];
+}
+
+- (BOOL)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+         threadpool:(pthreadpool_t)threadpool {
+    return NO;
 }
 
 @end
 
 @implementation CPUConvolutionLayer
 
+@synthesize doReLU = m_ReLU;
+
 - (instancetype)initWithName:(NSString *)name
                       weight:(float *)weight
                         bias:(float *)bias
@@ -48,8 +139,7 @@
                   kernelSize:(int)kernelSize
                          pad:(int)pad
                       stride:(int)stride
-                      doReLU:(BOOL)doReLU
-                     colData:(float *)colData {
+                      doReLU:(BOOL)doReLU {
     if (self = [super initWithName:name]) {
         m_Weight = weight;
         m_Biases = bias;
@@ -62,8 +152,6 @@
         m_Pad = pad;
         m_Stride = stride;
         m_ReLU = doReLU;
-        m_Zero = 0.0f;
-        m_ColData = colData;
         m_M = m_OutputChannel;
         m_N = m_OutputSize * m_OutputSize;
         m_K = m_InputChannel * m_KernelSize * m_KernelSize;
@@ -75,27 +163,181 @@
     return self;
 }
 
+- (void)foldInputMean:(const float *)mean
+                scale:(const float *)scale {
+    
+    // W' = W * scale, b' = b - sum(W' * mean)
+    int outputChannels = m_M * m_Group, kernelArea = m_KernelSize * m_KernelSize;
+    m_FoldedWeight = malloc(sizeof(float) * m_WeightPerGroup * m_Group);
+    m_FoldedBiases = malloc(sizeof(float) * outputChannels);
+    for (int outputIndex = 0; outputIndex < outputChannels; outputIndex++) {
+        int firstChannel = outputIndex / m_M * m_InputChannel;
+        double bias = m_Biases[outputIndex];
+        for (int channelIndex = 0; channelIndex < m_InputChannel; channelIndex++) {
+            const float *weight = m_Weight + ((size_t)outputIndex * m_InputChannel + channelIndex) * kernelArea;
+            float *foldedWeight = m_FoldedWeight + ((size_t)outputIndex * m_InputChannel + channelIndex) * kernelArea;
+            vmath_scale(weight, scale[firstChannel + channelIndex], foldedWeight, kernelArea);
+            bias -= (double)vmath_sum(foldedWeight, kernelArea) * mean[firstChannel + channelIndex];
+        }
+        m_FoldedBiases[outputIndex] = bias;
+    }
+    m_Weight = m_FoldedWeight;
+    m_Biases = m_FoldedBiases;
+    
+    // padded pixels of the raw input must be mean to become 0 after normalization
+    if (m_Pad > 0) {
+        m_PadValues = malloc(sizeof(float) * m_InputChannel * m_Group);
+        memcpy(m_PadValues, mean, sizeof(float) * m_InputChannel * m_Group);
+    }
+}
+
+- (void)enumerateParametersUsingBlock:(void (^)(const float *, size_t))block {
+    block(m_Weight, (size_t)m_WeightPerGroup * m_Group);
+    block(m_Biases, (size_t)m_M * m_Group);
+}
+
+- (size_t)scratchNumForBatch:(int)batch {
+    // col_data of one group, and the result of gemm before being scattered to each image
+    return (size_t)m_K * m_N * batch + (batch > 1? (size_t)m_M * m_N * batch : 0);
+}
+
+- (double)flops {
+    return 2.0 * m_M * m_N * m_K * m_Group;
+}
+
+- (double)bytesForBatch:(int)batch {
+    // weights are read once for the whole batch, col_data is written by im2col and read by gemm
+    double activations = (double)(m_InputPerGroup + m_OutputPerGroup) * m_Group * batch;
+    double parameters = (double)m_WeightPerGroup * m_Group + m_M * m_Group;
+    double colData = 2.0 * m_K * m_N * m_Group * batch;
+    return sizeof(float) * (activations + parameters + colData);
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
+    [self forwardWithInput:input output:output scratch:scratch batch:1 threadpool:threadpool];
+}
+
 - (void)forwardWithInput:(const float *)input
-                  output:(float *)output {
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool {
+    [self forwardWithInput:input output:output scratch:scratch batch:batch relu:m_ReLU threadpool:threadpool];
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+                    relu:(BOOL)relu
+              threadpool:(pthreadpool_t)threadpool {
+    // col_data of all images are put side by side, so that one gemm with N = output_size^2 * batch
+    // computes the whole batch; its result is M x (N * batch), which needs to be scattered to each image
+    const int batchN = m_N * batch;
+    float *colData = scratch;
+    float *gemmResult = scratch + (size_t)m_K * batchN;
+    for (int groupIndex = 0; groupIndex < m_Group; groupIndex++) {
+        float *dst = batch > 1? gemmResult : output + groupIndex * m_OutputPerGroup;
+        for (int batchIndex = 0; batchIndex < batch; batchIndex++) {
+            const float *src = input + batchIndex * self.inputNum + groupIndex * m_InputPerGroup;
+            const float *padValues = m_PadValues? m_PadValues + groupIndex * m_InputChannel : NULL;
+            im2col(src, m_InputChannel, m_InputSize, m_InputSize, m_OutputSize, m_OutputSize, m_KernelSize, m_KernelSize, 1, 1, m_Pad, m_Pad, m_Pad, m_Pad, m_Stride, m_Stride, padValues, colData + batchIndex * m_N, batchN);
+        }
+        for (int outputIndex = 0; outputIndex < m_M; outputIndex++) {
+            vmath_fill(dst + outputIndex * batchN, m_Biases[groupIndex * m_M + outputIndex], batchN);
+        }
+        [gemmHandler gemmWithTransA:gemmNoTrans
+                             transB:gemmNoTrans
+                                  M:m_M
+                                  N:batchN
+                                  K:m_K
+                              alpha:1
+                                  A:m_Weight + groupIndex * m_WeightPerGroup
+                                  B:colData
+                               beta:1
+                                  C:dst
+                         threadpool:threadpool];
+        if (batch > 1) {
+            for (int batchIndex = 0; batchIndex < batch; batchIndex++) {
+                float *image = output + batchIndex * self.destinationStride + groupIndex * m_OutputPerGroup;
+                for (int outputIndex = 0; outputIndex < m_M; outputIndex++) {
+                    memcpy(image + outputIndex * m_N, gemmResult + outputIndex * batchN + batchIndex * m_N, m_N * sizeof(float));
+                }
+            }
+        }
+    }
+    if (relu) {
+        for (int batchIndex = 0; batchIndex < batch; batchIndex++) {
+            float *image = output + batchIndex * self.destinationStride;
+            vmath_relu_mt(threadpool, image, image, m_OutputPerGroup * m_Group);
+        }
+    }
+}
+
+- (int)rowsCount {
+    return m_OutputSize;
+}
+
+- (row_range)outputRowsOfInputRows:(row_range)rows {
+    return window_output_rows(rows, m_KernelSize, m_Stride, m_Pad, m_OutputSize);
+}
+
+- (size_t)rowsScratchNum {
+    // col_data of the rows, and the result of gemm before being copied into rows of each output channel
+    return (size_t)m_K * m_N + (size_t)m_M * m_N;
+}
+
+- (BOOL)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+         threadpool:(pthreadpool_t)threadpool {
+    [self forwardRows:rows input:input output:output scratch:scratch relu:m_ReLU threadpool:threadpool];
+    return YES;
+}
+
+- (void)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+               relu:(BOOL)relu
+         threadpool:(pthreadpool_t)threadpool {
+    if (rows.begin <= 0 && rows.end >= m_OutputSize) {
+        [self forwardWithInput:input output:output scratch:scratch batch:1 relu:relu threadpool:threadpool];
+        return;
+    }
+    
+    // the same gemm with N = rows * output_size, rows of each output channel are then contiguous
+    const int rowsN = (rows.end - rows.begin) * m_OutputSize;
+    float *colData = scratch;
+    float *gemmResult = scratch + (size_t)m_K * rowsN;
     for (int groupIndex = 0; groupIndex < m_Group; groupIndex++) {
-        const float *src = input + groupIndex * m_InputPerGroup;
-        float *dst = output + groupIndex * m_OutputPerGroup;
-        im2col(src, m_InputChannel, m_InputSize, m_InputSize, m_OutputSize, m_OutputSize, m_KernelSize, m_KernelSize, 1, 1, m_Pad, m_Pad, m_Pad, m_Pad, m_Stride, m_Stride, m_ColData);
-        for (int featureIndex = 0; featureIndex < m_N; featureIndex++) {
-            memcpy(dst + featureIndex * m_M, m_Biases + groupIndex * m_M, m_M * sizeof(float));
+        const float *padValues = m_PadValues? m_PadValues + groupIndex * m_InputChannel : NULL;
+        im2col_rows(input + groupIndex * m_InputPerGroup, m_InputChannel, m_InputSize, m_OutputSize, m_KernelSize, m_Pad, m_Stride, padValues, rows.begin, rows.end, colData);
+        for (int outputIndex = 0; outputIndex < m_M; outputIndex++) {
+            vmath_fill(gemmResult + outputIndex * rowsN, m_Biases[groupIndex * m_M + outputIndex], rowsN);
         }
         [gemmHandler gemmWithTransA:gemmNoTrans
                              transB:gemmNoTrans
                                   M:m_M
-                                  N:m_N
+                                  N:rowsN
                                   K:m_K
                               alpha:1
                                   A:m_Weight + groupIndex * m_WeightPerGroup
-                                  B:m_ColData
+                                  B:colData
                                beta:1
-                                  C:dst];
+                                  C:gemmResult
+                         threadpool:threadpool];
+        if (relu) vmath_relu_mt(threadpool, gemmResult, gemmResult, m_M * rowsN);
+        for (int outputIndex = 0; outputIndex < m_M; outputIndex++) {
+            memcpy(output + groupIndex * m_OutputPerGroup + outputIndex * m_N + rows.begin * m_OutputSize,
+                   gemmResult + outputIndex * rowsN,
+                   rowsN * sizeof(float));
+        }
     }
-    if (m_ReLU) vDSP_vthres(output, 1, &m_Zero, output, 1, m_OutputPerGroup * m_Group);
 }
 
 static void im2col (const float* data_im,
@@ -114,7 +356,9 @@ static void im2col (const float* data_im,
                     const int pad_r,
                     const int stride_h,
                     const int stride_w,
-                    float* data_col) {
+                    const float* pad_values,  // value of padding of each channel, 0 if NULL
+                    float* data_col,
+                    const int col_stride) {   // distance between rows of data_col, at least output_h * output_w
     
     // Fast path for zero padding and no dilation
     // From Torch, THNN_(unfolded_copy)
@@ -125,8 +369,7 @@ static void im2col (const float* data_im,
             const int rest = k % (kernel_h * kernel_w);
             const int kh = rest / kernel_w;
             const int kw = rest % kernel_w;
-            float* dst = data_col + nip * (kernel_h * kernel_w * output_h * output_w) +
-            kh * (kernel_w * output_h * output_w) + kw * (output_h * output_w);
+            float* dst = data_col + k * col_stride;
             const float* src = data_im + nip * (input_h * input_w);
             for (int y = 0; y < output_h; y++) {
                 const int iy = y * stride_h + kh;
@@ -156,13 +399,14 @@ static void im2col (const float* data_im,
         const int pad_w = pad_l;
         const int channel_size = input_h * input_w;
         for (int channel = channels; channel--; data_im += channel_size) {
+            const float pad_value = pad_values? pad_values[channels - 1 - channel] : 0;
             for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
                 for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
                     int input_row = -pad_h + kernel_row * dilation_h;
                     for (int output_rows = output_h; output_rows; output_rows--) {
                         if (!((unsigned int)input_row < (unsigned int)input_h)) {
                             for (int output_cols = output_w; output_cols; output_cols--) {
-                                *(data_col++) = 0;
+                                *(data_col++) = pad_value;
                             }
                         } else {
                             int input_col = -pad_w + kernel_col * dilation_w;
@@ -170,13 +414,14 @@ static void im2col (const float* data_im,
                                 if ((unsigned int)input_col < (unsigned int)input_w) {
                                     *(data_col++) = data_im[input_row * input_w + input_col];
                                 } else {
-                                    *(data_col++) = 0;
+                                    *(data_col++) = pad_value;
                                 }
                                 input_col += stride_w;
                             }
                         }
                         input_row += stride_h;
                     }
+                    data_col += col_stride - output_h * output_w;
                 }
             }
         }
@@ -200,15 +445,57 @@ static void im2col (const float* data_im,
                 int h_pad = h * stride_h - pad_t + h_offset * dilation_h;
                 int w_pad = w * stride_w - pad_l + w_offset * dilation_w;
                 if (h_pad >= 0 && h_pad < input_h && w_pad >= 0 && w_pad < input_w)
-                    data_col[(c * height_col + h) * width_col + w] =
+                    data_col[c * col_stride + h * width_col + w] =
                     data_im[(c_im * input_h + h_pad) * input_w + w_pad];
                 else
-                    data_col[(c * height_col + h) * width_col + w] = 0;
+                    data_col[c * col_stride + h * width_col + w] = pad_values? pad_values[c_im] : 0;
+            }
+        }
+    }
+}
+
+// im2col of output rows [row_begin, row_end) of a square image padded equally on all sides, without dilation
+// data_col has (row_end - row_begin) * output_size columns
+static void im2col_rows(const float *data_im,
+                        const int channels,
+                        const int input_size,
+                        const int output_size,
+                        const int kernel_size,
+                        const int pad,
+                        const int stride,
+                        const float *pad_values,
+                        const int row_begin,
+                        const int row_end,
+                        float *data_col) {
+    for (int channel = 0; channel < channels; channel++, data_im += input_size * input_size) {
+        const float pad_value = pad_values? pad_values[channel] : 0;
+        for (int kernel_row = 0; kernel_row < kernel_size; kernel_row++) {
+            for (int kernel_col = 0; kernel_col < kernel_size; kernel_col++) {
+                for (int output_row = row_begin; output_row < row_end; output_row++) {
+                    const int input_row = output_row * stride - pad + kernel_row;
+                    if (!((unsigned int)input_row < (unsigned int)input_size)) {
+                        for (int output_col = 0; output_col < output_size; output_col++) {
+                            *(data_col++) = pad_value;
+                        }
+                        continue;
+                    }
+                    int input_col = kernel_col - pad;
+                    for (int output_col = 0; output_col < output_size; output_col++) {
+                        *(data_col++) = (unsigned int)input_col < (unsigned int)input_size? data_im[input_row * input_size + input_col] : pad_value;
+                        input_col += stride;
+                    }
+                }
             }
         }
     }
 }
 
+- (void)dealloc {
+    if (m_FoldedWeight) free(m_FoldedWeight);
+    if (m_FoldedBiases) free(m_FoldedBiases);
+    if (m_PadValues)    free(m_PadValues);
+}
+
 @end
 
 @implementation CPUFullyConnectedLayer
@@ -227,7 +514,6 @@ static void im2col (const float* data_im,
         m_OutputChannel = outputChannel;
         m_InputSize = inputSize;
         m_ReLU = doReLU;
-        m_Zero = 0.0f;
         m_M = m_OutputChannel;
         m_N = m_InputSize * m_InputSize * m_InputChannel;
     }
@@ -235,18 +521,68 @@ static void im2col (const float* data_im,
     return self;
 }
 
+- (double)flops {
+    return 2.0 * m_M * m_N;
+}
+
+- (double)bytesForBatch:(int)batch {
+    return sizeof(float) * ((double)(m_N + m_M) * batch + (double)m_M * m_N + m_M);
+}
+
+- (void)enumerateParametersUsingBlock:(void (^)(const float *, size_t))block {
+    block(m_Weight, (size_t)m_M * m_N);
+    block(m_Biases, (size_t)m_M);
+}
+
 - (void)forwardWithInput:(const float *)input
-                  output:(float *)output {
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
     memcpy(output, m_Biases, m_OutputChannel * sizeof(float));
-    cblas_sgemv(CblasRowMajor, CblasNoTrans, m_M, m_N, 1, m_Weight, m_N, input, 1, 1,
-                output, 1);
-    if (m_ReLU) vDSP_vthres(output, 1, &m_Zero, output, 1, m_OutputChannel);
+    vmath_sgemv_mt(threadpool, m_M, m_N, m_Weight, input, output);
+    if (m_ReLU) vmath_relu(output, output, m_OutputChannel);
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool {
+    if (batch == 1 || self.destinationStride != m_OutputChannel || self.inputNum != m_N) {
+        [super forwardWithInput:input output:output scratch:scratch batch:batch threadpool:threadpool];
+        return;
+    }
+    
+    // output (batch x M) = input (batch x N) * weight (M x N) ^ T, weight is read only once for the whole batch
+    for (int batchIndex = 0; batchIndex < batch; batchIndex++) {
+        memcpy(output + batchIndex * m_OutputChannel, m_Biases, m_OutputChannel * sizeof(float));
+    }
+    [gemmHandler gemmWithTransA:gemmNoTrans
+                         transB:gemmTrans
+                              M:batch
+                              N:m_M
+                              K:m_N
+                          alpha:1
+                              A:input
+                              B:m_Weight
+                           beta:1
+                              C:output
+                     threadpool:threadpool];
+    if (m_ReLU) vmath_relu_mt(threadpool, output, output, batch * m_OutputChannel);
 }
 
 @end
 
 @implementation CPUPoolingLayer
 
+@synthesize poolingType = m_PoolingType;
+@synthesize inputChannel = m_InputChannel;
+@synthesize inputSize = m_InputSize;
+@synthesize outputSize = m_OutputSize;
+@synthesize kernelSize = m_KernelSize;
+@synthesize pad = m_Pad;
+@synthesize stride = m_Stride;
+
 - (instancetype)initWithName:(NSString *)name
                  poolingType:(PoolingLayerTypes)poolingType
                 inputChannel:(int)inputChannel
@@ -282,18 +618,24 @@ static void im2col (const float* data_im,
     return self;
 }
 
+- (double)flops {
+    if (m_PoolingType == ePoolingGlobalAverage) return (double)m_InputChannel * m_InputSize * m_InputSize;
+    return (double)m_InputChannel * m_OutputSize * m_OutputSize * m_KernelSize * m_KernelSize;
+}
+
+- (double)bytesForBatch:(int)batch {
+    double outputArea = m_PoolingType == ePoolingGlobalAverage? 1 : (double)m_OutputSize * m_OutputSize;
+    return sizeof(float) * m_InputChannel * ((double)m_InputSize * m_InputSize + outputArea) * batch;
+}
+
 - (void)forwardWithInput:(const float *)input
-                  output:(float *)output {
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
     switch (m_PoolingType) {
         case ePoolingMax:
-            for (int channelIndex = 0; channelIndex < m_InputChannel; channelIndex++) {
-                computeMaxPooling(input + channelIndex * m_InputSize * m_InputSize, output + channelIndex * m_OutputSize * m_OutputSize, m_InputSize, m_InputSize, m_Pad, m_Pad, m_OutputSize, m_OutputSize, m_Stride, m_Stride, m_KernelSize, m_KernelSize);
-            }
-            break;
         case ePoolingAverage:
-            for (int channelIndex = 0; channelIndex < m_InputChannel; channelIndex++) {
-                computeAveragePooling(input + channelIndex * m_InputSize * m_InputSize, output + channelIndex * m_OutputSize * m_OutputSize, m_InputSize, m_InputSize, m_Pad, m_Pad, m_OutputSize, m_OutputSize, m_Stride, m_Stride, m_KernelSize, m_KernelSize);
-            }
+            [self forwardRows:(row_range){ 0, m_OutputSize } input:input output:output scratch:scratch threadpool:threadpool];
             break;
         case ePoolingGlobalAverage:
             computeGlobalAveragePooling(input, output, m_InputSize, m_InputSize, m_InputChannel);
@@ -303,13 +645,46 @@ static void im2col (const float* data_im,
     }
 }
 
+- (int)rowsCount {
+    return m_PoolingType == ePoolingGlobalAverage? 1 : m_OutputSize;
+}
+
+- (row_range)outputRowsOfInputRows:(row_range)rows {
+    if (m_PoolingType == ePoolingGlobalAverage) return (row_range){ 0, 1 };
+    return window_output_rows(rows, m_KernelSize, m_Stride, m_Pad, m_OutputSize);
+}
+
+- (row_range)inputRowsOfOutputRows:(row_range)rows {
+    return (row_range){ MAX(rows.begin * m_Stride - m_Pad, 0), MIN((rows.end - 1) * m_Stride - m_Pad + m_KernelSize, m_InputSize) };
+}
+
+- (BOOL)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+         threadpool:(pthreadpool_t)threadpool {
+    if (m_PoolingType == ePoolingGlobalAverage) return NO;
+    
+    for (int channelIndex = 0; channelIndex < m_InputChannel; channelIndex++) {
+        const float *src = input + channelIndex * m_InputSize * m_InputSize;
+        float *dst = output + channelIndex * m_OutputSize * m_OutputSize;
+        if (m_PoolingType == ePoolingMax) {
+            computeMaxPooling(src, dst, m_InputSize, m_InputSize, m_Pad, m_Pad, rows.begin, rows.end, m_OutputSize, m_Stride, m_Stride, m_KernelSize, m_KernelSize);
+        } else {
+            computeAveragePooling(src, dst, m_InputSize, m_InputSize, m_Pad, m_Pad, rows.begin, rows.end, m_OutputSize, m_Stride, m_Stride, m_KernelSize, m_KernelSize);
+        }
+    }
+    return YES;
+}
+
 static void computeMaxPooling(const float *input_pointer,
                               float *output_pointer,
                               size_t input_height,
                               size_t input_width,
                               size_t padding_top,
                               size_t padding_left,
-                              size_t output_height,
+                              size_t output_row_begin,
+                              size_t output_row_end,
                               size_t output_width,
                               size_t stride_height,
                               size_t stride_width,
@@ -318,7 +693,7 @@ static void computeMaxPooling(const float *input_pointer,
     const float (*input)[input_width] = (const float(*)[input_width]) input_pointer;
     float (*output)[output_width] = (float(*)[output_width]) output_pointer;
     
-    for (size_t y = 0; y < output_height; y++) {
+    for (size_t y = output_row_begin; y < output_row_end; y++) {
         for (size_t x = 0; x < output_width; x++) {
             float v = -__builtin_inff();
             for (size_t i = 0; i < pooling_height; i++) {
@@ -343,7 +718,8 @@ static void computeAveragePooling(const float *input_pointer,
                                   size_t input_width,
                                   size_t padding_top,
                                   size_t padding_left,
-                                  size_t output_height,
+                                  size_t output_row_begin,
+                                  size_t output_row_end,
                                   size_t output_width,
                                   size_t stride_height,
                                   size_t stride_width,
@@ -352,7 +728,7 @@ static void computeAveragePooling(const float *input_pointer,
     const float (*input)[input_width] = (const float(*)[input_width]) input_pointer;
     float (*output)[output_width] = (float(*)[output_width]) output_pointer;
     
-    for (size_t y = 0; y < output_height; y++) {
+    for (size_t y = output_row_begin; y < output_row_end; y++) {
         for (size_t x = 0; x < output_width; x++) {
             float sum = 0;
             for (size_t i = 0; i < pooling_height; i++) {
@@ -377,11 +753,120 @@ static void computeGlobalAveragePooling(const float *input_pointer,
                                         size_t input_width,
                                         size_t input_channel) {
     for (int channelIndex = 0; channelIndex < input_channel; channelIndex++) {
-        vDSP_sve(input_pointer + channelIndex * input_width * input_height, 1,
-                 output_pointer + channelIndex, input_width * input_height);
+        output_pointer[channelIndex] = vmath_sum(input_pointer + channelIndex * input_width * input_height,
+                                                 input_width * input_height);
     }
-    float denom = input_width * input_height;
-    vDSP_vsdiv(output_pointer, 1, &denom, output_pointer, 1, input_channel);
+    vmath_scale(output_pointer, 1.0f / (input_width * input_height), output_pointer, input_channel);
+}
+
+@end
+
+@implementation CPUConvolutionPoolingLayer
+
+@synthesize reluAfterPooling = m_ReLUAfterPooling;
+
+- (instancetype)initWithConvolution:(CPUConvolutionLayer *)convolution
+                            pooling:(CPUPoolingLayer *)pooling {
+    if (self = [super initWithName:pooling.name]) {
+        m_Convolution = convolution;
+        m_Pooling = pooling;
+        self.outputNum = pooling.outputNum;
+        self.destinationOffset = pooling.destinationOffset;
+        self.inputNum = convolution.inputNum;
+        self.destinationStride = pooling.destinationStride;
+        self.ownsImage = pooling.ownsImage;
+        self.readCount = pooling.readCount;
+        
+        // max(relu(x)) == relu(max(x)), which is not true for average pooling; the convolution layer itself
+        // is left as it is, it is only told not to apply ReLU when forwarded by this layer
+        m_ReLUAfterPooling = convolution.doReLU && pooling.poolingType == ePoolingMax;
+    }
+    
+    return self;
+}
+
+- (double)flops {
+    return [m_Convolution flops] + [m_Pooling flops];
+}
+
+- (double)bytesForBatch:(int)batch {
+    return [m_Convolution bytesForBatch:batch] + [m_Pooling bytesForBatch:batch];
+}
+
+- (void)enumerateParametersUsingBlock:(void (^)(const float *, size_t))block {
+    [m_Convolution enumerateParametersUsingBlock:block];
+}
+
+- (size_t)scratchNumForBatch:(int)batch {
+    // output of convolution, then scratch memory of convolution
+    return (size_t)m_Convolution.outputNum * batch + [m_Convolution scratchNumForBatch:batch];
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
+    [self forwardWithInput:input output:output scratch:scratch batch:1 threadpool:threadpool];
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool {
+    float *convolutionOutput = scratch;
+    [m_Convolution forwardWithInput:input
+                             output:convolutionOutput
+                            scratch:scratch + (size_t)m_Convolution.outputNum * batch
+                              batch:batch
+                               relu:m_Convolution.doReLU && !m_ReLUAfterPooling
+                         threadpool:threadpool];
+    [m_Pooling forwardWithInput:convolutionOutput
+                         output:output
+                        scratch:NULL
+                          batch:batch
+                     threadpool:threadpool];
+    if (m_ReLUAfterPooling) {
+        for (int batchIndex = 0; batchIndex < batch; batchIndex++) {
+            float *image = output + batchIndex * self.destinationStride;
+            vmath_relu_mt(threadpool, image, image, m_Pooling.outputNum);
+        }
+    }
+}
+
+- (int)rowsCount {
+    return [m_Pooling rowsCount];
+}
+
+- (row_range)outputRowsOfInputRows:(row_range)rows {
+    return [m_Pooling outputRowsOfInputRows:[m_Convolution outputRowsOfInputRows:rows]];
+}
+
+- (size_t)rowsScratchNum {
+    // output of convolution, then scratch memory of its rows
+    return (size_t)m_Convolution.outputNum + [m_Convolution rowsScratchNum];
+}
+
+- (BOOL)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+         threadpool:(pthreadpool_t)threadpool {
+    if (m_Pooling.poolingType == ePoolingGlobalAverage) return NO;
+    
+    // only rows of convolution read by the rows of pooling are computed
+    float *convolutionOutput = scratch;
+    [m_Convolution forwardRows:[m_Pooling inputRowsOfOutputRows:rows]
+                         input:input
+                        output:convolutionOutput
+                       scratch:scratch + m_Convolution.outputNum
+                          relu:m_Convolution.doReLU && !m_ReLUAfterPooling
+                    threadpool:threadpool];
+    [m_Pooling forwardRows:rows input:convolutionOutput output:output scratch:NULL threadpool:threadpool];
+    if (m_ReLUAfterPooling) {
+        vmath_relu_mt(threadpool, output, output, m_Pooling.outputNum);    // rows not forwarded are already rectified
+    }
+    return YES;
 }
 
 @end
@@ -401,38 +886,86 @@ static void computeGlobalAveragePooling(const float *input_pointer,
         m_InputPerChannel = inputSize * inputSize;
         m_LocalSize = localSize;
         m_AlphaOverN = alpha / m_LocalSize;
-        m_Beta = (float *)malloc(m_InputPerChannel * sizeof(float));
-        vDSP_vfill(&beta, m_Beta, 1, m_InputPerChannel);
+        m_Beta = beta;
         m_Delta = delta;
         m_Pad =  (localSize - 1) / 2;
         m_PaddedPerChannel = m_InputPerChannel + 2 * m_Pad;
-        m_MidShort = (float *)malloc(m_InputPerChannel * sizeof(float));
-        m_MidLong = (float *)malloc(m_PaddedPerChannel * sizeof(float));
-        m_One = 1.0f;
     }
     
     return self;
 }
 
+- (BOOL)canComputeInPlace {
+    return YES;     // each channel is read into scratch before written
+}
+
+- (size_t)scratchNumForBatch:(int)batch {
+    return m_InputPerChannel + m_PaddedPerChannel;     // images are normalized one by one
+}
+
+- (double)flops {
+    return (double)m_InputChannel * m_InputPerChannel * (m_LocalSize + 5);
+}
+
+- (double)bytesForBatch:(int)batch {
+    return sizeof(float) * 2.0 * m_InputChannel * m_InputPerChannel * batch;
+}
+
 - (void)forwardWithInput:(const float *)input
-                  output:(float *)output {
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
+    float *midShort = scratch;
+    float *midLong = scratch + m_InputPerChannel;
     for (int channelIndex = 0; channelIndex < m_InputChannel; channelIndex++) {
         const float *src = input + channelIndex * m_InputPerChannel;
         float *dst = output + channelIndex * m_InputPerChannel;
-        vDSP_vsq(src, 1, m_MidShort, 1, m_InputPerChannel);                                             // square of each element
-        memset(m_MidLong, 0, m_PaddedPerChannel * sizeof(float));
+        vmath_square(src, midShort, m_InputPerChannel);                                                 // square of each element
+        memset(midLong, 0, m_PaddedPerChannel * sizeof(float));
         for (int regionIndex = 0; regionIndex < m_LocalSize; regionIndex++) {                           // sum up nearby channels
-            vDSP_vadd(m_MidLong + regionIndex, 1, m_MidShort, 1, m_MidLong + regionIndex, 1, m_InputPerChannel);
+            vmath_add(midLong + regionIndex, midShort, midLong + regionIndex, m_InputPerChannel);
         }
-        vDSP_vsmsa(m_MidLong + m_Pad, 1, &m_AlphaOverN, &m_Delta, m_MidShort, 1, m_InputPerChannel);    // denom = delta + (alpha / N) * sum
-        vvpowf(m_MidShort, m_Beta, m_MidShort, &m_InputPerChannel);                                     // denom = denom ^ beta
-        vDSP_vdiv(m_MidShort, 1, src, 1, dst, 1, m_InputPerChannel);                                    // norm_result = origin / denom
+        vmath_scale_add(midLong + m_Pad, m_AlphaOverN, m_Delta, midShort, m_InputPerChannel);           // denom = delta + (alpha / N) * sum
+        vmath_pow_scalar(midShort, m_Beta, midShort, m_InputPerChannel);                                // denom = denom ^ beta
+        vmath_div(src, midShort, dst, m_InputPerChannel);                                               // norm_result = origin / denom
     }
 }
 
-- (void)dealloc {
-    free(m_MidShort);
-    free(m_MidLong);
+- (int)rowsCount {
+    return m_InputSize;
+}
+
+- (row_range)outputRowsOfInputRows:(row_range)rows {
+    // elements are normalized with m_Pad elements on each side in the same channel
+    int rowsOfPad = (m_Pad + m_InputSize - 1) / m_InputSize;
+    return (row_range){ MAX(rows.begin - rowsOfPad, 0), MIN(rows.end + rowsOfPad, m_InputSize) };
+}
+
+- (BOOL)forwardRows:(row_range)rows
+              input:(const float *)input
+             output:(float *)output
+            scratch:(float *)scratch
+         threadpool:(pthreadpool_t)threadpool {
+    // the same as above over elements of the rows and m_Pad elements on each side of them
+    const int begin = rows.begin * m_InputSize;
+    const int count = (rows.end - rows.begin) * m_InputSize;
+    const int first = MAX(begin - m_Pad, 0);
+    const int readCount = MIN(begin + count + m_Pad, m_InputPerChannel) - first;
+    float *midShort = scratch;
+    float *midLong = scratch + m_InputPerChannel;
+    for (int channelIndex = 0; channelIndex < m_InputChannel; channelIndex++) {
+        const float *src = input + channelIndex * m_InputPerChannel;
+        float *dst = output + channelIndex * m_InputPerChannel;
+        vmath_square(src + first, midShort, readCount);
+        memset(midLong, 0, (readCount + 2 * m_Pad) * sizeof(float));
+        for (int regionIndex = 0; regionIndex < m_LocalSize; regionIndex++) {
+            vmath_add(midLong + regionIndex, midShort, midLong + regionIndex, readCount);
+        }
+        vmath_scale_add(midLong + m_Pad + begin - first, m_AlphaOverN, m_Delta, midShort, count);
+        vmath_pow_scalar(midShort, m_Beta, midShort, count);
+        vmath_div(src + begin, midShort, dst + begin, count);
+    }
+    return YES;
 }
 
 @end
@@ -443,26 +976,32 @@ static void computeGlobalAveragePooling(const float *input_pointer,
                 inputChannel:(int)inputChannel{
     if (self = [super initWithName:name]) {
         m_InputChannel = inputChannel;
-        m_Mid = (float *)malloc(m_InputChannel * sizeof(float));
     }
     
     return self;
 }
 
-- (void)forwardWithInput:(const float *)input
-                  output:(float *)output {
-    float max;
-    vDSP_maxv(input, 1, &max, m_InputChannel);                  // find maximum
-    max *= -1;
-    vDSP_vsadd(input, 1, &max, m_Mid, 1, m_InputChannel);       // subtract the maximum
-    vvexpf(m_Mid, m_Mid, &m_InputChannel);                      // exponential of each element
-    float sum;
-    vDSP_sve(m_Mid, 1, &sum, m_InputChannel);                   // sum of exponential of all elements
-    vDSP_vsdiv(m_Mid, 1, &sum, output, 1, m_InputChannel);      // divide by the sum of exponential
+- (BOOL)canComputeInPlace {
+    return YES;
 }
 
-- (void)dealloc {
-    free(m_Mid);
+- (double)flops {
+    return 5.0 * m_InputChannel;
+}
+
+- (double)bytesForBatch:(int)batch {
+    return sizeof(float) * 2.0 * m_InputChannel * batch;
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
+    float max = vmath_max(input, m_InputChannel);               // find maximum
+    vmath_add_scalar(input, -max, output, m_InputChannel);      // subtract the maximum
+    vmath_exp(output, output, m_InputChannel);                  // exponential of each element
+    float sum = vmath_sum(output, m_InputChannel);              // sum of exponential of all elements
+    vmath_scale(output, 1.0f / sum, output, m_InputChannel);    // divide by the sum of exponential
 }
 
 @end
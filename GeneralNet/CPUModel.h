@@ -0,0 +1,166 @@
+//
+//  CPUModel.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/12.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "pthreadpool.h"
+
+@class CPULayer;
+@class CPUModelWeights;
+
+struct weight_prefetch;
+struct compiled_model_header;
+
+// keys of options of CPUModel
+extern NSString * const CPUModelOptionInputMean;        // NSArray of 3 NSNumber in the order of input channels, i.e. BGR, 120 by default
+extern NSString * const CPUModelOptionInputScale;       // NSArray of 3 NSNumber, 1 by default
+extern NSString * const CPUModelOptionFoldInputNormalization;   // NSNumber of BOOL, YES by default
+extern NSString * const CPUModelOptionOptimizeGraph;    // NSNumber of BOOL, YES by default
+extern NSString * const CPUModelOptionPrefetchWeights;  // NSNumber of BOOL, YES by default, see -startPrefetchingWeights
+extern NSString * const CPUModelOptionPopulateWeights;  // NSNumber of BOOL, NO by default, read all weights before returning from init
+extern NSString * const CPUModelOptionArgmaxOnly;       // NSNumber of BOOL, NO by default, probs are then scores of the layer before softmax
+extern NSString * const CPUModelOptionInputSize;        // NSNumber, input_size of the JSON by default, see -modelWithInputSize:
+
+// where outputs and scratch memory of each step are in an arena, for a certain batch size
+// step 0 runs the first layer, step i runs the (i-1)th triplet of the encode sequence
+@interface CPUMemoryPlan : NSObject {
+@protected
+    size_t *m_InputOffsets;
+    size_t *m_OutputOffsets;
+    size_t *m_ScratchOffsets;
+}
+
+@property (readonly, nonatomic) int batch;
+@property (readonly, nonatomic) size_t arenaSize;
+@property (readonly, nonatomic) size_t probsOffset;     // output of the last layer
+
+// byte offsets in the arena; input of step 0 is not in the arena, output offset is of the whole destination image
+- (size_t)inputOffsetOfStep:(int)step;
+- (size_t)outputOffsetOfStep:(int)step;
+- (size_t)scratchOffsetOfStep:(int)step;
+
+@end
+
+// Everything of a net that does not change when forwarding: the mmap'd weights, the layers, the encode
+// sequence and how it is scheduled, and memory plans. A model can be shared by any number of CPUSession,
+// each of them owns the memory written during forwarding, so that sessions can forward concurrently.
+@interface CPUModel : NSObject {
+@protected
+
+    float *m_BasePtr;
+    CPUModelWeights *m_Weights;     // the mapped data file, shared with models of other input sizes
+    size_t m_FileSize;
+    int m_InputSize;
+
+    CPULayer *m_FirstLayer;
+    CPULayer *m_LastLayer;
+    NSDictionary *m_LayersDict;
+    NSArray *m_EncodeSequence;
+    NSArray *m_Waves;       // steps that can run concurrently
+    int *m_WaveOfStep;
+    int *m_StepOrder;       // steps in the order of waves
+    NSArray *m_Layers;      // in the order of layer_info, including those without an image
+    NSArray *m_Labels;
+    const struct compiled_model_header *m_Compiled;     // mmap'd compiled model, labels are read from it lazily
+    size_t m_CompiledSize;
+    NSMutableDictionary *m_Plans;   // memory plans keyed by batch size
+    float m_InputMean[3];
+    float m_InputScale[3];
+    struct weight_prefetch *m_Prefetch;
+    NSArray *m_Exits;       // auxiliary classifiers, see -forwardExit:
+    NSDictionary *m_Description;    // the JSON, nil for a compiled model
+    NSDictionary *m_Options;
+    NSMutableDictionary *m_Resolutions;     // models of other input sizes keyed by input size
+    NSString *m_OptimizationSummary;
+}
+
+@property (readonly, nonatomic) int inputSize;
+@property (readonly, nonatomic) int inputNum;           // the input image of the first layer, 3 channels of input_size x input_size
+@property (readonly, nonatomic) int probsNum;
+@property (readonly, nonatomic) int stepsCount;
+@property (readonly, nonatomic) NSArray<NSString *> *labels;
+@property (readonly, nonatomic) NSArray<NSArray<NSNumber *> *> *waves;
+@property (readonly, nonatomic) int exitsCount;
+
+// what CPUModelOptionOptimizeGraph changed, one line each, ending with the estimated savings per image;
+// nil if the graph was not optimized
+@property (readonly, nonatomic) NSString *optimizationSummary;
+
+// normalization that preprocessing still has to apply to each input channel, (pixel - mean) * scale
+// they are 0 and 1 once the normalization is folded into the first convolution layer
+@property (readonly, nonatomic) const float *inputMean;
+@property (readonly, nonatomic) const float *inputScale;
+
+- (instancetype)initWithDescriptionFile:(NSString *)descriptionFile
+                               dataFile:(NSString *)dataFile;
+
+- (instancetype)initWithDescriptionFile:(NSString *)descriptionFile
+                               dataFile:(NSString *)dataFile
+                                options:(NSDictionary *)options;
+
+// load a model compiled by Convert/compile_model.py, which is mmap'd and read in place instead of
+// parsing JSON: layers are built from a table of precomputed sizes, and the encode sequence is a table of layer indices
+- (instancetype)initWithCompiledFile:(NSString *)compiledFile
+                            dataFile:(NSString *)dataFile
+                             options:(NSDictionary *)options;
+
+// the same net at another input size, whose sizes of all layers are inferred again from it the same way as
+// convert_prototxt.py does; it shares the mapped weights of this model, and is kept by this model, so that nets of
+// several input sizes are ready at once, e.g. to forward at 160 or 192 instead of 227 under load; only models loaded
+// from JSON whose fully connected and softmax layers still read inputs of the same size, e.g. SqueezeNet ending in
+// global pooling, can take other input sizes; exits that can not are dropped; this method is thread-safe
+- (CPUModel *)modelWithInputSize:(int)inputSize;
+
+// weights are mmap'd, so the first forwarding after loading page-faults them in one page at a time;
+// this starts a thread that asks the kernel to read ahead weights of all steps in the order of execution,
+// then maps their pages, so that the first forwarding finds most of them ready
+// called by init unless CPUModelOptionPrefetchWeights is NO
+- (void)startPrefetchingWeights;
+
+// plans are computed once for each batch size, this method is thread-safe
+- (CPUMemoryPlan *)planForBatch:(int)batch;
+
+// a plan in which outputs of all layers are kept after forwarding, so that the next forwarding may
+// recompute only some rows of them, see CPUVideoSession; it needs more memory than -planForBatch:
+- (CPUMemoryPlan *)persistentPlanForBatch:(int)batch;
+
+// running steps one by one must follow the waves, since memory plans are based on them
+- (int)stepAtPosition:(int)position;
+
+- (CPULayer *)kernelOfStep:(int)step;
+- (CPULayer *)sourceOfStep:(int)step;       // nil for step 0, which reads the input
+- (CPULayer *)destinationOfStep:(int)step;
+
+// auxiliary classifiers kept as exits by convert_prototxt.py, e.g. loss1 and loss2 of GoogLeNet, each of them
+// reads the output of a branch layer of the net and gives probsNum probabilities; a compiled model has none
+- (NSString *)nameOfExit:(int)exit;
+
+// the output of the branch layer is complete after this wave, and is not overwritten before the next one runs
+- (int)waveOfExit:(int)exit;
+
+// floats of memory for outputs and scratch of the layers of an exit
+- (size_t)exitArenaNumOfExit:(int)exit
+                    forBatch:(int)batch;
+
+// forward an exit of a batch after its wave, reading the branch layer in arena; returns probabilities in exitArena
+- (const float *)forwardExit:(int)exit
+                       arena:(char *)arena
+                        plan:(CPUMemoryPlan *)plan
+                   exitArena:(float *)exitArena
+                       batch:(int)batch
+                  threadpool:(pthreadpool_t)threadpool;
+
+// forward one step of a batch whose outputs and scratch memory are in arena, laid out as the plan
+// imageData is only read by step 0
+- (void)forwardStep:(int)step
+          imageData:(const float *)imageData
+              arena:(char *)arena
+               plan:(CPUMemoryPlan *)plan
+              batch:(int)batch
+         threadpool:(pthreadpool_t)threadpool;
+
+@end
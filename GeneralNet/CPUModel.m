@@ -0,0 +1,1422 @@
+//
+//  CPUModel.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/12.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <sys/mman.h>
+#import <sys/stat.h>
+#import <pthread.h>
+#import <stdatomic.h>
+#import <unistd.h>
+#import "CPUModel.h"
+#import "CPULayer.h"
+#import "CPUQuantizedLayer.h"
+#import "memoryPlanner.h"
+#import "compiledModel.h"
+#import "weightContainer.h"
+
+@interface CPUMemoryPlan ()
+
+// takes the ownership of offsets
+- (instancetype)initWithBatch:(int)batch
+                    arenaSize:(size_t)arenaSize
+                  probsOffset:(size_t)probsOffset
+                 inputOffsets:(size_t *)inputOffsets
+                outputOffsets:(size_t *)outputOffsets
+               scratchOffsets:(size_t *)scratchOffsets;
+
+@end
+
+@implementation CPUMemoryPlan
+
+- (instancetype)initWithBatch:(int)batch
+                    arenaSize:(size_t)arenaSize
+                  probsOffset:(size_t)probsOffset
+                 inputOffsets:(size_t *)inputOffsets
+                outputOffsets:(size_t *)outputOffsets
+               scratchOffsets:(size_t *)scratchOffsets {
+    if (self = [super init]) {
+        _batch = batch;
+        _arenaSize = arenaSize;
+        _probsOffset = probsOffset;
+        m_InputOffsets = inputOffsets;
+        m_OutputOffsets = outputOffsets;
+        m_ScratchOffsets = scratchOffsets;
+    }
+    
+    return self;
+}
+
+- (size_t)inputOffsetOfStep:(int)step {
+    return m_InputOffsets[step];
+}
+
+- (size_t)outputOffsetOfStep:(int)step {
+    return m_OutputOffsets[step];
+}
+
+- (size_t)scratchOffsetOfStep:(int)step {
+    return m_ScratchOffsets[step];
+}
+
+- (void)dealloc {
+    free(m_InputOffsets);
+    free(m_OutputOffsets);
+    free(m_ScratchOffsets);
+}
+
+@end
+
+// an auxiliary classifier, whose layers run one after another in its own memory
+@interface CPUModelExit : NSObject
+
+@property (strong, nonatomic) NSString *name;
+@property (strong, nonatomic) CPULayer *branch;
+@property (strong, nonatomic) CPULayer *lastLayer;
+@property (strong, nonatomic) NSArray<NSArray<CPULayer *> *> *sequence;     // [kernel, source, destination]
+@property (strong, nonatomic) NSDictionary<NSString *, NSNumber *> *offsets;  // of outputs, in floats of one image
+@property (assign, nonatomic) int outputsNum;   // of all outputs of one image
+@property (assign, nonatomic) int wave;
+@property (assign, nonatomic) int branchStep;   // a step writing the branch layer
+
+@end
+
+@implementation CPUModelExit
+
+@end
+
+// the mapped data file, or the memory it is decompressed into, unmapped when no model uses it any more
+@interface CPUModelWeights : NSObject
+
+@property (assign, nonatomic) float *basePtr;
+@property (assign, nonatomic) size_t fileSize;
+@property (assign, nonatomic) int fd;       // -1 for decompressed weights
+
+@end
+
+@implementation CPUModelWeights
+
+- (void)dealloc {
+    int error = munmap(_basePtr, _fileSize);
+    NSAssert(error == 0, @"Error: munmap failed with errno = %d", errno);
+    if (_fd != -1) close(_fd);
+}
+
+@end
+
+NSString * const CPUModelOptionInputMean = @"input_mean";
+NSString * const CPUModelOptionInputScale = @"input_scale";
+NSString * const CPUModelOptionFoldInputNormalization = @"fold_input_normalization";
+NSString * const CPUModelOptionOptimizeGraph = @"optimize_graph";
+NSString * const CPUModelOptionArgmaxOnly = @"argmax_only";
+NSString * const CPUModelOptionPrefetchWeights = @"prefetch_weights";
+NSString * const CPUModelOptionPopulateWeights = @"populate_weights";
+NSString * const CPUModelOptionInputSize = @"input_size";
+
+// page-aligned ranges of the mapped weights, in the order they are read when forwarding
+struct weight_prefetch {
+    const char *base;
+    size_t *ranges;         // begin and end of each range
+    size_t count;
+    atomic_bool cancelled;
+    pthread_t thread;
+};
+
+static void *prefetch_weights(void *argument) {
+    struct weight_prefetch *prefetch = argument;
+    const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    
+    // ask for all ranges first, so that the kernel queues reads in this order, then map their pages one by one
+    for (size_t i = 0; i < prefetch->count; i++) {
+        madvise((void *)(prefetch->base + prefetch->ranges[2 * i]), prefetch->ranges[2 * i + 1] - prefetch->ranges[2 * i], MADV_WILLNEED);
+    }
+    for (size_t i = 0; i < prefetch->count; i++) {
+        for (size_t offset = prefetch->ranges[2 * i]; offset < prefetch->ranges[2 * i + 1]; offset += pageSize) {
+            if (atomic_load_explicit(&prefetch->cancelled, memory_order_relaxed)) return NULL;
+            (void)*(volatile const char *)(prefetch->base + offset);
+        }
+    }
+    
+    return NULL;
+}
+
+@implementation CPUModel
+
+- (instancetype)initWithDescriptionFile:(NSString *)descriptionFile
+                               dataFile:(NSString *)dataFile {
+    return [self initWithDescriptionFile:descriptionFile dataFile:dataFile options:nil];
+}
+
+- (instancetype)initWithDescriptionFile:(NSString *)descriptionFile
+                               dataFile:(NSString *)dataFile
+                                options:(NSDictionary *)options {
+#if ALLOW_PRINT
+    NSDate *startTime = [NSDate date];
+#endif
+    
+    // read JSON file
+    NSData *jsonData = [NSData dataWithContentsOfFile:descriptionFile];
+    NSDictionary *jsonDict = [NSJSONSerialization JSONObjectWithData:jsonData options:0 error:NULL];
+    if (self = [self initWithDescription:jsonDict dataFile:dataFile weights:nil options:options]) {
+#if ALLOW_PRINT
+        NSLog(@"Model loaded from %@ in %.0f us", descriptionFile.lastPathComponent, -[startTime timeIntervalSinceNow] * 1e6);
+#endif
+    }
+    
+    return self;
+}
+
+// weights are mapped from dataFile, unless they are already mapped by a model of the same description
+- (instancetype)initWithDescription:(NSDictionary *)jsonDict
+                           dataFile:(NSString *)dataFile
+                            weights:(CPUModelWeights *)weights
+                            options:(NSDictionary *)options {
+    if (self = [super init]) {
+        NSDictionary *inoutInfo = jsonDict[@"inout_info"];
+        NSArray *layersInfo = jsonDict[@"layer_info"];
+        NSArray *encodeSeq = jsonDict[@"encode_seq"];
+        NSArray *exitsInfo = jsonDict[@"exits"];
+        NSMutableArray *layers = [[NSMutableArray alloc] initWithCapacity:layersInfo.count];
+        NSMutableDictionary *layersDict = [[NSMutableDictionary alloc] init];
+        NSMutableArray *encodeSequence = [[NSMutableArray alloc] init];
+        
+        m_FileSize = [(NSNumber *)inoutInfo[@"file_size"] unsignedIntegerValue];
+        m_InputSize = [(NSNumber *)inoutInfo[@"input_size"] intValue];
+        BOOL populate = NO;
+        if (weights) {
+            m_Weights = weights;
+            m_BasePtr = weights.basePtr;
+        } else {
+            populate = [self mapDataFile:dataFile options:options];
+        }
+        m_Description = jsonDict;
+        m_Options = [options copy];
+        
+        // sizes in layer_info are of input_size of the JSON
+        int inputSize = options[CPUModelOptionInputSize]? [options[CPUModelOptionInputSize] intValue] : m_InputSize;
+        if (inputSize != m_InputSize) {
+            NSMutableDictionary<NSString *, NSNumber *> *sizes = [[NSMutableDictionary alloc] init];
+            layersInfo = [CPUModel layersInfo:layersInfo
+                                     sequence:encodeSeq
+                                   firstLayer:inoutInfo[@"first_layer"]
+                                    inputSize:inputSize
+                                        sizes:sizes];
+            NSAssert(layersInfo, @"Error: the net is not fully convolutional, and can not take input of size %d", inputSize);
+            
+            NSMutableArray *exits = [[NSMutableArray alloc] init];
+            for (NSDictionary *exitInfo in exitsInfo) {
+                NSArray *exitLayersInfo = [CPUModel layersInfo:exitInfo[@"layer_info"]
+                                                      sequence:exitInfo[@"encode_seq"]
+                                                    firstLayer:nil
+                                                     inputSize:0
+                                                         sizes:[sizes mutableCopy]];
+                if (!exitLayersInfo) {
+#if ALLOW_PRINT
+                    NSLog(@"Exit %@ can not take input of size %d, and is dropped", exitInfo[@"name"], inputSize);
+#endif
+                    continue;
+                }
+                NSMutableDictionary *reshapedExitInfo = [exitInfo mutableCopy];
+                [reshapedExitInfo setObject:exitLayersInfo forKey:@"layer_info"];
+                [exits addObject:reshapedExitInfo];
+            }
+            exitsInfo = exits;
+            m_InputSize = inputSize;
+        }
+        
+        // construct layers and encode sequence
+        [self constructLayersWithInfo:layersInfo layers:layers layersDict:layersDict];
+        for (NSArray *triplet in encodeSeq) {
+            CPULayer *kernel = layersDict[triplet[0]];
+            kernel.inputNum = ((CPULayer *)layersDict[triplet[1]]).outputNum;
+            kernel.destinationStride = ((CPULayer *)layersDict[triplet[2]]).outputNum;
+            [encodeSequence addObject:@[kernel, layersDict[triplet[1]], layersDict[triplet[2]]]];
+        }
+        
+        // they should not be changed after initialization
+        m_FirstLayer = layersDict[inoutInfo[@"first_layer"]];
+        m_LastLayer = layersDict[inoutInfo[@"last_layer"]];
+        m_Layers = [layers copy];
+        m_LayersDict = [layersDict copy];
+        m_EncodeSequence = [encodeSequence copy];
+        m_Labels = jsonDict[@"labels"];
+        [self constructExitsWithInfo:exitsInfo];
+        [self finishLoadingWithOptions:options populate:populate];
+    }
+    
+    return self;
+}
+
+// output size of a layer of layer_info for input of inputSize, the same as convert_prototxt.py,
+// or 0 if the layer can not take it, i.e. a fully connected or softmax layer not reading its own input size
+static int output_size_of_layer(NSDictionary *layerInfo, int inputSize) {
+    NSString *layerType = layerInfo[@"layer_type"];
+    int kernelSize = [(NSNumber *)layerInfo[@"kernel_size"] intValue];
+    int pad = [(NSNumber *)layerInfo[@"pad"] intValue];
+    int stride = MAX([(NSNumber *)layerInfo[@"stride"] intValue], 1);
+    int outputSize;
+    if ([layerType isEqualToString:@"Convolution"]) {
+        outputSize = (int)floor((double)(inputSize - kernelSize + 2 * pad) / stride) + 1;
+    } else if ([layerType isEqualToString:@"PoolingMax"]) {
+        outputSize = (int)ceil((double)(inputSize - kernelSize + 2 * pad) / stride) + 1;
+    } else if ([layerType isEqualToString:@"PoolingAverage"]) {
+        outputSize = [layerInfo[@"global"] boolValue]? 1 : (int)ceil((double)(inputSize - kernelSize) / stride) + 1;
+    } else if ([layerType isEqualToString:@"FullyConnected"] || [layerType isEqualToString:@"SoftMax"]) {
+        outputSize = inputSize == [(NSNumber *)layerInfo[@"input_size"] intValue]? [(NSNumber *)layerInfo[@"output_size"] intValue] : 0;
+    } else {
+        outputSize = inputSize;     // normalization and concat
+    }
+    return MAX(outputSize, 0);
+}
+
+// layer_info with input_size and output_size of layers inferred again, following the encode sequence from
+// the first layer taking input of inputSize, or from layers whose output sizes are already in sizes (e.g. the
+// branch layer of an exit); returns nil if any layer can not take its new input size
++ (NSArray *)layersInfo:(NSArray *)layersInfo
+               sequence:(NSArray *)sequence
+             firstLayer:(NSString *)firstLayer
+              inputSize:(int)inputSize
+                  sizes:(NSMutableDictionary<NSString *, NSNumber *> *)sizes {
+    NSMutableDictionary<NSString *, NSMutableDictionary *> *infos = [[NSMutableDictionary alloc] init];
+    for (NSDictionary *layerInfo in layersInfo) {
+        [infos setObject:[layerInfo mutableCopy] forKey:layerInfo[@"name"]];
+    }
+    
+    // the first layer reads the input, which is not a layer and is named "" here
+    NSMutableArray<NSArray<NSString *> *> *triplets = [[NSMutableArray alloc] initWithArray:sequence];
+    if (firstLayer) {
+        [triplets insertObject:@[firstLayer, @"", firstLayer] atIndex:0];
+        [sizes setObject:@(inputSize) forKey:@""];
+    }
+    for (NSArray<NSString *> *triplet in triplets) {
+        NSMutableDictionary *kernel = infos[triplet[0]];
+        int kernelInputSize = [sizes[triplet[1]] intValue];
+        int outputSize = output_size_of_layer(kernel, kernelInputSize);
+        if (!outputSize) return nil;
+        [kernel setObject:@(kernelInputSize) forKey:@"input_size"];
+        [kernel setObject:@(outputSize) forKey:@"output_size"];
+        [sizes setObject:@(outputSize) forKey:triplet[0]];
+        
+        // a concat takes the size of the layers writing it, which should all agree
+        if (![triplet[2] isEqualToString:triplet[0]]) {
+            if (sizes[triplet[2]] && [sizes[triplet[2]] intValue] != outputSize) return nil;
+            [infos[triplet[2]] setObject:@(outputSize) forKey:@"input_size"];
+            [infos[triplet[2]] setObject:@(outputSize) forKey:@"output_size"];
+            [sizes setObject:@(outputSize) forKey:triplet[2]];
+        }
+    }
+    [sizes removeObjectForKey:@""];
+    
+    NSMutableArray *reshaped = [[NSMutableArray alloc] initWithCapacity:layersInfo.count];
+    for (NSDictionary *layerInfo in layersInfo) {
+        [reshaped addObject:[infos[layerInfo[@"name"]] copy]];
+    }
+    return [reshaped copy];
+}
+
+- (CPUModel *)modelWithInputSize:(int)inputSize {
+    if (inputSize == m_InputSize) return self;
+    NSAssert(m_Description, @"Error: a compiled model only takes the input size it was compiled for");
+    
+    @synchronized (m_Resolutions) {
+        CPUModel *model = m_Resolutions[@(inputSize)];
+        if (!model) {
+#if ALLOW_PRINT
+            NSDate *startTime = [NSDate date];
+#endif
+            NSMutableDictionary *options = m_Options? [m_Options mutableCopy] : [[NSMutableDictionary alloc] init];
+            [options setObject:@(inputSize) forKey:CPUModelOptionInputSize];
+            [options setObject:@NO forKey:CPUModelOptionPrefetchWeights];     // they are the same as those of this model
+            [options setObject:@NO forKey:CPUModelOptionPopulateWeights];
+            model = [[CPUModel alloc] initWithDescription:m_Description dataFile:nil weights:m_Weights options:options];
+            [m_Resolutions setObject:model forKey:@(inputSize)];
+#if ALLOW_PRINT
+            NSLog(@"Model of input size %d prepared in %.0f us", inputSize, -[startTime timeIntervalSinceNow] * 1e6);
+#endif
+        }
+        return model;
+    }
+}
+
+- (instancetype)initWithCompiledFile:(NSString *)compiledFile
+                            dataFile:(NSString *)dataFile
+                             options:(NSDictionary *)options {
+    if (self = [super init]) {
+#if ALLOW_PRINT
+        NSDate *startTime = [NSDate date];
+#endif
+        
+        // map the compiled model, it stays mapped since labels are read from it later
+        int fd = open([compiledFile UTF8String], O_RDONLY);
+        NSAssert(fd != -1, @"Error: failed to open compiled model with errno = %d", errno);
+        struct stat fileStat;
+        fstat(fd, &fileStat);
+        m_CompiledSize = (size_t)fileStat.st_size;
+        m_Compiled = mmap(nil, m_CompiledSize, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+        NSAssert(m_Compiled != MAP_FAILED, @"Error: mmap failed with errno = %d", errno);
+        close(fd);
+        const char *error = compiled_model_check(m_Compiled, m_CompiledSize);
+        NSAssert(error == NULL, @"Error: %@ can not be loaded, %s", compiledFile, error);
+        
+        m_FileSize = m_Compiled->data_file_size;
+        m_InputSize = m_Compiled->input_size;
+        BOOL populate = [self mapDataFile:dataFile options:options];
+        
+        // steps refer to layers by their indices in the layer table
+        const compiled_model_layer *layersTable = compiled_model_layers(m_Compiled);
+        const compiled_model_step *stepsTable = compiled_model_steps(m_Compiled);
+        NSMutableArray<CPULayer *> *layers = [[NSMutableArray alloc] initWithCapacity:m_Compiled->layer_count];
+        NSMutableDictionary *layersDict = [[NSMutableDictionary alloc] initWithCapacity:m_Compiled->layer_count];
+        NSMutableArray *encodeSequence = [[NSMutableArray alloc] initWithCapacity:m_Compiled->sequence_count];
+        for (uint32_t i = 0; i < m_Compiled->layer_count; i++) {
+            CPULayer *layer = [self newLayerWithCompiledLayer:&layersTable[i]];
+            [layers addObject:layer];
+            [layersDict setObject:layer forKey:layer.name];
+        }
+        for (uint32_t i = 0; i < m_Compiled->sequence_count; i++) {
+            CPULayer *kernel = layers[stepsTable[i].kernel];
+            CPULayer *source = layers[stepsTable[i].source];
+            CPULayer *destination = layers[stepsTable[i].destination];
+            kernel.inputNum = source.outputNum;
+            kernel.destinationStride = destination.outputNum;
+            [encodeSequence addObject:@[kernel, source, destination]];
+        }
+        
+        // they should not be changed after initialization
+        m_FirstLayer = layers[m_Compiled->first_layer];
+        m_LastLayer = layers[m_Compiled->last_layer];
+        m_Layers = [layers copy];
+        m_LayersDict = [layersDict copy];
+        m_EncodeSequence = [encodeSequence copy];
+        [self finishLoadingWithOptions:options populate:populate];
+        
+#if ALLOW_PRINT
+        NSLog(@"Model loaded from %@ in %.0f us", compiledFile.lastPathComponent, -[startTime timeIntervalSinceNow] * 1e6);
+#endif
+    }
+    
+    return self;
+}
+
+// returns whether weights are populated
+- (BOOL)mapDataFile:(NSString *)dataFile
+            options:(NSDictionary *)options {
+    
+    // read parameters
+    int fd = open([dataFile UTF8String], O_RDONLY, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+    NSAssert(fd != -1, @"Error: failed to open params file with errno = %d", errno);
+    if ([self decompressDataFile:fd]) return YES;
+    
+    // weights of layers are only checked against the size given by the description, so the file must have it
+    struct stat fileStat;
+    fstat(fd, &fileStat);
+    NSAssert((size_t)fileStat.st_size == m_FileSize, @"Error: %@ has %lld bytes, but the model expects %zu bytes",
+             dataFile.lastPathComponent, (long long)fileStat.st_size, m_FileSize);
+    
+    BOOL populate = [options[CPUModelOptionPopulateWeights] boolValue];
+    int flags = MAP_FILE | MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (populate) flags |= MAP_POPULATE;
+#endif
+    m_BasePtr = mmap(nil, m_FileSize, PROT_READ, flags, fd, 0);
+    NSAssert(m_BasePtr != MAP_FAILED, @"Error: mmap failed with errno = %d", errno);
+    m_Weights = [[CPUModelWeights alloc] init];
+    m_Weights.basePtr = m_BasePtr;
+    m_Weights.fileSize = m_FileSize;
+    m_Weights.fd = fd;
+#ifndef MAP_POPULATE
+    if (populate) {
+        const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+        madvise(m_BasePtr, m_FileSize, MADV_WILLNEED);
+        for (size_t offset = 0; offset < m_FileSize; offset += pageSize) {
+            (void)*(volatile const char *)((const char *)m_BasePtr + offset);
+        }
+    }
+#endif
+    
+    return populate;
+}
+
+// a data file compressed by Convert/compress_weights.py is decompressed into anonymous memory on all cores,
+// returns NO if it is a raw .dat file, which is mapped as it is
+- (BOOL)decompressDataFile:(int)fd {
+    struct stat fileStat;
+    fstat(fd, &fileStat);
+    size_t containerSize = (size_t)fileStat.st_size;
+    weight_container_header header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || !weight_container_is_container(&header, sizeof(header))) return NO;
+    
+#if ALLOW_PRINT
+    NSDate *startTime = [NSDate date];
+#endif
+    void *container = mmap(nil, containerSize, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+    NSAssert(container != MAP_FAILED, @"Error: mmap failed with errno = %d", errno);
+    const char *error = weight_container_check(container, containerSize);
+    NSAssert(error == NULL, @"Error: compressed weights can not be loaded, %s", error);
+    NSAssert(header.raw_size == m_FileSize, @"Error: compressed weights of %llu bytes, expected %zu", header.raw_size, m_FileSize);
+    madvise(container, containerSize, MADV_SEQUENTIAL);
+    
+    // weights are written once and only read afterwards, in huge pages where the kernel has them
+    m_BasePtr = mmap(nil, m_FileSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    NSAssert(m_BasePtr != MAP_FAILED, @"Error: mmap failed with errno = %d", errno);
+#ifdef MADV_HUGEPAGE
+    madvise(m_BasePtr, m_FileSize, MADV_HUGEPAGE);
+#endif
+    pthreadpool_t threadpool = pthreadpool_create(0);
+    int failed = weight_container_decompress(threadpool, container, m_BasePtr);
+    pthreadpool_destroy(threadpool);
+    NSAssert(failed == 0, @"Error: compressed weights are corrupted");
+    mprotect(m_BasePtr, m_FileSize, PROT_READ);
+    munmap(container, containerSize);
+    close(fd);
+    
+    m_Weights = [[CPUModelWeights alloc] init];
+    m_Weights.basePtr = m_BasePtr;
+    m_Weights.fileSize = m_FileSize;
+    m_Weights.fd = -1;
+#if ALLOW_PRINT
+    NSLog(@"Weights decompressed from %zu to %zu bytes in %.0f us", containerSize, m_FileSize, -[startTime timeIntervalSinceNow] * 1e6);
+#endif
+    return YES;
+}
+
+- (void)finishLoadingWithOptions:(NSDictionary *)options
+                        populate:(BOOL)populate {
+    m_FirstLayer.inputNum = self.inputNum;
+    m_FirstLayer.destinationStride = m_FirstLayer.outputNum;
+    m_Plans = [[NSMutableDictionary alloc] init];
+    m_Resolutions = [[NSMutableDictionary alloc] init];
+    
+    // rewrite the graph, then group independent steps, and find out layers that can overwrite their inputs
+    [self setupInputNormalizationWithOptions:options];
+    [self setupQuantization];
+    if (options[CPUModelOptionOptimizeGraph]? [options[CPUModelOptionOptimizeGraph] boolValue] : YES) {
+        [self optimizeGraphWithOptions:options];
+    }
+    [self scheduleWaves];
+    [self locateExits];
+    [self markInPlaceLayers];
+    [self planForBatch:1];
+    if (!populate && (options[CPUModelOptionPrefetchWeights]? [options[CPUModelOptionPrefetchWeights] boolValue] : YES)) {
+        [self startPrefetchingWeights];
+    }
+}
+
+- (void)constructLayersWithInfo:(NSArray *)layersInfo
+                         layers:(NSMutableArray *)layers
+                     layersDict:(NSMutableDictionary *)layersDict {
+    
+    for (NSDictionary *layerInfo in layersInfo) {
+        NSString *layerName = layerInfo[@"name"];
+        NSString *layerType = layerInfo[@"layer_type"];
+        NSString *imageType = layerInfo[@"image_type"];
+        
+        CPULayer *newLayer;
+        
+        // construct forward method, layers quantized by quantize_weights.py have int8 weights and their scales
+        BOOL quantized = [layerInfo[@"weight_type"] isEqualToString:@"int8"];
+        if ([layerType isEqualToString:@"Convolution"] && quantized) {
+            newLayer = [[CPUQuantizedConvolutionLayer alloc] initWithName:layerName
+                                                                   weight:(const int8_t *)(m_BasePtr + [(NSNumber *)layerInfo[@"weight_offset"] intValue])
+                                                             weightScales:m_BasePtr + [(NSNumber *)layerInfo[@"weight_scale_offset"] intValue]
+                                                                     bias:m_BasePtr + [(NSNumber *)layerInfo[@"bias_offset"] intValue]
+                                                                    group:[(NSNumber *)layerInfo[@"group"] intValue]
+                                                             inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                                            outputChannel:[(NSNumber *)layerInfo[@"output_channel"] intValue]
+                                                                inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                               outputSize:[(NSNumber *)layerInfo[@"output_size"] intValue]
+                                                               kernelSize:[(NSNumber *)layerInfo[@"kernel_size"] intValue]
+                                                                      pad:[(NSNumber *)layerInfo[@"pad"] intValue]
+                                                                   stride:[(NSNumber *)layerInfo[@"stride"] intValue]
+                                                                   doReLU:[(NSString *)layerInfo[@"activation"] isEqualToString:@"ReLU"]? YES : NO];
+        } else if ([layerType isEqualToString:@"FullyConnected"] && quantized) {
+            newLayer = [[CPUQuantizedFullyConnectedLayer alloc] initWithName:layerName
+                                                                      weight:(const int8_t *)(m_BasePtr + [(NSNumber *)layerInfo[@"weight_offset"] intValue])
+                                                                weightScales:m_BasePtr + [(NSNumber *)layerInfo[@"weight_scale_offset"] intValue]
+                                                                        bias:m_BasePtr + [(NSNumber *)layerInfo[@"bias_offset"] intValue]
+                                                                inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                                               outputChannel:[(NSNumber *)layerInfo[@"output_channel"] intValue]
+                                                                   inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                                      doReLU:[(NSString *)layerInfo[@"activation"] isEqualToString:@"ReLU"]? YES : NO];
+        } else if ([layerType isEqualToString:@"Convolution"]) {
+            newLayer = [[CPUConvolutionLayer alloc] initWithName:layerName
+                                                          weight:m_BasePtr + [(NSNumber *)layerInfo[@"weight_offset"] intValue]
+                                                            bias:m_BasePtr + [(NSNumber *)layerInfo[@"bias_offset"] intValue]
+                                                           group:[(NSNumber *)layerInfo[@"group"] intValue]
+                                                    inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                                   outputChannel:[(NSNumber *)layerInfo[@"output_channel"] intValue]
+                                                       inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                      outputSize:[(NSNumber *)layerInfo[@"output_size"] intValue]
+                                                      kernelSize:[(NSNumber *)layerInfo[@"kernel_size"] intValue]
+                                                             pad:[(NSNumber *)layerInfo[@"pad"] intValue]
+                                                          stride:[(NSNumber *)layerInfo[@"stride"] intValue]
+                                                          doReLU:[(NSString *)layerInfo[@"activation"] isEqualToString:@"ReLU"]? YES : NO];
+        } else if ([layerType isEqualToString:@"FullyConnected"]) {
+            newLayer = [[CPUFullyConnectedLayer alloc] initWithName:layerName
+                                                             weight:m_BasePtr + [(NSNumber *)layerInfo[@"weight_offset"] intValue]
+                                                               bias:m_BasePtr + [(NSNumber *)layerInfo[@"bias_offset"] intValue]
+                                                       inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                                      outputChannel:[(NSNumber *)layerInfo[@"output_channel"] intValue]
+                                                          inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                             doReLU:[(NSString *)layerInfo[@"activation"] isEqualToString:@"ReLU"]? YES : NO];
+        } else if ([layerType isEqualToString:@"PoolingMax"]) {
+            newLayer = [[CPUPoolingLayer alloc]initWithName:layerName
+                                                poolingType:ePoolingMax
+                                               inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                              outputChannel:[(NSNumber *)layerInfo[@"output_channel"] intValue]
+                                                  inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                 outputSize:[(NSNumber *)layerInfo[@"output_size"] intValue]
+                                                 kernelSize:[(NSNumber *)layerInfo[@"kernel_size"] intValue]
+                                                        pad:[(NSNumber *)layerInfo[@"pad"] intValue]
+                                                     stride:[(NSNumber *)layerInfo[@"stride"] intValue]];
+        } else if ([layerType isEqualToString:@"PoolingAverage"]) {
+            if ([layerInfo[@"global"] boolValue]) {
+                newLayer = [[CPUPoolingLayer alloc]initWithName:layerName
+                                                    poolingType:ePoolingGlobalAverage
+                                                   inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                                  outputChannel:[(NSNumber *)layerInfo[@"output_channel"] intValue]
+                                                      inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                     outputSize:[(NSNumber *)layerInfo[@"output_size"] intValue]
+                                                     kernelSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                            pad:0
+                                                         stride:[(NSNumber *)layerInfo[@"input_size"] intValue]];
+            } else {
+                newLayer = [[CPUPoolingLayer alloc]initWithName:layerName
+                                                    poolingType:ePoolingAverage
+                                                   inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                                  outputChannel:[(NSNumber *)layerInfo[@"output_channel"] intValue]
+                                                      inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                     outputSize:[(NSNumber *)layerInfo[@"output_size"] intValue]
+                                                     kernelSize:[(NSNumber *)layerInfo[@"kernel_size"] intValue]
+                                                            pad:0
+                                                         stride:[(NSNumber *)layerInfo[@"stride"] intValue]];
+            }
+        } else if ([layerType isEqualToString:@"LocalResponseNormalization"]) {     // only support within-channel normalization for now
+            newLayer = [[CPULocalResponseNormalizationLayer alloc] initWithName:layerName
+                                                                   inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]
+                                                                      inputSize:[(NSNumber *)layerInfo[@"input_size"] intValue]
+                                                                          alpha:[(NSNumber *)layerInfo[@"alpha"] floatValue]
+                                                                           beta:[(NSNumber *)layerInfo[@"beta"] floatValue]
+                                                                          delta:1.0f
+                                                                      localSize:[(NSNumber *)layerInfo[@"local_size"] intValue]];
+        } else if ([layerType isEqualToString:@"SoftMax"]) {
+            newLayer = [[CPUSoftMaxLayer alloc] initWithName:layerName
+                                                inputChannel:[(NSNumber *)layerInfo[@"input_channel"] intValue]];
+        } else if ([layerType isEqualToString:@"Concat"]) {
+            newLayer = [[CPULayer alloc] initWithName:layerName];
+        } else {
+            assert("Unsupported layer!");
+        }
+        
+        newLayer.ownsImage = ![imageType isEqualToString:@"None"];
+        if (layerInfo[@"read_count"]) newLayer.readCount = [(NSNumber *)layerInfo[@"read_count"] intValue];
+        if (layerInfo[@"output_range"]) {
+            newLayer.outputMin = [(NSNumber *)layerInfo[@"output_range"][0] floatValue];
+            newLayer.outputMax = [(NSNumber *)layerInfo[@"output_range"][1] floatValue];
+        }
+        if (newLayer.ownsImage) {
+            newLayer.outputNum = [(NSNumber *)layerInfo[@"output_size"] intValue] * [(NSNumber *)layerInfo[@"output_size"] intValue] *
+            [(NSNumber *)layerInfo[@"output_channel"] intValue];
+        }
+        
+        if ([layerInfo objectForKey:@"destination_channel_offset"]) {
+            newLayer.destinationOffset = [((NSNumber *)layerInfo[@"destination_channel_offset"]) intValue] *
+            [(NSNumber *)layerInfo[@"output_size"] intValue] * [(NSNumber *)layerInfo[@"output_size"] intValue];
+        }
+        
+        [layers addObject:newLayer];
+        [layersDict setObject:newLayer forKey:layerName];
+    }
+}
+
+- (void)constructExitsWithInfo:(NSArray *)exitsInfo {
+    NSMutableArray<CPUModelExit *> *exits = [[NSMutableArray alloc] initWithCapacity:exitsInfo.count];
+    for (NSDictionary *exitInfo in exitsInfo) {
+        NSMutableArray *layers = [[NSMutableArray alloc] init];
+        NSMutableDictionary *layersDict = [[NSMutableDictionary alloc] init];
+        [self constructLayersWithInfo:exitInfo[@"layer_info"] layers:layers layersDict:layersDict];
+        
+        // layers of an exit have their own outputs one after another, only the first one reads the branch layer
+        CPUModelExit *exit = [[CPUModelExit alloc] init];
+        exit.name = exitInfo[@"name"];
+        exit.branch = m_LayersDict[exitInfo[@"branch_layer"]];
+        exit.lastLayer = layersDict[exitInfo[@"last_layer"]];
+        NSAssert(exit.branch && exit.lastLayer, @"Error: exit %@ has no branch layer or last layer", exit.name);
+        NSAssert(exit.lastLayer.outputNum == m_LastLayer.outputNum, @"Error: exit %@ gives %d probabilities, the net gives %d",
+                 exit.name, exit.lastLayer.outputNum, m_LastLayer.outputNum);
+        
+        NSMutableArray<NSArray<CPULayer *> *> *sequence = [[NSMutableArray alloc] init];
+        for (NSArray *triplet in exitInfo[@"encode_seq"]) {
+            CPULayer *kernel = layersDict[triplet[0]];
+            CPULayer *source = layersDict[triplet[1]] ?: m_LayersDict[triplet[1]];
+            CPULayer *destination = layersDict[triplet[2]];
+            NSAssert(kernel && destination && (source == exit.branch || layersDict[triplet[1]]),
+                     @"Error: exit %@ can only read its own layers and %@", exit.name, exit.branch.name);
+            kernel.inputNum = source.outputNum;
+            kernel.destinationStride = destination.outputNum;
+            [sequence addObject:@[kernel, source, destination]];
+        }
+        exit.sequence = [sequence copy];
+        
+        NSMutableDictionary<NSString *, NSNumber *> *offsets = [[NSMutableDictionary alloc] init];
+        int outputsNum = 0;
+        for (CPULayer *layer in layers) {
+            if (!layer.ownsImage) continue;
+            [offsets setObject:@(outputsNum) forKey:layer.name];
+            outputsNum += layer.outputNum;
+        }
+        exit.offsets = [offsets copy];
+        exit.outputsNum = outputsNum;
+        [exits addObject:exit];
+    }
+    m_Exits = [exits copy];
+}
+
+// exits run after the last wave writing their branch layers, which therefore should not be fused away,
+// though a branch pooling layer may be replaced by a fused layer of the same name
+- (void)locateExits {
+    for (CPUModelExit *exit in m_Exits) {
+        exit.wave = -1;
+        for (int step = 0; step < self.stepsCount; step++) {
+            CPULayer *destination = [self destinationOfStep:step];
+            if ([destination.name isEqualToString:exit.branch.name] && m_WaveOfStep[step] > exit.wave) {
+                exit.branch = destination;
+                exit.wave = m_WaveOfStep[step];
+                exit.branchStep = step;
+            }
+        }
+        NSAssert(exit.wave >= 0, @"Error: branch layer %@ of exit %@ is not written by any step", exit.branch.name, exit.name);
+        
+        NSMutableArray<NSArray<CPULayer *> *> *sequence = [exit.sequence mutableCopy];
+        for (NSUInteger i = 0; i < sequence.count; i++) {
+            if ([sequence[i][1].name isEqualToString:exit.branch.name]) sequence[i] = @[sequence[i][0], exit.branch, sequence[i][2]];
+        }
+        exit.sequence = [sequence copy];
+    }
+}
+
+- (BOOL)isBranchOfExit:(CPULayer *)layer {
+    for (CPUModelExit *exit in m_Exits) {
+        if (exit.branch == layer) return YES;
+    }
+    return NO;
+}
+
+- (CPULayer *)newLayerWithCompiledLayer:(const compiled_model_layer *)info {
+    NSString *layerName = [[NSString alloc] initWithUTF8String:compiled_model_string(m_Compiled, info->name)];
+    CPULayer *newLayer;
+    
+    switch (info->type) {
+        case COMPILED_LAYER_CONVOLUTION:
+            newLayer = [[CPUConvolutionLayer alloc] initWithName:layerName
+                                                          weight:m_BasePtr + info->weight_offset
+                                                            bias:m_BasePtr + info->bias_offset
+                                                           group:info->group
+                                                    inputChannel:info->input_channel
+                                                   outputChannel:info->output_channel
+                                                       inputSize:info->input_size
+                                                      outputSize:info->output_size
+                                                      kernelSize:info->kernel_size
+                                                             pad:info->pad
+                                                          stride:info->stride
+                                                          doReLU:info->do_relu? YES : NO];
+            break;
+        case COMPILED_LAYER_FULLY_CONNECTED:
+            newLayer = [[CPUFullyConnectedLayer alloc] initWithName:layerName
+                                                             weight:m_BasePtr + info->weight_offset
+                                                               bias:m_BasePtr + info->bias_offset
+                                                       inputChannel:info->input_channel
+                                                      outputChannel:info->output_channel
+                                                          inputSize:info->input_size
+                                                             doReLU:info->do_relu? YES : NO];
+            break;
+        case COMPILED_LAYER_POOLING_MAX:
+        case COMPILED_LAYER_POOLING_AVERAGE:
+        case COMPILED_LAYER_POOLING_GLOBAL_AVERAGE:
+            newLayer = [[CPUPoolingLayer alloc] initWithName:layerName
+                                                 poolingType:info->type == COMPILED_LAYER_POOLING_MAX? ePoolingMax :
+                                                             info->type == COMPILED_LAYER_POOLING_AVERAGE? ePoolingAverage : ePoolingGlobalAverage
+                                                inputChannel:info->input_channel
+                                               outputChannel:info->output_channel
+                                                   inputSize:info->input_size
+                                                  outputSize:info->output_size
+                                                  kernelSize:info->kernel_size
+                                                         pad:info->pad
+                                                      stride:info->stride];
+            break;
+        case COMPILED_LAYER_LOCAL_RESPONSE_NORMALIZATION:
+            newLayer = [[CPULocalResponseNormalizationLayer alloc] initWithName:layerName
+                                                                   inputChannel:info->input_channel
+                                                                      inputSize:info->input_size
+                                                                          alpha:info->alpha
+                                                                           beta:info->beta
+                                                                          delta:1.0f
+                                                                      localSize:info->local_size];
+            break;
+        case COMPILED_LAYER_SOFTMAX:
+            newLayer = [[CPUSoftMaxLayer alloc] initWithName:layerName
+                                                inputChannel:info->input_channel];
+            break;
+        case COMPILED_LAYER_CONCAT:
+            newLayer = [[CPULayer alloc] initWithName:layerName];
+            break;
+        default:
+            NSAssert(NO, @"Error: unsupported layer type %u of %@", info->type, layerName);
+            newLayer = [[CPULayer alloc] initWithName:layerName];
+    }
+    
+    // sizes are computed by the compiler
+    newLayer.ownsImage = info->image_type != COMPILED_IMAGE_NONE;
+    newLayer.readCount = info->read_count;
+    newLayer.outputNum = info->output_num;
+    newLayer.destinationOffset = info->destination_offset;
+    
+    return newLayer;
+}
+
+
+- (void)optimizeGraphWithOptions:(NSDictionary *)options {
+    NSMutableArray<NSArray<CPULayer *> *> *sequence = [m_EncodeSequence mutableCopy];
+    NSMutableDictionary<NSString *, CPULayer *> *layersDict = [m_LayersDict mutableCopy];
+    NSMutableArray<NSString *> *changes = [[NSMutableArray alloc] init];
+    double savedFlops = 0, savedBytes = 0;      // for one image
+    
+    // softmax keeps the order of its input, so it is not needed when the caller only wants the top classes
+    if ([options[CPUModelOptionArgmaxOnly] boolValue] && [m_LastLayer isKindOfClass:[CPUSoftMaxLayer class]]) {
+        NSUInteger index = [sequence indexOfObjectPassingTest:^BOOL(NSArray<CPULayer *> *triplet, NSUInteger idx, BOOL *stop) {
+            return triplet[0] == m_LastLayer;
+        }];
+        if (index != NSNotFound && sequence[index][2] == m_LastLayer) {
+            CPULayer *softmax = m_LastLayer;
+            m_LastLayer = sequence[index][1];
+            [sequence removeObjectAtIndex:index];
+            [layersDict removeObjectForKey:softmax.name];
+            savedFlops += [softmax flops];
+            savedBytes += 2.0 * softmax.outputNum * sizeof(float);
+            [changes addObject:[NSString stringWithFormat:@"dropped %@, %@ gives the top classes", softmax.name, m_LastLayer.name]];
+        }
+    }
+    
+    // images that are never read, except the output of the net, are dead, so are all steps writing them;
+    // dropping them may make their inputs dead too
+    while (true) {
+        NSCountedSet<NSString *> *readers = [[NSCountedSet alloc] init];
+        for (NSArray<CPULayer *> *triplet in sequence) {
+            [readers addObject:triplet[1].name];
+        }
+        NSIndexSet *deadSteps = [sequence indexesOfObjectsPassingTest:^BOOL(NSArray<CPULayer *> *triplet, NSUInteger idx, BOOL *stop) {
+            return triplet[2] != m_LastLayer && [readers countForObject:triplet[2].name] == 0;
+        }];
+        if (!deadSteps.count) break;
+        for (NSArray<CPULayer *> *triplet in [sequence objectsAtIndexes:deadSteps]) {
+            [layersDict removeObjectForKey:triplet[0].name];
+            [layersDict removeObjectForKey:triplet[2].name];
+            savedFlops += [triplet[0] flops];
+            savedBytes += (double)(triplet[0] == triplet[2]? triplet[2].outputNum : 0) * sizeof(float);
+            [changes addObject:[NSString stringWithFormat:@"dropped %@, its output is never read", triplet[0].name]];
+        }
+        [sequence removeObjectsAtIndexes:deadSteps];
+    }
+    
+#if !ALLOW_PRINT
+    // a convolution layer only read by a pooling layer runs in the same step, its output stays in scratch memory
+    // (not done when printing, since the output of the convolution layer would not be printed)
+    while (true) {
+        NSCountedSet<NSString *> *readers = [[NSCountedSet alloc] init];
+        NSCountedSet<NSString *> *writers = [[NSCountedSet alloc] init];
+        for (NSArray<CPULayer *> *triplet in sequence) {
+            [readers addObject:triplet[1].name];
+            [writers addObject:triplet[2].name];
+        }
+        
+        NSUInteger poolingIndex = NSNotFound, convolutionIndex = NSNotFound;
+        for (NSUInteger i = 0; i < sequence.count && poolingIndex == NSNotFound; i++) {
+            CPULayer *source = sequence[i][1];
+            if (![sequence[i][0] isKindOfClass:[CPUPoolingLayer class]] || ![source isKindOfClass:[CPUConvolutionLayer class]] ||
+                [readers countForObject:source.name] != 1 || source == m_LastLayer || [self isBranchOfExit:source]) continue;
+            if (source == m_FirstLayer) {
+                if (sequence[i][2] == sequence[i][0]) poolingIndex = i;     // the first layer writes its own output
+            } else if ([writers countForObject:source.name] == 1) {
+                NSUInteger index = [sequence indexOfObjectPassingTest:^BOOL(NSArray<CPULayer *> *triplet, NSUInteger idx, BOOL *stop) {
+                    return triplet[2] == source;
+                }];
+                if (sequence[index][0] == source && source.destinationOffset == 0) {
+                    poolingIndex = i;
+                    convolutionIndex = index;
+                }
+            }
+        }
+        if (poolingIndex == NSNotFound) break;
+        
+        CPUConvolutionLayer *convolution = (CPUConvolutionLayer *)sequence[poolingIndex][1];
+        CPUPoolingLayer *pooling = (CPUPoolingLayer *)sequence[poolingIndex][0];
+        CPUConvolutionPoolingLayer *fused = [[CPUConvolutionPoolingLayer alloc] initWithConvolution:convolution pooling:pooling];
+        CPULayer *destination = sequence[poolingIndex][2] == pooling? fused : sequence[poolingIndex][2];
+        if (convolutionIndex == NSNotFound) {
+            m_FirstLayer = fused;
+        } else {
+            sequence[convolutionIndex] = @[fused, sequence[convolutionIndex][1], destination];
+        }
+        [sequence removeObjectAtIndex:poolingIndex];
+        
+        // the fused layer takes the place of pooling layer, whose output is read by others
+        for (NSUInteger i = 0; i < sequence.count; i++) {
+            if (sequence[i][1] == pooling || sequence[i][2] == pooling) {
+                sequence[i] = @[sequence[i][0], sequence[i][1] == pooling? fused : sequence[i][1], sequence[i][2] == pooling? fused : sequence[i][2]];
+            }
+        }
+        if (m_LastLayer == pooling) m_LastLayer = fused;
+        [layersDict removeObjectForKey:convolution.name];
+        [layersDict setObject:fused forKey:pooling.name];
+        
+        // ReLU behind max pooling runs on the pooled output, and the output of convolution is neither
+        // written to nor read back from the arena
+        savedFlops += fused.reluAfterPooling? (double)convolution.outputNum - pooling.outputNum : 0;
+        savedBytes += 2.0 * convolution.outputNum * sizeof(float);
+        [changes addObject:[NSString stringWithFormat:@"fused %@ into %@%@", convolution.name, pooling.name,
+                            fused.reluAfterPooling? @", ReLU after pooling" : @""]];
+    }
+#endif
+    
+    // producers of concat already write into their part of its output at destination_channel_offset
+    int concatProducers = 0;
+    for (NSArray<CPULayer *> *triplet in sequence) {
+        if (triplet[0] != triplet[2]) concatProducers++;
+    }
+    if (concatProducers) {
+        [changes addObject:[NSString stringWithFormat:@"%d layers write into concat outputs in place", concatProducers]];
+    }
+    
+    // images that are no longer written have no buffer, and read counts change
+    NSMutableSet<NSString *> *images = [[NSMutableSet alloc] initWithObjects:m_FirstLayer.name, nil];
+    NSCountedSet<NSString *> *readers = [[NSCountedSet alloc] init];
+    for (NSArray<CPULayer *> *triplet in sequence) {
+        [images addObject:triplet[2].name];
+        [readers addObject:triplet[1].name];
+    }
+    NSMutableArray<CPULayer *> *layers = [[NSMutableArray alloc] initWithCapacity:m_Layers.count];
+    for (CPULayer *oldLayer in m_Layers) {
+        CPULayer *layer = layersDict[oldLayer.name];   // fused layers take the place of pooling layers
+        if (!layer) continue;
+        if (![images containsObject:layer.name]) {
+            layer.ownsImage = NO;
+            layer.readCount = -1;
+        } else if (layer.readCount >= 0) {
+            layer.readCount = (int)[readers countForObject:layer.name];
+        }
+        [layers addObject:layer];
+    }
+    
+    [changes addObject:[NSString stringWithFormat:@"%lu steps left of %lu, saves %.2f MFLOPs and %.2f MB of memory traffic per image",
+                        (unsigned long)sequence.count + 1, (unsigned long)m_EncodeSequence.count + 1, savedFlops / 1e6, savedBytes / 1048576.0]];
+    m_OptimizationSummary = [changes componentsJoinedByString:@"\n"];
+#if ALLOW_PRINT
+    for (NSString *change in changes) {
+        NSLog(@"Graph optimizer: %@", change);
+    }
+#endif
+    
+    m_EncodeSequence = [sequence copy];
+    m_LayersDict = [layersDict copy];
+    m_Layers = [layers copy];
+}
+
+- (void)scheduleWaves {
+    
+    // a step can run as soon as all steps writing its input have finished, so it goes into the wave
+    // after the latest one writing its input; steps in the same wave only share inputs and write disjoint
+    // outputs (e.g. branches of inception and fire modules), so that they can run concurrently
+    NSMutableArray<NSMutableArray<NSNumber *> *> *waves = [[NSMutableArray alloc] initWithObjects:[NSMutableArray arrayWithObject:@0], nil];
+    NSMutableDictionary<NSString *, NSNumber *> *wavesOfLayers = [[NSMutableDictionary alloc] init];
+    [wavesOfLayers setObject:@0 forKey:m_FirstLayer.name];
+    m_WaveOfStep = calloc(self.stepsCount, sizeof(int));
+    for (int step = 1; step < self.stepsCount; step++) {
+        NSArray<CPULayer *> *triplet = m_EncodeSequence[step - 1];
+        int wave = [wavesOfLayers[triplet[1].name] intValue] + 1;
+        if (wave == waves.count) [waves addObject:[[NSMutableArray alloc] init]];
+        [waves[wave] addObject:@(step)];
+        m_WaveOfStep[step] = wave;
+        if ([wavesOfLayers[triplet[2].name] intValue] < wave) [wavesOfLayers setObject:@(wave) forKey:triplet[2].name];
+    }
+    m_Waves = [waves copy];
+    
+    m_StepOrder = calloc(self.stepsCount, sizeof(int));
+    int position = 0;
+    for (NSArray<NSNumber *> *wave in m_Waves) {
+        for (NSNumber *step in wave) {
+            m_StepOrder[position++] = step.intValue;
+        }
+    }
+}
+
+- (void)markInPlaceLayers {
+#if !ALLOW_PRINT
+    
+    // a layer that can compute in place overwrites its input if no other layer reads the input
+    // (not done when printing, since outputs of all layers are printed after forwarding)
+    for (NSArray<CPULayer *> *triplet in m_EncodeSequence) {
+        CPULayer *kernel = triplet[0];
+        if ([kernel canComputeInPlace] && triplet[2] == kernel && triplet[1].readCount == 1) {
+            kernel.inPlace = YES;
+        }
+    }
+#endif
+}
+
+- (void)setupInputNormalizationWithOptions:(NSDictionary *)options {
+    NSArray<NSNumber *> *mean = options[CPUModelOptionInputMean];
+    NSArray<NSNumber *> *scale = options[CPUModelOptionInputScale];
+    for (int channel = 0; channel < 3; channel++) {
+        m_InputMean[channel] = mean? mean[channel].floatValue : 120.0f;
+        m_InputScale[channel] = scale? scale[channel].floatValue : 1.0f;
+    }
+    
+    // the normalization is linear, so is a convolution layer right after it
+    BOOL fold = options[CPUModelOptionFoldInputNormalization]? [options[CPUModelOptionFoldInputNormalization] boolValue] : YES;
+    if (fold && ([m_FirstLayer isKindOfClass:[CPUConvolutionLayer class]] || [m_FirstLayer isKindOfClass:[CPUQuantizedConvolutionLayer class]])) {
+        if ([m_FirstLayer isKindOfClass:[CPUConvolutionLayer class]]) {
+            [(CPUConvolutionLayer *)m_FirstLayer foldInputMean:m_InputMean scale:m_InputScale];
+        } else {
+            [(CPUQuantizedConvolutionLayer *)m_FirstLayer foldInputMean:m_InputMean scale:m_InputScale];
+        }
+        for (int channel = 0; channel < 3; channel++) {
+            m_InputMean[channel] = 0.0f;
+            m_InputScale[channel] = 1.0f;
+        }
+    }
+}
+
+// decides which images of a net quantized by quantize_weights.py hold uint8, see CPUQuantizedLayer.h;
+// images need a calibrated range and only int8 layers or max pooling writing and reading them, and max pooling
+// keeps its input and output of the same kind, the output of the net and branches of exits stay floats
+- (void)setupQuantization {
+    NSUInteger quantizedLayers = [m_Layers indexesOfObjectsPassingTest:^BOOL(CPULayer *layer, NSUInteger idx, BOOL *stop) {
+        return [layer isKindOfClass:[CPUQuantizedLayer class]];
+    }].count;
+    if (!quantizedLayers) return;
+    
+    NSMutableDictionary<NSString *, NSMutableArray<CPULayer *> *> *kernelsOfImages = [[NSMutableDictionary alloc] init];
+    NSArray<NSArray<CPULayer *> *> *steps = [@[@[m_FirstLayer, m_FirstLayer, m_FirstLayer]] arrayByAddingObjectsFromArray:m_EncodeSequence];
+    for (NSUInteger step = 0; step < steps.count; step++) {
+        for (CPULayer *image in step? @[steps[step][1], steps[step][2]] : @[m_FirstLayer]) {
+            if (!kernelsOfImages[image.name]) [kernelsOfImages setObject:[[NSMutableArray alloc] init] forKey:image.name];
+            [kernelsOfImages[image.name] addObject:steps[step][0]];
+        }
+    }
+    BOOL (^isMaxPooling)(CPULayer *) = ^BOOL(CPULayer *layer) {
+        return [layer isKindOfClass:[CPUPoolingLayer class]] && ((CPUPoolingLayer *)layer).poolingType == ePoolingMax;
+    };
+    
+    NSMutableSet<NSString *> *images = [[NSMutableSet alloc] init];
+    for (NSString *name in kernelsOfImages) {
+        CPULayer *image = m_LayersDict[name];
+        if (image.outputMax <= image.outputMin || image == m_LastLayer || [self isBranchOfExit:image]) continue;
+        BOOL integral = YES;
+        for (CPULayer *kernel in kernelsOfImages[name]) {
+            integral = integral && ([kernel isKindOfClass:[CPUQuantizedLayer class]] || isMaxPooling(kernel));
+        }
+        if (integral) [images addObject:name];
+    }
+    BOOL changed = YES;
+    while (changed) {
+        changed = NO;
+        for (NSArray<CPULayer *> *triplet in m_EncodeSequence) {
+            if (!isMaxPooling(triplet[0]) || [images containsObject:triplet[1].name] == [images containsObject:triplet[2].name]) continue;
+            [images removeObject:triplet[1].name];
+            [images removeObject:triplet[2].name];
+            changed = YES;
+        }
+    }
+    for (NSString *name in images) {
+        ((CPULayer *)m_LayersDict[name]).quantizedImage = YES;
+    }
+    
+    // max pooling of uint8 takes the place of max pooling between them
+    NSMutableArray<NSArray<CPULayer *> *> *sequence = [m_EncodeSequence mutableCopy];
+    NSMutableDictionary<NSString *, CPULayer *> *layersDict = [m_LayersDict mutableCopy];
+    NSMutableArray<CPULayer *> *layers = [m_Layers mutableCopy];
+#if ALLOW_PRINT
+    NSUInteger poolingCount = 0;
+#endif
+    for (NSUInteger i = 0; i < sequence.count; i++) {
+        if (!isMaxPooling(sequence[i][0]) || !sequence[i][1].quantizedImage) continue;
+        CPUPoolingLayer *maxPooling = (CPUPoolingLayer *)sequence[i][0];
+        CPUQuantizedPoolingLayer *quantized = [[CPUQuantizedPoolingLayer alloc] initWithPooling:maxPooling];
+        for (NSUInteger j = 0; j < sequence.count; j++) {
+            if (sequence[j][1] == maxPooling || sequence[j][2] == maxPooling || j == i) {
+                sequence[j] = @[j == i? quantized : sequence[j][0],
+                                sequence[j][1] == maxPooling? quantized : sequence[j][1],
+                                sequence[j][2] == maxPooling? quantized : sequence[j][2]];
+            }
+        }
+        [layersDict setObject:quantized forKey:maxPooling.name];
+        [layers replaceObjectAtIndex:[layers indexOfObject:maxPooling] withObject:quantized];
+#if ALLOW_PRINT
+        poolingCount++;
+#endif
+    }
+    m_EncodeSequence = [sequence copy];
+    m_LayersDict = [layersDict copy];
+    m_Layers = [layers copy];
+    
+    // the raw input is quantized by the first layer with the range of normalized pixels, i.e. exactly once folded
+    float inputMin = 0, inputMax = 0;
+    for (int channel = 0; channel < 3; channel++) {
+        float low = (0.0f - m_InputMean[channel]) * m_InputScale[channel], high = (255.0f - m_InputMean[channel]) * m_InputScale[channel];
+        inputMin = MIN(inputMin, MIN(low, high));
+        inputMax = MAX(inputMax, MAX(low, high));
+    }
+    for (int step = 0; step < self.stepsCount; step++) {
+        CPULayer *kernel = [self kernelOfStep:step], *source = [self sourceOfStep:step], *destination = [self destinationOfStep:step];
+        if (![kernel isKindOfClass:[CPUQuantizedLayer class]]) continue;
+        NSAssert(!source || source.outputMax > source.outputMin, @"Error: input %@ of %@ has no calibrated range", source.name, kernel.name);
+        [(CPUQuantizedLayer *)kernel setInputParams:source? qmath_params_of_range(source.outputMin, source.outputMax) : qmath_params_of_range(inputMin, inputMax)
+                                          quantized:source.quantizedImage
+                                       outputParams:qmath_params_of_range(destination.outputMin, destination.outputMax)
+                                          quantized:destination.quantizedImage];
+    }
+    
+#if ALLOW_PRINT
+    size_t floatBytes = 0, quantizedBytes = 0;
+    for (CPULayer *layer in m_Layers) {
+        if (!layer.ownsImage) continue;
+        floatBytes += layer.outputNum * sizeof(float);
+        quantizedBytes += layer.outputNum * (layer.quantizedImage? sizeof(uint8_t) : sizeof(float));
+    }
+    NSLog(@"Quantization: %lu layers run on int8, %lu images of %lu hold uint8, images take %.2f MB per image instead of %.2f MB",
+          (unsigned long)(quantizedLayers + poolingCount), (unsigned long)images.count, (unsigned long)kernelsOfImages.count,
+          quantizedBytes / 1048576.0, floatBytes / 1048576.0);
+#endif
+}
+
+- (void)startPrefetchingWeights {
+    if (m_Prefetch) return;
+    
+    // parameters outside of the file (e.g. folded into the first layer) are skipped, and
+    // neighbouring ranges are merged, since layers are mostly stored in the order of execution
+    const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    __block size_t count = 0, capacity = 16;
+    __block size_t *ranges = malloc(sizeof(size_t) * 2 * capacity);
+    const char *base = (const char *)m_BasePtr;
+    size_t fileSize = m_FileSize;
+    for (int position = 0; position < self.stepsCount; position++) {
+        [[self kernelOfStep:[self stepAtPosition:position]] enumerateParametersUsingBlock:^(const float *parameters, size_t parametersCount) {
+            const char *begin = (const char *)parameters, *end = (const char *)(parameters + parametersCount);
+            if (begin < base || end > base + fileSize) return;
+            size_t pageBegin = (begin - base) / pageSize * pageSize;
+            size_t pageEnd = MIN((end - base + pageSize - 1) / pageSize * pageSize, fileSize);
+            if (count && pageBegin <= ranges[2 * count - 1] && pageBegin >= ranges[2 * count - 2]) {
+                ranges[2 * count - 1] = MAX(ranges[2 * count - 1], pageEnd);
+                return;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                ranges = realloc(ranges, sizeof(size_t) * 2 * capacity);
+            }
+            ranges[2 * count] = pageBegin;
+            ranges[2 * count + 1] = pageEnd;
+            count++;
+        }];
+    }
+    
+    m_Prefetch = calloc(1, sizeof(struct weight_prefetch));
+    m_Prefetch->base = base;
+    m_Prefetch->ranges = ranges;
+    m_Prefetch->count = count;
+    atomic_init(&m_Prefetch->cancelled, false);
+    int error = pthread_create(&m_Prefetch->thread, NULL, prefetch_weights, m_Prefetch);
+    NSAssert(error == 0, @"Error: failed to create prefetching thread with errno = %d", error);
+}
+
+- (CPUMemoryPlan *)planForBatch:(int)batch {
+    @synchronized (m_Plans) {
+        CPUMemoryPlan *plan = m_Plans[@(batch)];
+        if (!plan) {
+            plan = [self newPlanForBatch:batch persistent:NO];
+            [m_Plans setObject:plan forKey:@(batch)];
+        }
+        return plan;
+    }
+}
+
+- (CPUMemoryPlan *)persistentPlanForBatch:(int)batch {
+    @synchronized (m_Plans) {
+        CPUMemoryPlan *plan = m_Plans[@(-batch)];      // keyed by negative batch sizes not to be mixed up
+        if (!plan) {
+            plan = [self newPlanForBatch:batch persistent:YES];
+            [m_Plans setObject:plan forKey:@(-batch)];
+        }
+        return plan;
+    }
+}
+
+- (CPUMemoryPlan *)newPlanForBatch:(int)batch
+                        persistent:(BOOL)persistent {
+    
+    // every layer with an output image owns a buffer, which is alive from the wave writing it
+    // to the last wave reading it; scratch memory of a layer is only alive during the wave of its step
+    // (lifetimes are counted in waves rather than steps, since steps of a wave may run concurrently)
+    // in a persistent plan, every output is alive all the time and scratch memory also fits -forwardRows:
+    int lastWave = (int)m_Waves.count - 1;
+    NSMutableArray<CPULayer *> *owners = [[NSMutableArray alloc] init];
+    NSMutableDictionary<NSString *, NSNumber *> *ownerIndices = [[NSMutableDictionary alloc] init];
+    for (CPULayer *layer in m_Layers) {
+        if (layer.ownsImage) {
+            [ownerIndices setObject:@(owners.count) forKey:layer.name];
+            [owners addObject:layer];
+        }
+    }
+    
+    memory_plan_buffer *buffers = calloc(owners.count + self.stepsCount, sizeof(memory_plan_buffer));
+    int *reads = calloc(owners.count, sizeof(int));
+    int *scratchIndices = malloc(self.stepsCount * sizeof(int));
+    for (int i = 0; i < owners.count; i++) {
+        buffers[i].size = owners[i].outputNum * (owners[i].quantizedImage? sizeof(uint8_t) : sizeof(float)) * batch;
+        buffers[i].first_use = lastWave + 1;
+        buffers[i].last_use = -1;
+    }
+    
+    size_t bufferNum = owners.count, maxScratchSize = 0;
+    for (int step = 0; step < self.stepsCount; step++) {
+        CPULayer *source = step? m_EncodeSequence[step - 1][1] : nil;
+        int wave = m_WaveOfStep[step];
+        
+        int dstIndex = [ownerIndices[[self destinationOfStep:step].name] intValue];
+        if (buffers[dstIndex].first_use > wave) buffers[dstIndex].first_use = wave;
+        if (buffers[dstIndex].last_use < wave) buffers[dstIndex].last_use = wave;
+        
+        if (source) {
+            int srcIndex = [ownerIndices[source.name] intValue];
+            NSAssert(buffers[srcIndex].first_use < wave, @"Error: %@ is read before written", source.name);
+            if (buffers[srcIndex].last_use < wave) buffers[srcIndex].last_use = wave;
+            reads[srcIndex]++;
+        }
+        
+        size_t scratchSize = [[self kernelOfStep:step] scratchNumForBatch:batch] * sizeof(float);
+        if (persistent) scratchSize = MAX(scratchSize, [[self kernelOfStep:step] rowsScratchNum] * sizeof(float));
+        scratchIndices[step] = scratchSize? (int)bufferNum : -1;
+        if (scratchSize) {
+            buffers[bufferNum++] = (memory_plan_buffer){ .size = scratchSize, .first_use = wave, .last_use = wave };
+            if (scratchSize > maxScratchSize) maxScratchSize = scratchSize;
+        }
+    }
+    
+    for (int i = 0; i < owners.count; i++) {
+        if (owners[i].readCount >= 0) {
+            NSAssert(reads[i] == owners[i].readCount, @"Error: %@ is read %d times, expected %d",
+                     owners[i].name, reads[i], owners[i].readCount);
+        }
+#if ALLOW_PRINT
+        // outputs of all layers are printed after forwarding
+        buffers[i].last_use = lastWave;
+#endif
+        if (persistent) {
+            buffers[i].first_use = 0;
+            buffers[i].last_use = lastWave;
+        }
+    }
+    buffers[[ownerIndices[m_LastLayer.name] intValue]].last_use = lastWave;
+    
+#if ALLOW_PRINT
+    // the naive way: a separate buffer for each output, and one col_data shared by all convolution layers
+    size_t naiveSize = memory_plan_naive_size(buffers, owners.count, MEMORY_PLAN_ALIGNMENT) + maxScratchSize;
+#endif
+    
+    // output of a layer computing in place shares the buffer of its input,
+    // which then lives until the output is read for the last time
+    int *aliases = malloc(owners.count * sizeof(int));
+    for (int i = 0; i < owners.count; i++) {
+        aliases[i] = i;
+    }
+    for (NSArray<CPULayer *> *triplet in m_EncodeSequence) {
+        CPULayer *kernel = triplet[0];
+        if (kernel.inPlace && !persistent) {
+            int srcIndex = aliases[[ownerIndices[triplet[1].name] intValue]];
+            int dstIndex = [ownerIndices[kernel.name] intValue];
+            NSAssert(buffers[srcIndex].size == buffers[dstIndex].size, @"Error: %@ changes size of its input", kernel.name);
+            if (buffers[srcIndex].last_use < buffers[dstIndex].last_use) buffers[srcIndex].last_use = buffers[dstIndex].last_use;
+            buffers[dstIndex].size = 0;
+            aliases[dstIndex] = srcIndex;
+        }
+    }
+#if ALLOW_PRINT
+    size_t lowerBound = memory_plan_lower_bound(buffers, bufferNum, MEMORY_PLAN_ALIGNMENT);
+#endif
+    size_t arenaSize = memory_plan(buffers, bufferNum, MEMORY_PLAN_ALIGNMENT);
+    
+    size_t *inputOffsets = calloc(self.stepsCount, sizeof(size_t));
+    size_t *outputOffsets = calloc(self.stepsCount, sizeof(size_t));
+    size_t *scratchOffsets = calloc(self.stepsCount, sizeof(size_t));
+    for (int step = 0; step < self.stepsCount; step++) {
+        if (step) inputOffsets[step] = buffers[aliases[[ownerIndices[((CPULayer *)m_EncodeSequence[step - 1][1]).name] intValue]]].offset;
+        outputOffsets[step] = buffers[aliases[[ownerIndices[[self destinationOfStep:step].name] intValue]]].offset;
+        if (scratchIndices[step] >= 0) scratchOffsets[step] = buffers[scratchIndices[step]].offset;
+    }
+    size_t probsOffset = buffers[aliases[[ownerIndices[m_LastLayer.name] intValue]]].offset;
+    
+#if ALLOW_PRINT
+    NSLog(@"Activation memory for %sbatch %d: %.2f MB (%.2f MB without planning, lower bound %.2f MB)",
+          persistent? "persistent " : "", batch, arenaSize / 1048576.0, naiveSize / 1048576.0, lowerBound / 1048576.0);
+#endif
+    
+    free(aliases);
+    free(scratchIndices);
+    free(reads);
+    free(buffers);
+    
+    return [[CPUMemoryPlan alloc] initWithBatch:batch
+                                      arenaSize:arenaSize
+                                    probsOffset:probsOffset
+                                   inputOffsets:inputOffsets
+                                  outputOffsets:outputOffsets
+                                 scratchOffsets:scratchOffsets];
+}
+
+- (int)inputSize {
+    return m_InputSize;
+}
+
+- (int)inputNum {
+    return m_InputSize * m_InputSize * 3;
+}
+
+- (int)probsNum {
+    return m_LastLayer.outputNum;
+}
+
+- (int)stepsCount {
+    return (int)m_EncodeSequence.count + 1;
+}
+
+- (NSArray<NSString *> *)labels {
+    
+    // labels of a compiled model are only made into strings when asked for
+    @synchronized (self) {
+        if (!m_Labels && m_Compiled) {
+            const uint32_t *labelOffsets = compiled_model_labels(m_Compiled);
+            NSMutableArray<NSString *> *labels = [[NSMutableArray alloc] initWithCapacity:m_Compiled->label_count];
+            for (uint32_t i = 0; i < m_Compiled->label_count; i++) {
+                [labels addObject:[[NSString alloc] initWithUTF8String:compiled_model_string(m_Compiled, labelOffsets[i])]];
+            }
+            m_Labels = [labels copy];
+        }
+        return m_Labels;
+    }
+}
+
+- (NSArray<NSArray<NSNumber *> *> *)waves {
+    return m_Waves;
+}
+
+- (NSString *)optimizationSummary {
+    return m_OptimizationSummary;
+}
+
+- (const float *)inputMean {
+    return m_InputMean;
+}
+
+- (const float *)inputScale {
+    return m_InputScale;
+}
+
+- (int)exitsCount {
+    return (int)m_Exits.count;
+}
+
+- (NSString *)nameOfExit:(int)exit {
+    return ((CPUModelExit *)m_Exits[exit]).name;
+}
+
+- (int)waveOfExit:(int)exit {
+    return ((CPUModelExit *)m_Exits[exit]).wave;
+}
+
+- (size_t)exitArenaNumOfExit:(int)exit
+                    forBatch:(int)batch {
+    CPUModelExit *info = m_Exits[exit];
+    size_t scratchNum = 0;
+    for (NSArray<CPULayer *> *triplet in info.sequence) {
+        scratchNum = MAX(scratchNum, [triplet[0] scratchNumForBatch:batch]);
+    }
+    return (size_t)info.outputsNum * batch + scratchNum;
+}
+
+- (const float *)forwardExit:(int)exit
+                       arena:(char *)arena
+                        plan:(CPUMemoryPlan *)plan
+                   exitArena:(float *)exitArena
+                       batch:(int)batch
+                  threadpool:(pthreadpool_t)threadpool {
+    CPUModelExit *info = m_Exits[exit];
+    float *scratch = exitArena + (size_t)info.outputsNum * batch;
+    for (NSArray<CPULayer *> *triplet in info.sequence) {
+        CPULayer *kernel = triplet[0];
+        const float *input = triplet[1] == info.branch? (const float *)(arena + [plan outputOffsetOfStep:info.branchStep]) :
+                                                        exitArena + (size_t)[info.offsets[triplet[1].name] intValue] * batch;
+        float *output = exitArena + (size_t)[info.offsets[triplet[2].name] intValue] * batch;
+        [kernel forwardWithInput:input
+                          output:output + kernel.destinationOffset
+                         scratch:scratch
+                           batch:batch
+                      threadpool:threadpool];
+    }
+    
+    return exitArena + (size_t)[info.offsets[info.lastLayer.name] intValue] * batch;
+}
+
+- (int)stepAtPosition:(int)position {
+    return m_StepOrder[position];
+}
+
+- (CPULayer *)kernelOfStep:(int)step {
+    return step? m_EncodeSequence[step - 1][0] : m_FirstLayer;
+}
+
+- (CPULayer *)sourceOfStep:(int)step {
+    return step? m_EncodeSequence[step - 1][1] : nil;
+}
+
+- (CPULayer *)destinationOfStep:(int)step {
+    return step? m_EncodeSequence[step - 1][2] : m_FirstLayer;
+}
+
+- (void)forwardStep:(int)step
+          imageData:(const float *)imageData
+              arena:(char *)arena
+               plan:(CPUMemoryPlan *)plan
+              batch:(int)batch
+         threadpool:(pthreadpool_t)threadpool {
+    CPULayer *kernel = [self kernelOfStep:step];
+    const float *input = step? (const float *)(arena + [plan inputOffsetOfStep:step]) : imageData;
+    size_t elementSize = [self destinationOfStep:step].quantizedImage? sizeof(uint8_t) : sizeof(float);
+    float *output = (float *)(arena + [plan outputOffsetOfStep:step] + kernel.destinationOffset * elementSize);
+    [kernel forwardWithInput:input
+                      output:output
+                     scratch:(float *)(arena + [plan scratchOffsetOfStep:step])
+                       batch:batch
+                  threadpool:threadpool];
+}
+
+- (void)dealloc {
+    
+    // stop prefetching before unmapping
+    if (m_Prefetch) {
+        atomic_store(&m_Prefetch->cancelled, true);
+        pthread_join(m_Prefetch->thread, NULL);
+        free(m_Prefetch->ranges);
+        free(m_Prefetch);
+    }
+    
+    // the data file is closed with the last model using m_Weights
+    if (m_Compiled) munmap((void *)m_Compiled, m_CompiledSize);
+    
+    // release pointers
+    if (m_WaveOfStep) free(m_WaveOfStep);
+    if (m_StepOrder)  free(m_StepOrder);
+}
+
+@end
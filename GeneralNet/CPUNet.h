@@ -2,32 +2,49 @@
 //  CPUNet.h
 //  GeneralNet
 //
-//  Created by Lun on 2017/8/19.
-//  Copyright © 2017年 Lun. All rights reserved.
+//  Created by Lun on 2017/8/19.
+//  Copyright © 2017年 Lun. All rights reserved.
 //
 
 #import <Foundation/Foundation.h>
 #import <UIKit/UIKit.h>
 #import "GeneralNetProtocol.h"
 
-@class CPULayer;
+@class CPUModel;
+@class CPUSession;
 
+// a model with one session of all cores, to serve concurrent requests create more CPUSession of the same model
 @interface CPUNet : NSObject <GeneralNetProtocol> {
 @protected
-    
-    float *m_BasePtr;
-    int m_Fd;
-    size_t m_FileSize;
-    int m_InputSize;
-    unsigned char *m_ImageRawData;
-    float *m_ImageData;
-    float *m_ColData;
-    
-    CPULayer *m_FirstLayer;
-    CPULayer *m_LastLayer;
-    NSDictionary *m_LayersDict;
-    NSArray *m_EncodeSequence;
-    NSArray *m_Labels;
+    CPUModel *m_Model;
+    CPUSession *m_Session;
 }
 
+@property (readonly, nonatomic) CPUModel *model;
+@property (readonly, nonatomic) CPUSession *session;
+
+// the input image of the first layer, which is 3 channels of input_size x input_size
+@property (readonly, nonatomic) int inputNum;
+
+- (instancetype)initWithDescriptionFile:(NSString *)descriptionFile
+                               dataFile:(NSString *)dataFile;
+
+// a model compiled by Convert/compile_model.py, see CPUModel
+- (instancetype)initWithCompiledFile:(NSString *)compiledFile
+                            dataFile:(NSString *)dataFile;
+
+// write an image into data in the layout of input, i.e. resized, normalized by inputMean and inputScale of the model, and in BGR order
+- (void)preprocessImage:(UIImage *)image
+                 toData:(float *)data;
+
+// forward a batch of images, which are preprocessed and stored one after another in imageData
+- (void)forwardWithImageData:(const float *)imageData
+                       batch:(int)batch;
+
+- (void)forwardWithImages:(NSArray<UIImage *> *)images
+               completion:(void (^)())completion;
+
+// labels of the top k probabilities of each image in the last batch
+- (NSArray<NSString *> *)labelsOfTopProbsInBatch:(int)topK;
+
 @end
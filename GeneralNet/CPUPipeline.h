@@ -0,0 +1,50 @@
+//
+//  CPUPipeline.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/10.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "pthreadpool.h"
+#import "spscRing.h"
+
+@class CPUModel;
+@class CPUMemoryPlan;
+
+struct pipeline_stage;
+
+// Streams images through a CPUModel for throughput: the steps are split into stages of about the same
+// measured cost, each stage runs on its own thread with its own threadpool (pinned to its own cores on Linux),
+// and several images are in flight at the same time, each with its own arena. Stages hand images over
+// through lock-free single-producer/single-consumer rings, so the throughput is limited by the slowest stage.
+// Images should be pushed from one thread and popped from one thread.
+@interface CPUPipeline : NSObject {
+@protected
+    CPUModel *m_Model;
+    CPUMemoryPlan *m_Plan;
+    int m_InputNum;
+    int m_ProbsNum;
+    float *m_ImageData;             // input images of all slots
+    char **m_Arenas;                // arena of each slot
+    struct pipeline_stage *m_Stages;
+    spsc_ring *m_Rings;             // ring i feeds stage i, the last ring holds finished slots
+    spsc_ring m_FreeSlots;
+}
+
+@property (readonly, nonatomic) int stagesCount;
+@property (readonly, nonatomic) int inFlightCount;
+
+- (instancetype)initWithModel:(CPUModel *)model
+                  stagesCount:(int)stagesCount
+                inFlightCount:(int)inFlightCount;
+
+// imageData is one image preprocessed by -[CPUSession preprocessImage:toData:], and is copied before returning
+// blocks while inFlightCount images are in the pipeline
+- (void)pushImageData:(const float *)imageData;
+
+// blocks until the oldest image in the pipeline finishes, and copies its probabilities
+- (void)popProbs:(float *)probs;
+
+@end
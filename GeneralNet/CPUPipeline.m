@@ -0,0 +1,224 @@
+//
+//  CPUPipeline.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/10.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifdef __linux__
+#define _GNU_SOURCE     // pthread_setaffinity_np
+#endif
+
+#import <math.h>
+#import <pthread.h>
+#import <sched.h>
+#import "CPUPipeline.h"
+#import "CPUModel.h"
+#import "CPUSession.h"
+#import "memoryPlanner.h"
+
+struct pipeline_stage {
+    __unsafe_unretained CPUModel *model;
+    __unsafe_unretained CPUMemoryPlan *plan;
+    NSRange steps;          // positions in the order of execution
+    spsc_ring *input;
+    spsc_ring *output;
+    char **arenas;
+    float *imageData;
+    int inputNum;
+    int firstCore;
+    int coresCount;
+    pthreadpool_t threadpool;
+    pthread_t thread;
+};
+
+static void *run_stage(void *argument) {
+    struct pipeline_stage *stage = argument;
+    
+#ifdef __linux__
+    // threads of the threadpool inherit the affinity of this thread
+    cpu_set_t cores;
+    CPU_ZERO(&cores);
+    for (int core = stage->firstCore; core < stage->firstCore + stage->coresCount; core++) {
+        CPU_SET(core, &cores);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(cores), &cores);
+#endif
+    stage->threadpool = pthreadpool_create(stage->coresCount);
+    
+    // a negative slot means the pipeline is being released, pass it on and quit
+    while (true) {
+        int slot = spsc_ring_pop(stage->input);
+        if (slot >= 0) {
+            @autoreleasepool {
+                for (NSUInteger position = stage->steps.location; position < NSMaxRange(stage->steps); position++) {
+                    [stage->model forwardStep:[stage->model stepAtPosition:(int)position]
+                                    imageData:stage->imageData + (size_t)slot * stage->inputNum
+                                        arena:stage->arenas[slot]
+                                         plan:stage->plan
+                                        batch:1
+                                   threadpool:stage->threadpool];
+                }
+            }
+        }
+        spsc_ring_push(stage->output, slot);
+        if (slot < 0) break;
+    }
+    
+    return NULL;
+}
+
+// split costs into partsCount contiguous ranges so that the largest total cost of a range is minimized
+// ends[i] will be the end (exclusive) of range i
+static void partition_costs(const double *costs, int count, int partsCount, int *ends) {
+    double *prefix = calloc(count + 1, sizeof(double));
+    double *best = malloc(sizeof(double) * (partsCount + 1) * (count + 1));     // best[k][i]: first i costs in k parts
+    int *split = calloc((partsCount + 1) * (count + 1), sizeof(int));
+    for (int i = 0; i < count; i++) {
+        prefix[i + 1] = prefix[i] + costs[i];
+    }
+    
+    for (int i = 0; i <= count; i++) {
+        best[i] = i? INFINITY : 0;
+    }
+    for (int k = 1; k <= partsCount; k++) {
+        for (int i = 0; i <= count; i++) {
+            best[k * (count + 1) + i] = INFINITY;
+            for (int j = k - 1; j < i; j++) {       // the last part is [j, i), no part is empty
+                double cost = fmax(best[(k - 1) * (count + 1) + j], prefix[i] - prefix[j]);
+                if (cost < best[k * (count + 1) + i]) {
+                    best[k * (count + 1) + i] = cost;
+                    split[k * (count + 1) + i] = j;
+                }
+            }
+        }
+    }
+    
+    for (int k = partsCount, i = count; k > 0; k--) {
+        ends[k - 1] = i;
+        i = split[k * (count + 1) + i];
+    }
+    
+    free(split);
+    free(best);
+    free(prefix);
+}
+
+@implementation CPUPipeline
+
+- (instancetype)initWithModel:(CPUModel *)model
+                  stagesCount:(int)stagesCount
+                inFlightCount:(int)inFlightCount {
+    if (self = [super init]) {
+        NSAssert(stagesCount > 0 && inFlightCount > 0, @"Error: need at least one stage and one image in flight");
+        m_Model = model;
+        m_Plan = [model planForBatch:1];
+        m_InputNum = model.inputNum;
+        m_ProbsNum = model.probsNum;
+        _stagesCount = MIN(stagesCount, model.stepsCount);
+        _inFlightCount = inFlightCount;
+        
+        // cores are split evenly between stages, and shared if there are not enough
+        int coresCount = (int)[NSProcessInfo processInfo].activeProcessorCount;
+        int coresPerStage = MAX(coresCount / _stagesCount, 1);
+        
+        // balance stages by cost of steps measured on as many threads as a stage has, since steps do not all
+        // speed up alike with more threads
+        CPUSession *session = [[CPUSession alloc] initWithModel:model threadsCount:coresPerStage];
+        NSArray<NSNumber *> *stepCosts = [session measureStepCostsWithRounds:3];
+        double *costs = malloc(sizeof(double) * stepCosts.count);
+        int *ends = malloc(sizeof(int) * _stagesCount);
+        for (int i = 0; i < stepCosts.count; i++) {
+            costs[i] = stepCosts[i].doubleValue;
+        }
+        partition_costs(costs, (int)stepCosts.count, _stagesCount, ends);
+        
+        // every slot has its own input and arena, and a ring can hold all slots plus the quitting mark
+        m_ImageData = malloc(sizeof(float) * m_InputNum * _inFlightCount);
+        m_Arenas = malloc(sizeof(char *) * _inFlightCount);
+        for (int slot = 0; slot < _inFlightCount; slot++) {
+            int error = posix_memalign((void **)&m_Arenas[slot], MEMORY_PLAN_ALIGNMENT, m_Plan.arenaSize);
+            NSAssert(error == 0, @"Error: failed to allocate arena with errno = %d", error);
+        }
+        m_Rings = malloc(sizeof(spsc_ring) * (_stagesCount + 1));
+        for (int i = 0; i <= _stagesCount; i++) {
+            spsc_ring_init(&m_Rings[i], _inFlightCount + 1);
+        }
+        spsc_ring_init(&m_FreeSlots, _inFlightCount);
+        for (int slot = 0; slot < _inFlightCount; slot++) {
+            spsc_ring_push(&m_FreeSlots, slot);
+        }
+        
+        m_Stages = calloc(_stagesCount, sizeof(struct pipeline_stage));
+        for (int i = 0; i < _stagesCount; i++) {
+            struct pipeline_stage *stage = &m_Stages[i];
+            int start = i? ends[i - 1] : 0;
+            stage->model = model;
+            stage->plan = m_Plan;
+            stage->steps = NSMakeRange(start, ends[i] - start);
+            stage->input = &m_Rings[i];
+            stage->output = &m_Rings[i + 1];
+            stage->arenas = m_Arenas;
+            stage->imageData = m_ImageData;
+            stage->inputNum = m_InputNum;
+            stage->firstCore = coresCount >= _stagesCount? i * coresPerStage : i % coresCount;
+            stage->coresCount = coresCount >= _stagesCount && i == _stagesCount - 1? coresCount - stage->firstCore : coresPerStage;
+            
+#if ALLOW_PRINT
+            double stageCost = 0;
+            for (int step = start; step < ends[i]; step++) {
+                stageCost += costs[step];
+            }
+            NSLog(@"Pipeline stage %d: steps %d to %d, %.2f ms, cores %d to %d", i, start, ends[i] - 1,
+                  stageCost * 1000, stage->firstCore, stage->firstCore + stage->coresCount - 1);
+#endif
+            
+            int error = pthread_create(&stage->thread, NULL, run_stage, stage);
+            NSAssert(error == 0, @"Error: failed to create thread for stage %d with errno = %d", i, error);
+        }
+        
+        free(ends);
+        free(costs);
+    }
+    
+    return self;
+}
+
+- (void)pushImageData:(const float *)imageData {
+    int slot = spsc_ring_pop(&m_FreeSlots);
+    memcpy(m_ImageData + (size_t)slot * m_InputNum, imageData, sizeof(float) * m_InputNum);
+    spsc_ring_push(&m_Rings[0], slot);
+}
+
+- (void)popProbs:(float *)probs {
+    int slot = spsc_ring_pop(&m_Rings[_stagesCount]);
+    memcpy(probs, m_Arenas[slot] + m_Plan.probsOffset, sizeof(float) * m_ProbsNum);
+    spsc_ring_push(&m_FreeSlots, slot);
+}
+
+- (void)dealloc {
+    
+    // send the quitting mark through all stages, dropping images not popped yet
+    spsc_ring_push(&m_Rings[0], -1);
+    while (spsc_ring_pop(&m_Rings[_stagesCount]) >= 0);
+    for (int i = 0; i < _stagesCount; i++) {
+        pthread_join(m_Stages[i].thread, NULL);
+        pthreadpool_destroy(m_Stages[i].threadpool);
+    }
+    
+    // release pointers
+    for (int i = 0; i <= _stagesCount; i++) {
+        spsc_ring_destroy(&m_Rings[i]);
+    }
+    spsc_ring_destroy(&m_FreeSlots);
+    for (int slot = 0; slot < _inFlightCount; slot++) {
+        free(m_Arenas[slot]);
+    }
+    free(m_Arenas);
+    free(m_ImageData);
+    free(m_Rings);
+    free(m_Stages);
+}
+
+@end
@@ -0,0 +1,67 @@
+//
+//  CPUProfile.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/17.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "perfCounters.h"
+
+@class CPUModel;
+
+// totals of a step over the profiled runs
+struct step_profile {
+    double time;        // seconds
+    double flops;
+    double bytes;
+    perf_counter_values counters;   // of the calling thread and workers of its threadpool
+};
+
+// Time of each step recorded by a profiling CPUSession, next to the floating point operations and bytes
+// the layer should need (see -[CPULayer flops] and -[CPULayer bytesForBatch:]). Achieved GFLOP/s and GB/s
+// tell compute-bound layers from bandwidth-bound ones: a layer with few FLOPs per byte reaching a high GB/s
+// is limited by memory, one with many FLOPs per byte reaching a high GFLOP/s is limited by arithmetic.
+//
+// With hardware counters, each step also gets cycles, instructions, cache and TLB misses and stalled cycles,
+// and threads lists the totals of each worker thread, which shows how evenly a threadpool splits the work.
+@interface CPUProfile : NSObject {
+@protected
+    NSArray<NSDictionary<NSString *, id> *> *m_Steps;
+    NSArray<NSDictionary<NSString *, id> *> *m_Threads;
+}
+
+@property (readonly, nonatomic) int runs;
+@property (readonly, nonatomic) int images;
+@property (readonly, nonatomic) NSTimeInterval wallTime;   // of whole forwardings, less than the sum of steps if waves run concurrently
+
+@property (readonly, nonatomic) unsigned countersMask;     // counters that were read, see perfCounters.h
+
+// one dictionary for each step in the order of execution, with the keys of -JSONData
+@property (readonly, nonatomic) NSArray<NSDictionary<NSString *, id> *> *steps;
+@property (readonly, nonatomic) NSArray<NSDictionary<NSString *, id> *> *threads;
+
+// stepProfiles is indexed by step, threads are {"threadpool", "thread", "counters"} with counters per run
+- (instancetype)initWithModel:(CPUModel *)model
+                 stepProfiles:(const struct step_profile *)stepProfiles
+                         runs:(int)runs
+                       images:(int)images
+                     wallTime:(NSTimeInterval)wallTime
+                 countersMask:(unsigned)countersMask
+                      threads:(NSArray<NSDictionary<NSString *, id> *> *)threads;
+
+// counters in the mask keyed by their names, multiplied by scale
++ (NSDictionary<NSString *, NSNumber *> *)dictionaryWithCounters:(const perf_counter_values *)counters
+                                                            mask:(unsigned)mask
+                                                           scale:(double)scale;
+
+// a table for people, one row for each step, and the total, then counters of each step and thread if any
+- (NSString *)table;
+
+// {"runs", "images", "wall_time_ms", "steps": [{"position", "step", "layer", "type", "time_ms",
+// "share", "flops", "bytes", "gflops", "gbps", "flops_per_byte", "counters", "ipc"}, ...], "threads": [...]},
+// times and counts are per run; counters are {"cycles", "instructions", ...} of available counters only
+- (NSData *)JSONData;
+
+@end
@@ -0,0 +1,166 @@
+//
+//  CPUProfile.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/17.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPUProfile.h"
+#import "CPUModel.h"
+#import "CPULayer.h"
+
+@implementation CPUProfile
+
+- (instancetype)initWithModel:(CPUModel *)model
+                 stepProfiles:(const struct step_profile *)stepProfiles
+                         runs:(int)runs
+                       images:(int)images
+                     wallTime:(NSTimeInterval)wallTime
+                 countersMask:(unsigned)countersMask
+                      threads:(NSArray<NSDictionary<NSString *, id> *> *)threads {
+    if (self = [super init]) {
+        _runs = runs;
+        _images = images;
+        _wallTime = wallTime;
+        _countersMask = countersMask;
+        m_Threads = threads? [threads copy] : @[];
+
+        double totalTime = 0;
+        for (int step = 0; step < model.stepsCount; step++) {
+            totalTime += stepProfiles[step].time;
+        }
+
+        // everything is per run, so that profiles of different numbers of runs compare
+        NSMutableArray<NSDictionary<NSString *, id> *> *steps = [[NSMutableArray alloc] initWithCapacity:model.stepsCount];
+        double perRun = 1.0 / MAX(runs, 1);
+        for (int position = 0; position < model.stepsCount; position++) {
+            int step = [model stepAtPosition:position];
+            CPULayer *kernel = [model kernelOfStep:step];
+            const struct step_profile *profile = &stepProfiles[step];
+
+            // CPUConvolutionLayer -> Convolution
+            NSString *type = NSStringFromClass([kernel class]);
+            if ([type hasPrefix:@"CPU"]) type = [type substringFromIndex:3];
+            if ([type hasSuffix:@"Layer"]) type = [type substringToIndex:type.length - 5];
+
+            NSMutableDictionary<NSString *, id> *record = [@{@"position": @(position),
+                                                             @"step": @(step),
+                                                             @"layer": kernel.name,
+                                                             @"type": type,
+                                                             @"time_ms": @(profile->time * perRun * 1000),
+                                                             @"share": @(totalTime > 0? profile->time / totalTime : 0),
+                                                             @"flops": @(profile->flops * perRun),
+                                                             @"bytes": @(profile->bytes * perRun),
+                                                             @"gflops": @(profile->time > 0? profile->flops / profile->time / 1e9 : 0),
+                                                             @"gbps": @(profile->time > 0? profile->bytes / profile->time / 1e9 : 0),
+                                                             @"flops_per_byte": @(profile->bytes > 0? profile->flops / profile->bytes : 0)} mutableCopy];
+            if (countersMask) {
+                const double *counts = profile->counters.counts;
+                [record setObject:[CPUProfile dictionaryWithCounters:&profile->counters mask:countersMask scale:perRun] forKey:@"counters"];
+                if (counts[PERF_COUNTER_CYCLES] > 0) [record setObject:@(counts[PERF_COUNTER_INSTRUCTIONS] / counts[PERF_COUNTER_CYCLES]) forKey:@"ipc"];
+            }
+            [steps addObject:[record copy]];
+        }
+        m_Steps = [steps copy];
+    }
+
+    return self;
+}
+
++ (NSDictionary<NSString *, NSNumber *> *)dictionaryWithCounters:(const perf_counter_values *)counters
+                                                            mask:(unsigned)mask
+                                                           scale:(double)scale {
+    NSMutableDictionary<NSString *, NSNumber *> *dictionary = [[NSMutableDictionary alloc] init];
+    for (int counter = 0; counter < PERF_COUNTERS_COUNT; counter++) {
+        if (mask & (1u << counter)) {
+            [dictionary setObject:@(counters->counts[counter] * scale) forKey:@(perf_counter_name(counter))];
+        }
+    }
+    return [dictionary copy];
+}
+
+- (NSArray<NSDictionary<NSString *, id> *> *)steps {
+    return m_Steps;
+}
+
+- (NSArray<NSDictionary<NSString *, id> *> *)threads {
+    return m_Threads;
+}
+
+// millions of each available counter, IPC if cycles and instructions are there
+- (void)appendCounters:(NSDictionary<NSString *, NSNumber *> *)counters
+               toTable:(NSMutableString *)table {
+    for (int counter = 0; counter < PERF_COUNTERS_COUNT; counter++) {
+        if (_countersMask & (1u << counter)) {
+            [table appendFormat:@" %14.3f", [counters[@(perf_counter_name(counter))] doubleValue] / 1e6];
+        }
+    }
+    double cycles = [counters[@(perf_counter_name(PERF_COUNTER_CYCLES))] doubleValue];
+    if (cycles > 0 && counters[@(perf_counter_name(PERF_COUNTER_INSTRUCTIONS))]) {
+        [table appendFormat:@" %5.2f", [counters[@(perf_counter_name(PERF_COUNTER_INSTRUCTIONS))] doubleValue] / cycles];
+    }
+    [table appendString:@"\n"];
+}
+
+- (NSString *)table {
+    NSMutableString *table = [[NSMutableString alloc] init];
+    [table appendFormat:@"%d runs, %d images, %.3f ms per run\n", _runs, _images, _wallTime / MAX(_runs, 1) * 1000];
+    [table appendFormat:@"%4s %4s  %-32s %-20s %9s %6s %9s %8s %7s\n",
+     "pos", "step", "layer", "type", "ms", "share", "GFLOP/s", "GB/s", "FLOP/B"];
+
+    double time = 0, flops = 0, bytes = 0;
+    for (NSDictionary<NSString *, id> *step in m_Steps) {
+        [table appendFormat:@"%4d %4d  %-32.32s %-20.20s %9.3f %5.1f%% %9.2f %8.2f %7.2f\n",
+         [step[@"position"] intValue],
+         [step[@"step"] intValue],
+         [step[@"layer"] UTF8String],
+         [step[@"type"] UTF8String],
+         [step[@"time_ms"] doubleValue],
+         [step[@"share"] doubleValue] * 100,
+         [step[@"gflops"] doubleValue],
+         [step[@"gbps"] doubleValue],
+         [step[@"flops_per_byte"] doubleValue]];
+        time += [step[@"time_ms"] doubleValue] / 1000;
+        flops += [step[@"flops"] doubleValue];
+        bytes += [step[@"bytes"] doubleValue];
+    }
+    [table appendFormat:@"%4s %4s  %-32s %-20s %9.3f %5.1f%% %9.2f %8.2f %7.2f\n",
+     "", "", "total", "", time * 1000, 100.0,
+     time > 0? flops / time / 1e9 : 0, time > 0? bytes / time / 1e9 : 0, bytes > 0? flops / bytes : 0];
+    if (!_countersMask) return [table copy];
+
+    // hardware counters in millions per run
+    [table appendFormat:@"\n%4s %4s  %-32s", "pos", "step", "layer"];
+    for (int counter = 0; counter < PERF_COUNTERS_COUNT; counter++) {
+        if (_countersMask & (1u << counter)) [table appendFormat:@" %14s", perf_counter_name(counter)];
+    }
+    [table appendString:(_countersMask & (1u << PERF_COUNTER_CYCLES)) && (_countersMask & (1u << PERF_COUNTER_INSTRUCTIONS))? @"   IPC\n" : @"\n"];
+    for (NSDictionary<NSString *, id> *step in m_Steps) {
+        [table appendFormat:@"%4d %4d  %-32.32s", [step[@"position"] intValue], [step[@"step"] intValue], [step[@"layer"] UTF8String]];
+        [self appendCounters:step[@"counters"] toTable:table];
+    }
+    for (NSDictionary<NSString *, id> *thread in m_Threads) {
+        NSString *name = [NSString stringWithFormat:@"threadpool %@ thread %@", thread[@"threadpool"], thread[@"thread"]];
+        [table appendFormat:@"%4s %4s  %-32.32s", "", "", name.UTF8String];
+        [self appendCounters:thread[@"counters"] toTable:table];
+    }
+
+    return [table copy];
+}
+
+- (NSData *)JSONData {
+    NSMutableArray<NSString *> *counters = [[NSMutableArray alloc] init];
+    for (int counter = 0; counter < PERF_COUNTERS_COUNT; counter++) {
+        if (_countersMask & (1u << counter)) [counters addObject:@(perf_counter_name(counter))];
+    }
+    NSDictionary *profile = @{@"runs": @(_runs),
+                              @"images": @(_images),
+                              @"wall_time_ms": @(_wallTime / MAX(_runs, 1) * 1000),
+                              @"counters_available": counters,
+                              @"steps": m_Steps,
+                              @"threads": m_Threads};
+    return [NSJSONSerialization dataWithJSONObject:profile options:NSJSONWritingPrettyPrinted error:NULL];
+}
+
+@end
@@ -0,0 +1,140 @@
+//
+//  CPUQuantizedLayer.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPULayer.h"
+#import "quantizedMath.h"
+
+// Layers of a net quantized by Convert/quantize_weights.py, whose convolution and fully connected layers have
+// int8 weights with a scale for each output channel. Images between quantized layers hold uint8 of the range
+// calibrated by Benchmark/calibrate.m instead of floats (quantizedImage of the layer owning them), max pooling
+// and concat work on them directly, and convolution and fully connected layers requantize their int32 sums
+// straight into their outputs. CPUModel decides which images hold uint8: those written and read only by these
+// layers; others, e.g. read by softmax, LRN or an exit, stay floats, which the layers writing them dequantize
+// into and those reading them quantize first, so that the rest of the net runs as it is.
+//
+// Input and output pointers are still passed as float *, and images of uint8 are as many bytes as they have
+// elements; batches of them are inputNum and destinationStride bytes apart.
+@interface CPUQuantizedLayer : CPULayer {
+@protected
+    qmath_params m_InputParams;
+    qmath_params m_OutputParams;
+    BOOL m_InputQuantized;
+    BOOL m_OutputQuantized;
+}
+
+@property (readonly, nonatomic) BOOL inputQuantized;
+@property (readonly, nonatomic) BOOL outputQuantized;
+
+// called once by CPUModel after deciding which images hold uint8: the input is uint8 of inputParams if inputQuantized,
+// otherwise floats the layer quantizes with inputParams itself; the output is uint8 of outputParams if
+// outputQuantized, otherwise floats
+- (void)setInputParams:(qmath_params)inputParams
+             quantized:(BOOL)inputQuantized
+          outputParams:(qmath_params)outputParams
+             quantized:(BOOL)outputQuantized;
+
+// subclasses compute what depends on the params here, e.g. int32 biases, nothing by default
+- (void)prepareQuantization;
+
+@end
+
+@interface CPUQuantizedConvolutionLayer : CPUQuantizedLayer {
+@protected
+    const int8_t *m_Weight;
+    const float *m_WeightScales;
+    const float *m_Biases;
+    int m_InputChannel;
+    int m_OutputChannel;
+    int m_InputSize;
+    int m_OutputSize;
+    int m_KernelSize;
+    int m_Pad;
+    int m_Stride;
+    int m_Group;
+    BOOL m_ReLU;
+    int m_M;
+    int m_N;
+    int m_K;
+    int m_InputPerGroup;
+    int m_OutputPerGroup;
+    int m_WeightPerGroup;
+    BOOL m_Pointwise;           // 1x1 without padding or stride, which reads the input as col_data
+    int8_t *m_FoldedWeight;     // owned copies after folding the input normalization
+    float *m_FoldedWeightScales;
+    float *m_FoldedBiases;
+    float *m_PadValues;         // value of padding of each input channel, 0 if NULL
+    int32_t *m_QuantizedBiases;
+    float *m_Multipliers;
+    uint8_t *m_QuantizedPadValues;
+}
+
+- (instancetype)initWithName:(NSString *)name
+                      weight:(const int8_t *)weight
+                weightScales:(const float *)weightScales
+                        bias:(const float *)bias
+                       group:(int)group
+                inputChannel:(int)inputChannel
+               outputChannel:(int)outputChannel
+                   inputSize:(int)inputSize
+                  outputSize:(int)outputSize
+                  kernelSize:(int)kernelSize
+                         pad:(int)pad
+                      stride:(int)stride
+                      doReLU:(BOOL)doReLU;
+
+// the same as -[CPUConvolutionLayer foldInputMean:scale:], weights are quantized again after being scaled,
+// and the raw input of the first layer is pixels, which uint8 holds exactly
+- (void)foldInputMean:(const float *)mean
+                scale:(const float *)scale;
+
+@end
+
+@interface CPUQuantizedFullyConnectedLayer : CPUQuantizedLayer {
+@protected
+    const int8_t *m_Weight;
+    const float *m_WeightScales;
+    const float *m_Biases;
+    int m_InputChannel;
+    int m_OutputChannel;
+    int m_InputSize;
+    BOOL m_ReLU;
+    int m_M;
+    int m_N;
+    int32_t *m_QuantizedBiases;
+    float *m_Multipliers;
+}
+
+- (instancetype)initWithName:(NSString *)name
+                      weight:(const int8_t *)weight
+                weightScales:(const float *)weightScales
+                        bias:(const float *)bias
+                inputChannel:(int)inputChannel
+               outputChannel:(int)outputChannel
+                   inputSize:(int)inputSize
+                      doReLU:(BOOL)doReLU;
+
+@end
+
+// max pooling of uint8, whose input and output are both quantized; max commutes with quantization, so that
+// outputs are only mapped through a table when the output has another range than the input
+@interface CPUQuantizedPoolingLayer : CPUQuantizedLayer {
+@protected
+    int m_InputSize;
+    int m_OutputSize;
+    int m_InputChannel;
+    int m_KernelSize;
+    int m_Pad;
+    int m_Stride;
+    BOOL m_Requantize;
+    uint8_t m_Table[256];
+}
+
+// takes the name, sizes and place in the graph of a max pooling layer
+- (instancetype)initWithPooling:(CPUPoolingLayer *)pooling;
+
+@end
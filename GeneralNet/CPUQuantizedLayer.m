@@ -0,0 +1,469 @@
+//
+//  CPUQuantizedLayer.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPUQuantizedLayer.h"
+
+// parts of scratch memory are 64-byte aligned, like buffers of the arena
+static size_t align_bytes(size_t bytes) {
+    return (bytes + 63) / 64 * 64;
+}
+
+static size_t floats_of_bytes(size_t bytes) {
+    return (bytes + sizeof(float) - 1) / sizeof(float);
+}
+
+@implementation CPUQuantizedLayer
+
+@synthesize inputQuantized = m_InputQuantized;
+@synthesize outputQuantized = m_OutputQuantized;
+
+- (void)setInputParams:(qmath_params)inputParams
+             quantized:(BOOL)inputQuantized
+          outputParams:(qmath_params)outputParams
+             quantized:(BOOL)outputQuantized {
+    m_InputParams = inputParams;
+    m_InputQuantized = inputQuantized;
+    m_OutputParams = outputParams;
+    m_OutputQuantized = outputQuantized;
+    [self prepareQuantization];
+}
+
+- (void)prepareQuantization {
+}
+
+// bytes of scratch memory holding the input quantized by the layer itself, none if it is already uint8
+- (size_t)quantizedInputBytesForBatch:(int)batch {
+    return m_InputQuantized? 0 : align_bytes((size_t)self.inputNum * batch);
+}
+
+- (const uint8_t *)quantizedInput:(const float *)input
+                            batch:(int)batch
+                          scratch:(uint8_t *)scratch {
+    if (m_InputQuantized) return (const uint8_t *)input;
+    qmath_quantize(input, m_InputParams, scratch, (size_t)self.inputNum * batch);
+    return scratch;
+}
+
+- (size_t)inputElementSize {
+    return m_InputQuantized? sizeof(uint8_t) : sizeof(float);
+}
+
+- (size_t)outputElementSize {
+    return m_OutputQuantized? sizeof(uint8_t) : sizeof(float);
+}
+
+@end
+
+// the same as im2col of CPULayer.m for uint8 of square images without dilation, padding takes the value of each channel
+static void im2col_u8(const uint8_t *data_im,
+                      const int channels,
+                      const int input_size,
+                      const int output_size,
+                      const int kernel_size,
+                      const int pad,
+                      const int stride,
+                      const uint8_t *pad_values,
+                      uint8_t *data_col) {
+    for (int channel = 0; channel < channels; channel++) {
+        const uint8_t *image = data_im + (size_t)channel * input_size * input_size;
+        for (int kernel_row = 0; kernel_row < kernel_size; kernel_row++) {
+            for (int kernel_col = 0; kernel_col < kernel_size; kernel_col++) {
+                uint8_t *col = data_col + ((size_t)(channel * kernel_size + kernel_row) * kernel_size + kernel_col) * output_size * output_size;
+
+                // output columns [x_begin, x_end) read inside the image
+                const int offset = kernel_col - pad;
+                int x_begin = offset >= 0? 0 : (-offset + stride - 1) / stride;
+                int x_end = input_size - offset <= 0? 0 : (input_size - offset + stride - 1) / stride;
+                x_begin = x_begin < output_size? x_begin : output_size;
+                x_end = x_end < x_begin? x_begin : x_end < output_size? x_end : output_size;
+                for (int output_row = 0; output_row < output_size; output_row++) {
+                    uint8_t *row = col + output_row * output_size;
+                    const int input_row = output_row * stride - pad + kernel_row;
+                    if (input_row < 0 || input_row >= input_size) {
+                        memset(row, pad_values[channel], output_size);
+                        continue;
+                    }
+                    const uint8_t *source = image + input_row * input_size + offset;
+                    memset(row, pad_values[channel], x_begin);
+                    if (stride == 1) {
+                        memcpy(row + x_begin, source + x_begin, x_end - x_begin);
+                    } else {
+                        for (int x = x_begin; x < x_end; x++) {
+                            row[x] = source[x * stride];
+                        }
+                    }
+                    memset(row + x_end, pad_values[channel], output_size - x_end);
+                }
+            }
+        }
+    }
+}
+
+@implementation CPUQuantizedConvolutionLayer
+
+- (instancetype)initWithName:(NSString *)name
+                      weight:(const int8_t *)weight
+                weightScales:(const float *)weightScales
+                        bias:(const float *)bias
+                       group:(int)group
+                inputChannel:(int)inputChannel
+               outputChannel:(int)outputChannel
+                   inputSize:(int)inputSize
+                  outputSize:(int)outputSize
+                  kernelSize:(int)kernelSize
+                         pad:(int)pad
+                      stride:(int)stride
+                      doReLU:(BOOL)doReLU {
+    if (self = [super initWithName:name]) {
+        m_Weight = weight;
+        m_WeightScales = weightScales;
+        m_Biases = bias;
+        m_Group = group;
+        m_InputChannel = inputChannel / m_Group;
+        m_OutputChannel = outputChannel / m_Group;
+        m_InputSize = inputSize;
+        m_OutputSize = outputSize;
+        m_KernelSize = kernelSize;
+        m_Pad = pad;
+        m_Stride = stride;
+        m_ReLU = doReLU;
+        m_M = m_OutputChannel;
+        m_N = m_OutputSize * m_OutputSize;
+        m_K = m_InputChannel * m_KernelSize * m_KernelSize;
+        m_InputPerGroup = m_InputChannel * m_InputSize * m_InputSize;
+        m_OutputPerGroup = m_OutputChannel * m_OutputSize * m_OutputSize;
+        m_WeightPerGroup = m_OutputChannel * m_InputChannel * m_KernelSize * m_KernelSize;
+        m_Pointwise = m_KernelSize == 1 && m_Stride == 1 && m_Pad == 0;
+    }
+
+    return self;
+}
+
+- (void)foldInputMean:(const float *)mean
+                scale:(const float *)scale {
+
+    // W' = W * scale, b' = b - sum(W' * mean), then W' is quantized again with its own scales
+    int outputChannels = m_M * m_Group, kernelArea = m_KernelSize * m_KernelSize;
+    m_FoldedWeight = malloc((size_t)m_WeightPerGroup * m_Group);
+    m_FoldedWeightScales = malloc(sizeof(float) * outputChannels);
+    m_FoldedBiases = malloc(sizeof(float) * outputChannels);
+    float *foldedRow = malloc(sizeof(float) * m_K);
+    for (int outputIndex = 0; outputIndex < outputChannels; outputIndex++) {
+        int firstChannel = outputIndex / m_M * m_InputChannel;
+        const int8_t *weight = m_Weight + (size_t)outputIndex * m_K;
+        double bias = m_Biases[outputIndex];
+        float maxMagnitude = 0;
+        for (int channelIndex = 0; channelIndex < m_InputChannel; channelIndex++) {
+            for (int i = 0; i < kernelArea; i++) {
+                float value = weight[channelIndex * kernelArea + i] * m_WeightScales[outputIndex] * scale[firstChannel + channelIndex];
+                foldedRow[channelIndex * kernelArea + i] = value;
+                bias -= (double)value * mean[firstChannel + channelIndex];
+                maxMagnitude = fmaxf(maxMagnitude, fabsf(value));
+            }
+        }
+        float weightScale = maxMagnitude > 0? maxMagnitude / 127.0f : 1.0f;
+        for (int k = 0; k < m_K; k++) {
+            m_FoldedWeight[(size_t)outputIndex * m_K + k] = (int8_t)lrintf(foldedRow[k] / weightScale);
+        }
+        m_FoldedWeightScales[outputIndex] = weightScale;
+        m_FoldedBiases[outputIndex] = bias;
+    }
+    free(foldedRow);
+    m_Weight = m_FoldedWeight;
+    m_WeightScales = m_FoldedWeightScales;
+    m_Biases = m_FoldedBiases;
+
+    // padded pixels of the raw input must be mean to become 0 after normalization
+    if (m_Pad > 0) {
+        m_PadValues = malloc(sizeof(float) * m_InputChannel * m_Group);
+        memcpy(m_PadValues, mean, sizeof(float) * m_InputChannel * m_Group);
+    }
+}
+
+- (void)prepareQuantization {
+    int outputChannels = m_M * m_Group;
+    if (!m_QuantizedBiases) m_QuantizedBiases = malloc(sizeof(int32_t) * outputChannels);
+    if (!m_Multipliers) m_Multipliers = malloc(sizeof(float) * outputChannels);
+    if (!m_QuantizedPadValues) m_QuantizedPadValues = malloc((size_t)m_InputChannel * m_Group);
+
+    // the zero point of the input goes into the biases, so does that of padding, which is real 0 or the folded mean
+    qmath_bias(m_Weight, m_Biases, m_WeightScales, m_InputParams, outputChannels, m_K, m_QuantizedBiases);
+    for (int outputIndex = 0; outputIndex < outputChannels; outputIndex++) {
+        m_Multipliers[outputIndex] = m_InputParams.scale * m_WeightScales[outputIndex] / (m_OutputQuantized? m_OutputParams.scale : 1.0f);
+    }
+    for (int channelIndex = 0; channelIndex < m_InputChannel * m_Group; channelIndex++) {
+        m_QuantizedPadValues[channelIndex] = m_PadValues? qmath_quantize_value(m_PadValues[channelIndex], m_InputParams) : (uint8_t)m_InputParams.zero_point;
+    }
+}
+
+- (void)enumerateParametersUsingBlock:(void (^)(const float *, size_t))block {
+    block((const float *)m_Weight, floats_of_bytes((size_t)m_WeightPerGroup * m_Group));
+    block(m_WeightScales, (size_t)m_M * m_Group);
+    block(m_Biases, (size_t)m_M * m_Group);
+}
+
+- (size_t)scratchNumForBatch:(int)batch {
+    // the quantized input, and col_data of one group of one image, since images are forwarded one by one
+    return floats_of_bytes([self quantizedInputBytesForBatch:batch] + (m_Pointwise? 0 : (size_t)m_K * m_N));
+}
+
+- (double)flops {
+    return 2.0 * m_M * m_N * m_K * m_Group;
+}
+
+- (double)bytesForBatch:(int)batch {
+    // weights are read once for each image, but are a quarter of floats
+    double activations = ((double)m_InputPerGroup * [self inputElementSize] + (double)m_OutputPerGroup * [self outputElementSize]) * m_Group * batch;
+    double quantizedInput = m_InputQuantized? 0 : 2.0 * self.inputNum * batch;
+    double parameters = ((double)m_WeightPerGroup * m_Group + 2.0 * sizeof(float) * m_M * m_Group) * batch;
+    double colData = m_Pointwise? 0 : 2.0 * m_K * m_N * m_Group * batch;
+    return activations + quantizedInput + parameters + colData;
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
+    [self forwardWithInput:input output:output scratch:scratch batch:1 threadpool:threadpool];
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool {
+    const uint8_t *source = [self quantizedInput:input batch:batch scratch:(uint8_t *)scratch];
+    uint8_t *colData = (uint8_t *)scratch + [self quantizedInputBytesForBatch:batch];
+    const size_t outputSize = [self outputElementSize];
+    qmath_output stage = { m_OutputQuantized? QMATH_OUTPUT_UINT8 : QMATH_OUTPUT_FLOAT, NULL, m_OutputParams.zero_point, m_ReLU };
+
+    // each gemm writes its rows straight into output channels of the image, requantized
+    for (int batchIndex = 0; batchIndex < batch; batchIndex++) {
+        for (int groupIndex = 0; groupIndex < m_Group; groupIndex++) {
+            const uint8_t *src = source + (size_t)batchIndex * self.inputNum + groupIndex * m_InputPerGroup;
+            if (!m_Pointwise) {
+                im2col_u8(src, m_InputChannel, m_InputSize, m_OutputSize, m_KernelSize, m_Pad, m_Stride, m_QuantizedPadValues + groupIndex * m_InputChannel, colData);
+            }
+            stage.multipliers = m_Multipliers + groupIndex * m_M;
+            qmath_gemm_mt(threadpool,
+                          m_M,
+                          m_N,
+                          m_K,
+                          m_Weight + (size_t)groupIndex * m_WeightPerGroup,
+                          m_Pointwise? src : colData,
+                          m_N,
+                          m_QuantizedBiases + groupIndex * m_M,
+                          stage,
+                          (char *)output + ((size_t)batchIndex * self.destinationStride + groupIndex * m_OutputPerGroup) * outputSize,
+                          m_N);
+        }
+    }
+}
+
+- (void)dealloc {
+    if (m_FoldedWeight)         free(m_FoldedWeight);
+    if (m_FoldedWeightScales)   free(m_FoldedWeightScales);
+    if (m_FoldedBiases)         free(m_FoldedBiases);
+    if (m_PadValues)            free(m_PadValues);
+    if (m_QuantizedBiases)      free(m_QuantizedBiases);
+    if (m_Multipliers)          free(m_Multipliers);
+    if (m_QuantizedPadValues)   free(m_QuantizedPadValues);
+}
+
+@end
+
+@implementation CPUQuantizedFullyConnectedLayer
+
+- (instancetype)initWithName:(NSString *)name
+                      weight:(const int8_t *)weight
+                weightScales:(const float *)weightScales
+                        bias:(const float *)bias
+                inputChannel:(int)inputChannel
+               outputChannel:(int)outputChannel
+                   inputSize:(int)inputSize
+                      doReLU:(BOOL)doReLU {
+    if (self = [super initWithName:name]) {
+        m_Weight = weight;
+        m_WeightScales = weightScales;
+        m_Biases = bias;
+        m_InputChannel = inputChannel;
+        m_OutputChannel = outputChannel;
+        m_InputSize = inputSize;
+        m_ReLU = doReLU;
+        m_M = m_OutputChannel;
+        m_N = m_InputSize * m_InputSize * m_InputChannel;
+    }
+
+    return self;
+}
+
+- (void)prepareQuantization {
+    if (!m_QuantizedBiases) m_QuantizedBiases = malloc(sizeof(int32_t) * m_M);
+    if (!m_Multipliers) m_Multipliers = malloc(sizeof(float) * m_M);
+    qmath_bias(m_Weight, m_Biases, m_WeightScales, m_InputParams, m_M, m_N, m_QuantizedBiases);
+    for (int outputIndex = 0; outputIndex < m_M; outputIndex++) {
+        m_Multipliers[outputIndex] = m_InputParams.scale * m_WeightScales[outputIndex] / (m_OutputQuantized? m_OutputParams.scale : 1.0f);
+    }
+}
+
+- (void)enumerateParametersUsingBlock:(void (^)(const float *, size_t))block {
+    block((const float *)m_Weight, floats_of_bytes((size_t)m_M * m_N));
+    block(m_WeightScales, (size_t)m_M);
+    block(m_Biases, (size_t)m_M);
+}
+
+- (size_t)scratchNumForBatch:(int)batch {
+    return floats_of_bytes([self quantizedInputBytesForBatch:batch]);
+}
+
+- (double)flops {
+    return 2.0 * m_M * m_N;
+}
+
+- (double)bytesForBatch:(int)batch {
+    double activations = ((double)m_N * [self inputElementSize] + (double)m_M * [self outputElementSize]) * batch;
+    double quantizedInput = m_InputQuantized? 0 : 2.0 * m_N * batch;
+    return activations + quantizedInput + (double)m_M * m_N + 2.0 * sizeof(float) * m_M;
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
+    [self forwardWithInput:input output:output scratch:scratch batch:1 threadpool:threadpool];
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool {
+    const uint8_t *source = [self quantizedInput:input batch:batch scratch:(uint8_t *)scratch];
+    qmath_output stage = { m_OutputQuantized? QMATH_OUTPUT_UINT8 : QMATH_OUTPUT_FLOAT, m_Multipliers, m_OutputParams.zero_point, m_ReLU };
+
+    // each row of weights is read once for the whole batch
+    qmath_gemv_mt(threadpool, m_M, m_N, batch, m_Weight, source, self.inputNum, m_QuantizedBiases, stage, output, self.destinationStride);
+}
+
+- (void)dealloc {
+    if (m_QuantizedBiases)  free(m_QuantizedBiases);
+    if (m_Multipliers)      free(m_Multipliers);
+}
+
+@end
+
+struct pooling_context {
+    const uint8_t *input;
+    uint8_t *output;
+    int inputNum;
+    int destinationStride;
+    int channels;
+    int input_size;
+    int output_size;
+    int kernel_size;
+    int pad;
+    int stride;
+    const uint8_t *table;       // NULL if the output has the range of the input
+};
+
+// one channel of one image
+static void compute_max_pooling_u8(const struct pooling_context *context, size_t index) {
+    const int batchIndex = (int)index / context->channels, channelIndex = (int)index % context->channels;
+    const int input_size = context->input_size, output_size = context->output_size;
+    const uint8_t *input = context->input + (size_t)batchIndex * context->inputNum + (size_t)channelIndex * input_size * input_size;
+    uint8_t *output = context->output + (size_t)batchIndex * context->destinationStride + (size_t)channelIndex * output_size * output_size;
+
+    for (int y = 0; y < output_size; y++) {
+        const int row_begin = MAX(y * context->stride - context->pad, 0);
+        const int row_end = MIN(y * context->stride - context->pad + context->kernel_size, input_size);
+        for (int x = 0; x < output_size; x++) {
+            const int col_begin = MAX(x * context->stride - context->pad, 0);
+            const int col_end = MIN(x * context->stride - context->pad + context->kernel_size, input_size);
+            uint8_t v = 0;
+            for (int s = row_begin; s < row_end; s++) {
+                for (int t = col_begin; t < col_end; t++) {
+                    v = MAX(v, input[s * input_size + t]);
+                }
+            }
+            output[y * output_size + x] = context->table? context->table[v] : v;
+        }
+    }
+}
+
+@implementation CPUQuantizedPoolingLayer
+
+- (instancetype)initWithPooling:(CPUPoolingLayer *)pooling {
+    if (self = [super initWithName:pooling.name]) {
+        NSAssert(pooling.poolingType == ePoolingMax, @"Error: only max pooling of %@ can be quantized", pooling.name);
+        m_InputChannel = pooling.inputChannel;
+        m_InputSize = pooling.inputSize;
+        m_OutputSize = pooling.outputSize;
+        m_KernelSize = pooling.kernelSize;
+        m_Pad = pooling.pad;
+        m_Stride = pooling.stride;
+        self.outputNum = pooling.outputNum;
+        self.destinationOffset = pooling.destinationOffset;
+        self.inputNum = pooling.inputNum;
+        self.destinationStride = pooling.destinationStride;
+        self.ownsImage = pooling.ownsImage;
+        self.readCount = pooling.readCount;
+        self.outputMin = pooling.outputMin;
+        self.outputMax = pooling.outputMax;
+        self.quantizedImage = pooling.quantizedImage;
+    }
+
+    return self;
+}
+
+- (void)prepareQuantization {
+    NSAssert(m_InputQuantized && m_OutputQuantized, @"Error: input and output of %@ should both be quantized", self.name);
+
+    // max of uint8 is that of the real values, which only need another scale if the ranges differ
+    m_Requantize = m_InputParams.scale != m_OutputParams.scale || m_InputParams.zero_point != m_OutputParams.zero_point;
+    for (int q = 0; q < 256; q++) {
+        m_Table[q] = qmath_quantize_value((q - m_InputParams.zero_point) * m_InputParams.scale, m_OutputParams);
+    }
+}
+
+- (double)flops {
+    return (double)m_InputChannel * m_OutputSize * m_OutputSize * m_KernelSize * m_KernelSize;
+}
+
+- (double)bytesForBatch:(int)batch {
+    return (double)m_InputChannel * ((double)m_InputSize * m_InputSize + (double)m_OutputSize * m_OutputSize) * batch;
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+              threadpool:(pthreadpool_t)threadpool {
+    [self forwardWithInput:input output:output scratch:scratch batch:1 threadpool:threadpool];
+}
+
+- (void)forwardWithInput:(const float *)input
+                  output:(float *)output
+                 scratch:(float *)scratch
+                   batch:(int)batch
+              threadpool:(pthreadpool_t)threadpool {
+    struct pooling_context context = {
+        .input = (const uint8_t *)input,
+        .output = (uint8_t *)output,
+        .inputNum = self.inputNum,
+        .destinationStride = self.destinationStride,
+        .channels = m_InputChannel,
+        .input_size = m_InputSize,
+        .output_size = m_OutputSize,
+        .kernel_size = m_KernelSize,
+        .pad = m_Pad,
+        .stride = m_Stride,
+        .table = m_Requantize? m_Table : NULL,
+    };
+    pthreadpool_compute_1d(threadpool, (pthreadpool_function_1d_t)compute_max_pooling_u8, &context, (size_t)m_InputChannel * batch);
+}
+
+@end
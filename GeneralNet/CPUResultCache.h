@@ -0,0 +1,64 @@
+//
+//  CPUResultCache.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/22.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "resultCache.h"
+
+// what results are keyed by
+typedef NS_ENUM (NSInteger, ResultCacheKeys) {
+    eResultCacheInputHash       = 1,    // hash of the preprocessed input, only the same input hits
+    eResultCachePerceptualHash  = 2,    // hash of how the source image looks, see result_cache_perceptual_hash
+};
+
+// Top k probabilities of images already forwarded, in front of CPUSession (see -[CPUSession resultCache]), so that
+// a repeated image is answered without forwarding it again. It is thread safe, and may be shared by all sessions
+// of a model, e.g. by the workers of a CPUEngine, but not by different models, whose results would be mixed up.
+//
+// Perceptual keys need the source pixels, so with them only images and pixels forwarded by a session are looked
+// up, while preprocessed image data goes straight to the net.
+@interface CPUResultCache : NSObject {
+@protected
+    result_cache *m_Cache;
+    ResultCacheKeys m_Keys;
+}
+
+@property (readonly, nonatomic) ResultCacheKeys keys;
+@property (readonly, nonatomic) int topK;
+
+// capacity is the number of results kept, split across shardsCount shards each with its own lock
+- (instancetype)initWithCapacity:(size_t)capacity
+                     shardsCount:(size_t)shardsCount
+                            topK:(int)topK
+                            keys:(ResultCacheKeys)keys;
+
+- (uint64_t)keyOfImageData:(const float *)imageData
+                     count:(int)count;
+
+- (uint64_t)keyOfPixels:(const uint8_t *)pixels
+                  width:(size_t)width
+                 height:(size_t)height
+            bytesPerRow:(size_t)bytesPerRow
+                 format:(preprocess_pixel_format)format;
+
+// writes count probabilities of key with only its top k set and the others 0, returns NO if it is not cached
+- (BOOL)lookupKey:(uint64_t)key
+            probs:(float *)probs
+            count:(int)count;
+
+- (void)storeKey:(uint64_t)key
+           probs:(const float *)probs
+           count:(int)count;
+
+- (void)removeAllResults;
+
+// {"hits", "misses", "hit_rate", "insertions", "evictions", "entries", "capacity"}
+- (NSDictionary<NSString *, NSNumber *> *)statistics;
+
+- (void)resetStatistics;
+
+@end
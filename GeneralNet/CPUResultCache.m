@@ -0,0 +1,93 @@
+//
+//  CPUResultCache.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/22.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPUResultCache.h"
+
+@implementation CPUResultCache
+
+- (instancetype)initWithCapacity:(size_t)capacity
+                     shardsCount:(size_t)shardsCount
+                            topK:(int)topK
+                            keys:(ResultCacheKeys)keys {
+    if (self = [super init]) {
+        m_Cache = result_cache_create(capacity, shardsCount, topK);
+        NSAssert(m_Cache, @"Error: failed to create a result cache of %zu results in %zu shards", capacity, shardsCount);
+        m_Keys = keys;
+    }
+
+    return self;
+}
+
+- (ResultCacheKeys)keys {
+    return m_Keys;
+}
+
+- (int)topK {
+    return result_cache_top_k(m_Cache);
+}
+
+- (uint64_t)keyOfImageData:(const float *)imageData
+                     count:(int)count {
+    return result_cache_hash(imageData, sizeof(float) * count, 0);
+}
+
+- (uint64_t)keyOfPixels:(const uint8_t *)pixels
+                  width:(size_t)width
+                 height:(size_t)height
+            bytesPerRow:(size_t)bytesPerRow
+                 format:(preprocess_pixel_format)format {
+    return result_cache_perceptual_hash(pixels, width, height, bytesPerRow, format);
+}
+
+- (BOOL)lookupKey:(uint64_t)key
+            probs:(float *)probs
+            count:(int)count {
+    const int topK = result_cache_top_k(m_Cache);
+    int indices[topK];
+    float values[topK];
+    if (!result_cache_lookup(m_Cache, key, indices, values)) return NO;
+
+    memset(probs, 0, sizeof(float) * count);
+    for (int i = 0; i < topK; i++) {
+        if (indices[i] >= 0 && indices[i] < count) probs[indices[i]] = values[i];
+    }
+    return YES;
+}
+
+- (void)storeKey:(uint64_t)key
+           probs:(const float *)probs
+           count:(int)count {
+    result_cache_insert(m_Cache, key, probs, count);
+}
+
+- (void)removeAllResults {
+    result_cache_clear(m_Cache);
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)statistics {
+    result_cache_statistics statistics;
+    result_cache_get_statistics(m_Cache, &statistics);
+    uint64_t lookups = statistics.hits + statistics.misses;
+    return @{@"hits": @(statistics.hits),
+             @"misses": @(statistics.misses),
+             @"hit_rate": @(lookups? (double)statistics.hits / lookups : 0),
+             @"insertions": @(statistics.insertions),
+             @"evictions": @(statistics.evictions),
+             @"entries": @(statistics.entries),
+             @"capacity": @(statistics.capacity)};
+}
+
+- (void)resetStatistics {
+    result_cache_reset_statistics(m_Cache);
+}
+
+- (void)dealloc {
+    result_cache_destroy(m_Cache);
+}
+
+@end
@@ -0,0 +1,166 @@
+//
+//  CPUSession.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/12.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#if __has_include(<UIKit/UIKit.h>)
+#import <UIKit/UIKit.h>
+#endif
+#import "pthreadpool.h"
+#import "imagePreprocess.h"
+#import "CPUCascade.h"
+
+@class CPUModel;
+@class CPULayer;
+@class CPUMemoryPlan;
+@class CPUProfile;
+@class CPUResultCache;
+
+struct step_profile;
+struct counter_hook;
+
+// Owns everything written when forwarding a CPUModel: the arena of outputs and scratch memory,
+// input images and threadpools. A session is cheap compared with its model, so that concurrent
+// requests can be served by one session per thread sharing one model. A session itself should
+// only be used by one thread at a time.
+@interface CPUSession : NSObject {
+@protected
+    CPUModel *m_Model;
+    CPUMemoryPlan *m_Plan;
+    char *m_Arena;
+    float *m_ImageData;
+    int m_MaxBatch;         // the arena and image data can hold this many images
+    int m_Batch;            // number of images in the last forwarding
+    pthreadpool_t m_Threadpool;
+    pthreadpool_t m_BranchThreadpool;           // runs steps of a wave concurrently
+    NSMutableDictionary *m_BranchThreadpools;   // threadpools for steps of waves, keyed by slot and number of threads
+    pthreadpool_t *m_StepThreadpools;
+    BOOL m_Profiling;
+    struct step_profile *m_StepProfiles;        // indexed by step
+    int m_ProfiledRuns;
+    int m_ProfiledImages;
+    NSTimeInterval m_ProfiledTime;
+    BOOL m_CountingEvents;
+    unsigned m_CountersMask;
+    struct counter_hook *m_CounterHooks;        // one for each threadpool running steps
+    NSArray *m_CounterHookNames;
+    int m_CounterHooksCount;
+    int *m_CounterHookOfStep;
+    BOOL m_EarlyExits;
+    CascadeRules *m_ExitRules;
+    float *m_ExitThresholds;
+    float **m_ExitArenas;       // one for each exit of the model, for m_MaxBatch images
+    const float **m_ExitProbs;
+    int *m_ExitOfImage;         // exit answering each image of the last batch, -1 for the whole net
+    int *m_ExitCounts;          // images answered by each exit, then by the whole net
+    CPUResultCache *m_ResultCache;
+    uint64_t *m_CacheKeys;      // of each image of the batch
+    float *m_CachedProbs;       // of images of the last batch answered by the cache, m_MaxBatch x probsNum
+    int *m_RunOfImage;          // position of each image of the last batch among those forwarded, -1 if it was cached
+}
+
+@property (readonly, nonatomic) CPUModel *model;
+
+// when it is on, every forwarding records time, flops and bytes of each step, see -profile
+// off by default, since reading the clock around every step costs a little
+@property (assign, nonatomic) BOOL profiling;
+
+// when it is on as well as profiling, hardware performance counters are read around each step on the calling
+// thread and around each computation on the workers of its threadpool; it stays NO where counters can not be read
+// (not Linux, or perf_event_open is not permitted), and profiling goes on with time only
+@property (assign, nonatomic) BOOL countingEvents;
+
+// when it is on, exits of the model (see -[CPUModel forwardExit:]) run right after their branch layers are written,
+// and forwarding stops at the first exit that is confident about every image of the batch by its rule; images that
+// an exit is confident about take its probabilities even if forwarding goes on for others; off by default
+@property (assign, nonatomic) BOOL earlyExits;
+
+// when it is set, images found in the cache are not forwarded, and images forwarded are stored in it; the result of
+// a cached image only has its top k probabilities, the others are 0; nil by default
+@property (strong, nonatomic) CPUResultCache *resultCache;
+
+// threadsCount is the number of threads used by this session, 0 for all cores
+- (instancetype)initWithModel:(CPUModel *)model
+                 threadsCount:(size_t)threadsCount;
+
+// write interleaved 8-bit pixels into data in the layout of input, the same way as -preprocessImage:toData:,
+// e.g. for images decoded without UIKit
+- (void)preprocessPixels:(const uint8_t *)pixels
+                   width:(size_t)width
+                  height:(size_t)height
+             bytesPerRow:(size_t)bytesPerRow
+                  format:(preprocess_pixel_format)format
+                  toData:(float *)data;
+
+#if __has_include(<UIKit/UIKit.h>)
+// write an image into data in the layout of input, i.e. resized, normalized by inputMean and inputScale of the model, and in BGR order
+- (void)preprocessImage:(UIImage *)image
+                 toData:(float *)data;
+#endif
+
+// forward a batch of images, which are preprocessed and stored one after another in imageData
+// convolution layers run one gemm for the whole batch, and fully connected layers become gemm
+// instead of gemv, so that their weights are only read once
+- (void)forwardWithImageData:(const float *)imageData
+                       batch:(int)batch;
+
+// forward one image of interleaved 8-bit pixels, with perceptual keys a cached image is not even preprocessed
+- (void)forwardWithPixels:(const uint8_t *)pixels
+                    width:(size_t)width
+                   height:(size_t)height
+              bytesPerRow:(size_t)bytesPerRow
+                   format:(preprocess_pixel_format)format;
+
+#if __has_include(<UIKit/UIKit.h>)
+- (void)forwardWithImages:(NSArray<UIImage *> *)images;
+#endif
+
+// forward steps one by one in the order of execution, without running waves concurrently, and pass the output
+// of the destination of each step to block after the step; images of the batch are destination.outputNum apart,
+// and are only valid during the call, since memory plans reuse them; a destination written by several steps,
+// e.g. of a concat, is passed after each of them and is complete after the last one; the result cache is not used;
+// images holding uint8 in a quantized net (see CPUQuantizedLayer.h) are passed as floats dequantized from them
+- (void)forwardWithImageData:(const float *)imageData
+                       batch:(int)batch
+               outputHandler:(void (^)(CPULayer *destination, const float *output))handler;
+
+// probabilities of an image in the last batch
+- (const float *)probsOfImage:(int)index;
+
+// labels of the top k probabilities of each image in the last batch
+- (NSArray<NSString *> *)labelsOfTopProbsInBatch:(int)topK;
+
+// every exit stops at top-1 probability >= 0.9 until it is set
+- (void)setRule:(CascadeRules)rule
+      threshold:(float)threshold
+         ofExit:(int)exit;
+
+// exit that answered an image in the last batch, -1 if it went through the whole net or was cached
+- (int)exitOfImage:(int)index;
+
+// images answered by each exit, and by the whole net last, since the session was created or counts were reset
+- (NSArray<NSNumber *> *)exitCounts;
+
+- (void)resetExitCounts;
+
+// steps of all forwardings since profiling was turned on or reset
+- (CPUProfile *)profile;
+
+- (void)resetProfile;
+
+// forward a blank image twice and time both: the first one is cold, paying for page faults of weights
+// and the arena, the second one is warm; returns the warm time, and the cold time in coldTime if it is not NULL;
+// exit counts and profiles are not changed, but the arena is, so probs of an earlier forwarding are gone
+- (NSTimeInterval)warmupWithColdTime:(NSTimeInterval *)coldTime;
+
+// average seconds spent on each step when forwarding a blank image, in the order of execution
+- (NSArray<NSNumber *> *)measureStepCostsWithRounds:(int)rounds;
+
+// for subclasses: the memory plan of the arena for batch images, -[CPUModel planForBatch:] by default
+- (CPUMemoryPlan *)planForBatch:(int)batch;
+
+@end
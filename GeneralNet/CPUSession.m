@@ -0,0 +1,725 @@
+//
+//  CPUSession.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/12.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPUSession.h"
+#import "CPUModel.h"
+#import "CPULayer.h"
+#import "quantizedMath.h"
+#import "memoryPlanner.h"
+#import "imagePreprocess.h"
+#import "CPUProfile.h"
+#import "perfCounters.h"
+#import "CPUCascade.h"
+#import "CPUResultCache.h"
+
+@interface CPUSession ()
+
+- (void)forwardStep:(int)step
+          imageData:(const float *)imageData
+              batch:(int)batch;
+
+@end
+
+struct wave_context {
+    __unsafe_unretained CPUSession *session;
+    __unsafe_unretained NSArray<NSNumber *> *steps;
+    const float *imageData;
+    int batch;
+};
+
+static void forward_step_of_wave(struct wave_context *context, size_t index) {
+    [context->session forwardStep:context->steps[index].intValue imageData:context->imageData batch:context->batch];
+}
+
+// counts of the workers of a threadpool
+struct counter_hook {
+    pthreadpool_t threadpool;
+    __unsafe_unretained NSString *name;
+    size_t threadsCount;
+    perf_counter_values *stepCounts;        // during the current step
+    perf_counter_values *threadTotals;      // since the profile was reset
+};
+
+static void begin_counting(struct counter_hook *hook, size_t thread) {
+    perf_counters_begin();
+}
+
+static void end_counting(struct counter_hook *hook, size_t thread) {
+    perf_counters_end(&hook->stepCounts[thread]);
+}
+
+#if __has_include(<UIKit/UIKit.h>)
+// layout of pixels in memory, only for what preprocess_image can read
+static BOOL pixel_format_of_image(CGImageRef image, preprocess_pixel_format *format) {
+    if (CGImageGetBitsPerComponent(image) != 8 ||
+        CGColorSpaceGetModel(CGImageGetColorSpace(image)) != kCGColorSpaceModelRGB) return NO;
+    
+    CGImageAlphaInfo alphaInfo = CGImageGetAlphaInfo(image);
+    CGBitmapInfo byteOrder = CGImageGetBitmapInfo(image) & kCGBitmapByteOrderMask;
+    BOOL bigEndian = byteOrder == kCGBitmapByteOrderDefault || byteOrder == kCGBitmapByteOrder32Big;
+    BOOL alphaLast = alphaInfo == kCGImageAlphaLast || alphaInfo == kCGImageAlphaPremultipliedLast || alphaInfo == kCGImageAlphaNoneSkipLast;
+    BOOL alphaFirst = alphaInfo == kCGImageAlphaFirst || alphaInfo == kCGImageAlphaPremultipliedFirst || alphaInfo == kCGImageAlphaNoneSkipFirst;
+    
+    switch (CGImageGetBitsPerPixel(image)) {
+        case 24:
+            *format = PREPROCESS_RGB;
+            return alphaInfo == kCGImageAlphaNone && bigEndian;
+        case 32:
+            *format = alphaLast? PREPROCESS_RGBA : PREPROCESS_BGRA;
+            return (alphaLast && bigEndian) || (alphaFirst && byteOrder == kCGBitmapByteOrder32Little);
+        default:
+            return NO;
+    }
+}
+#endif
+
+@implementation CPUSession
+
+- (instancetype)initWithModel:(CPUModel *)model
+                 threadsCount:(size_t)threadsCount {
+    if (self = [super init]) {
+        m_Model = model;
+        m_Threadpool = pthreadpool_create(threadsCount);
+        [self createThreadpools];
+        
+        int exitsCount = model.exitsCount;
+        m_ExitRules = malloc(sizeof(CascadeRules) * MAX(exitsCount, 1));
+        m_ExitThresholds = malloc(sizeof(float) * MAX(exitsCount, 1));
+        for (int exit = 0; exit < exitsCount; exit++) {
+            m_ExitRules[exit] = eCascadeTopProbability;
+            m_ExitThresholds[exit] = 0.9;
+        }
+        m_ExitArenas = calloc(MAX(exitsCount, 1), sizeof(float *));
+        m_ExitProbs = calloc(MAX(exitsCount, 1), sizeof(const float *));
+        m_ExitCounts = calloc(exitsCount + 1, sizeof(int));
+        [self reserveForBatch:1];
+    }
+    
+    return self;
+}
+
+- (CPUModel *)model {
+    return m_Model;
+}
+
+- (BOOL)profiling {
+    return m_Profiling;
+}
+
+- (void)setProfiling:(BOOL)profiling {
+    if (profiling && !m_StepProfiles) {
+        m_StepProfiles = calloc(m_Model.stepsCount, sizeof(struct step_profile));
+    }
+    m_Profiling = profiling;
+}
+
+- (BOOL)countingEvents {
+    return m_CountingEvents;
+}
+
+- (void)setCountingEvents:(BOOL)countingEvents {
+    if (countingEvents == m_CountingEvents) return;
+    if (countingEvents) {
+        m_CountersMask = perf_counters_mask();
+        if (!m_CountersMask) {
+#if ALLOW_PRINT
+            NSLog(@"Hardware counters are not available, profiling goes on with time only");
+#endif
+            return;
+        }
+        if (!m_CounterHooks) [self createCounterHooks];
+    }
+    
+    // hooks cost a little on every computation, so they are only installed while counting
+    for (int i = 0; i < m_CounterHooksCount; i++) {
+        pthreadpool_set_hooks(m_CounterHooks[i].threadpool,
+                              countingEvents? (pthreadpool_hook_t)begin_counting : NULL,
+                              countingEvents? (pthreadpool_hook_t)end_counting : NULL,
+                              &m_CounterHooks[i]);
+    }
+    m_CountingEvents = countingEvents;
+}
+
+- (void)createCounterHooks {
+    
+    // the main threadpool, then threadpools of steps of waves; not the one running branches, whose
+    // workers are the calling threads of steps, and are counted around the steps
+    NSMutableArray<NSString *> *names = [[NSMutableArray alloc] initWithObjects:@"main", nil];
+    [names addObjectsFromArray:[m_BranchThreadpools.allKeys sortedArrayUsingSelector:@selector(compare:)]];
+    m_CounterHooksCount = (int)names.count;
+    m_CounterHooks = calloc(m_CounterHooksCount, sizeof(struct counter_hook));
+    for (int i = 0; i < m_CounterHooksCount; i++) {
+        struct counter_hook *hook = &m_CounterHooks[i];
+        hook->threadpool = i? [(NSValue *)m_BranchThreadpools[names[i]] pointerValue] : m_Threadpool;
+        hook->name = names[i];
+        hook->threadsCount = pthreadpool_get_threads_count(hook->threadpool);
+        hook->stepCounts = calloc(hook->threadsCount, sizeof(perf_counter_values));
+        hook->threadTotals = calloc(hook->threadsCount, sizeof(perf_counter_values));
+    }
+    m_CounterHookNames = [names copy];
+    
+    m_CounterHookOfStep = malloc(m_Model.stepsCount * sizeof(int));
+    for (int step = 0; step < m_Model.stepsCount; step++) {
+        for (int i = 0; i < m_CounterHooksCount; i++) {
+            if (m_CounterHooks[i].threadpool == m_StepThreadpools[step]) m_CounterHookOfStep[step] = i;
+        }
+    }
+}
+
+- (CPUProfile *)profile {
+    NSAssert(m_StepProfiles, @"Error: profiling has never been turned on");
+    NSMutableArray<NSDictionary<NSString *, id> *> *threads = [[NSMutableArray alloc] init];
+    for (int i = 0; i < m_CounterHooksCount && m_CountersMask; i++) {
+        for (size_t thread = 0; thread < m_CounterHooks[i].threadsCount; thread++) {
+            [threads addObject:@{@"threadpool": m_CounterHooks[i].name,
+                                 @"thread": @(thread),
+                                 @"counters": [CPUProfile dictionaryWithCounters:&m_CounterHooks[i].threadTotals[thread]
+                                                                            mask:m_CountersMask
+                                                                           scale:1.0 / MAX(m_ProfiledRuns, 1)]}];
+        }
+    }
+    return [[CPUProfile alloc] initWithModel:m_Model
+                                stepProfiles:m_StepProfiles
+                                        runs:m_ProfiledRuns
+                                      images:m_ProfiledImages
+                                    wallTime:m_ProfiledTime
+                                countersMask:m_CountersMask
+                                     threads:threads];
+}
+
+- (void)resetProfile {
+    if (m_StepProfiles) memset(m_StepProfiles, 0, m_Model.stepsCount * sizeof(struct step_profile));
+    for (int i = 0; i < m_CounterHooksCount; i++) {
+        memset(m_CounterHooks[i].threadTotals, 0, m_CounterHooks[i].threadsCount * sizeof(perf_counter_values));
+    }
+    m_ProfiledRuns = 0;
+    m_ProfiledImages = 0;
+    m_ProfiledTime = 0;
+}
+
+- (void)createThreadpools {
+    
+    // threads are split between steps of a wave in proportion to their flops, and each step gets its own
+    // threadpool, since a pthreadpool only runs one computation at a time; a wave of one step uses all threads
+    size_t threadsCount = pthreadpool_get_threads_count(m_Threadpool);
+    size_t maxWidth = 1;
+    m_BranchThreadpools = [[NSMutableDictionary alloc] init];
+    m_StepThreadpools = malloc(m_Model.stepsCount * sizeof(pthreadpool_t));
+    for (NSArray<NSNumber *> *wave in m_Model.waves) {
+        if (wave.count == 1) {
+            m_StepThreadpools[wave[0].intValue] = m_Threadpool;
+            continue;
+        }
+        double waveFlops = 0;
+        for (NSNumber *step in wave) {
+            waveFlops += [[m_Model kernelOfStep:step.intValue] flops];
+        }
+        for (int slot = 0; slot < wave.count; slot++) {
+            long threads = waveFlops > 0? lround(threadsCount * [[m_Model kernelOfStep:wave[slot].intValue] flops] / waveFlops) : 1;
+            m_StepThreadpools[wave[slot].intValue] = [self threadpoolAtSlot:slot threadsCount:MAX(threads, 1)];
+        }
+        if (wave.count > maxWidth) maxWidth = wave.count;
+    }
+    if (maxWidth > 1) m_BranchThreadpool = pthreadpool_create(maxWidth);
+}
+
+- (pthreadpool_t)threadpoolAtSlot:(int)slot
+                     threadsCount:(size_t)threadsCount {
+    NSString *key = [NSString stringWithFormat:@"%d:%zu", slot, threadsCount];
+    if (!m_BranchThreadpools[key]) {
+        [m_BranchThreadpools setObject:[NSValue valueWithPointer:pthreadpool_create(threadsCount)] forKey:key];
+    }
+    return [(NSValue *)m_BranchThreadpools[key] pointerValue];
+}
+
+- (CPUMemoryPlan *)planForBatch:(int)batch {
+    return [m_Model planForBatch:batch];
+}
+
+- (void)reserveForBatch:(int)batch {
+    m_Plan = [self planForBatch:batch];
+    if (m_Arena) free(m_Arena);
+    int error = posix_memalign((void **)&m_Arena, MEMORY_PLAN_ALIGNMENT, m_Plan.arenaSize);
+    NSAssert(error == 0, @"Error: failed to allocate %zu bytes for activations with errno = %d", m_Plan.arenaSize, error);
+    
+    if (m_ImageData) free(m_ImageData);
+    m_ImageData = malloc(sizeof(float) * m_Model.inputNum * batch);
+    
+    for (int exit = 0; exit < m_Model.exitsCount; exit++) {
+        free(m_ExitArenas[exit]);
+        m_ExitArenas[exit] = malloc(sizeof(float) * [m_Model exitArenaNumOfExit:exit forBatch:batch]);
+    }
+    free(m_ExitOfImage);
+    m_ExitOfImage = malloc(sizeof(int) * batch);
+    
+    free(m_CacheKeys);
+    m_CacheKeys = malloc(sizeof(uint64_t) * batch);
+    free(m_CachedProbs);
+    m_CachedProbs = malloc(sizeof(float) * m_Model.probsNum * batch);
+    free(m_RunOfImage);
+    m_RunOfImage = malloc(sizeof(int) * batch);
+    for (int i = 0; i < batch; i++) {
+        m_ExitOfImage[i] = -1;
+        m_RunOfImage[i] = i;
+    }
+    m_MaxBatch = batch;
+}
+
+- (void)preprocessPixels:(const uint8_t *)pixels
+                   width:(size_t)width
+                  height:(size_t)height
+             bytesPerRow:(size_t)bytesPerRow
+                  format:(preprocess_pixel_format)format
+                  toData:(float *)data {
+    
+    // resize, normalize if it is not folded into the first layer, flip to BGR and store one channel after another, all in one pass
+    preprocess_image(m_Threadpool,
+                     pixels,
+                     width,
+                     height,
+                     bytesPerRow,
+                     format,
+                     PREPROCESS_AREA,
+                     m_Model.inputMean,
+                     m_Model.inputScale,
+                     PREPROCESS_ORDER_BGR,
+                     m_Model.inputSize,
+                     data);
+}
+
+- (void)forwardWithPixels:(const uint8_t *)pixels
+                    width:(size_t)width
+                   height:(size_t)height
+              bytesPerRow:(size_t)bytesPerRow
+                   format:(preprocess_pixel_format)format {
+    if (m_ResultCache.keys == eResultCachePerceptualHash) {
+        int runBatch = [self lookupPixels:pixels width:width height:height bytesPerRow:bytesPerRow format:format ofImage:0 runBatch:0];
+        [self forwardMissesWithImageData:m_ImageData batch:1 runBatch:runBatch cached:YES];
+        return;
+    }
+    
+    [self preprocessPixels:pixels width:width height:height bytesPerRow:bytesPerRow format:format toData:m_ImageData];
+    [self forwardWithImageData:m_ImageData batch:1];
+}
+
+// with perceptual keys, pixels are looked up before they are preprocessed, so that a cached image only costs its key;
+// a missed one is preprocessed at runBatch of the image data of the session, returns the new number of images to forward
+- (int)lookupPixels:(const uint8_t *)pixels
+              width:(size_t)width
+             height:(size_t)height
+        bytesPerRow:(size_t)bytesPerRow
+             format:(preprocess_pixel_format)format
+            ofImage:(int)index
+           runBatch:(int)runBatch {
+    m_CacheKeys[index] = [m_ResultCache keyOfPixels:pixels width:width height:height bytesPerRow:bytesPerRow format:format];
+    if ([m_ResultCache lookupKey:m_CacheKeys[index] probs:m_CachedProbs + (size_t)index * m_Model.probsNum count:m_Model.probsNum]) {
+        m_RunOfImage[index] = -1;
+        return runBatch;
+    }
+    
+    m_RunOfImage[index] = runBatch;
+    [self preprocessPixels:pixels
+                     width:width
+                    height:height
+               bytesPerRow:bytesPerRow
+                    format:format
+                    toData:m_ImageData + (size_t)runBatch * m_Model.inputNum];
+    return runBatch + 1;
+}
+
+#if __has_include(<UIKit/UIKit.h>)
+- (void)preprocessImage:(UIImage *)image
+                 toData:(float *)data {
+    [self readPixelsOfImage:image usingBlock:^(const uint8_t *pixels, size_t width, size_t height, size_t bytesPerRow, preprocess_pixel_format format) {
+        [self preprocessPixels:pixels width:width height:height bytesPerRow:bytesPerRow format:format toData:data];
+    }];
+}
+
+- (void)readPixelsOfImage:(UIImage *)image
+               usingBlock:(void (^)(const uint8_t *pixels, size_t width, size_t height, size_t bytesPerRow, preprocess_pixel_format format))block {
+    
+    // pixels of the image are used as they are if they are 8-bit RGB(A) or BGRA and need no rotation,
+    // otherwise the image is drawn once at its own size, which gives BGRA
+    CGImageRef imageRef = [image CGImage];
+    preprocess_pixel_format format;
+    UIImage *drawnImage = nil;
+    if (image.imageOrientation != UIImageOrientationUp || !pixel_format_of_image(imageRef, &format)) {
+        UIGraphicsBeginImageContextWithOptions(image.size, YES, 1.0);
+        [image drawInRect:CGRectMake(0, 0, image.size.width, image.size.height)];
+        drawnImage = UIGraphicsGetImageFromCurrentImageContext();
+        UIGraphicsEndImageContext();
+        imageRef = [drawnImage CGImage];
+        BOOL supported = pixel_format_of_image(imageRef, &format);
+        NSAssert(supported, @"Error: unsupported pixel format of the drawn image");
+    }
+    
+    CFDataRef pixels = CGDataProviderCopyData(CGImageGetDataProvider(imageRef));
+    block(CFDataGetBytePtr(pixels), CGImageGetWidth(imageRef), CGImageGetHeight(imageRef), CGImageGetBytesPerRow(imageRef), format);
+    CFRelease(pixels);
+}
+
+- (void)forwardWithImages:(NSArray<UIImage *> *)images {
+    int batch = (int)images.count;
+    if (batch > m_MaxBatch) [self reserveForBatch:batch];
+    if (m_ResultCache.keys == eResultCachePerceptualHash) {
+        __block int runBatch = 0;
+        for (int i = 0; i < batch; i++) {
+            [self readPixelsOfImage:images[i] usingBlock:^(const uint8_t *pixels, size_t width, size_t height, size_t bytesPerRow, preprocess_pixel_format format) {
+                runBatch = [self lookupPixels:pixels width:width height:height bytesPerRow:bytesPerRow format:format ofImage:i runBatch:runBatch];
+            }];
+        }
+        [self forwardMissesWithImageData:m_ImageData batch:batch runBatch:runBatch cached:YES];
+    } else {
+        for (int i = 0; i < batch; i++) {
+            [self preprocessImage:images[i] toData:m_ImageData + i * m_Model.inputNum];
+        }
+        [self forwardWithImageData:m_ImageData batch:batch];
+    }
+    
+#if ALLOW_PRINT
+    for (int step = 0; step < m_Model.stepsCount; step++) {
+        CPULayer *destination = [m_Model destinationOfStep:step];
+        [self printOutput:(float *)(m_Arena + [m_Plan outputOffsetOfStep:step])
+                  ofLayer:destination.name
+                   length:destination.outputNum];
+    }
+#endif
+}
+#endif
+
+- (void)forwardWithImageData:(const float *)imageData
+                       batch:(int)batch {
+    if (batch > m_MaxBatch) [self reserveForBatch:batch];
+    BOOL cached = m_ResultCache.keys == eResultCacheInputHash;
+    int runBatch = 0;
+    for (int i = 0; i < batch; i++) {
+        if (cached) {
+            m_CacheKeys[i] = [m_ResultCache keyOfImageData:imageData + (size_t)i * m_Model.inputNum count:m_Model.inputNum];
+            if ([m_ResultCache lookupKey:m_CacheKeys[i] probs:m_CachedProbs + (size_t)i * m_Model.probsNum count:m_Model.probsNum]) {
+                m_RunOfImage[i] = -1;
+                continue;
+            }
+        }
+        m_RunOfImage[i] = runBatch++;
+    }
+    
+    // missed images are gathered at the front of the image data of the session, which may be imageData itself
+    if (runBatch < batch) {
+        for (int i = 0; i < batch; i++) {
+            int run = m_RunOfImage[i];
+            if (run < 0 || (imageData == m_ImageData && run == i)) continue;
+            memmove(m_ImageData + (size_t)run * m_Model.inputNum, imageData + (size_t)i * m_Model.inputNum, sizeof(float) * m_Model.inputNum);
+        }
+        imageData = m_ImageData;
+    }
+    
+    [self forwardMissesWithImageData:imageData batch:batch runBatch:runBatch cached:cached];
+}
+
+// forward the runBatch images missed by the cache, which are stored one after another in imageData, and store their results
+- (void)forwardMissesWithImageData:(const float *)imageData
+                             batch:(int)batch
+                          runBatch:(int)runBatch
+                            cached:(BOOL)cached {
+    if (runBatch) [self forwardBatchWithImageData:imageData batch:runBatch];
+    m_Batch = batch;
+    if (!cached) return;
+    
+    for (int i = 0; i < batch; i++) {
+        if (m_RunOfImage[i] >= 0) [m_ResultCache storeKey:m_CacheKeys[i] probs:[self probsOfImage:i] count:m_Model.probsNum];
+    }
+}
+
+- (void)forwardBatchWithImageData:(const float *)imageData
+                            batch:(int)batch {
+    NSDate *startTime = m_Profiling? [NSDate date] : nil;
+    
+    for (int i = 0; i < batch; i++) {
+        m_ExitOfImage[i] = -1;
+    }
+    int wave = 0, answered = 0;
+    for (NSArray<NSNumber *> *steps in m_Model.waves) {
+        if (steps.count == 1) {
+            [self forwardStep:steps[0].intValue imageData:imageData batch:batch];
+        } else {
+            struct wave_context context = { .session = self, .steps = steps, .imageData = imageData, .batch = batch };
+            pthreadpool_compute_1d(m_BranchThreadpool, (pthreadpool_function_1d_t)forward_step_of_wave, &context, steps.count);
+        }
+        if (m_EarlyExits) {
+            answered += [self forwardExitsAfterWave:wave batch:batch];
+            if (answered == batch) break;
+        }
+        wave++;
+    }
+    for (int i = 0; i < batch; i++) {
+        m_ExitCounts[m_ExitOfImage[i] >= 0? m_ExitOfImage[i] : m_Model.exitsCount]++;
+    }
+    
+    if (startTime) {
+        m_ProfiledTime -= [startTime timeIntervalSinceNow];
+        m_ProfiledRuns++;
+        m_ProfiledImages += batch;
+    }
+}
+
+- (void)forwardWithImageData:(const float *)imageData
+                       batch:(int)batch
+               outputHandler:(void (^)(CPULayer *destination, const float *output))handler {
+    if (batch > m_MaxBatch) [self reserveForBatch:batch];
+    m_Batch = batch;
+    
+    // exits are not taken, every image goes through the whole net
+    for (int i = 0; i < batch; i++) {
+        m_ExitOfImage[i] = -1;
+        m_RunOfImage[i] = i;
+    }
+    
+    // images of uint8 in quantized nets are passed dequantized
+    float *dequantized = NULL;
+    for (int position = 0; position < m_Model.stepsCount; position++) {
+        int step = [m_Model stepAtPosition:position];
+        [self forwardStep:step imageData:imageData batch:batch];
+        CPULayer *destination = [m_Model destinationOfStep:step];
+        const float *output = (const float *)(m_Arena + [m_Plan outputOffsetOfStep:step]);
+        if (destination.quantizedImage) {
+            dequantized = realloc(dequantized, sizeof(float) * destination.outputNum * batch);
+            qmath_dequantize((const uint8_t *)output, qmath_params_of_range(destination.outputMin, destination.outputMax),
+                             dequantized, (size_t)destination.outputNum * batch);
+            output = dequantized;
+        }
+        handler(destination, output);
+    }
+    free(dequantized);
+}
+
+- (void)forwardStep:(int)step
+          imageData:(const float *)imageData
+              batch:(int)batch {
+    
+    // steps of a wave write their own entries, and run on threadpools of their own, so no lock is needed
+    NSDate *startTime = m_Profiling? [NSDate date] : nil;
+    struct counter_hook *hook = m_Profiling && m_CountingEvents? &m_CounterHooks[m_CounterHookOfStep[step]] : NULL;
+    if (hook) {
+        memset(hook->stepCounts, 0, hook->threadsCount * sizeof(perf_counter_values));
+        perf_counters_begin();
+    }
+    [m_Model forwardStep:step
+               imageData:imageData
+                   arena:m_Arena
+                    plan:m_Plan
+                   batch:batch
+              threadpool:m_StepThreadpools[step]];
+    if (hook) {
+        
+        // the threadpool is idle again, counts of its workers go into the step and into their totals
+        perf_counter_values counts = {{0}};
+        perf_counters_end(&counts);
+        for (size_t thread = 0; thread < hook->threadsCount; thread++) {
+            perf_counters_add(&counts, &hook->stepCounts[thread]);
+            perf_counters_add(&hook->threadTotals[thread], &hook->stepCounts[thread]);
+        }
+        perf_counters_add(&m_StepProfiles[step].counters, &counts);
+    }
+    if (startTime) {
+        CPULayer *kernel = [m_Model kernelOfStep:step];
+        m_StepProfiles[step].time -= [startTime timeIntervalSinceNow];
+        m_StepProfiles[step].flops += [kernel flops] * batch;
+        m_StepProfiles[step].bytes += [kernel bytesForBatch:batch];
+    }
+}
+
+// returns how many images are newly answered
+- (int)forwardExitsAfterWave:(int)wave
+                       batch:(int)batch {
+    int answered = 0;
+    for (int exit = 0; exit < m_Model.exitsCount; exit++) {
+        if ([m_Model waveOfExit:exit] != wave) continue;
+        
+        m_ExitProbs[exit] = [m_Model forwardExit:exit arena:m_Arena plan:m_Plan exitArena:m_ExitArenas[exit] batch:batch threadpool:m_Threadpool];
+        for (int i = 0; i < batch; i++) {
+            if (m_ExitOfImage[i] >= 0) continue;
+            float confidence = [CPUCascade confidenceOfProbs:m_ExitProbs[exit] + i * m_Model.probsNum count:m_Model.probsNum rule:m_ExitRules[exit]];
+            if (m_ExitRules[exit] == eCascadeEntropy? confidence <= m_ExitThresholds[exit] : confidence >= m_ExitThresholds[exit]) {
+                m_ExitOfImage[i] = exit;
+                answered++;
+            }
+        }
+    }
+    
+    return answered;
+}
+
+- (BOOL)earlyExits {
+    return m_EarlyExits;
+}
+
+- (void)setEarlyExits:(BOOL)earlyExits {
+    m_EarlyExits = earlyExits && m_Model.exitsCount > 0;
+}
+
+- (void)setRule:(CascadeRules)rule
+      threshold:(float)threshold
+         ofExit:(int)exit {
+    NSAssert(exit >= 0 && exit < m_Model.exitsCount, @"Error: there is no exit %d", exit);
+    m_ExitRules[exit] = rule;
+    m_ExitThresholds[exit] = threshold;
+}
+
+- (int)exitOfImage:(int)index {
+    return m_RunOfImage[index] >= 0? m_ExitOfImage[m_RunOfImage[index]] : -1;
+}
+
+- (NSArray<NSNumber *> *)exitCounts {
+    NSMutableArray<NSNumber *> *counts = [[NSMutableArray alloc] initWithCapacity:m_Model.exitsCount + 1];
+    for (int exit = 0; exit <= m_Model.exitsCount; exit++) {
+        [counts addObject:@(m_ExitCounts[exit])];
+    }
+    return [counts copy];
+}
+
+- (void)resetExitCounts {
+    memset(m_ExitCounts, 0, sizeof(int) * (m_Model.exitsCount + 1));
+}
+
+- (CPUResultCache *)resultCache {
+    return m_ResultCache;
+}
+
+- (void)setResultCache:(CPUResultCache *)resultCache {
+    m_ResultCache = resultCache;
+}
+
+- (const float *)probsOfImage:(int)index {
+    int run = m_RunOfImage[index];
+    if (run < 0) return m_CachedProbs + (size_t)index * m_Model.probsNum;
+    if (m_ExitOfImage[run] >= 0) return m_ExitProbs[m_ExitOfImage[run]] + run * m_Model.probsNum;
+    return (const float *)(m_Arena + m_Plan.probsOffset) + run * m_Model.probsNum;
+}
+
+- (NSArray<NSString *> *)labelsOfTopProbsInBatch:(int)topK {
+    NSMutableArray<NSString *> *labels = [[NSMutableArray alloc] initWithCapacity:m_Batch];
+    for (int i = 0; i < m_Batch; i++) {
+        [labels addObject:[self labelsOfTop:topK probs:[self probsOfImage:i]]];
+    }
+    return [labels copy];
+}
+
+- (NSString *)labelsOfTop:(int)topK
+                    probs:(const float *)probs {
+    
+    // copy output probabilities into an array of touples of (probability, index)
+    NSMutableArray *indexedProbabilities = [[NSMutableArray alloc] initWithCapacity:m_Model.labels.count];
+    for (int i = 0; i < m_Model.labels.count; i++) {
+        [indexedProbabilities addObject:@[@(probs[i]), @(i)]];
+    }
+    
+    // sort the touple array to have top k guesses in the front
+    NSArray *sortedIndexedProbabilities = [indexedProbabilities sortedArrayUsingComparator:^NSComparisonResult(id a, id b) {
+        NSNumber *first = [(NSArray *)a objectAtIndex:0];
+        NSNumber *second = [(NSArray *)b objectAtIndex:0];
+        return [second compare:first];
+    }];
+    
+    // get top k valid guesses and add them to return string with top k guesses
+    NSString *returnString = @"";
+    for (int i = 0; i < topK && i < sortedIndexedProbabilities.count; i++) {
+        NSArray *probAndIndex = sortedIndexedProbabilities[i];
+        returnString = [NSString stringWithFormat:@"%@%3.2f%%: %@\n", returnString, [(NSNumber *)probAndIndex[0] floatValue] * 100, m_Model.labels[[(NSNumber *)probAndIndex[1] intValue]]];
+    }
+    
+    return returnString;
+}
+
+- (NSTimeInterval)warmupWithColdTime:(NSTimeInterval *)coldTime {
+    memset(m_ImageData, 0, sizeof(float) * m_Model.inputNum);
+    NSTimeInterval times[2];
+    for (int round = 0; round < 2; round++) {
+        
+        // steps are forwarded through the model, so that exit counts, exits of images and profiles are left as they are
+        NSDate *startTime = [NSDate date];
+        for (int position = 0; position < m_Model.stepsCount; position++) {
+            int step = [m_Model stepAtPosition:position];
+            [m_Model forwardStep:step imageData:m_ImageData arena:m_Arena plan:m_Plan batch:1 threadpool:m_StepThreadpools[step]];
+        }
+        times[round] = -[startTime timeIntervalSinceNow];
+    }
+    if (coldTime) *coldTime = times[0];
+    return times[1];
+}
+
+- (NSArray<NSNumber *> *)measureStepCostsWithRounds:(int)rounds {
+    double *costs = calloc(m_Model.stepsCount, sizeof(double));
+    memset(m_ImageData, 0, sizeof(float) * m_Model.inputNum);
+    for (int round = 0; round <= rounds; round++) {     // the first round only warms up
+        for (int position = 0; position < m_Model.stepsCount; position++) {
+            NSDate *startTime = [NSDate date];
+            [m_Model forwardStep:[m_Model stepAtPosition:position] imageData:m_ImageData arena:m_Arena plan:m_Plan batch:1 threadpool:m_Threadpool];
+            if (round) costs[position] -= [startTime timeIntervalSinceNow];
+        }
+    }
+    
+    NSMutableArray<NSNumber *> *stepCosts = [[NSMutableArray alloc] initWithCapacity:m_Model.stepsCount];
+    for (int position = 0; position < m_Model.stepsCount; position++) {
+        [stepCosts addObject:@(costs[position] / MAX(rounds, 1))];
+    }
+    free(costs);
+    return [stepCosts copy];
+}
+
+#if ALLOW_PRINT
+- (void)printOutput:(float *)output
+            ofLayer:(NSString *)layer
+             length:(size_t)length {
+    NSLog(@"Now comes %@",layer);
+    
+    for (int i = 0; i < 8; i++) {
+        printf("%d: %f\n", i, output[i]);
+    }
+    
+    float sum = 0.0f, sqr = 0.0f;
+    for (int i = 0; i < length; i++) {
+        sum += fabsf(output[i]);
+        sqr += powf(output[i], 2);
+    }
+    printf("sum: %f\nsquare: %f\n", sum, sqr);
+}
+#endif
+
+- (void)dealloc {
+    
+    // release pointers
+    if (m_ImageData)    free(m_ImageData);
+    if (m_Arena)        free(m_Arena);
+    if (m_StepThreadpools) free(m_StepThreadpools);
+    if (m_StepProfiles) free(m_StepProfiles);
+    for (int i = 0; i < m_CounterHooksCount; i++) {
+        free(m_CounterHooks[i].stepCounts);
+        free(m_CounterHooks[i].threadTotals);
+    }
+    if (m_CounterHooks) free(m_CounterHooks);
+    if (m_CounterHookOfStep) free(m_CounterHookOfStep);
+    for (int exit = 0; exit < m_Model.exitsCount; exit++) {
+        free(m_ExitArenas[exit]);
+    }
+    free(m_ExitArenas);
+    free(m_ExitProbs);
+    free(m_ExitRules);
+    free(m_ExitThresholds);
+    free(m_ExitOfImage);
+    free(m_ExitCounts);
+    free(m_CacheKeys);
+    free(m_CachedProbs);
+    free(m_RunOfImage);
+    pthreadpool_destroy(m_Threadpool);
+    if (m_BranchThreadpool) pthreadpool_destroy(m_BranchThreadpool);
+    for (NSValue *threadpool in m_BranchThreadpools.allValues) {
+        pthreadpool_destroy(threadpool.pointerValue);
+    }
+}
+
+@end
@@ -0,0 +1,66 @@
+//
+//  CPUVideoSession.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPUSession.h"
+#import "CPULayer.h"
+
+// A session for classifying frames of a video one after another. Outputs of all layers are kept after each
+// frame (see -[CPUModel persistentPlanForBatch:]), and the next frame is compared with the one they were computed
+// from in tiles of its input; only rows of each layer that read changed tiles, through the receptive fields of
+// convolution, pooling and normalization layers, are forwarded again. Fully connected, softmax and global pooling
+// layers are forwarded whole once anything before them changed, since they are a small share of the cost.
+// Early exits and the result cache are not used, since they skip layers whose outputs the next frame relies on.
+@interface CPUVideoSession : CPUSession {
+@protected
+    float *m_Reference;         // the input that outputs of layers were computed from
+    BOOL m_HasReference;
+    int m_TileSize;
+    float m_ChangeThreshold;
+    float m_MaxChangedFraction;
+    int m_ImagesCount;          // the input, then images of layers that own one
+    int *m_SourceOfStep;        // indices of images
+    int *m_DestinationOfStep;
+    row_range *m_DirtyRows;     // rows of each image forwarded for the current frame
+    double m_TotalFlops;
+    int m_Frames;
+    int m_FullFrames;
+    int m_UnchangedFrames;
+    double m_RecomputedFraction;    // sum over frames of the share of flops forwarded
+}
+
+// side of square tiles of the input compared between frames, 16 by default
+@property (assign, nonatomic) int tileSize;
+
+// a tile is changed if any of its values differs by more than this many levels of 8-bit pixels, 6 by default,
+// so that noise of the camera does not count as change
+@property (assign, nonatomic) float changeThreshold;
+
+// a frame with a larger share of changed tiles is forwarded whole, 0.5 by default
+@property (assign, nonatomic) float maxChangedFraction;
+
+// forward a frame preprocessed as by -preprocessPixels:width:height:bytesPerRow:format:toData:, the first one
+// whole and the others from what changed since, its probabilities are those of image 0 as after -forwardWithImageData:
+- (void)forwardFrameWithImageData:(const float *)imageData;
+
+- (void)forwardFrameWithPixels:(const uint8_t *)pixels
+                         width:(size_t)width
+                        height:(size_t)height
+                   bytesPerRow:(size_t)bytesPerRow
+                        format:(preprocess_pixel_format)format;
+
+// forget the last frame, so that the next one is forwarded whole, e.g. at a cut of the video
+// forwarding anything other than frames does the same, since it overwrites outputs of layers
+- (void)reset;
+
+// {"frames", "full_frames", "unchanged_frames", "recomputed_fraction"}, the last one is the average
+// share of flops forwarded for a frame
+- (NSDictionary<NSString *, NSNumber *> *)statistics;
+
+- (void)resetStatistics;
+
+@end
@@ -0,0 +1,248 @@
+//
+//  CPUVideoSession.m
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import "CPUVideoSession.h"
+#import "CPUModel.h"
+
+// rows of an image forwarded whole, whatever the number of its rows
+static const row_range all_rows = { 0, INT_MAX };
+
+static row_range union_of_rows(row_range a, row_range b) {
+    if (a.begin >= a.end) return b;
+    if (b.begin >= b.end) return a;
+    return (row_range){ MIN(a.begin, b.begin), MAX(a.end, b.end) };
+}
+
+@implementation CPUVideoSession
+
+- (instancetype)initWithModel:(CPUModel *)model
+                 threadsCount:(size_t)threadsCount {
+    if (self = [super initWithModel:model threadsCount:threadsCount]) {
+        m_TileSize = 16;
+        m_ChangeThreshold = 6;
+        m_MaxChangedFraction = 0.5;
+        m_Reference = malloc(sizeof(float) * model.inputNum);
+
+        // each step reads and writes images of layers, which are numbered after the input
+        NSMutableDictionary<NSString *, NSNumber *> *imageIndices = [[NSMutableDictionary alloc] init];
+        m_SourceOfStep = malloc(sizeof(int) * model.stepsCount);
+        m_DestinationOfStep = malloc(sizeof(int) * model.stepsCount);
+        m_ImagesCount = 1;
+        for (int step = 0; step < model.stepsCount; step++) {
+            NSString *destination = [model destinationOfStep:step].name;
+            if (!imageIndices[destination]) [imageIndices setObject:@(m_ImagesCount++) forKey:destination];
+            m_DestinationOfStep[step] = [imageIndices[destination] intValue];
+            m_SourceOfStep[step] = step? [imageIndices[[model sourceOfStep:step].name] intValue] : 0;
+        }
+        m_DirtyRows = malloc(sizeof(row_range) * m_ImagesCount);
+
+        for (int step = 0; step < model.stepsCount; step++) {
+            m_TotalFlops += [[model kernelOfStep:step] flops];
+        }
+    }
+
+    return self;
+}
+
+// outputs of layers are not overwritten by others
+- (CPUMemoryPlan *)planForBatch:(int)batch {
+    return [m_Model persistentPlanForBatch:batch];
+}
+
+// an exit taken or a cached frame would leave outputs of layers behind the reference
+- (void)setEarlyExits:(BOOL)earlyExits {
+}
+
+- (void)setResultCache:(CPUResultCache *)resultCache {
+}
+
+- (int)tileSize {
+    return m_TileSize;
+}
+
+- (void)setTileSize:(int)tileSize {
+    NSAssert(tileSize > 0, @"Error: tiles of size %d", tileSize);
+    m_TileSize = tileSize;
+}
+
+- (float)changeThreshold {
+    return m_ChangeThreshold;
+}
+
+- (void)setChangeThreshold:(float)changeThreshold {
+    m_ChangeThreshold = changeThreshold;
+}
+
+- (float)maxChangedFraction {
+    return m_MaxChangedFraction;
+}
+
+- (void)setMaxChangedFraction:(float)maxChangedFraction {
+    m_MaxChangedFraction = maxChangedFraction;
+}
+
+- (void)forwardFrameWithPixels:(const uint8_t *)pixels
+                         width:(size_t)width
+                        height:(size_t)height
+                   bytesPerRow:(size_t)bytesPerRow
+                        format:(preprocess_pixel_format)format {
+    [self preprocessPixels:pixels width:width height:height bytesPerRow:bytesPerRow format:format toData:m_ImageData];
+    [self forwardFrameWithImageData:m_ImageData];
+}
+
+- (void)forwardFrameWithImageData:(const float *)imageData {
+    m_Frames++;
+    row_range rows = { 0, 0 };
+    if (!m_HasReference || ![self changedRows:&rows ofImageData:imageData]) {
+        [super forwardWithImageData:imageData batch:1];
+        memcpy(m_Reference, imageData, sizeof(float) * m_Model.inputNum);
+        m_HasReference = YES;
+        m_FullFrames++;
+        m_RecomputedFraction += 1;
+        return;
+    }
+
+    m_Batch = 1;
+    m_RunOfImage[0] = 0;
+    m_ExitOfImage[0] = -1;
+    if (rows.begin >= rows.end) {
+        m_UnchangedFrames++;
+        return;
+    }
+
+    // steps run one by one in the order of waves with all threads, each of them only on rows
+    // reading rows of its source that were forwarded for this frame
+    for (int i = 0; i < m_ImagesCount; i++) {
+        m_DirtyRows[i] = (row_range){ 0, 0 };
+    }
+    m_DirtyRows[0] = rows;
+    double flops = 0;
+    for (int position = 0; position < m_Model.stepsCount; position++) {
+        int step = [m_Model stepAtPosition:position];
+        row_range sourceRows = m_DirtyRows[m_SourceOfStep[step]];
+        if (sourceRows.begin >= sourceRows.end) continue;
+
+        CPULayer *kernel = [m_Model kernelOfStep:step];
+        row_range outputRows = sourceRows.end == INT_MAX? (row_range){ 0, [kernel rowsCount] } : [kernel outputRowsOfInputRows:sourceRows];
+        if (outputRows.begin >= outputRows.end) continue;
+
+        const float *input = step? (const float *)(m_Arena + [m_Plan inputOffsetOfStep:step]) : imageData;
+        float *output = (float *)(m_Arena + [m_Plan outputOffsetOfStep:step]) + kernel.destinationOffset;
+        float *scratch = (float *)(m_Arena + [m_Plan scratchOffsetOfStep:step]);
+        if ([kernel forwardRows:outputRows input:input output:output scratch:scratch threadpool:m_Threadpool]) {
+            flops += [kernel flops] * (outputRows.end - outputRows.begin) / [kernel rowsCount];
+        } else {
+            [m_Model forwardStep:step imageData:imageData arena:m_Arena plan:m_Plan batch:1 threadpool:m_Threadpool];
+            flops += [kernel flops];
+            outputRows = all_rows;
+        }
+
+        // images written by several steps, e.g. of a concat, are forwarded on rows of any of them
+        int destination = m_DestinationOfStep[step];
+        m_DirtyRows[destination] = union_of_rows(m_DirtyRows[destination], outputRows);
+    }
+    m_RecomputedFraction += m_TotalFlops > 0? flops / m_TotalFlops : 0;
+
+    // only rows forwarded are taken into the reference, others keep what their outputs were computed from
+    int size = m_Model.inputSize;
+    for (int channel = 0; channel < 3; channel++) {
+        size_t offset = (size_t)(channel * size + rows.begin) * size;
+        memcpy(m_Reference + offset, imageData + offset, sizeof(float) * (rows.end - rows.begin) * size);
+    }
+}
+
+// rows of input covering all changed tiles, returns NO if so many tiles changed that the frame should be forwarded whole
+- (BOOL)changedRows:(row_range *)rows
+        ofImageData:(const float *)imageData {
+    int size = m_Model.inputSize;
+    int tilesCount = (size + m_TileSize - 1) / m_TileSize;
+    int changedCount = 0;
+
+    // the threshold is in levels of pixels, while inputs may still be normalized by the scale of each channel
+    float thresholds[3];
+    for (int channel = 0; channel < 3; channel++) {
+        thresholds[channel] = m_ChangeThreshold * fabsf(m_Model.inputScale[channel]);
+    }
+
+    *rows = (row_range){ 0, 0 };
+    for (int tileRow = 0; tileRow < tilesCount; tileRow++) {
+        int rowBegin = tileRow * m_TileSize, rowEnd = MIN(rowBegin + m_TileSize, size);
+        for (int tileCol = 0; tileCol < tilesCount; tileCol++) {
+            int colBegin = tileCol * m_TileSize, colEnd = MIN(colBegin + m_TileSize, size);
+            BOOL changed = NO;
+            for (int channel = 0; channel < 3 && !changed; channel++) {
+                for (int y = rowBegin; y < rowEnd && !changed; y++) {
+                    size_t offset = (size_t)(channel * size + y) * size;
+                    for (int x = colBegin; x < colEnd; x++) {
+                        if (fabsf(imageData[offset + x] - m_Reference[offset + x]) > thresholds[channel]) {
+                            changed = YES;
+                            break;
+                        }
+                    }
+                }
+            }
+            if (changed) {
+                changedCount++;
+                *rows = union_of_rows(*rows, (row_range){ rowBegin, rowEnd });
+            }
+        }
+    }
+
+    return changedCount <= m_MaxChangedFraction * tilesCount * tilesCount;
+}
+
+- (void)reset {
+    m_HasReference = NO;
+}
+
+// anything else forwarded overwrites outputs of layers
+- (void)forwardWithImageData:(const float *)imageData
+                       batch:(int)batch {
+    [self reset];
+    [super forwardWithImageData:imageData batch:batch];
+}
+
+- (void)forwardWithImageData:(const float *)imageData
+                       batch:(int)batch
+               outputHandler:(void (^)(CPULayer *destination, const float *output))handler {
+    [self reset];
+    [super forwardWithImageData:imageData batch:batch outputHandler:handler];
+}
+
+- (NSTimeInterval)warmupWithColdTime:(NSTimeInterval *)coldTime {
+    [self reset];
+    return [super warmupWithColdTime:coldTime];
+}
+
+- (NSArray<NSNumber *> *)measureStepCostsWithRounds:(int)rounds {
+    [self reset];
+    return [super measureStepCostsWithRounds:rounds];
+}
+
+- (NSDictionary<NSString *, NSNumber *> *)statistics {
+    return @{@"frames": @(m_Frames),
+             @"full_frames": @(m_FullFrames),
+             @"unchanged_frames": @(m_UnchangedFrames),
+             @"recomputed_fraction": @(m_Frames? m_RecomputedFraction / m_Frames : 0)};
+}
+
+- (void)resetStatistics {
+    m_Frames = 0;
+    m_FullFrames = 0;
+    m_UnchangedFrames = 0;
+    m_RecomputedFraction = 0;
+}
+
+- (void)dealloc {
+    free(m_Reference);
+    free(m_SourceOfStep);
+    free(m_DestinationOfStep);
+    free(m_DirtyRows);
+}
+
+@end
@@ -0,0 +1,86 @@
+//
+//  compiledModel.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/16.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#include <string.h>
+#include "compiledModel.h"
+
+// whether count items of item_size bytes at offset are inside a file of size bytes
+static int table_fits(uint64_t offset, uint64_t count, uint64_t item_size, size_t size) {
+    return offset % 8 == 0 && offset <= size && count <= (size - offset) / item_size;
+}
+
+static int string_fits(const compiled_model_header *header, uint32_t offset) {
+    return offset < header->strings_size &&
+    memchr(compiled_model_string(header, offset), '\0', header->strings_size - offset) != NULL;
+}
+
+// whether count floats at offset are inside a .dat file of size bytes
+static int parameters_fit(uint64_t offset, uint64_t count, uint64_t size) {
+    return offset <= size / sizeof(float) && count <= size / sizeof(float) - offset;
+}
+
+// product of the sizes of a layer, UINT64_MAX if it does not fit in 64 bits
+static uint64_t product_of_sizes(const uint64_t *sizes, int count) {
+    uint64_t product = 1;
+    for (int i = 0; i < count; i++) {
+        if (sizes[i] && product > UINT64_MAX / sizes[i]) return UINT64_MAX;
+        product *= sizes[i];
+    }
+    return product;
+}
+
+// weights and biases of convolution and fully connected layers, whose sizes come from the layer itself
+static const char *check_parameters(const compiled_model_layer *layer, uint64_t data_file_size) {
+    if (layer->type != COMPILED_LAYER_CONVOLUTION && layer->type != COMPILED_LAYER_FULLY_CONNECTED) return NULL;
+    if (layer->input_channel <= 0 || layer->output_channel <= 0 || layer->input_size <= 0 ||
+        (layer->type == COMPILED_LAYER_CONVOLUTION && (layer->kernel_size <= 0 || layer->group <= 0 || layer->input_channel % layer->group))) {
+        return "invalid layer sizes";
+    }
+
+    uint64_t weight_count;
+    if (layer->type == COMPILED_LAYER_CONVOLUTION) {
+        const uint64_t sizes[] = { layer->output_channel, layer->input_channel / layer->group, layer->kernel_size, layer->kernel_size };
+        weight_count = product_of_sizes(sizes, 4);
+    } else {
+        const uint64_t sizes[] = { layer->output_channel, layer->input_channel, layer->input_size, layer->input_size };
+        weight_count = product_of_sizes(sizes, 4);
+    }
+    if (!parameters_fit(layer->weight_offset, weight_count, data_file_size) ||
+        !parameters_fit(layer->bias_offset, (uint64_t)layer->output_channel, data_file_size)) return "weights or biases out of the data file";
+    return NULL;
+}
+
+const char *compiled_model_check(const void *base, size_t size) {
+    const compiled_model_header *header = base;
+    if (size < sizeof(compiled_model_header) || header->magic != COMPILED_MODEL_MAGIC) return "not a compiled model";
+    if (header->version != COMPILED_MODEL_VERSION) return "unsupported version";
+    if (header->file_size != size) return "truncated file";
+    if (!table_fits(header->layers_offset, header->layer_count, sizeof(compiled_model_layer), size) ||
+        !table_fits(header->steps_offset, header->sequence_count, sizeof(compiled_model_step), size) ||
+        !table_fits(header->labels_offset, header->label_count, sizeof(uint32_t), size) ||
+        !table_fits(header->strings_offset, header->strings_size, 1, size)) return "table out of range";
+    if (header->first_layer >= header->layer_count || header->last_layer >= header->layer_count) return "layer index out of range";
+
+    const compiled_model_layer *layers = compiled_model_layers(header);
+    for (uint32_t i = 0; i < header->layer_count; i++) {
+        if (!string_fits(header, layers[i].name)) return "layer name out of range";
+        const char *error = check_parameters(&layers[i], header->data_file_size);
+        if (error) return error;
+    }
+    const compiled_model_step *steps = compiled_model_steps(header);
+    for (uint32_t i = 0; i < header->sequence_count; i++) {
+        if (steps[i].kernel >= header->layer_count || steps[i].source >= header->layer_count ||
+            steps[i].destination >= header->layer_count) return "layer index out of range";
+    }
+    const uint32_t *labels = compiled_model_labels(header);
+    for (uint32_t i = 0; i < header->label_count; i++) {
+        if (!string_fits(header, labels[i])) return "label out of range";
+    }
+
+    return NULL;
+}
@@ -0,0 +1,122 @@
+//
+//  compiledModel.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/16.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef compiledModel_h
+#define compiledModel_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A net description compiled from JSON by Convert/compile_model.py, to be mmap'd and read in place.
+// All integers are little-endian, tables are 8-byte aligned:
+//
+//   header | layer table | step table | label table | string table
+//
+// Everything that used to be computed from the JSON at load time (output sizes, destination offsets,
+// the encode sequence resolved into layer indices) is stored as is, so loading only reads the tables.
+
+#define COMPILED_MODEL_MAGIC    0x4d4e4e47      // "GNNM"
+#define COMPILED_MODEL_VERSION  1
+
+typedef enum compiled_layer_type {
+    COMPILED_LAYER_CONVOLUTION              = 1,
+    COMPILED_LAYER_FULLY_CONNECTED          = 2,
+    COMPILED_LAYER_POOLING_MAX              = 3,
+    COMPILED_LAYER_POOLING_AVERAGE          = 4,
+    COMPILED_LAYER_POOLING_GLOBAL_AVERAGE   = 5,
+    COMPILED_LAYER_LOCAL_RESPONSE_NORMALIZATION = 6,
+    COMPILED_LAYER_SOFTMAX                  = 7,
+    COMPILED_LAYER_CONCAT                   = 8,
+} compiled_layer_type;
+
+// image_type of JSON
+typedef enum compiled_image_type {
+    COMPILED_IMAGE_NONE         = 0,
+    COMPILED_IMAGE_TEMPORARY    = 1,
+    COMPILED_IMAGE_PERMANENT    = 2,
+} compiled_image_type;
+
+typedef struct compiled_model_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t layer_count;
+    uint32_t sequence_count;    // triplets of the encode sequence, the first layer is not one of them
+    uint32_t label_count;
+    uint32_t first_layer;       // indices in the layer table
+    uint32_t last_layer;
+    uint32_t input_size;
+    uint64_t data_file_size;    // size of the .dat file of weights and biases
+    uint64_t file_size;         // size of this file
+    uint64_t layers_offset;     // byte offsets of the tables from the beginning of this file
+    uint64_t steps_offset;
+    uint64_t labels_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} compiled_model_header;
+
+typedef struct compiled_model_layer {
+    uint32_t name;              // offset of a NUL-terminated string in the string table
+    uint32_t type;              // compiled_layer_type
+    uint32_t image_type;        // compiled_image_type
+    int32_t read_count;         // of a temporary image, -1 otherwise
+    uint64_t weight_offset;     // floats from the beginning of the .dat file
+    uint64_t bias_offset;
+    int32_t group;
+    int32_t input_channel;
+    int32_t output_channel;
+    int32_t input_size;
+    int32_t output_size;
+    int32_t kernel_size;
+    int32_t pad;
+    int32_t stride;
+    int32_t do_relu;
+    int32_t local_size;
+    float alpha;
+    float beta;
+    int32_t output_num;         // output_channel x output_size^2, 0 without an image
+    int32_t destination_offset; // floats from the beginning of the destination image
+} compiled_model_layer;
+
+// [kernel, src, dst] of the encode sequence
+typedef struct compiled_model_step {
+    uint32_t kernel;
+    uint32_t source;
+    uint32_t destination;
+} compiled_model_step;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// returns NULL if a mapped file of size bytes is a complete compiled model of this version,
+// whose indices and string offsets are all in range, and whose weights and biases are all inside
+// data_file_size bytes, or the reason why it is not
+const char *compiled_model_check(const void *base, size_t size);
+
+static inline const compiled_model_layer *compiled_model_layers(const compiled_model_header *header) {
+    return (const compiled_model_layer *)((const char *)header + header->layers_offset);
+}
+
+static inline const compiled_model_step *compiled_model_steps(const compiled_model_header *header) {
+    return (const compiled_model_step *)((const char *)header + header->steps_offset);
+}
+
+// string offset of each label
+static inline const uint32_t *compiled_model_labels(const compiled_model_header *header) {
+    return (const uint32_t *)((const char *)header + header->labels_offset);
+}
+
+static inline const char *compiled_model_string(const compiled_model_header *header, uint32_t offset) {
+    return (const char *)header + header->strings_offset + offset;
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* compiledModel_h */
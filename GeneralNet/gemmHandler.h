@@ -7,6 +7,7 @@
 //
 
 #import <Foundation/Foundation.h>
+#import "pthreadpool.h"
 
 @interface gemmHandler : NSObject
 
@@ -26,4 +27,17 @@ enum GEMM_TRANSPOSE {
                   beta:(const float)beta
                      C:(float *)C;
 
+// threadpool is only used by NNPACK, NULL means the threadpool of NNPACK
++ (void)gemmWithTransA:(const enum GEMM_TRANSPOSE)transA
+                transB:(const enum GEMM_TRANSPOSE)transB
+                     M:(const int)M
+                     N:(const int)N
+                     K:(const int)K
+                 alpha:(const float)alpha
+                     A:(const float *)A
+                     B:(const float *)B
+                  beta:(const float)beta
+                     C:(float *)C
+            threadpool:(pthreadpool_t)threadpool;
+
 @end
@@ -12,8 +12,10 @@
 #import "nnpackNoTransGemm.h"
 #elif USE_EIGEN_FOR_GEMM
 #import "eigenGemmWrapper.h"
-#else
+#elif defined(__APPLE__)
 #import <Accelerate/Accelerate.h>
+#else
+#include <cblas.h>
 #endif
 
 @implementation gemmHandler
@@ -28,16 +30,31 @@
                      B:(const float *)B
                   beta:(const float)beta
                      C:(float *)C {
+    [self gemmWithTransA:transA transB:transB M:M N:N K:K alpha:alpha A:A B:B beta:beta C:C threadpool:NULL];
+}
+
++ (void)gemmWithTransA:(const enum GEMM_TRANSPOSE)transA
+                transB:(const enum GEMM_TRANSPOSE)transB
+                     M:(const int)M
+                     N:(const int)N
+                     K:(const int)K
+                 alpha:(const float)alpha
+                     A:(const float *)A
+                     B:(const float *)B
+                  beta:(const float)beta
+                     C:(float *)C
+            threadpool:(pthreadpool_t)threadpool {
 #if USE_NNPACK_FOR_GEMM
     if (transA == gemmNoTrans && transB == gemmNoTrans) {
-        nnpack_no_trans_gemm(M, N, K, 1, A, B, 1, C);
+        nnpack_no_trans_gemm(M, N, K, 1, A, B, 1, C, threadpool);
     } else {
-        nnpack_gemm(nnpackGemmAuto, transA == gemmTrans? nnpackTrans : nnpackNoTrans, transB == gemmTrans? nnpackTrans : nnpackNoTrans, M, N, K, 1, A, B, 1, C);
+        nnpack_gemm(nnpackGemmAuto, transA == gemmTrans? nnpackTrans : nnpackNoTrans, transB == gemmTrans? nnpackTrans : nnpackNoTrans, M, N, K, 1, A, B, 1, C, threadpool);
     }
 #elif USE_EIGEN_FOR_GEMM
     [eigenGemmWrapper gemmWithTransA:transA == gemmTrans transB:transB == gemmTrans M:M N:N K:K alpha:1 A:A B:B beta:1 C:C];
 #else
-    cblas_sgemm(CblasRowMajor, transA == gemmTrans? CblasTrans : CblasNoTrans, transB == gemmTrans? CblasTrans : CblasNoTrans, M, N, K, 1, A, K, B, N, 1, C, N);
+    cblas_sgemm(CblasRowMajor, transA == gemmTrans? CblasTrans : CblasNoTrans, transB == gemmTrans? CblasTrans : CblasNoTrans, M, N, K, 1,
+                A, transA == gemmTrans? M : K, B, transB == gemmTrans? K : N, 1, C, N);
 #endif
 }
 
@@ -0,0 +1,188 @@
+//
+//  imagePreprocess.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/15.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include "imagePreprocess.h"
+#include "vectorMath.h"
+
+// output index i is the weighted sum of source indices start[i] ... start[i] + count[i] - 1,
+// whose weights are weights[i * max_count ...], and add up to 1
+typedef struct preprocess_taps {
+    size_t *start;
+    size_t *count;
+    float *weights;
+    size_t max_count;
+} preprocess_taps;
+
+static void compute_taps(size_t input_size, size_t output_size, preprocess_interpolation interpolation, preprocess_taps *taps) {
+    const double scale = (double)input_size / output_size;
+    const int use_area = interpolation == PREPROCESS_AREA && input_size > output_size;
+    taps->max_count = use_area? (size_t)ceil(scale) + 1 : 2;
+    taps->start = malloc(sizeof(size_t) * output_size);
+    taps->count = malloc(sizeof(size_t) * output_size);
+    taps->weights = calloc(output_size * taps->max_count, sizeof(float));
+
+    for (size_t i = 0; i < output_size; i++) {
+        float *weights = taps->weights + i * taps->max_count;
+        if (use_area) {
+
+            // the box [i * scale, (i + 1) * scale) in the source, partly covered pixels at both ends
+            const double begin = i * scale, end = (i + 1) * scale;
+            size_t first = (size_t)floor(begin), last = (size_t)ceil(end);
+            if (last > input_size) last = input_size;
+            taps->start[i] = first;
+            taps->count[i] = last - first;
+            for (size_t j = first; j < last; j++) {
+                weights[j - first] = (float)((fmin(end, j + 1) - fmax(begin, j)) / scale);
+            }
+        } else {
+
+            // pixel centers are aligned, the nearest pixel at both borders is repeated
+            double center = (i + 0.5) * scale - 0.5;
+            if (center < 0) center = 0;
+            size_t first = (size_t)floor(center);
+            if (first >= input_size - 1) {
+                taps->start[i] = input_size - 1;
+                taps->count[i] = 1;
+                weights[0] = 1.0f;
+            } else {
+                taps->start[i] = first;
+                taps->count[i] = 2;
+                weights[1] = (float)(center - first);
+                weights[0] = 1.0f - weights[1];
+            }
+        }
+    }
+}
+
+static void release_taps(preprocess_taps *taps) {
+    free(taps->start);
+    free(taps->count);
+    free(taps->weights);
+}
+
+struct preprocess_context {
+    const uint8_t *source;
+    size_t stride;
+    size_t channels;
+    size_t offsets[3];      // byte offset in a source pixel of each output channel
+    preprocess_taps x_taps;
+    preprocess_taps y_taps;
+    float weight_scale[3];
+    float bias[3];
+    size_t output_size;
+    float *output;
+};
+
+// source row y resampled to output_size pixels, one channel after another
+static void resample_row(const struct preprocess_context *context, size_t y, float *row) {
+    const uint8_t *source = context->source + y * context->stride;
+    const size_t output_size = context->output_size, channels = context->channels;
+    const preprocess_taps *taps = &context->x_taps;
+
+    for (size_t x = 0; x < output_size; x++) {
+        const uint8_t *pixels = source + taps->start[x] * channels;
+        const float *weights = taps->weights + x * taps->max_count;
+        float sum[3] = { 0.0f, 0.0f, 0.0f };
+        for (size_t k = 0; k < taps->count[x]; k++) {
+            for (int c = 0; c < 3; c++) {
+                sum[c] += weights[k] * pixels[k * channels + context->offsets[c]];
+            }
+        }
+        for (int c = 0; c < 3; c++) {
+            row[c * output_size + x] = sum[c];
+        }
+    }
+}
+
+static void preprocess_rows(const struct preprocess_context *context, size_t row_start, size_t row_count) {
+    const size_t output_size = context->output_size;
+    const preprocess_taps *taps = &context->y_taps;
+
+    // source rows are cached by y % max_count, the rows of one output row never collide,
+    // and neighbouring output rows share most of their source rows
+    float *cache = malloc(sizeof(float) * taps->max_count * 3 * output_size);
+    size_t *cached = malloc(sizeof(size_t) * taps->max_count);
+    for (size_t k = 0; k < taps->max_count; k++) {
+        cached[k] = SIZE_MAX;
+    }
+
+    for (size_t y = row_start; y < row_start + row_count; y++) {
+        const float *weights = taps->weights + y * taps->max_count;
+        for (size_t k = 0; k < taps->count[y]; k++) {
+            const size_t source_y = taps->start[y] + k;
+            float *row = cache + (source_y % taps->max_count) * 3 * output_size;
+            if (cached[source_y % taps->max_count] != source_y) {
+                resample_row(context, source_y, row);
+                cached[source_y % taps->max_count] = source_y;
+            }
+
+            // mean and scale are folded into the weights: sum(w * scale * p) - mean * scale
+            for (int c = 0; c < 3; c++) {
+                float *output = context->output + (c * output_size + y) * output_size;
+                if (k == 0) {
+                    vmath_scale_add(row + c * output_size, weights[k] * context->weight_scale[c], context->bias[c], output, output_size);
+                } else {
+                    vmath_axpy(row + c * output_size, weights[k] * context->weight_scale[c], output, output_size);
+                }
+            }
+        }
+    }
+
+    free(cached);
+    free(cache);
+}
+
+void preprocess_image(pthreadpool_t threadpool,
+                      const uint8_t *source,
+                      size_t width,
+                      size_t height,
+                      size_t stride,
+                      preprocess_pixel_format format,
+                      preprocess_interpolation interpolation,
+                      const float mean[3],
+                      const float scale[3],
+                      preprocess_channel_order order,
+                      size_t output_size,
+                      float *output) {
+    struct preprocess_context context = {
+        .source = source,
+        .stride = stride,
+        .channels = format == PREPROCESS_RGBA || format == PREPROCESS_BGRA? 4 : 3,
+        .output_size = output_size,
+        .output = output,
+    };
+
+    // offsets of R, G and B in a source pixel, then in the order of output
+    const int source_is_bgr = format == PREPROCESS_BGR || format == PREPROCESS_BGRA;
+    const size_t rgb_offsets[3] = { source_is_bgr? 2 : 0, 1, source_is_bgr? 0 : 2 };
+    for (int c = 0; c < 3; c++) {
+        context.offsets[c] = rgb_offsets[order == PREPROCESS_ORDER_BGR? 2 - c : c];
+        context.weight_scale[c] = scale[c];
+        context.bias[c] = -mean[c] * scale[c];
+    }
+    compute_taps(width, output_size, interpolation, &context.x_taps);
+    compute_taps(height, output_size, interpolation, &context.y_taps);
+
+    // a few tiles per thread, each tile resamples its source rows once
+    size_t tile = output_size;
+    if (threadpool) {
+        const size_t tiles = pthreadpool_get_threads_count(threadpool) * 4;
+        tile = (output_size + tiles - 1) / tiles;
+    }
+    pthreadpool_compute_1d_tiled(threadpool,
+                                 (pthreadpool_function_1d_tiled_t)preprocess_rows,
+                                 &context,
+                                 output_size,
+                                 tile);
+
+    release_taps(&context.x_taps);
+    release_taps(&context.y_taps);
+}
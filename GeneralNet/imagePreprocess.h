@@ -0,0 +1,66 @@
+//
+//  imagePreprocess.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/15.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef imagePreprocess_h
+#define imagePreprocess_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pthreadpool.h"
+
+// Turns an interleaved 8-bit image into the planar float input of a net in one pass:
+// resize to output_size x output_size, subtract the mean and multiply by the scale of each channel,
+// reorder channels, and write one channel after another. Output rows are split across a pthreadpool.
+//
+// The resize is separable: every output pixel is a weighted sum of a few source rows, each of which
+// is a weighted sum of a few source pixels. Source rows are converted to float and resampled
+// horizontally once per thread, and the vertical sum and normalization run on vectors of vectorMath.
+
+typedef enum preprocess_pixel_format {
+    PREPROCESS_RGB,
+    PREPROCESS_BGR,
+    PREPROCESS_RGBA,
+    PREPROCESS_BGRA,
+} preprocess_pixel_format;
+
+// order of channels in the output, caffe models trained from OpenCV images want BGR
+typedef enum preprocess_channel_order {
+    PREPROCESS_ORDER_RGB,
+    PREPROCESS_ORDER_BGR,
+} preprocess_channel_order;
+
+typedef enum preprocess_interpolation {
+    PREPROCESS_BILINEAR,    // sample at pixel centers, same as OpenCV INTER_LINEAR
+    PREPROCESS_AREA,        // average of the covered source area when shrinking, bilinear when enlarging
+} preprocess_interpolation;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// stride is the distance in bytes between rows of source
+// mean and scale are in the order of output channels, output[c][y][x] = (pixel[c] - mean[c]) * scale[c]
+// threadpool can be NULL
+void preprocess_image(pthreadpool_t threadpool,
+                      const uint8_t *source,
+                      size_t width,
+                      size_t height,
+                      size_t stride,
+                      preprocess_pixel_format format,
+                      preprocess_interpolation interpolation,
+                      const float mean[3],
+                      const float scale[3],
+                      preprocess_channel_order order,
+                      size_t output_size,
+                      float *output);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* imagePreprocess_h */
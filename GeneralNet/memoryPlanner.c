@@ -0,0 +1,110 @@
+//
+//  memoryPlanner.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/5.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#include <stdlib.h>
+#include "memoryPlanner.h"
+
+static inline size_t align_up(size_t number, size_t alignment) {
+    return (number + alignment - 1) / alignment * alignment;
+}
+
+static inline int overlaps(const memory_plan_buffer *a, const memory_plan_buffer *b) {
+    return a->first_use <= b->last_use && b->first_use <= a->last_use;
+}
+
+// order holds pointers into the buffers, so that sorting needs no state outside of its arguments
+// and plans of several models can be computed at the same time
+static int compare_by_size(const void *a, const void *b) {
+    const memory_plan_buffer *x = *(const memory_plan_buffer * const *)a;
+    const memory_plan_buffer *y = *(const memory_plan_buffer * const *)b;
+    if (x->size != y->size) return x->size > y->size ? -1 : 1;
+    if (x->first_use != y->first_use) return x->first_use < y->first_use ? -1 : 1;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int compare_by_offset(const void *a, const void *b) {
+    const memory_plan_buffer *x = *(const memory_plan_buffer * const *)a;
+    const memory_plan_buffer *y = *(const memory_plan_buffer * const *)b;
+    if (x->offset != y->offset) return x->offset < y->offset ? -1 : 1;
+    return 0;
+}
+
+size_t memory_plan(memory_plan_buffer *buffers, size_t count, size_t alignment) {
+    if (count == 0) return 0;
+
+    memory_plan_buffer **order = malloc(count * sizeof(memory_plan_buffer *));
+    const memory_plan_buffer **placed = malloc(count * sizeof(memory_plan_buffer *));
+    const memory_plan_buffer **neighbours = malloc(count * sizeof(memory_plan_buffer *));
+    size_t placedCount = 0;
+    size_t arenaSize = 0;
+
+    for (size_t i = 0; i < count; i++) order[i] = buffers + i;
+    qsort(order, count, sizeof(memory_plan_buffer *), compare_by_size);
+
+    for (size_t i = 0; i < count; i++) {
+        memory_plan_buffer *buffer = order[i];
+        buffer->offset = 0;
+        if (buffer->size == 0) continue;
+
+        // collect placed buffers that are alive at the same time, ordered by offset
+        size_t neighbourCount = 0;
+        for (size_t j = 0; j < placedCount; j++) {
+            if (overlaps(placed[j], buffer)) neighbours[neighbourCount++] = placed[j];
+        }
+        qsort(neighbours, neighbourCount, sizeof(memory_plan_buffer *), compare_by_offset);
+
+        // take the smallest gap that fits, or the end of the neighbours if there is none
+        const size_t size = align_up(buffer->size, alignment);
+        size_t bestOffset = 0, bestGap = (size_t)-1, candidate = 0;
+        int found = 0;
+        for (size_t j = 0; j < neighbourCount; j++) {
+            const size_t start = neighbours[j]->offset;
+            if (start >= candidate + size && start - candidate < bestGap) {
+                bestGap = start - candidate;
+                bestOffset = candidate;
+                found = 1;
+            }
+            const size_t end = align_up(neighbours[j]->offset + neighbours[j]->size, alignment);
+            if (end > candidate) candidate = end;
+        }
+        buffer->offset = found ? bestOffset : candidate;
+
+        if (buffer->offset + size > arenaSize) arenaSize = buffer->offset + size;
+        placed[placedCount++] = buffer;
+    }
+
+    free(order);
+    free(placed);
+    free(neighbours);
+    return arenaSize;
+}
+
+size_t memory_plan_naive_size(const memory_plan_buffer *buffers, size_t count, size_t alignment) {
+    size_t size = 0;
+    for (size_t i = 0; i < count; i++) size += align_up(buffers[i].size, alignment);
+    return size;
+}
+
+size_t memory_plan_lower_bound(const memory_plan_buffer *buffers, size_t count, size_t alignment) {
+    int lastStep = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (buffers[i].size && buffers[i].last_use > lastStep) lastStep = buffers[i].last_use;
+    }
+
+    size_t bound = 0;
+    for (int step = 0; step <= lastStep; step++) {
+        size_t alive = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (buffers[i].size && buffers[i].first_use <= step && step <= buffers[i].last_use) {
+                alive += align_up(buffers[i].size, alignment);
+            }
+        }
+        if (alive > bound) bound = alive;
+    }
+    return bound;
+}
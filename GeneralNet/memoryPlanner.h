@@ -0,0 +1,47 @@
+//
+//  memoryPlanner.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/5.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef memoryPlanner_h
+#define memoryPlanner_h
+
+#include <stddef.h>
+
+#define MEMORY_PLAN_ALIGNMENT 64
+
+// a buffer that is alive from step first_use to step last_use (both inclusive)
+typedef struct memory_plan_buffer {
+    size_t size;
+    int first_use;
+    int last_use;
+    size_t offset;      // filled in by memory_plan()
+} memory_plan_buffer;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Packs all buffers into one arena: two buffers may share memory only if their
+// lifetimes do not overlap. Buffers are placed from the largest to the smallest,
+// each one in the smallest aligned gap between already placed buffers whose
+// lifetimes overlap its own that fits it (best fit), or after all of them if no
+// gap does (greedy offset assignment on the interval graph). Buffers with size 0
+// get offset 0.
+// Returns the size of the arena in bytes.
+size_t memory_plan(memory_plan_buffer *buffers, size_t count, size_t alignment);
+
+// size of the arena if every buffer got its own memory
+size_t memory_plan_naive_size(const memory_plan_buffer *buffers, size_t count, size_t alignment);
+
+// the largest total size of buffers alive at the same step, no plan can do better than that
+size_t memory_plan_lower_bound(const memory_plan_buffer *buffers, size_t count, size_t alignment);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* memoryPlanner_h */
@@ -188,9 +188,13 @@ void nnpack_gemm(const enum NNPACK_ALGORITHM algorithm,
                  const float* A,
                  const float* B,
                  const float beta,
-                 float* C)
+                 float* C,
+                 pthreadpool_t threadpool)
 {
-    if (!global_context.initialized) nnpack_init();
+    if (!threadpool) {
+        if (!global_context.initialized) nnpack_init();
+        threadpool = global_context.threadpool;
+    }
     
     if (algorithm == nnpackGemmBaseLine) {
         if (transB == nnpackTrans) {
@@ -205,7 +209,7 @@ void nnpack_gemm(const enum NNPACK_ALGORITHM algorithm,
                 .n = N,
                 .k = K,
             };
-            pthreadpool_compute_2d_tiled(global_context.threadpool,
+            pthreadpool_compute_2d_tiled(threadpool,
                                          (pthreadpool_function_2d_tiled_t) baseline_gemm,
                                          &baseline_gemm_context,
                                          M, N,
@@ -288,7 +292,7 @@ void nnpack_gemm(const enum NNPACK_ALGORITHM algorithm,
                 .func_only = func_only,
                 .func_upto = func_upto,
             };
-            pthreadpool_compute_2d_tiled(global_context.threadpool,
+            pthreadpool_compute_2d_tiled(threadpool,
                                          (pthreadpool_function_2d_tiled_t) compute_gemm,
                                          &gemm_context,
                                          output_row,    col_block_size,
@@ -9,6 +9,8 @@
 #ifndef nnpackGemm_h
 #define nnpackGemm_h
 
+#include "pthreadpool.h"
+
 enum NNPACK_TRANSPOSE {
     nnpackNoTrans = 111,
     nnpackTrans   = 112
@@ -31,6 +33,7 @@ void nnpack_gemm(const enum NNPACK_ALGORITHM algorithm,
                  const float* A,
                  const float* B,
                  const float beta,
-                 float* C);
+                 float* C,
+                 pthreadpool_t threadpool);     // NULL to use the threadpool of NNPACK
 
 #endif /* nnpackGemm_h */
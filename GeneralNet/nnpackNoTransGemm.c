@@ -666,9 +666,13 @@ void nnpack_no_trans_gemm(const int M,
                           const float* A,
                           const float* B,
                           const float beta,
-                          float* C)
+                          float* C,
+                          pthreadpool_t threadpool)
 {
-    if (!global_context.initialized) nnpack_init();
+    if (!threadpool) {
+        if (!global_context.initialized) nnpack_init();
+        threadpool = global_context.threadpool;
+    }
     
     const size_t output_row = M;
     const size_t output_col = N;
@@ -702,7 +706,7 @@ void nnpack_no_trans_gemm(const int M,
                 .col_subblock_max = col_subblock_max,
                 .row_subblock_max = row_subblock_max,
             };
-            pthreadpool_compute_2d_tiled(global_context.threadpool,
+            pthreadpool_compute_2d_tiled(threadpool,
                                          (pthreadpool_function_2d_tiled_t) compute_no_trans_gemm,
                                          &gemm_context,
                                          output_row,    col_block_size,
@@ -10,6 +10,7 @@
 #define nnpackNoTransGemm_h
 
 #include <stdio.h>
+#include "pthreadpool.h"
 
 void nnpack_no_trans_gemm(const int M,
                           const int N,
@@ -18,6 +19,7 @@ void nnpack_no_trans_gemm(const int M,
                           const float* A,
                           const float* B,
                           const float beta,
-                          float* C);
+                          float* C,
+                          pthreadpool_t threadpool);    // NULL to use the threadpool of NNPACK
 
 #endif /* nnpackNoTransGemm_h */
@@ -0,0 +1,158 @@
+//
+//  perfCounters.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/18.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+#include "perfCounters.h"
+
+static const char *const counter_names[PERF_COUNTERS_COUNT] = {
+    "cycles",
+    "instructions",
+    "l1d_misses",
+    "llc_misses",
+    "dtlb_misses",
+    "stalled_cycles",
+};
+
+const char *perf_counter_name(perf_counter counter) {
+    return counter < PERF_COUNTERS_COUNT? counter_names[counter] : "unknown";
+}
+
+#if defined(__linux__)
+
+struct thread_counters {
+    int fds[PERF_COUNTERS_COUNT];       // fds[PERF_COUNTER_CYCLES] leads the group
+    uint64_t ids[PERF_COUNTERS_COUNT];
+    unsigned mask;
+    perf_counter_values begin;
+};
+
+static pthread_key_t counters_key;
+static pthread_once_t counters_once = PTHREAD_ONCE_INIT;
+
+static void close_thread_counters(void *argument) {
+    struct thread_counters *counters = argument;
+    for (int i = 0; i < PERF_COUNTERS_COUNT; i++) {
+        if (counters->fds[i] >= 0) close(counters->fds[i]);
+    }
+    free(counters);
+}
+
+static void create_counters_key(void) {
+    pthread_key_create(&counters_key, close_thread_counters);
+}
+
+static int open_counter(uint32_t type, uint64_t config, int group_fd) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+}
+
+#define CACHE_READ_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct thread_counters *thread_counters(void) {
+    pthread_once(&counters_once, create_counters_key);
+    struct thread_counters *counters = pthread_getspecific(counters_key);
+    if (counters) return counters;
+
+    static const struct { uint32_t type; uint64_t config; } events[PERF_COUNTERS_COUNT] = {
+        [PERF_COUNTER_CYCLES]           = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        [PERF_COUNTER_INSTRUCTIONS]     = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        [PERF_COUNTER_L1D_MISSES]       = { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_L1D) },
+        [PERF_COUNTER_LLC_MISSES]       = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        [PERF_COUNTER_DTLB_MISSES]      = { PERF_TYPE_HW_CACHE, CACHE_READ_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+        [PERF_COUNTER_STALLED_CYCLES]   = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+    };
+
+    // without cycles there is no group, and nothing is counted on this thread
+    counters = calloc(1, sizeof(struct thread_counters));
+    for (int i = 0; i < PERF_COUNTERS_COUNT; i++) {
+        counters->fds[i] = -1;
+    }
+    int leader = open_counter(events[PERF_COUNTER_CYCLES].type, events[PERF_COUNTER_CYCLES].config, -1);
+    for (int i = 0; i < PERF_COUNTERS_COUNT && leader >= 0; i++) {
+        int fd = i == PERF_COUNTER_CYCLES? leader : open_counter(events[i].type, events[i].config, leader);
+        if (fd < 0 || ioctl(fd, PERF_EVENT_IOC_ID, &counters->ids[i]) != 0) {
+            if (fd >= 0 && fd != leader) close(fd);
+            continue;
+        }
+        counters->fds[i] = fd;
+        counters->mask |= 1u << i;
+    }
+    pthread_setspecific(counters_key, counters);
+
+    return counters;
+}
+
+static void read_counters(const struct thread_counters *counters, perf_counter_values *values) {
+    memset(values, 0, sizeof(perf_counter_values));
+    if (!counters->mask) return;
+
+    struct {
+        uint64_t nr;
+        uint64_t time_enabled;
+        uint64_t time_running;
+        struct { uint64_t value; uint64_t id; } values[PERF_COUNTERS_COUNT];
+    } group;
+    if (read(counters->fds[PERF_COUNTER_CYCLES], &group, sizeof(group)) <= 0 || group.time_running == 0) return;
+
+    const double scale = (double)group.time_enabled / group.time_running;
+    for (uint64_t j = 0; j < group.nr && j < PERF_COUNTERS_COUNT; j++) {
+        for (int i = 0; i < PERF_COUNTERS_COUNT; i++) {
+            if ((counters->mask & (1u << i)) && counters->ids[i] == group.values[j].id) {
+                values->counts[i] = group.values[j].value * scale;
+            }
+        }
+    }
+}
+
+unsigned perf_counters_mask(void) {
+    return thread_counters()->mask;
+}
+
+void perf_counters_begin(void) {
+    struct thread_counters *counters = thread_counters();
+    read_counters(counters, &counters->begin);
+}
+
+void perf_counters_end(perf_counter_values *values) {
+    struct thread_counters *counters = thread_counters();
+    perf_counter_values end;
+    read_counters(counters, &end);
+    for (int i = 0; i < PERF_COUNTERS_COUNT; i++) {
+        values->counts[i] += end.counts[i] - counters->begin.counts[i];
+    }
+}
+
+#else
+
+unsigned perf_counters_mask(void) {
+    return 0;
+}
+
+void perf_counters_begin(void) {
+}
+
+void perf_counters_end(perf_counter_values *values) {
+}
+
+#endif
@@ -0,0 +1,60 @@
+//
+//  perfCounters.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/18.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef perfCounters_h
+#define perfCounters_h
+
+#include <stdint.h>
+
+// Hardware performance counters of the calling thread, read through a perf_event_open group on Linux.
+// The group is opened the first time a thread asks for it and closed when the thread exits; counters
+// the kernel refuses (perf_event_paranoid, virtual machines without a PMU, events the CPU does not have)
+// are left out of the mask, and everything is a no-op where perf_event_open does not exist, e.g. iOS.
+// Only user space is counted. If the group does not fit in the PMU, counts are scaled by the kernel's
+// enabled / running times.
+
+typedef enum perf_counter {
+    PERF_COUNTER_CYCLES,
+    PERF_COUNTER_INSTRUCTIONS,
+    PERF_COUNTER_L1D_MISSES,        // L1 data cache read misses
+    PERF_COUNTER_LLC_MISSES,        // last level cache misses
+    PERF_COUNTER_DTLB_MISSES,       // data TLB read misses
+    PERF_COUNTER_STALLED_CYCLES,    // backend stalls
+    PERF_COUNTERS_COUNT,
+} perf_counter;
+
+typedef struct perf_counter_values {
+    double counts[PERF_COUNTERS_COUNT];
+} perf_counter_values;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// short name for reports, e.g. "l1d_misses"
+const char *perf_counter_name(perf_counter counter);
+
+// bit (1 << counter) is set for each counter the calling thread can read, 0 if none
+unsigned perf_counters_mask(void);
+
+// counting is continuous, begin remembers the counts of the calling thread,
+// and end adds what was counted since then into values
+void perf_counters_begin(void);
+void perf_counters_end(perf_counter_values *values);
+
+static inline void perf_counters_add(perf_counter_values *sum, const perf_counter_values *values) {
+    for (int i = 0; i < PERF_COUNTERS_COUNT; i++) {
+        sum->counts[i] += values->counts[i];
+    }
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* perfCounters_h */
@@ -10,6 +10,7 @@ typedef void (*pthreadpool_function_1d_tiled_t)(void*, size_t, size_t);
 typedef void (*pthreadpool_function_2d_t)(void*, size_t, size_t);
 typedef void (*pthreadpool_function_2d_tiled_t)(void*, size_t, size_t, size_t, size_t);
 typedef void (*pthreadpool_function_3d_t)(void*, size_t, size_t, size_t);
+typedef void (*pthreadpool_hook_t)(void*, size_t);
 
 #ifdef __cplusplus
 extern "C" {
@@ -81,6 +82,25 @@ void pthreadpool_compute_2d_tiled(
 	size_t tile_i,
 	size_t tile_j);
 
+/**
+ * Sets functions called by each worker thread right before and right after
+ * it processes its items of a pthreadpool_compute_* call, e.g. to read
+ * performance counters of the thread.
+ *
+ * @note Must not be called while the thread pool is computing.
+ *
+ * @param[in]  threadpool  The thread pool to instrument.
+ * @param[in]  begin       Called with @a context and the thread number in the
+ *    0..threads_count-1 range, or NULL.
+ * @param[in]  end         Same as @a begin, called when the thread is done.
+ * @param[in]  context     The first argument passed to @a begin and @a end.
+ */
+void pthreadpool_set_hooks(
+	pthreadpool_t threadpool,
+	pthreadpool_hook_t begin,
+	pthreadpool_hook_t end,
+	void* context);
+
 /**
  * Terminates threads in the thread pool and releases associated resources.
  *
@@ -0,0 +1,240 @@
+//
+//  quantizedMath.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#include <math.h>
+#include "quantizedMath.h"
+
+// accumulators of a tile of C stay on the stack while all of K is streamed through them
+#define QMATH_TILE_M 4
+#define QMATH_TILE_N 256
+
+static inline int32_t round_to_int(float x) {
+    return (int32_t)(x + (x >= 0? 0.5f : -0.5f));
+}
+
+static inline uint8_t clamp_to_uint8(int32_t x, int32_t min) {
+    return (uint8_t)(x < min? min : x > 255? 255 : x);
+}
+
+qmath_params qmath_params_of_range(float min, float max) {
+    if (min > 0) min = 0;
+    if (max < 0) max = 0;
+    if (max - min < 1e-8f) return (qmath_params){ 1.0f, 0 };
+
+    qmath_params params;
+    params.scale = (max - min) / 255.0f;
+    params.zero_point = round_to_int(-min / params.scale);
+    if (params.zero_point > 255) params.zero_point = 255;
+    return params;
+}
+
+uint8_t qmath_quantize_value(float x, qmath_params params) {
+    return clamp_to_uint8(round_to_int(x / params.scale) + params.zero_point, 0);
+}
+
+void qmath_quantize(const float *x, qmath_params params, uint8_t *y, size_t n) {
+    const float inverse = 1.0f / params.scale;
+    for (size_t i = 0; i < n; i++) {
+        y[i] = clamp_to_uint8(round_to_int(x[i] * inverse) + params.zero_point, 0);
+    }
+}
+
+void qmath_dequantize(const uint8_t *x, qmath_params params, float *y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        y[i] = (float)((int32_t)x[i] - params.zero_point) * params.scale;
+    }
+}
+
+void qmath_bias(const int8_t *A,
+                const float *bias,
+                const float *weight_scales,
+                qmath_params params,
+                int M,
+                int K,
+                int32_t *y) {
+    for (int m = 0; m < M; m++) {
+        int32_t sum = 0;
+        for (int k = 0; k < K; k++) {
+            sum += A[(size_t)m * K + k];
+        }
+        y[m] = (int32_t)lrint((double)bias[m] / ((double)params.scale * weight_scales[m])) - params.zero_point * sum;
+    }
+}
+
+// one row of accumulators into the output, whose multiplier is that of the row
+static void store_row(const int32_t *x, const qmath_output *output, float multiplier, void *y, size_t n) {
+    if (output->type == QMATH_OUTPUT_UINT8) {
+        uint8_t *row = y;
+        const int32_t min = output->relu? output->zero_point : 0;
+        for (size_t i = 0; i < n; i++) {
+            row[i] = clamp_to_uint8(round_to_int((float)x[i] * multiplier) + output->zero_point, min);
+        }
+    } else if (output->relu) {
+        float *row = y;
+        for (size_t i = 0; i < n; i++) {
+            float value = (float)x[i] * multiplier;
+            row[i] = value > 0? value : 0;
+        }
+    } else {
+        float *row = y;
+        for (size_t i = 0; i < n; i++) {
+            row[i] = (float)x[i] * multiplier;
+        }
+    }
+}
+
+static inline size_t element_size(const qmath_output *output) {
+    return output->type == QMATH_OUTPUT_UINT8? sizeof(uint8_t) : sizeof(float);
+}
+
+struct gemm_context {
+    int K;
+    const int8_t *A;
+    const uint8_t *B;
+    int ldb;
+    const int32_t *bias;
+    qmath_output output;
+    char *C;
+    int ldc;
+};
+
+static void compute_gemm(const struct gemm_context *context, size_t m_start, size_t n_start, size_t m_count, size_t n_count) {
+    int32_t acc[QMATH_TILE_M][QMATH_TILE_N];
+    const int K = context->K;
+    const int8_t *A = context->A + m_start * K;
+    for (size_t i = 0; i < m_count; i++) {
+        const int32_t bias = context->bias? context->bias[m_start + i] : 0;
+        for (size_t n = 0; n < n_count; n++) {
+            acc[i][n] = bias;
+        }
+    }
+
+    // two rows of B at a time, each product fits in 16 bits and their sum in 17
+    int k = 0;
+    for (; k + 1 < K; k += 2) {
+        const uint8_t *b0 = context->B + (size_t)k * context->ldb + n_start;
+        const uint8_t *b1 = b0 + context->ldb;
+        for (size_t i = 0; i < m_count; i++) {
+            const int32_t a0 = A[i * K + k], a1 = A[i * K + k + 1];
+            if (!a0 && !a1) continue;      // pruned weights
+            int32_t *row = acc[i];
+            for (size_t n = 0; n < n_count; n++) {
+                row[n] += a0 * (int32_t)b0[n] + a1 * (int32_t)b1[n];
+            }
+        }
+    }
+    if (k < K) {
+        const uint8_t *b0 = context->B + (size_t)k * context->ldb + n_start;
+        for (size_t i = 0; i < m_count; i++) {
+            const int32_t a0 = A[i * K + k];
+            int32_t *row = acc[i];
+            for (size_t n = 0; n < n_count; n++) {
+                row[n] += a0 * (int32_t)b0[n];
+            }
+        }
+    }
+
+    const size_t size = element_size(&context->output);
+    for (size_t i = 0; i < m_count; i++) {
+        char *c = context->C + ((m_start + i) * context->ldc + n_start) * size;
+        store_row(acc[i], &context->output, context->output.multipliers[m_start + i], c, n_count);
+    }
+}
+
+void qmath_gemm_mt(pthreadpool_t threadpool,
+                   int M,
+                   int N,
+                   int K,
+                   const int8_t *A,
+                   const uint8_t *B,
+                   int ldb,
+                   const int32_t *bias,
+                   qmath_output output,
+                   void *C,
+                   int ldc) {
+    struct gemm_context context = {
+        .K = K,
+        .A = A,
+        .B = B,
+        .ldb = ldb,
+        .bias = bias,
+        .output = output,
+        .C = C,
+        .ldc = ldc,
+    };
+    pthreadpool_compute_2d_tiled(threadpool,
+                                 (pthreadpool_function_2d_tiled_t) compute_gemm,
+                                 &context,
+                                 M,
+                                 N,
+                                 QMATH_TILE_M,
+                                 QMATH_TILE_N);
+}
+
+struct gemv_context {
+    int N;
+    int batch;
+    const int8_t *A;
+    const uint8_t *x;
+    int ldx;
+    const int32_t *bias;
+    qmath_output output;
+    char *y;
+    int ldy;
+};
+
+static void compute_gemv(const struct gemv_context *context, size_t row_start, size_t row_count) {
+    const int N = context->N;
+    const size_t size = element_size(&context->output);
+    for (size_t m = row_start; m < row_start + row_count; m++) {
+        const int8_t *a = context->A + m * N;
+        for (int b = 0; b < context->batch; b++) {
+            const uint8_t *x = context->x + (size_t)b * context->ldx;
+            int32_t sum = 0;
+            for (int n = 0; n < N; n++) {
+                sum += (int32_t)a[n] * (int32_t)x[n];
+            }
+            sum += context->bias? context->bias[m] : 0;
+            store_row(&sum, &context->output, context->output.multipliers[m], context->y + ((size_t)b * context->ldy + m) * size, 1);
+        }
+    }
+}
+
+void qmath_gemv_mt(pthreadpool_t threadpool,
+                   int M,
+                   int N,
+                   int batch,
+                   const int8_t *A,
+                   const uint8_t *x,
+                   int ldx,
+                   const int32_t *bias,
+                   qmath_output output,
+                   void *y,
+                   int ldy) {
+    struct gemv_context context = {
+        .N = N,
+        .batch = batch,
+        .A = A,
+        .x = x,
+        .ldx = ldx,
+        .bias = bias,
+        .output = output,
+        .y = y,
+        .ldy = ldy,
+    };
+
+    // each tile of rows streams its own slice of A, so a few tiles per thread are enough
+    const size_t threads = threadpool? pthreadpool_get_threads_count(threadpool) : 1;
+    size_t tile = (M + 4 * threads - 1) / (4 * threads);
+    if (tile < 4) tile = 4;
+    pthreadpool_compute_1d_tiled(threadpool,
+                                 (pthreadpool_function_1d_tiled_t) compute_gemv,
+                                 &context,
+                                 M,
+                                 tile);
+}
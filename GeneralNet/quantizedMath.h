@@ -0,0 +1,101 @@
+//
+//  quantizedMath.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef quantizedMath_h
+#define quantizedMath_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pthreadpool.h"
+
+// Integer kernels of nets quantized by Convert/quantize_weights.py, see CPUQuantizedLayer.h.
+//
+// Activations are uint8 q standing for (q - zero_point) * scale, asymmetric so that outputs of ReLU use all
+// 256 levels; weights are int8 in [-127, 127] with one scale for each output channel, i.e. each row of A.
+// Products are summed in int32, which holds any K below 2^16 without overflow. The zero point of the input
+// is not subtracted in the inner loops, it goes into the int32 biases once (see qmath_bias).
+//
+// The *_mt variants split rows of the output across a pthreadpool, and run on the calling thread when
+// threadpool is NULL.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct qmath_params {
+    float scale;
+    int32_t zero_point;
+} qmath_params;
+
+// params of uint8 covering [min, max] widened to include 0, so that 0 (padding, ReLU) is exact
+qmath_params qmath_params_of_range(float min, float max);
+
+// y[i] = clamp(round(x[i] / scale) + zero_point, 0, 255)
+void qmath_quantize(const float *x, qmath_params params, uint8_t *y, size_t n);
+uint8_t qmath_quantize_value(float x, qmath_params params);
+
+// y[i] = (x[i] - zero_point) * scale
+void qmath_dequantize(const uint8_t *x, qmath_params params, float *y, size_t n);
+
+// int32 biases of rows of A (M x K) for input of params: round(bias[m] / (scale * weight_scales[m])) - zero_point * sum(A[m])
+void qmath_bias(const int8_t *A,
+                const float *bias,
+                const float *weight_scales,
+                qmath_params params,
+                int M,
+                int K,
+                int32_t *y);
+
+// how accumulators of C are stored, requantization is fused into the kernels so that int32 sums never leave them:
+// rows of C are either uint8 of another scale, with multipliers of input scale * weight scale / output scale,
+// or floats, with multipliers of input scale * weight scale; ReLU clamps uint8 below the zero point
+typedef enum qmath_output_type {
+    QMATH_OUTPUT_UINT8  = 0,
+    QMATH_OUTPUT_FLOAT  = 1,
+} qmath_output_type;
+
+typedef struct qmath_output {
+    qmath_output_type type;
+    const float *multipliers;   // of each row of A
+    int32_t zero_point;         // of uint8 output
+    int relu;
+} qmath_output;
+
+// C = A * B + bias[m] on each row, where A is a row-major M x K int8 matrix, B a row-major K x N uint8
+// matrix and C a row-major M x N matrix stored as output; rows of B are ldb apart and rows of C ldc apart
+void qmath_gemm_mt(pthreadpool_t threadpool,
+                   int M,
+                   int N,
+                   int K,
+                   const int8_t *A,
+                   const uint8_t *B,
+                   int ldb,
+                   const int32_t *bias,
+                   qmath_output output,
+                   void *C,
+                   int ldc);
+
+// y[b][m] = bias[m] + A[m] . x[b] for a batch of vectors x of N uint8 each, ldx apart, stored as output, where
+// A is a row-major M x N int8 matrix and outputs of each vector are ldy apart; rows of A are read once for the whole batch
+void qmath_gemv_mt(pthreadpool_t threadpool,
+                   int M,
+                   int N,
+                   int batch,
+                   const int8_t *A,
+                   const uint8_t *x,
+                   int ldx,
+                   const int32_t *bias,
+                   qmath_output output,
+                   void *y,
+                   int ldy);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* quantizedMath_h */
@@ -0,0 +1,403 @@
+//
+//  resultCache.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/22.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#define _POSIX_C_SOURCE 200112L     // posix_memalign
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resultCache.h"
+
+#define RESULT_CACHE_CACHE_LINE 64
+
+typedef struct cache_entry {
+    uint64_t key;
+    int32_t chain;          // next entry in the same bucket, -1 at the end
+    int32_t newer;          // neighbours in the recency list, -1 at its ends
+    int32_t older;
+} cache_entry;
+
+// shards are on cache lines of their own, so that locking one does not slow down its neighbours
+typedef struct result_shard {
+    pthread_mutex_t mutex;
+    cache_entry *entries;
+    int32_t *buckets;       // first entry of each bucket, -1 if it is empty
+    int *indices;           // top k of each entry
+    float *probs;
+    uint64_t bucket_mask;
+    int32_t capacity;
+    int32_t count;
+    int32_t newest;
+    int32_t oldest;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+} __attribute__((aligned(RESULT_CACHE_CACHE_LINE))) result_shard;
+
+struct result_cache {
+    result_shard *shards;
+    size_t shards_count;
+    int top_k;
+};
+
+static void shard_clear(result_shard *shard) {
+    for (uint64_t i = 0; i <= shard->bucket_mask; i++) {
+        shard->buckets[i] = -1;
+    }
+    shard->count = 0;
+    shard->newest = shard->oldest = -1;
+}
+
+result_cache *result_cache_create(size_t capacity, size_t shards_count, int top_k) {
+    if (!capacity || !shards_count || top_k <= 0) return NULL;
+    result_cache *cache = calloc(1, sizeof(result_cache));
+    if (!cache) return NULL;
+    if (posix_memalign((void **)&cache->shards, RESULT_CACHE_CACHE_LINE, sizeof(result_shard) * shards_count)) {
+        free(cache);
+        return NULL;
+    }
+    memset(cache->shards, 0, sizeof(result_shard) * shards_count);
+    cache->shards_count = shards_count;
+    cache->top_k = top_k;
+
+    // at most half of the buckets are used, so that chains stay short
+    int32_t shard_capacity = (int32_t)((capacity + shards_count - 1) / shards_count);
+    uint64_t buckets_count = 1;
+    while (buckets_count < (uint64_t)shard_capacity * 2) buckets_count <<= 1;
+    for (size_t i = 0; i < shards_count; i++) {
+        result_shard *shard = &cache->shards[i];
+        pthread_mutex_init(&shard->mutex, NULL);
+        shard->capacity = shard_capacity;
+        shard->bucket_mask = buckets_count - 1;
+        shard->entries = malloc(sizeof(cache_entry) * shard_capacity);
+        shard->buckets = malloc(sizeof(int32_t) * buckets_count);
+        shard->indices = malloc(sizeof(int) * shard_capacity * top_k);
+        shard->probs = malloc(sizeof(float) * shard_capacity * top_k);
+        if (!shard->entries || !shard->buckets || !shard->indices || !shard->probs) {
+            cache->shards_count = i + 1;
+            result_cache_destroy(cache);
+            return NULL;
+        }
+        shard_clear(shard);
+    }
+
+    return cache;
+}
+
+void result_cache_destroy(result_cache *cache) {
+    if (!cache) return;
+    for (size_t i = 0; i < cache->shards_count; i++) {
+        result_shard *shard = &cache->shards[i];
+        pthread_mutex_destroy(&shard->mutex);
+        free(shard->entries);
+        free(shard->buckets);
+        free(shard->indices);
+        free(shard->probs);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+int result_cache_top_k(const result_cache *cache) {
+    return cache->top_k;
+}
+
+// low bits of keys pick buckets, so shards are picked by high bits
+static result_shard *shard_of_key(result_cache *cache, uint64_t key) {
+    return &cache->shards[(key >> 32) % cache->shards_count];
+}
+
+static int32_t find_entry(const result_shard *shard, uint64_t key) {
+    int32_t index = shard->buckets[key & shard->bucket_mask];
+    while (index >= 0 && shard->entries[index].key != key) {
+        index = shard->entries[index].chain;
+    }
+    return index;
+}
+
+static void unlink_recency(result_shard *shard, int32_t index) {
+    cache_entry *entry = &shard->entries[index];
+    if (entry->newer >= 0) shard->entries[entry->newer].older = entry->older;
+    else shard->newest = entry->older;
+    if (entry->older >= 0) shard->entries[entry->older].newer = entry->newer;
+    else shard->oldest = entry->newer;
+}
+
+static void push_newest(result_shard *shard, int32_t index) {
+    cache_entry *entry = &shard->entries[index];
+    entry->newer = -1;
+    entry->older = shard->newest;
+    if (shard->newest >= 0) shard->entries[shard->newest].newer = index;
+    shard->newest = index;
+    if (shard->oldest < 0) shard->oldest = index;
+}
+
+static void unlink_bucket(result_shard *shard, int32_t index) {
+    int32_t *link = &shard->buckets[shard->entries[index].key & shard->bucket_mask];
+    while (*link != index) {
+        link = &shard->entries[*link].chain;
+    }
+    *link = shard->entries[index].chain;
+}
+
+int result_cache_lookup(result_cache *cache, uint64_t key, int *indices, float *probs) {
+    result_shard *shard = shard_of_key(cache, key);
+    pthread_mutex_lock(&shard->mutex);
+    int32_t index = find_entry(shard, key);
+    if (index < 0) {
+        shard->misses++;
+        pthread_mutex_unlock(&shard->mutex);
+        return 0;
+    }
+
+    if (shard->newest != index) {
+        unlink_recency(shard, index);
+        push_newest(shard, index);
+    }
+    memcpy(indices, shard->indices + (size_t)index * cache->top_k, sizeof(int) * cache->top_k);
+    memcpy(probs, shard->probs + (size_t)index * cache->top_k, sizeof(float) * cache->top_k);
+    shard->hits++;
+    pthread_mutex_unlock(&shard->mutex);
+    return 1;
+}
+
+// sorted from the largest one, ties keep the smaller index; missing ones are index -1 with probability 0
+static void select_top_k(const float *probs, int count, int top_k, int *indices, float *values) {
+    for (int i = 0; i < top_k; i++) {
+        indices[i] = -1;
+        values[i] = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (indices[top_k - 1] >= 0 && probs[i] <= values[top_k - 1]) continue;
+        int position = top_k - 1;
+        while (position > 0 && (indices[position - 1] < 0 || probs[i] > values[position - 1])) {
+            indices[position] = indices[position - 1];
+            values[position] = values[position - 1];
+            position--;
+        }
+        indices[position] = i;
+        values[position] = probs[i];
+    }
+}
+
+void result_cache_insert(result_cache *cache, uint64_t key, const float *probs, int count) {
+
+    // selecting outside of the lock keeps it short
+    const int top_k = cache->top_k;
+    int indices[top_k];
+    float values[top_k];
+    select_top_k(probs, count, top_k, indices, values);
+
+    result_shard *shard = shard_of_key(cache, key);
+    pthread_mutex_lock(&shard->mutex);
+    int32_t index = find_entry(shard, key);
+    if (index >= 0) {
+        unlink_recency(shard, index);
+    } else {
+        if (shard->count < shard->capacity) {
+            index = shard->count++;
+        } else {
+            index = shard->oldest;
+            unlink_recency(shard, index);
+            unlink_bucket(shard, index);
+            shard->evictions++;
+        }
+        cache_entry *entry = &shard->entries[index];
+        entry->key = key;
+        entry->chain = shard->buckets[key & shard->bucket_mask];
+        shard->buckets[key & shard->bucket_mask] = index;
+    }
+    push_newest(shard, index);
+    memcpy(shard->indices + (size_t)index * top_k, indices, sizeof(int) * top_k);
+    memcpy(shard->probs + (size_t)index * top_k, values, sizeof(float) * top_k);
+    shard->insertions++;
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+void result_cache_clear(result_cache *cache) {
+    for (size_t i = 0; i < cache->shards_count; i++) {
+        result_shard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        shard_clear(shard);
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+void result_cache_get_statistics(result_cache *cache, result_cache_statistics *statistics) {
+    memset(statistics, 0, sizeof(result_cache_statistics));
+    for (size_t i = 0; i < cache->shards_count; i++) {
+        result_shard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        statistics->hits += shard->hits;
+        statistics->misses += shard->misses;
+        statistics->insertions += shard->insertions;
+        statistics->evictions += shard->evictions;
+        statistics->entries += shard->count;
+        statistics->capacity += shard->capacity;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+void result_cache_reset_statistics(result_cache *cache) {
+    for (size_t i = 0; i < cache->shards_count; i++) {
+        result_shard *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        shard->hits = shard->misses = shard->insertions = shard->evictions = 0;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+}
+
+static const uint64_t XXH_PRIME1 = 11400714785074694791ULL;
+static const uint64_t XXH_PRIME2 = 14029467366897019727ULL;
+static const uint64_t XXH_PRIME3 = 1609587929392839161ULL;
+static const uint64_t XXH_PRIME4 = 9650029242287828579ULL;
+static const uint64_t XXH_PRIME5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// devices reading inputs are little endian, unaligned loads go through memcpy
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t xxh_round(uint64_t accumulator, uint64_t input) {
+    accumulator += input * XXH_PRIME2;
+    return rotl64(accumulator, 31) * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t hash, uint64_t accumulator) {
+    hash ^= xxh_round(0, accumulator);
+    return hash * XXH_PRIME1 + XXH_PRIME4;
+}
+
+uint64_t result_cache_hash(const void *data, size_t size, uint64_t seed) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + size;
+    uint64_t hash;
+
+    // four independent lanes keep the multipliers busy
+    if (size >= 32) {
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2, v2 = seed + XXH_PRIME2, v3 = seed, v4 = seed - XXH_PRIME1;
+        const uint8_t *limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read64(p));
+            v2 = xxh_round(v2, read64(p + 8));
+            v3 = xxh_round(v3, read64(p + 16));
+            v4 = xxh_round(v4, read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        hash = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        hash = xxh_merge(hash, v1);
+        hash = xxh_merge(hash, v2);
+        hash = xxh_merge(hash, v3);
+        hash = xxh_merge(hash, v4);
+    } else {
+        hash = seed + XXH_PRIME5;
+    }
+    hash += size;
+
+    for (; p + 8 <= end; p += 8) {
+        hash ^= xxh_round(0, read64(p));
+        hash = rotl64(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+    }
+    if (p + 4 <= end) {
+        hash ^= read32(p) * XXH_PRIME1;
+        hash = rotl64(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    for (; p < end; p++) {
+        hash ^= *p * XXH_PRIME5;
+        hash = rotl64(hash, 11) * XXH_PRIME1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+#define PERCEPTUAL_ROWS 16
+#define PERCEPTUAL_COLUMNS (PERCEPTUAL_ROWS + 1)
+#define PERCEPTUAL_SAMPLES 8    // per cell in each direction at most, so that large images cost no more than small ones
+
+uint64_t result_cache_perceptual_hash(const uint8_t *pixels,
+                                      size_t width,
+                                      size_t height,
+                                      size_t stride,
+                                      preprocess_pixel_format format) {
+    const size_t channels = format == PREPROCESS_RGB || format == PREPROCESS_BGR? 3 : 4;
+    const size_t red = format == PREPROCESS_RGB || format == PREPROCESS_RGBA? 0 : 2;
+    const size_t blue = 2 - red;
+
+    // gray of each cell is the mean of samples spread over it
+    float gray[PERCEPTUAL_ROWS][PERCEPTUAL_COLUMNS];
+    double sums[3] = {0, 0, 0};
+    size_t samplesCount = 0;
+    for (size_t row = 0; row < PERCEPTUAL_ROWS; row++) {
+        size_t top = row * height / PERCEPTUAL_ROWS;
+        size_t bottom = (row + 1) * height / PERCEPTUAL_ROWS;
+        if (bottom <= top) bottom = top + 1;
+        size_t stepY = (bottom - top + PERCEPTUAL_SAMPLES - 1) / PERCEPTUAL_SAMPLES;
+
+        for (size_t column = 0; column < PERCEPTUAL_COLUMNS; column++) {
+            size_t left = column * width / PERCEPTUAL_COLUMNS;
+            size_t right = (column + 1) * width / PERCEPTUAL_COLUMNS;
+            if (right <= left) right = left + 1;
+            size_t stepX = (right - left + PERCEPTUAL_SAMPLES - 1) / PERCEPTUAL_SAMPLES;
+
+            uint32_t cellSums[3] = {0, 0, 0}, cellCount = 0;
+            for (size_t y = top; y < bottom && y < height; y += stepY) {
+                const uint8_t *line = pixels + y * stride;
+                for (size_t x = left; x < right && x < width; x += stepX) {
+                    const uint8_t *pixel = line + x * channels;
+                    cellSums[0] += pixel[red];
+                    cellSums[1] += pixel[1];
+                    cellSums[2] += pixel[blue];
+                    cellCount++;
+                }
+            }
+            if (!cellCount) cellCount = 1;
+            gray[row][column] = (0.299f * cellSums[0] + 0.587f * cellSums[1] + 0.114f * cellSums[2]) / cellCount;
+            for (int c = 0; c < 3; c++) {
+                sums[c] += cellSums[c];
+            }
+            samplesCount += cellCount;
+        }
+    }
+
+    // one bit for each pair of neighbouring cells in a row, then the mean color in 16 levels
+    struct {
+        uint64_t gradients[PERCEPTUAL_ROWS * PERCEPTUAL_ROWS / 64];
+        uint8_t colors[3];
+    } signature;
+    memset(&signature, 0, sizeof(signature));
+    for (int row = 0; row < PERCEPTUAL_ROWS; row++) {
+        for (int column = 0; column < PERCEPTUAL_ROWS; column++) {
+            int bit = row * PERCEPTUAL_ROWS + column;
+            if (gray[row][column] < gray[row][column + 1]) signature.gradients[bit / 64] |= 1ULL << (bit % 64);
+        }
+    }
+    for (int c = 0; c < 3; c++) {
+        signature.colors[c] = (uint8_t)(sums[c] / (samplesCount? samplesCount : 1)) >> 4;
+    }
+
+    return result_cache_hash(&signature, sizeof(signature), 0);
+}
@@ -0,0 +1,68 @@
+//
+//  resultCache.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/22.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef resultCache_h
+#define resultCache_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "imagePreprocess.h"
+
+// Bounded LRU of the top k probabilities of images, keyed by 64-bit hashes of their content.
+// Keys are spread over shards by their high bits, each shard has its own lock, hash table and
+// recency list, so that threads looking up different images rarely wait for each other.
+// All memory is allocated when the cache is created, and the least recently used result of
+// a full shard is replaced by a new one.
+typedef struct result_cache result_cache;
+
+typedef struct result_cache_statistics {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t insertions;
+    uint64_t evictions;
+    size_t entries;
+    size_t capacity;
+} result_cache_statistics;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// capacity is split evenly across shards, returns NULL if memory can not be allocated
+result_cache *result_cache_create(size_t capacity, size_t shards_count, int top_k);
+void result_cache_destroy(result_cache *cache);
+
+int result_cache_top_k(const result_cache *cache);
+
+// copies indices and probabilities of the top k of key, from the largest one, returns 1 if it is cached
+int result_cache_lookup(result_cache *cache, uint64_t key, int *indices, float *probs);
+
+// keeps the top k of count probabilities under key, replacing what key had
+void result_cache_insert(result_cache *cache, uint64_t key, const float *probs, int count);
+
+void result_cache_clear(result_cache *cache);
+void result_cache_get_statistics(result_cache *cache, result_cache_statistics *statistics);
+void result_cache_reset_statistics(result_cache *cache);
+
+// XXH64 of size bytes, e.g. of a preprocessed input, at more than a byte per cycle
+uint64_t result_cache_hash(const void *data, size_t size, uint64_t seed);
+
+// a hash of what an image looks like rather than of its bytes: signs of horizontal gradients of the image
+// shrunk to 16 x 16 gray, and its mean color in 16 levels, so that the same picture decoded, re-encoded or
+// resized again usually gets the same key, while different pictures very rarely do
+uint64_t result_cache_perceptual_hash(const uint8_t *pixels,
+                                      size_t width,
+                                      size_t height,
+                                      size_t stride,
+                                      preprocess_pixel_format format);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* resultCache_h */
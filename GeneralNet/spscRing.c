@@ -0,0 +1,76 @@
+//
+//  spscRing.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/10.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#define _POSIX_C_SOURCE 200809L     // nanosleep
+
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include "spscRing.h"
+
+int spsc_ring_init(spsc_ring *ring, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    
+    ring->items = malloc(size * sizeof(int));
+    if (!ring->items) return -1;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+void spsc_ring_destroy(spsc_ring *ring) {
+    free(ring->items);
+    ring->items = NULL;
+}
+
+bool spsc_ring_try_push(spsc_ring *ring, int item) {
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask) return false;
+    
+    ring->items[tail & ring->mask] = item;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);     // publish the item
+    return true;
+}
+
+bool spsc_ring_try_pop(spsc_ring *ring, int *item) {
+    const size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    const size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) return false;
+    
+    *item = ring->items[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);     // give the room back
+    return true;
+}
+
+// images take milliseconds per stage, so after a short spin the waiting thread gives up its core
+static void backoff(unsigned int *spins) {
+    if (*spins < 64) {
+        (*spins)++;
+    } else if (*spins < 1024) {
+        (*spins)++;
+        sched_yield();
+    } else {
+        const struct timespec interval = { .tv_sec = 0, .tv_nsec = 50 * 1000 };
+        nanosleep(&interval, NULL);
+    }
+}
+
+void spsc_ring_push(spsc_ring *ring, int item) {
+    unsigned int spins = 0;
+    while (!spsc_ring_try_push(ring, item)) backoff(&spins);
+}
+
+int spsc_ring_pop(spsc_ring *ring) {
+    int item;
+    unsigned int spins = 0;
+    while (!spsc_ring_try_pop(ring, &item)) backoff(&spins);
+    return item;
+}
@@ -0,0 +1,50 @@
+//
+//  spscRing.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/10.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef spscRing_h
+#define spscRing_h
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SPSC_RING_CACHE_LINE 64
+
+// Bounded lock-free ring of ints for exactly one producer thread and one consumer thread.
+// head and tail are on separate cache lines, so that the two threads do not share a line
+// unless the ring is nearly empty or full.
+typedef struct spsc_ring {
+    _Atomic size_t head;        // next position to pop, only written by the consumer
+    char padding_head[SPSC_RING_CACHE_LINE - sizeof(size_t)];
+    _Atomic size_t tail;        // next position to push, only written by the producer
+    char padding_tail[SPSC_RING_CACHE_LINE - sizeof(size_t)];
+    size_t mask;
+    int *items;
+} spsc_ring;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// capacity is rounded up to a power of 2, returns 0 on success
+int spsc_ring_init(spsc_ring *ring, size_t capacity);
+void spsc_ring_destroy(spsc_ring *ring);
+
+// return false if the ring is full / empty
+bool spsc_ring_try_push(spsc_ring *ring, int item);
+bool spsc_ring_try_pop(spsc_ring *ring, int *item);
+
+// wait until there is room / an item, spinning first and then yielding the processor
+void spsc_ring_push(spsc_ring *ring, int item);
+int spsc_ring_pop(spsc_ring *ring);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* spscRing_h */
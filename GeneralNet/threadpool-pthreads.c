@@ -194,6 +194,12 @@ struct PTHREADPOOL_CACHELINE_ALIGNED pthreadpool {
 	 */
 	pthread_cond_t command_condvar;
 #endif
+	/**
+	 * Called by each worker thread around its part of a computation, see pthreadpool_set_hooks.
+	 */
+	pthreadpool_hook_t begin_hook;
+	pthreadpool_hook_t end_hook;
+	void* hook_context;
 	/**
 	 * The number of threads in the thread pool. Never changes after initialization.
 	 */
@@ -305,7 +311,13 @@ static void* thread_main(void* arg) {
 		/* Process command */
 		switch (command & THREADPOOL_COMMAND_MASK) {
 			case threadpool_command_compute_1d:
+				if (threadpool->begin_hook != NULL) {
+					threadpool->begin_hook(threadpool->hook_context, thread->thread_number);
+				}
 				thread_compute_1d(threadpool, thread);
+				if (threadpool->end_hook != NULL) {
+					threadpool->end_hook(threadpool->hook_context, thread->thread_number);
+				}
 				break;
 			case threadpool_command_shutdown:
 				/* Exit immediately: the master thread is waiting on pthread_join */
@@ -457,6 +469,20 @@ void pthreadpool_compute_1d(
 	}
 }
 
+void pthreadpool_set_hooks(
+	struct pthreadpool* threadpool,
+	pthreadpool_hook_t begin,
+	pthreadpool_hook_t end,
+	void* context)
+{
+	/* Workers read the hooks after observing the next command, which is published under a lock or a barrier */
+	pthread_mutex_lock(&threadpool->execution_mutex);
+	threadpool->begin_hook = begin;
+	threadpool->end_hook = end;
+	threadpool->hook_context = context;
+	pthread_mutex_unlock(&threadpool->execution_mutex);
+}
+
 struct compute_1d_tiled_context {
 	pthreadpool_function_1d_tiled_t function;
 	void* argument;
@@ -0,0 +1,635 @@
+//
+//  vectorMath.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/2.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "vectorMath.h"
+
+#if defined(__AVX512F__)
+    #include <immintrin.h>
+    #define VMATH_AVX512 1
+#elif defined(__AVX2__) && defined(__FMA__)
+    #include <immintrin.h>
+    #define VMATH_AVX2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    #include <arm_neon.h>
+    #define VMATH_NEON 1
+#endif
+
+// a thin layer over the intrinsics, so that every kernel below is written only once
+// vf_t: vector of floats, vi_t: vector of int32, vm_t: comparison mask
+#if VMATH_AVX512
+
+#define VF_WIDTH 16
+typedef __m512    vf_t;
+typedef __m512i   vi_t;
+typedef __mmask16 vm_t;
+
+static inline vf_t vf_load(const float *p)          { return _mm512_loadu_ps(p); }
+static inline void vf_store(float *p, vf_t a)       { _mm512_storeu_ps(p, a); }
+static inline vf_t vf_set1(float a)                 { return _mm512_set1_ps(a); }
+static inline vf_t vf_add(vf_t a, vf_t b)           { return _mm512_add_ps(a, b); }
+static inline vf_t vf_sub(vf_t a, vf_t b)           { return _mm512_sub_ps(a, b); }
+static inline vf_t vf_mul(vf_t a, vf_t b)           { return _mm512_mul_ps(a, b); }
+static inline vf_t vf_div(vf_t a, vf_t b)           { return _mm512_div_ps(a, b); }
+static inline vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) { return _mm512_fmadd_ps(a, b, c); }
+static inline vf_t vf_max(vf_t a, vf_t b)           { return _mm512_max_ps(a, b); }
+static inline float vf_hsum(vf_t a)                 { return _mm512_reduce_add_ps(a); }
+static inline float vf_hmax(vf_t a)                 { return _mm512_reduce_max_ps(a); }
+static inline vm_t vf_cmplt(vf_t a, vf_t b)         { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+static inline vm_t vf_cmpgt(vf_t a, vf_t b)         { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+static inline vm_t vf_cmpeq(vf_t a, vf_t b)         { return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ); }
+static inline vm_t vf_isnan(vf_t a)                 { return _mm512_cmp_ps_mask(a, a, _CMP_UNORD_Q); }
+static inline vf_t vf_select(vm_t m, vf_t t, vf_t f) { return _mm512_mask_blend_ps(m, f, t); }
+static inline vi_t vf_as_vi(vf_t a)                 { return _mm512_castps_si512(a); }
+static inline vf_t vi_as_vf(vi_t a)                 { return _mm512_castsi512_ps(a); }
+static inline vf_t vi_to_vf(vi_t a)                 { return _mm512_cvtepi32_ps(a); }
+static inline vi_t vi_set1(int32_t a)               { return _mm512_set1_epi32(a); }
+static inline vi_t vi_add(vi_t a, vi_t b)           { return _mm512_add_epi32(a, b); }
+static inline vi_t vi_sub(vi_t a, vi_t b)           { return _mm512_sub_epi32(a, b); }
+static inline vi_t vi_and(vi_t a, vi_t b)           { return _mm512_and_si512(a, b); }
+static inline vi_t vi_or(vi_t a, vi_t b)            { return _mm512_or_si512(a, b); }
+static inline vi_t vi_sra1(vi_t a)                  { return _mm512_srai_epi32(a, 1); }
+static inline vi_t vi_srl23(vi_t a)                 { return _mm512_srli_epi32(a, 23); }
+static inline vi_t vi_sll23(vi_t a)                 { return _mm512_slli_epi32(a, 23); }
+
+#elif VMATH_AVX2
+
+#define VF_WIDTH 8
+typedef __m256  vf_t;
+typedef __m256i vi_t;
+typedef __m256  vm_t;
+
+static inline vf_t vf_load(const float *p)          { return _mm256_loadu_ps(p); }
+static inline void vf_store(float *p, vf_t a)       { _mm256_storeu_ps(p, a); }
+static inline vf_t vf_set1(float a)                 { return _mm256_set1_ps(a); }
+static inline vf_t vf_add(vf_t a, vf_t b)           { return _mm256_add_ps(a, b); }
+static inline vf_t vf_sub(vf_t a, vf_t b)           { return _mm256_sub_ps(a, b); }
+static inline vf_t vf_mul(vf_t a, vf_t b)           { return _mm256_mul_ps(a, b); }
+static inline vf_t vf_div(vf_t a, vf_t b)           { return _mm256_div_ps(a, b); }
+static inline vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) { return _mm256_fmadd_ps(a, b, c); }
+static inline vf_t vf_max(vf_t a, vf_t b)           { return _mm256_max_ps(a, b); }
+static inline vm_t vf_cmplt(vf_t a, vf_t b)         { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vm_t vf_cmpgt(vf_t a, vf_t b)         { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline vm_t vf_cmpeq(vf_t a, vf_t b)         { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+static inline vm_t vf_isnan(vf_t a)                 { return _mm256_cmp_ps(a, a, _CMP_UNORD_Q); }
+static inline vf_t vf_select(vm_t m, vf_t t, vf_t f) { return _mm256_blendv_ps(f, t, m); }
+static inline vi_t vf_as_vi(vf_t a)                 { return _mm256_castps_si256(a); }
+static inline vf_t vi_as_vf(vi_t a)                 { return _mm256_castsi256_ps(a); }
+static inline vf_t vi_to_vf(vi_t a)                 { return _mm256_cvtepi32_ps(a); }
+static inline vi_t vi_set1(int32_t a)               { return _mm256_set1_epi32(a); }
+static inline vi_t vi_add(vi_t a, vi_t b)           { return _mm256_add_epi32(a, b); }
+static inline vi_t vi_sub(vi_t a, vi_t b)           { return _mm256_sub_epi32(a, b); }
+static inline vi_t vi_and(vi_t a, vi_t b)           { return _mm256_and_si256(a, b); }
+static inline vi_t vi_or(vi_t a, vi_t b)            { return _mm256_or_si256(a, b); }
+static inline vi_t vi_sra1(vi_t a)                  { return _mm256_srai_epi32(a, 1); }
+static inline vi_t vi_srl23(vi_t a)                 { return _mm256_srli_epi32(a, 23); }
+static inline vi_t vi_sll23(vi_t a)                 { return _mm256_slli_epi32(a, 23); }
+
+static inline float vf_hsum(vf_t a) {
+    __m128 v = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_movehdup_ps(v));
+    return _mm_cvtss_f32(v);
+}
+
+static inline float vf_hmax(vf_t a) {
+    __m128 v = _mm_max_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_movehdup_ps(v));
+    return _mm_cvtss_f32(v);
+}
+
+#elif VMATH_NEON
+
+#define VF_WIDTH 4
+typedef float32x4_t vf_t;
+typedef int32x4_t   vi_t;
+typedef uint32x4_t  vm_t;
+
+static inline vf_t vf_load(const float *p)          { return vld1q_f32(p); }
+static inline void vf_store(float *p, vf_t a)       { vst1q_f32(p, a); }
+static inline vf_t vf_set1(float a)                 { return vdupq_n_f32(a); }
+static inline vf_t vf_add(vf_t a, vf_t b)           { return vaddq_f32(a, b); }
+static inline vf_t vf_sub(vf_t a, vf_t b)           { return vsubq_f32(a, b); }
+static inline vf_t vf_mul(vf_t a, vf_t b)           { return vmulq_f32(a, b); }
+static inline vf_t vf_max(vf_t a, vf_t b)           { return vmaxq_f32(a, b); }
+static inline vm_t vf_cmplt(vf_t a, vf_t b)         { return vcltq_f32(a, b); }
+static inline vm_t vf_cmpgt(vf_t a, vf_t b)         { return vcgtq_f32(a, b); }
+static inline vm_t vf_cmpeq(vf_t a, vf_t b)         { return vceqq_f32(a, b); }
+static inline vm_t vf_isnan(vf_t a)                 { return vmvnq_u32(vceqq_f32(a, a)); }
+static inline vf_t vf_select(vm_t m, vf_t t, vf_t f) { return vbslq_f32(m, t, f); }
+static inline vi_t vf_as_vi(vf_t a)                 { return vreinterpretq_s32_f32(a); }
+static inline vf_t vi_as_vf(vi_t a)                 { return vreinterpretq_f32_s32(a); }
+static inline vf_t vi_to_vf(vi_t a)                 { return vcvtq_f32_s32(a); }
+static inline vi_t vi_set1(int32_t a)               { return vdupq_n_s32(a); }
+static inline vi_t vi_add(vi_t a, vi_t b)           { return vaddq_s32(a, b); }
+static inline vi_t vi_sub(vi_t a, vi_t b)           { return vsubq_s32(a, b); }
+static inline vi_t vi_and(vi_t a, vi_t b)           { return vandq_s32(a, b); }
+static inline vi_t vi_or(vi_t a, vi_t b)            { return vorrq_s32(a, b); }
+static inline vi_t vi_sra1(vi_t a)                  { return vshrq_n_s32(a, 1); }
+static inline vi_t vi_srl23(vi_t a)                 { return vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(a), 23)); }
+static inline vi_t vi_sll23(vi_t a)                 { return vshlq_n_s32(a, 23); }
+
+#if defined(__aarch64__)
+static inline vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) { return vfmaq_f32(c, a, b); }
+static inline vf_t vf_div(vf_t a, vf_t b)           { return vdivq_f32(a, b); }
+static inline float vf_hsum(vf_t a)                 { return vaddvq_f32(a); }
+static inline float vf_hmax(vf_t a)                 { return vmaxvq_f32(a); }
+#else
+static inline vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) { return vmlaq_f32(c, a, b); }
+
+static inline vf_t vf_div(vf_t a, vf_t b) {
+    // reciprocal estimate refined by two Newton-Raphson steps
+    float32x4_t r = vrecpeq_f32(b);
+    r = vmulq_f32(vrecpsq_f32(b, r), r);
+    r = vmulq_f32(vrecpsq_f32(b, r), r);
+    return vmulq_f32(a, r);
+}
+
+static inline float vf_hsum(vf_t a) {
+    float32x2_t v = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+    return vget_lane_f32(vpadd_f32(v, v), 0);
+}
+
+static inline float vf_hmax(vf_t a) {
+    float32x2_t v = vmax_f32(vget_low_f32(a), vget_high_f32(a));
+    return vget_lane_f32(vpmax_f32(v, v), 0);
+}
+#endif
+
+#else
+
+#define VF_WIDTH 1
+typedef float   vf_t;
+typedef int32_t vi_t;
+typedef int     vm_t;
+
+static inline vf_t vf_load(const float *p)          { return *p; }
+static inline void vf_store(float *p, vf_t a)       { *p = a; }
+static inline vf_t vf_set1(float a)                 { return a; }
+static inline vf_t vf_add(vf_t a, vf_t b)           { return a + b; }
+static inline vf_t vf_sub(vf_t a, vf_t b)           { return a - b; }
+static inline vf_t vf_mul(vf_t a, vf_t b)           { return a * b; }
+static inline vf_t vf_div(vf_t a, vf_t b)           { return a / b; }
+static inline vf_t vf_fmadd(vf_t a, vf_t b, vf_t c) { return fmaf(a, b, c); }
+static inline vf_t vf_max(vf_t a, vf_t b)           { return a > b ? a : b; }
+static inline float vf_hsum(vf_t a)                 { return a; }
+static inline float vf_hmax(vf_t a)                 { return a; }
+static inline vm_t vf_cmplt(vf_t a, vf_t b)         { return a < b; }
+static inline vm_t vf_cmpgt(vf_t a, vf_t b)         { return a > b; }
+static inline vm_t vf_cmpeq(vf_t a, vf_t b)         { return a == b; }
+static inline vm_t vf_isnan(vf_t a)                 { return a != a; }
+static inline vf_t vf_select(vm_t m, vf_t t, vf_t f) { return m ? t : f; }
+static inline vi_t vf_as_vi(vf_t a)                 { vi_t r; memcpy(&r, &a, sizeof(r)); return r; }
+static inline vf_t vi_as_vf(vi_t a)                 { vf_t r; memcpy(&r, &a, sizeof(r)); return r; }
+static inline vf_t vi_to_vf(vi_t a)                 { return (float)a; }
+static inline vi_t vi_set1(int32_t a)               { return a; }
+static inline vi_t vi_add(vi_t a, vi_t b)           { return a + b; }
+static inline vi_t vi_sub(vi_t a, vi_t b)           { return a - b; }
+static inline vi_t vi_and(vi_t a, vi_t b)           { return a & b; }
+static inline vi_t vi_or(vi_t a, vi_t b)            { return a | b; }
+static inline vi_t vi_sra1(vi_t a)                  { return a >> 1; }
+static inline vi_t vi_srl23(vi_t a)                 { return (vi_t)((uint32_t)a >> 23); }
+static inline vi_t vi_sll23(vi_t a)                 { return (vi_t)((uint32_t)a << 23); }
+
+#endif
+
+// exp(x), from Cephes expf:
+// x = n * ln2 + r with |r| <= ln2 / 2, exp(r) = 1 + r + r^2 * P(r) with a degree-5 minimax P,
+// and 2^n assembled in the exponent bits. n is split in two halves so that the full
+// input range, including results that end up subnormal, stays representable.
+static const float kExpHi     =  88.72283935546875f;
+static const float kExpLo     = -103.97208404541015625f;
+static const float kLog2e     =  1.44269504088896341f;
+static const float kLn2Hi     =  0.693359375f;
+static const float kLn2Lo     = -2.12194440e-4f;
+static const float kRoundMagic = 12582912.0f;   // 1.5 * 2^23, adding it rounds to the nearest integer
+
+static inline vf_t vf_exp(vf_t x) {
+    const vf_t hi = vf_set1(kExpHi);
+    const vf_t lo = vf_set1(kExpLo);
+    const vf_t magic = vf_set1(kRoundMagic);
+
+    vf_t xc = vf_select(vf_cmpgt(x, hi), hi, x);
+    xc = vf_select(vf_cmplt(xc, lo), lo, xc);
+
+    const vf_t t = vf_fmadd(xc, vf_set1(kLog2e), magic);
+    const vf_t n = vf_sub(t, magic);
+    vf_t r = vf_fmadd(n, vf_set1(-kLn2Hi), xc);
+    r = vf_fmadd(n, vf_set1(-kLn2Lo), r);
+
+    vf_t p = vf_set1(1.9875691500E-4f);
+    p = vf_fmadd(p, r, vf_set1(1.3981999507E-3f));
+    p = vf_fmadd(p, r, vf_set1(8.3334519073E-3f));
+    p = vf_fmadd(p, r, vf_set1(4.1665795894E-2f));
+    p = vf_fmadd(p, r, vf_set1(1.6666665459E-1f));
+    p = vf_fmadd(p, r, vf_set1(5.0000001201E-1f));
+    vf_t y = vf_fmadd(p, vf_mul(r, r), r);
+    y = vf_add(y, vf_set1(1.0f));
+
+    const vi_t ni = vi_sub(vf_as_vi(t), vf_as_vi(magic));
+    const vi_t n1 = vi_sra1(ni);
+    const vi_t n2 = vi_sub(ni, n1);
+    y = vf_mul(y, vi_as_vf(vi_sll23(vi_add(n1, vi_set1(127)))));
+    y = vf_mul(y, vi_as_vf(vi_sll23(vi_add(n2, vi_set1(127)))));
+
+    y = vf_select(vf_cmpgt(x, hi), vf_set1(INFINITY), y);
+    y = vf_select(vf_cmplt(x, lo), vf_set1(0.0f), y);
+    return vf_select(vf_isnan(x), x, y);
+}
+
+// log(x), from Cephes logf:
+// x = m * 2^e with m in [sqrt(0.5), sqrt(2)), log(m) = f - f^2 / 2 + f^3 * P(f) with f = m - 1
+// and a degree-8 minimax P, then e * ln2 is added in two parts.
+static const float kSqrtHalf  = 0.707106781186547524f;
+static const float kFloatMin  = 1.17549435e-38f;
+static const float kTwoTo23   = 8388608.0f;
+
+static inline vf_t vf_log(vf_t x) {
+    // bring subnormals into the normal range first
+    const vm_t subnormal = vf_cmplt(x, vf_set1(kFloatMin));
+    const vf_t xs = vf_select(subnormal, vf_mul(x, vf_set1(kTwoTo23)), x);
+
+    const vi_t bits = vf_as_vi(xs);
+    vf_t e = vi_to_vf(vi_sub(vi_srl23(bits), vi_set1(126)));
+    e = vf_select(subnormal, vf_sub(e, vf_set1(23.0f)), e);
+    vf_t m = vi_as_vf(vi_or(vi_and(bits, vi_set1(0x007FFFFF)), vi_set1(0x3F000000)));     // [0.5, 1)
+
+    const vm_t small = vf_cmplt(m, vf_set1(kSqrtHalf));
+    e = vf_select(small, vf_sub(e, vf_set1(1.0f)), e);
+    m = vf_select(small, vf_add(m, m), m);
+    const vf_t f = vf_sub(m, vf_set1(1.0f));
+    const vf_t z = vf_mul(f, f);
+
+    vf_t p = vf_set1(7.0376836292E-2f);
+    p = vf_fmadd(p, f, vf_set1(-1.1514610310E-1f));
+    p = vf_fmadd(p, f, vf_set1(1.1676998740E-1f));
+    p = vf_fmadd(p, f, vf_set1(-1.2420140846E-1f));
+    p = vf_fmadd(p, f, vf_set1(1.4249322787E-1f));
+    p = vf_fmadd(p, f, vf_set1(-1.6668057665E-1f));
+    p = vf_fmadd(p, f, vf_set1(2.0000714765E-1f));
+    p = vf_fmadd(p, f, vf_set1(-2.4999993993E-1f));
+    p = vf_fmadd(p, f, vf_set1(3.3333331174E-1f));
+
+    vf_t y = vf_mul(vf_mul(p, f), z);
+    y = vf_fmadd(e, vf_set1(kLn2Lo), y);
+    y = vf_fmadd(z, vf_set1(-0.5f), y);
+    y = vf_add(f, y);
+    y = vf_fmadd(e, vf_set1(kLn2Hi), y);
+
+    y = vf_select(vf_cmpeq(x, vf_set1(INFINITY)), x, y);
+    y = vf_select(vf_cmpeq(x, vf_set1(0.0f)), vf_set1(-INFINITY), y);
+    y = vf_select(vf_cmplt(x, vf_set1(0.0f)), vf_set1(NAN), y);
+    return vf_select(vf_isnan(x), x, y);
+}
+
+static inline vf_t vf_pow(vf_t x, vf_t e) {
+    return vf_exp(vf_mul(e, vf_log(x)));
+}
+
+// element-wise kernels: a vector loop, then a scalar loop for the tail
+// transcendental functions handle the tail by padding it to a full vector,
+// so that every element goes through exactly the same arithmetic
+#define VMATH_UNARY_TAIL(func, x, y, i, n)                      \
+    if (i < n) {                                                \
+        float tail[VF_WIDTH] = { 0.0f };                        \
+        memcpy(tail, x + i, (n - i) * sizeof(float));           \
+        vf_store(tail, func(vf_load(tail)));                    \
+        memcpy(y + i, tail, (n - i) * sizeof(float));           \
+    }
+
+void vmath_fill(float *y, float value, size_t n) {
+    size_t i = 0;
+    const vf_t v = vf_set1(value);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, v);
+    for (; i < n; i++) y[i] = value;
+}
+
+void vmath_relu(const float *x, float *y, size_t n) {
+    size_t i = 0;
+    const vf_t zero = vf_set1(0.0f);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_max(vf_load(x + i), zero));
+    for (; i < n; i++) y[i] = x[i] > 0.0f ? x[i] : 0.0f;
+}
+
+void vmath_add(const float *a, const float *b, float *y, size_t n) {
+    size_t i = 0;
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_add(vf_load(a + i), vf_load(b + i)));
+    for (; i < n; i++) y[i] = a[i] + b[i];
+}
+
+void vmath_div(const float *a, const float *b, float *y, size_t n) {
+    size_t i = 0;
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_div(vf_load(a + i), vf_load(b + i)));
+    for (; i < n; i++) y[i] = a[i] / b[i];
+}
+
+void vmath_square(const float *x, float *y, size_t n) {
+    size_t i = 0;
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) {
+        const vf_t v = vf_load(x + i);
+        vf_store(y + i, vf_mul(v, v));
+    }
+    for (; i < n; i++) y[i] = x[i] * x[i];
+}
+
+void vmath_add_scalar(const float *x, float b, float *y, size_t n) {
+    size_t i = 0;
+    const vf_t vb = vf_set1(b);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_add(vf_load(x + i), vb));
+    for (; i < n; i++) y[i] = x[i] + b;
+}
+
+void vmath_scale(const float *x, float a, float *y, size_t n) {
+    size_t i = 0;
+    const vf_t va = vf_set1(a);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_mul(vf_load(x + i), va));
+    for (; i < n; i++) y[i] = x[i] * a;
+}
+
+void vmath_scale_add(const float *x, float a, float b, float *y, size_t n) {
+    size_t i = 0;
+    const vf_t va = vf_set1(a);
+    const vf_t vb = vf_set1(b);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_fmadd(vf_load(x + i), va, vb));
+    for (; i < n; i++) y[i] = fmaf(x[i], a, b);
+}
+
+void vmath_axpy(const float *x, float a, float *y, size_t n) {
+    size_t i = 0;
+    const vf_t va = vf_set1(a);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_fmadd(vf_load(x + i), va, vf_load(y + i)));
+    for (; i < n; i++) y[i] = fmaf(x[i], a, y[i]);
+}
+
+float vmath_sum(const float *x, size_t n) {
+    size_t i = 0;
+    float sum = 0.0f;
+    if (n >= 2 * VF_WIDTH) {
+        vf_t acc0 = vf_set1(0.0f), acc1 = vf_set1(0.0f);
+        for (; i + 2 * VF_WIDTH <= n; i += 2 * VF_WIDTH) {
+            acc0 = vf_add(acc0, vf_load(x + i));
+            acc1 = vf_add(acc1, vf_load(x + i + VF_WIDTH));
+        }
+        sum = vf_hsum(vf_add(acc0, acc1));
+    }
+    for (; i < n; i++) sum += x[i];
+    return sum;
+}
+
+float vmath_max(const float *x, size_t n) {
+    size_t i = 0;
+    float max = -INFINITY;
+    if (n >= VF_WIDTH) {
+        vf_t acc = vf_set1(-INFINITY);
+        for (; i + VF_WIDTH <= n; i += VF_WIDTH) acc = vf_max(acc, vf_load(x + i));
+        max = vf_hmax(acc);
+    }
+    for (; i < n; i++) max = x[i] > max ? x[i] : max;
+    return max;
+}
+
+void vmath_exp(const float *x, float *y, size_t n) {
+    size_t i = 0;
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_exp(vf_load(x + i)));
+    VMATH_UNARY_TAIL(vf_exp, x, y, i, n);
+}
+
+void vmath_log(const float *x, float *y, size_t n) {
+    size_t i = 0;
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_log(vf_load(x + i)));
+    VMATH_UNARY_TAIL(vf_log, x, y, i, n);
+}
+
+void vmath_pow(const float *x, const float *e, float *y, size_t n) {
+    size_t i = 0;
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_pow(vf_load(x + i), vf_load(e + i)));
+    if (i < n) {
+        float tailX[VF_WIDTH] = { 0.0f }, tailE[VF_WIDTH] = { 0.0f };
+        memcpy(tailX, x + i, (n - i) * sizeof(float));
+        memcpy(tailE, e + i, (n - i) * sizeof(float));
+        vf_store(tailX, vf_pow(vf_load(tailX), vf_load(tailE)));
+        memcpy(y + i, tailX, (n - i) * sizeof(float));
+    }
+}
+
+void vmath_pow_scalar(const float *x, float e, float *y, size_t n) {
+    size_t i = 0;
+    const vf_t ve = vf_set1(e);
+    for (; i + VF_WIDTH <= n; i += VF_WIDTH) vf_store(y + i, vf_pow(vf_load(x + i), ve));
+    if (i < n) {
+        float tail[VF_WIDTH] = { 0.0f };
+        memcpy(tail, x + i, (n - i) * sizeof(float));
+        vf_store(tail, vf_pow(vf_load(tail), ve));
+        memcpy(y + i, tail, (n - i) * sizeof(float));
+    }
+}
+
+static inline float dot(const float *a, const float *b, size_t n) {
+    size_t i = 0;
+    float sum = 0.0f;
+    if (n >= 2 * VF_WIDTH) {
+        vf_t acc0 = vf_set1(0.0f), acc1 = vf_set1(0.0f);
+        for (; i + 2 * VF_WIDTH <= n; i += 2 * VF_WIDTH) {
+            acc0 = vf_fmadd(vf_load(a + i), vf_load(b + i), acc0);
+            acc1 = vf_fmadd(vf_load(a + i + VF_WIDTH), vf_load(b + i + VF_WIDTH), acc1);
+        }
+        sum = vf_hsum(vf_add(acc0, acc1));
+    }
+    for (; i < n; i++) sum = fmaf(a[i], b[i], sum);
+    return sum;
+}
+
+void vmath_sgemv(const int M,
+                 const int N,
+                 const float *A,
+                 const float *x,
+                 float *y) {
+    for (int row = 0; row < M; row++) {
+        y[row] += dot(A + (size_t)row * N, x, N);
+    }
+}
+
+// multithreaded versions
+// element-wise operations are cut into tiles of at least VMATH_MT_THRESHOLD / 4 elements,
+// reductions use at most kMaxPartials tiles and sum up the partial results afterwards
+enum vmath_op {
+    vmath_op_relu,
+    vmath_op_add,
+    vmath_op_div,
+    vmath_op_square,
+    vmath_op_add_scalar,
+    vmath_op_scale,
+    vmath_op_scale_add,
+    vmath_op_exp,
+    vmath_op_log,
+    vmath_op_pow,
+    vmath_op_pow_scalar,
+    vmath_op_sum,
+    vmath_op_max,
+};
+
+enum { kMaxPartials = 64 };
+
+struct vmath_mt_context {
+    enum vmath_op op;
+    const float *a;
+    const float *b;
+    float *y;
+    float s0;
+    float s1;
+    size_t tile;
+    float partials[kMaxPartials];
+};
+
+static void vmath_mt_tile(struct vmath_mt_context *context, size_t start, size_t length) {
+    const float *a = context->a + start;
+    const float *b = context->b ? context->b + start : NULL;
+    float *y = context->y ? context->y + start : NULL;
+
+    switch (context->op) {
+        case vmath_op_relu:         vmath_relu(a, y, length); break;
+        case vmath_op_add:          vmath_add(a, b, y, length); break;
+        case vmath_op_div:          vmath_div(a, b, y, length); break;
+        case vmath_op_square:       vmath_square(a, y, length); break;
+        case vmath_op_add_scalar:   vmath_add_scalar(a, context->s0, y, length); break;
+        case vmath_op_scale:        vmath_scale(a, context->s0, y, length); break;
+        case vmath_op_scale_add:    vmath_scale_add(a, context->s0, context->s1, y, length); break;
+        case vmath_op_exp:          vmath_exp(a, y, length); break;
+        case vmath_op_log:          vmath_log(a, y, length); break;
+        case vmath_op_pow:          vmath_pow(a, b, y, length); break;
+        case vmath_op_pow_scalar:   vmath_pow_scalar(a, context->s0, y, length); break;
+        case vmath_op_sum:          context->partials[start / context->tile] = vmath_sum(a, length); break;
+        case vmath_op_max:          context->partials[start / context->tile] = vmath_max(a, length); break;
+    }
+}
+
+static inline size_t round_up(size_t number, size_t factor) {
+    return (number + factor - 1) / factor * factor;
+}
+
+// returns the number of tiles, 0 if the operation should run on the calling thread only
+static size_t vmath_mt_run(pthreadpool_t threadpool, struct vmath_mt_context *context, size_t n) {
+    if (threadpool == NULL || n < VMATH_MT_THRESHOLD) return 0;
+
+    const size_t threads = pthreadpool_get_threads_count(threadpool);
+    size_t tile = round_up((n + threads - 1) / threads, 64);
+    if (tile < VMATH_MT_THRESHOLD / 4) tile = VMATH_MT_THRESHOLD / 4;
+    if ((n + tile - 1) / tile > kMaxPartials) tile = round_up((n + kMaxPartials - 1) / kMaxPartials, 64);
+    context->tile = tile;
+
+    pthreadpool_compute_1d_tiled(threadpool,
+                                 (pthreadpool_function_1d_tiled_t) vmath_mt_tile,
+                                 context,
+                                 n,
+                                 tile);
+    return (n + tile - 1) / tile;
+}
+
+#define VMATH_MT_MAP(threadpool, n, single_call, ...)                   \
+    struct vmath_mt_context context = { __VA_ARGS__ };                  \
+    if (!vmath_mt_run(threadpool, &context, n)) single_call;
+
+void vmath_relu_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_relu(x, y, n), .op = vmath_op_relu, .a = x, .y = y);
+}
+
+void vmath_add_mt(pthreadpool_t threadpool, const float *a, const float *b, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_add(a, b, y, n), .op = vmath_op_add, .a = a, .b = b, .y = y);
+}
+
+void vmath_div_mt(pthreadpool_t threadpool, const float *a, const float *b, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_div(a, b, y, n), .op = vmath_op_div, .a = a, .b = b, .y = y);
+}
+
+void vmath_square_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_square(x, y, n), .op = vmath_op_square, .a = x, .y = y);
+}
+
+void vmath_add_scalar_mt(pthreadpool_t threadpool, const float *x, float b, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_add_scalar(x, b, y, n), .op = vmath_op_add_scalar, .a = x, .y = y, .s0 = b);
+}
+
+void vmath_scale_mt(pthreadpool_t threadpool, const float *x, float a, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_scale(x, a, y, n), .op = vmath_op_scale, .a = x, .y = y, .s0 = a);
+}
+
+void vmath_scale_add_mt(pthreadpool_t threadpool, const float *x, float a, float b, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_scale_add(x, a, b, y, n), .op = vmath_op_scale_add, .a = x, .y = y, .s0 = a, .s1 = b);
+}
+
+void vmath_exp_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_exp(x, y, n), .op = vmath_op_exp, .a = x, .y = y);
+}
+
+void vmath_log_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_log(x, y, n), .op = vmath_op_log, .a = x, .y = y);
+}
+
+void vmath_pow_mt(pthreadpool_t threadpool, const float *x, const float *e, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_pow(x, e, y, n), .op = vmath_op_pow, .a = x, .b = e, .y = y);
+}
+
+void vmath_pow_scalar_mt(pthreadpool_t threadpool, const float *x, float e, float *y, size_t n) {
+    VMATH_MT_MAP(threadpool, n, vmath_pow_scalar(x, e, y, n), .op = vmath_op_pow_scalar, .a = x, .y = y, .s0 = e);
+}
+
+float vmath_sum_mt(pthreadpool_t threadpool, const float *x, size_t n) {
+    struct vmath_mt_context context = { .op = vmath_op_sum, .a = x };
+    const size_t tiles = vmath_mt_run(threadpool, &context, n);
+    if (!tiles) return vmath_sum(x, n);
+    return vmath_sum(context.partials, tiles);
+}
+
+float vmath_max_mt(pthreadpool_t threadpool, const float *x, size_t n) {
+    struct vmath_mt_context context = { .op = vmath_op_max, .a = x };
+    const size_t tiles = vmath_mt_run(threadpool, &context, n);
+    if (!tiles) return vmath_max(x, n);
+    return vmath_max(context.partials, tiles);
+}
+
+struct sgemv_context {
+    int N;
+    const float *A;
+    const float *x;
+    float *y;
+};
+
+static void compute_sgemv(const struct sgemv_context *context, size_t row_start, size_t row_count) {
+    vmath_sgemv((int)row_count, context->N, context->A + row_start * context->N, context->x, context->y + row_start);
+}
+
+void vmath_sgemv_mt(pthreadpool_t threadpool,
+                    const int M,
+                    const int N,
+                    const float *A,
+                    const float *x,
+                    float *y) {
+    if (threadpool == NULL || (size_t)M * N < VMATH_MT_THRESHOLD) {
+        vmath_sgemv(M, N, A, x, y);
+        return;
+    }
+
+    // each tile of rows streams its own slice of A, so a few tiles per thread are enough
+    const size_t threads = pthreadpool_get_threads_count(threadpool);
+    size_t tile = (M + 4 * threads - 1) / (4 * threads);
+    if (tile < 4) tile = 4;
+    struct sgemv_context context = {
+        .N = N,
+        .A = A,
+        .x = x,
+        .y = y,
+    };
+    pthreadpool_compute_1d_tiled(threadpool,
+                                 (pthreadpool_function_1d_tiled_t) compute_sgemv,
+                                 &context,
+                                 M,
+                                 tile);
+}
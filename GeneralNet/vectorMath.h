@@ -0,0 +1,109 @@
+//
+//  vectorMath.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/2.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef vectorMath_h
+#define vectorMath_h
+
+#include <stddef.h>
+#include "pthreadpool.h"
+
+// Portable replacement for the vDSP / vForce / cblas_sgemv calls used by the CPU layers.
+// The implementation is picked at compile time: AVX-512F, AVX2 + FMA, NEON, or plain C.
+//
+// All element-wise functions accept y == x (or y == a / y == b), so they can run in place.
+// The *_mt variants split the vector across a pthreadpool; they fall back to the
+// single-threaded version when threadpool is NULL or the vector is shorter than
+// VMATH_MT_THRESHOLD elements.
+//
+// Accuracy of the transcendental functions, measured against double precision over
+// the whole float range (see the comments in vectorMath.c for the polynomials):
+//   vmath_exp: <= 1.01 ulp for x in [-87.3, 88.7] (normal results); +inf above 88.72,
+//              0 below -103.97, subnormal results in between lose precision as usual
+//   vmath_log: <= 0.85 ulp (0.83 measured) for every positive normal or subnormal x;
+//              -inf for x == 0, NaN for x < 0, +inf for x == +inf
+//   vmath_pow: computed as exp(e * log(x)), valid for x >= 0; <= 2.1 ulp (2.09 measured) for
+//              e = -0.75 and x in [1, 4] (the LRN case), <= 2.4 ulp while |e * log2(x)| <= 1.5,
+//              growing to about 1 + |e * log2(x)| ulp beyond
+// NaN inputs propagate to NaN outputs.
+
+#define VMATH_MT_THRESHOLD (64 * 1024)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// y[i] = value
+void vmath_fill(float *y, float value, size_t n);
+
+// y[i] = max(x[i], 0), same as vDSP_vthres with a zero threshold
+void vmath_relu(const float *x, float *y, size_t n);
+
+// y[i] = a[i] + b[i]
+void vmath_add(const float *a, const float *b, float *y, size_t n);
+
+// y[i] = a[i] / b[i]
+void vmath_div(const float *a, const float *b, float *y, size_t n);
+
+// y[i] = x[i] * x[i]
+void vmath_square(const float *x, float *y, size_t n);
+
+// y[i] = x[i] + b
+void vmath_add_scalar(const float *x, float b, float *y, size_t n);
+
+// y[i] = x[i] * a
+void vmath_scale(const float *x, float a, float *y, size_t n);
+
+// y[i] = x[i] * a + b, same as vDSP_vsmsa
+void vmath_scale_add(const float *x, float a, float b, float *y, size_t n);
+
+// y[i] += x[i] * a
+void vmath_axpy(const float *x, float a, float *y, size_t n);
+
+// sum and maximum of all elements; vmath_max returns -inf for n == 0
+float vmath_sum(const float *x, size_t n);
+float vmath_max(const float *x, size_t n);
+
+// y[i] = exp(x[i]), log(x[i]), x[i] ^ e[i], x[i] ^ e
+void vmath_exp(const float *x, float *y, size_t n);
+void vmath_log(const float *x, float *y, size_t n);
+void vmath_pow(const float *x, const float *e, float *y, size_t n);
+void vmath_pow_scalar(const float *x, float e, float *y, size_t n);
+
+// y += A * x, where A is a row-major M x N matrix
+void vmath_sgemv(const int M,
+                 const int N,
+                 const float *A,
+                 const float *x,
+                 float *y);
+
+// multithreaded versions
+void vmath_relu_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n);
+void vmath_add_mt(pthreadpool_t threadpool, const float *a, const float *b, float *y, size_t n);
+void vmath_div_mt(pthreadpool_t threadpool, const float *a, const float *b, float *y, size_t n);
+void vmath_square_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n);
+void vmath_add_scalar_mt(pthreadpool_t threadpool, const float *x, float b, float *y, size_t n);
+void vmath_scale_mt(pthreadpool_t threadpool, const float *x, float a, float *y, size_t n);
+void vmath_scale_add_mt(pthreadpool_t threadpool, const float *x, float a, float b, float *y, size_t n);
+float vmath_sum_mt(pthreadpool_t threadpool, const float *x, size_t n);
+float vmath_max_mt(pthreadpool_t threadpool, const float *x, size_t n);
+void vmath_exp_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n);
+void vmath_log_mt(pthreadpool_t threadpool, const float *x, float *y, size_t n);
+void vmath_pow_mt(pthreadpool_t threadpool, const float *x, const float *e, float *y, size_t n);
+void vmath_pow_scalar_mt(pthreadpool_t threadpool, const float *x, float e, float *y, size_t n);
+void vmath_sgemv_mt(pthreadpool_t threadpool,
+                    const int M,
+                    const int N,
+                    const float *A,
+                    const float *x,
+                    float *y);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* vectorMath_h */
@@ -0,0 +1,95 @@
+//
+//  weightContainer.c
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <zlib.h>
+#include "weightContainer.h"
+
+struct decompress_context {
+    const char *base;
+    char *raw;
+    atomic_int failed;
+};
+
+int weight_container_is_container(const void *base, size_t size) {
+    return size >= sizeof(weight_container_header) && ((const weight_container_header *)base)->magic == WEIGHT_CONTAINER_MAGIC;
+}
+
+const char *weight_container_check(const void *base, size_t size) {
+    const weight_container_header *header = base;
+    if (!weight_container_is_container(base, size)) return "not a weight container";
+    if (header->version != WEIGHT_CONTAINER_VERSION) return "unsupported version";
+    if (header->file_size != size) return "truncated file";
+    if (header->chunk_count > (size - sizeof(weight_container_header)) / sizeof(weight_container_chunk)) return "chunk table out of range";
+
+    // chunks are stored in the order of their raw offsets
+    const weight_container_chunk *chunks = weight_container_chunks(header);
+    uint64_t raw_offset = 0;
+    for (uint32_t i = 0; i < header->chunk_count; i++) {
+        if (chunks[i].raw_offset != raw_offset || chunks[i].raw_size > header->raw_size - raw_offset) return "chunks do not cover the raw file";
+        if (chunks[i].offset > size || chunks[i].size > size - chunks[i].offset) return "chunk out of range";
+        switch (chunks[i].codec) {
+            case WEIGHT_CODEC_STORED:
+                if (chunks[i].size != chunks[i].raw_size) return "stored chunk of another size";
+                break;
+            case WEIGHT_CODEC_SHUFFLE_DEFLATE:
+                if (chunks[i].raw_size % sizeof(float)) return "shuffled chunk of partial floats";
+                break;
+            default:
+                return "unsupported codec";
+        }
+        raw_offset += chunks[i].raw_size;
+    }
+    if (raw_offset != header->raw_size) return "chunks do not cover the raw file";
+
+    return NULL;
+}
+
+static int decompress_chunk(const weight_container_chunk *chunk, const char *base, char *raw) {
+    const unsigned char *src = (const unsigned char *)base + chunk->offset;
+    char *dst = raw + chunk->raw_offset;
+    if (chunk->codec == WEIGHT_CODEC_STORED) {
+        memcpy(dst, src, chunk->raw_size);
+        return 0;
+    }
+
+    // inflate the planes of bytes, then put the bytes of each float back together
+    unsigned char *planes = malloc(chunk->raw_size);
+    if (!planes) return -1;
+    uLongf planes_size = (uLongf)chunk->raw_size;
+    int error = uncompress(planes, &planes_size, src, (uLong)chunk->size) != Z_OK || planes_size != chunk->raw_size;
+    if (!error) {
+        const size_t count = chunk->raw_size / sizeof(float);
+        for (size_t byte = 0; byte < sizeof(float); byte++) {
+            const unsigned char *plane = planes + byte * count;
+            unsigned char *output = (unsigned char *)dst + byte;
+            for (size_t i = 0; i < count; i++) {
+                output[i * sizeof(float)] = plane[i];
+            }
+        }
+    }
+    free(planes);
+    return error? -1 : 0;
+}
+
+static void decompress_chunk_at(struct decompress_context *context, size_t index) {
+    const weight_container_chunk *chunk = &weight_container_chunks((const weight_container_header *)context->base)[index];
+    if (decompress_chunk(chunk, context->base, context->raw)) atomic_store(&context->failed, 1);
+}
+
+int weight_container_decompress(pthreadpool_t threadpool, const void *base, void *raw) {
+    struct decompress_context context = { .base = base, .raw = raw };
+    atomic_init(&context.failed, 0);
+    pthreadpool_compute_1d(threadpool,
+                           (pthreadpool_function_1d_t)decompress_chunk_at,
+                           &context,
+                           ((const weight_container_header *)base)->chunk_count);
+    return atomic_load(&context.failed)? -1 : 0;
+}
@@ -0,0 +1,73 @@
+//
+//  weightContainer.h
+//  GeneralNet
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#ifndef weightContainer_h
+#define weightContainer_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pthreadpool.h"
+
+// A .dat file of weights and biases compressed by Convert/compress_weights.py, to be shipped instead of
+// the raw floats and decompressed once at load time. All integers are little-endian:
+//
+//   header | chunk table | chunks
+//
+// Chunks are ranges of the raw file, one for each layer and split further when large, so that they are
+// decompressed in parallel; each chunk is 8-byte aligned and compressed on its own.
+
+#define WEIGHT_CONTAINER_MAGIC      0x5a574e47      // "GNWZ"
+#define WEIGHT_CONTAINER_VERSION    1
+
+typedef enum weight_container_codec {
+    WEIGHT_CODEC_STORED         = 0,    // raw bytes, for chunks that do not compress
+    WEIGHT_CODEC_SHUFFLE_DEFLATE = 1,   // bytes of floats grouped by their position (signs and exponents together), then deflated
+} weight_container_codec;
+
+typedef struct weight_container_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunk_count;
+    uint32_t reserved;
+    uint64_t raw_size;          // size of the .dat file
+    uint64_t file_size;         // size of this file
+} weight_container_header;
+
+typedef struct weight_container_chunk {
+    uint32_t codec;             // weight_container_codec
+    uint32_t reserved;
+    uint64_t raw_offset;        // bytes in the .dat file
+    uint64_t raw_size;
+    uint64_t offset;            // bytes of the compressed chunk in this file
+    uint64_t size;
+} weight_container_chunk;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// whether size bytes start like a container, rather than raw floats
+int weight_container_is_container(const void *base, size_t size);
+
+// returns NULL if a mapped file of size bytes is a complete container of this version, whose chunks
+// are in range and cover the raw file exactly once, or the reason why it is not
+const char *weight_container_check(const void *base, size_t size);
+
+static inline const weight_container_chunk *weight_container_chunks(const weight_container_header *header) {
+    return (const weight_container_chunk *)(header + 1);
+}
+
+// decompress all chunks of a checked container into raw of header->raw_size bytes, one chunk at a time
+// on each thread of threadpool; returns 0 on success, -1 if a chunk is corrupted
+int weight_container_decompress(pthreadpool_t threadpool, const void *base, void *raw);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* weightContainer_h */
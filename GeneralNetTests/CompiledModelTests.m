@@ -0,0 +1,145 @@
+//
+//  CompiledModelTests.m
+//  GeneralNetTests
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <stddef.h>
+#import <string.h>
+#import "compiledModel.h"
+
+@interface CompiledModelTests : XCTestCase
+
+@end
+
+@implementation CompiledModelTests
+
+// a convolution layer followed by softmax, laid out as Convert/compile_model.py writes it
+typedef struct test_model {
+    compiled_model_header header;
+    compiled_model_layer layers[2];
+    compiled_model_step steps[2];       // one step, the other one keeps the labels 8-byte aligned
+    uint32_t labels[2];
+    char strings[24];
+} test_model;
+
+#define WEIGHTS_COUNT (4 * 3 * 3 * 3)
+#define BIASES_COUNT 4
+
+static void make_model(test_model *model) {
+    memset(model, 0, sizeof(test_model));
+    const char strings[] = "conv1\0prob\0cat\0dog";
+    memcpy(model->strings, strings, sizeof(strings));
+
+    model->header = (compiled_model_header){
+        .magic = COMPILED_MODEL_MAGIC,
+        .version = COMPILED_MODEL_VERSION,
+        .layer_count = 2,
+        .sequence_count = 1,
+        .label_count = 2,
+        .first_layer = 0,
+        .last_layer = 1,
+        .input_size = 8,
+        .data_file_size = (WEIGHTS_COUNT + BIASES_COUNT) * sizeof(float),
+        .file_size = sizeof(test_model),
+        .layers_offset = offsetof(test_model, layers),
+        .steps_offset = offsetof(test_model, steps),
+        .labels_offset = offsetof(test_model, labels),
+        .strings_offset = offsetof(test_model, strings),
+        .strings_size = sizeof(strings),
+    };
+    model->layers[0] = (compiled_model_layer){
+        .name = 0, .type = COMPILED_LAYER_CONVOLUTION, .image_type = COMPILED_IMAGE_TEMPORARY, .read_count = 1,
+        .weight_offset = 0, .bias_offset = WEIGHTS_COUNT,
+        .group = 1, .input_channel = 3, .output_channel = 4, .input_size = 8, .output_size = 8,
+        .kernel_size = 3, .pad = 1, .stride = 1, .do_relu = 1, .output_num = 4 * 8 * 8,
+    };
+    model->layers[1] = (compiled_model_layer){
+        .name = 6, .type = COMPILED_LAYER_SOFTMAX, .image_type = COMPILED_IMAGE_PERMANENT, .read_count = -1,
+        .input_channel = 4, .output_channel = 4, .input_size = 8, .output_size = 8, .output_num = 4 * 8 * 8,
+    };
+    model->steps[0] = (compiled_model_step){ .kernel = 1, .source = 0, .destination = 1 };
+    model->labels[0] = 11;
+    model->labels[1] = 15;
+}
+
+- (void)testValidModelIsReadInPlace {
+    test_model model;
+    make_model(&model);
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) == NULL);
+
+    const compiled_model_header *header = &model.header;
+    XCTAssertEqual(strcmp(compiled_model_string(header, compiled_model_layers(header)[0].name), "conv1"), 0);
+    XCTAssertEqual(strcmp(compiled_model_string(header, compiled_model_layers(header)[1].name), "prob"), 0);
+    XCTAssertEqual(compiled_model_steps(header)[0].destination, 1);
+    XCTAssertEqual(strcmp(compiled_model_string(header, compiled_model_labels(header)[1]), "dog"), 0);
+}
+
+- (void)testHeaderIsChecked {
+    test_model model;
+    make_model(&model);
+    XCTAssertTrue(compiled_model_check(&model, sizeof(compiled_model_header) - 1) != NULL);
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model) - 1) != NULL);
+
+    model.header.magic++;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.header.version++;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.header.layers_offset += 4;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.header.label_count = 3;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+}
+
+- (void)testIndicesAndStringsAreInRange {
+    test_model model;
+    make_model(&model);
+    model.header.last_layer = 2;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.steps[0].source = 2;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.layers[1].name = (uint32_t)model.header.strings_size;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.header.strings_size--;      // "dog" is no longer terminated
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+}
+
+- (void)testWeightsAreInsideTheDataFile {
+    test_model model;
+    make_model(&model);
+
+    // biases end exactly at the end of the data file, one float more does not fit
+    model.header.data_file_size -= sizeof(float);
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.layers[0].weight_offset = BIASES_COUNT + 1;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.layers[0].weight_offset = BIASES_COUNT;
+    model.layers[0].bias_offset = 0;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) == NULL);
+
+    // offsets and sizes that would wrap around
+    make_model(&model);
+    model.layers[0].bias_offset = UINT64_MAX - 1;
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.layers[0].output_channel = 1;
+    model.layers[0].input_channel = 1 << 30;
+    model.layers[0].kernel_size = 1 << 17;     // 2^64 weights
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+    make_model(&model);
+    model.layers[0].group = 2;        // 3 input channels can not be split into 2 groups
+    XCTAssertTrue(compiled_model_check(&model, sizeof(model)) != NULL);
+}
+
+@end
@@ -0,0 +1,104 @@
+//
+//  MemoryPlannerTests.m
+//  GeneralNetTests
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import "memoryPlanner.h"
+
+@interface MemoryPlannerTests : XCTestCase
+
+@end
+
+@implementation MemoryPlannerTests
+
+static unsigned int next_random(unsigned int *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+// offsets are aligned, inside the arena, and buffers alive at the same step do not share memory
+static BOOL plan_is_valid(const memory_plan_buffer *buffers, size_t count, size_t alignment, size_t arenaSize) {
+    for (size_t i = 0; i < count; i++) {
+        if (buffers[i].size == 0) {
+            if (buffers[i].offset != 0) return NO;
+            continue;
+        }
+        if (buffers[i].offset % alignment || buffers[i].offset + buffers[i].size > arenaSize) return NO;
+        for (size_t j = 0; j < i; j++) {
+            if (buffers[j].size == 0 || buffers[i].first_use > buffers[j].last_use || buffers[j].first_use > buffers[i].last_use) continue;
+            if (buffers[i].offset < buffers[j].offset + buffers[j].size && buffers[j].offset < buffers[i].offset + buffers[i].size) return NO;
+        }
+    }
+    return YES;
+}
+
+- (void)testEmptyPlan {
+    XCTAssertEqual(memory_plan(NULL, 0, MEMORY_PLAN_ALIGNMENT), 0);
+    XCTAssertEqual(memory_plan_naive_size(NULL, 0, MEMORY_PLAN_ALIGNMENT), 0);
+    XCTAssertEqual(memory_plan_lower_bound(NULL, 0, MEMORY_PLAN_ALIGNMENT), 0);
+}
+
+- (void)testChainReusesMemory {
+    // each output is read by the next step only, so two buffers are enough
+    memory_plan_buffer buffers[6];
+    for (int i = 0; i < 6; i++) {
+        buffers[i] = (memory_plan_buffer){ .size = 100, .first_use = i, .last_use = i + 1 };
+    }
+    size_t arenaSize = memory_plan(buffers, 6, MEMORY_PLAN_ALIGNMENT);
+    XCTAssertTrue(plan_is_valid(buffers, 6, MEMORY_PLAN_ALIGNMENT, arenaSize));
+    XCTAssertEqual(arenaSize, 2 * 128);
+    XCTAssertEqual(memory_plan_lower_bound(buffers, 6, MEMORY_PLAN_ALIGNMENT), 2 * 128);
+    XCTAssertEqual(memory_plan_naive_size(buffers, 6, MEMORY_PLAN_ALIGNMENT), 6 * 128);
+}
+
+- (void)testInPlaceAliasing {
+    // as in CPUModel: an output computed in place has no memory of its own, and its input lives until the output
+    // is read for the last time, so a buffer written meanwhile must not take the place of the input
+    memory_plan_buffer buffers[4] = {
+        { .size = 256, .first_use = 0, .last_use = 1 },     // input of the layer computing in place at step 1
+        { .size = 256, .first_use = 1, .last_use = 3 },     // its output, read at step 3
+        { .size = 256, .first_use = 2, .last_use = 3 },     // written at step 2, read at step 3 as well
+        { .size = 256, .first_use = 4, .last_use = 4 },     // written after all of them are dead
+    };
+    buffers[0].last_use = buffers[1].last_use;
+    buffers[1].size = 0;
+    size_t arenaSize = memory_plan(buffers, 4, MEMORY_PLAN_ALIGNMENT);
+    XCTAssertTrue(plan_is_valid(buffers, 4, MEMORY_PLAN_ALIGNMENT, arenaSize));
+    XCTAssertEqual(buffers[1].offset, 0);
+    XCTAssertNotEqual(buffers[0].offset, buffers[2].offset);
+    XCTAssertEqual(arenaSize, 2 * 256);
+}
+
+- (void)testRandomPlansAreValidAndBounded {
+    unsigned int state = 2017;
+    for (int round = 0; round < 100; round++) {
+        memory_plan_buffer buffers[64];
+        size_t count = 1 + next_random(&state) % 64;
+        for (size_t i = 0; i < count; i++) {
+            int first = next_random(&state) % 32;
+            buffers[i] = (memory_plan_buffer){
+                .size = next_random(&state) % 8 == 0? 0 : 1 + next_random(&state) % 100000,
+                .first_use = first,
+                .last_use = first + next_random(&state) % 8,
+            };
+        }
+        size_t arenaSize = memory_plan(buffers, count, MEMORY_PLAN_ALIGNMENT);
+        XCTAssertTrue(plan_is_valid(buffers, count, MEMORY_PLAN_ALIGNMENT, arenaSize), @"round %d", round);
+        XCTAssertLessThanOrEqual(memory_plan_lower_bound(buffers, count, MEMORY_PLAN_ALIGNMENT), arenaSize);
+        XCTAssertLessThanOrEqual(arenaSize, memory_plan_naive_size(buffers, count, MEMORY_PLAN_ALIGNMENT));
+
+        // the plan only depends on the buffers
+        memory_plan_buffer again[64];
+        memcpy(again, buffers, count * sizeof(memory_plan_buffer));
+        XCTAssertEqual(memory_plan(again, count, MEMORY_PLAN_ALIGNMENT), arenaSize);
+        XCTAssertEqual(memcmp(again, buffers, count * sizeof(memory_plan_buffer)), 0);
+    }
+}
+
+@end
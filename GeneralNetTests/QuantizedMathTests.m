@@ -0,0 +1,184 @@
+//
+//  QuantizedMathTests.m
+//  GeneralNetTests
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <math.h>
+#import "quantizedMath.h"
+
+@interface QuantizedMathTests : XCTestCase
+
+@end
+
+@implementation QuantizedMathTests
+
+// tiles of qmath_gemm_mt are 4 x 256, so sizes leave partial tiles, and K is odd
+enum { M = 6, N = 300, K = 7, LDB = N + 5, LDC = N + 3, BATCH = 3 };
+
+static unsigned int next_random(unsigned int *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void make_operands(int8_t *A, uint8_t *B, size_t countA, size_t countB) {
+    unsigned int state = 2017;
+    for (size_t i = 0; i < countA; i++) {
+        A[i] = next_random(&state) % 4 == 0? 0 : (int8_t)(next_random(&state) % 255 - 127);
+    }
+    for (size_t i = 0; i < countB; i++) {
+        B[i] = (uint8_t)next_random(&state);
+    }
+}
+
+- (void)testParamsKeepZeroExact {
+    qmath_params params = qmath_params_of_range(-1, 3);
+    XCTAssertEqualWithAccuracy(params.scale, 4.0f / 255, 1e-7);
+    XCTAssertEqual(params.zero_point, 64);
+    XCTAssertEqual(qmath_quantize_value(0, params), 64);
+
+    // ranges not covering 0 are widened to it
+    XCTAssertEqual(qmath_params_of_range(2, 5).zero_point, 0);
+    XCTAssertEqualWithAccuracy(qmath_params_of_range(2, 5).scale, 5.0f / 255, 1e-7);
+    XCTAssertEqual(qmath_params_of_range(-4, -1).zero_point, 255);
+    XCTAssertEqual(qmath_params_of_range(0, 0).scale, 1.0f);
+    XCTAssertEqual(qmath_params_of_range(0, 0).zero_point, 0);
+}
+
+- (void)testQuantizeRoundTrip {
+    qmath_params params = qmath_params_of_range(-1, 3);
+    enum { count = 1001 };
+    float x[count], y[count];
+    uint8_t q[count];
+    for (int i = 0; i < count; i++) {
+        x[i] = -1.5f + 5.0f * i / (count - 1);
+    }
+    qmath_quantize(x, params, q, count);
+    qmath_dequantize(q, params, y, count);
+
+    // the zero point is rounded, so levels cover the range shifted by less than half a level
+    const float low = -params.zero_point * params.scale, high = (255 - params.zero_point) * params.scale;
+    for (int i = 0; i < count; i++) {
+        if (x[i] < low - params.scale / 2) {
+            XCTAssertEqual(q[i], 0);
+        } else if (x[i] > high + params.scale / 2) {
+            XCTAssertEqual(q[i], 255);
+        } else {
+            XCTAssertEqualWithAccuracy(y[i], x[i], params.scale * 0.5001f);
+            XCTAssertEqualWithAccuracy(qmath_quantize_value(x[i], params), q[i], 1);
+        }
+    }
+    uint8_t all[256];
+    float values[256];
+    for (int i = 0; i < 256; i++) all[i] = (uint8_t)i;
+    qmath_dequantize(all, params, values, 256);
+    qmath_quantize(values, params, q, 256);
+    for (int i = 0; i < 256; i++) {
+        XCTAssertEqual(q[i], i);
+    }
+}
+
+- (void)testGemmMatchesIntegerProducts {
+    static int8_t A[M * K];
+    static uint8_t B[K * LDB];
+    static int32_t bias[M];
+    static float floatC[M * LDC], multipliers[M];
+    static uint8_t uint8C[M * LDC];
+    make_operands(A, B, M * K, K * LDB);
+    for (int m = 0; m < M; m++) {
+        bias[m] = (m - 3) * 1000;
+        multipliers[m] = 1.0f / (2000 + 300 * m);
+    }
+
+    pthreadpool_t threadpool = pthreadpool_create(2);
+    for (int threaded = 0; threaded < 2; threaded++) {
+        pthreadpool_t pool = threaded? threadpool : NULL;
+        qmath_output floatOutput = { .type = QMATH_OUTPUT_FLOAT, .multipliers = multipliers };
+        qmath_gemm_mt(pool, M, N, K, A, B, LDB, bias, floatOutput, floatC, LDC);
+        qmath_output uint8Output = { .type = QMATH_OUTPUT_UINT8, .multipliers = multipliers, .zero_point = 100, .relu = 1 };
+        qmath_gemm_mt(pool, M, N, K, A, B, LDB, bias, uint8Output, uint8C, LDC);
+
+        for (int m = 0; m < M; m++) {
+            for (int n = 0; n < N; n++) {
+                int32_t sum = bias[m];
+                for (int k = 0; k < K; k++) {
+                    sum += A[m * K + k] * B[k * LDB + n];
+                }
+                XCTAssertEqual(floatC[m * LDC + n], (float)sum * multipliers[m]);
+                float scaled = (float)sum * multipliers[m];
+                long level = lroundf(scaled) + 100;
+                XCTAssertEqual(uint8C[m * LDC + n], level < 100? 100 : level > 255? 255 : level);
+            }
+        }
+    }
+    pthreadpool_destroy(threadpool);
+}
+
+- (void)testBiasFoldsTheInputZeroPoint {
+    // the real product of dequantized weights and inputs, plus a float bias
+    static int8_t A[M * K];
+    static uint8_t B[K * LDB];
+    static int32_t bias[M];
+    static float C[M * LDC], multipliers[M], weightScales[M], floatBias[M];
+    make_operands(A, B, M * K, K * LDB);
+    qmath_params input = qmath_params_of_range(-2, 6);
+    for (int m = 0; m < M; m++) {
+        weightScales[m] = 0.01f * (m + 1);
+        floatBias[m] = 0.5f * m - 1;
+        multipliers[m] = input.scale * weightScales[m];
+    }
+    qmath_bias(A, floatBias, weightScales, input, M, K, bias);
+    qmath_output output = { .type = QMATH_OUTPUT_FLOAT, .multipliers = multipliers };
+    qmath_gemm_mt(NULL, M, N, K, A, B, LDB, bias, output, C, LDC);
+
+    for (int m = 0; m < M; m++) {
+        for (int n = 0; n < N; n++) {
+            double expected = floatBias[m];
+            for (int k = 0; k < K; k++) {
+                expected += (A[m * K + k] * weightScales[m]) * ((B[k * LDB + n] - input.zero_point) * input.scale);
+            }
+            XCTAssertEqualWithAccuracy(C[m * LDC + n], expected, multipliers[m] * 0.5 + fabs(expected) * 1e-5);
+        }
+    }
+}
+
+- (void)testGemvMatchesGemm {
+    enum { rows = 9, columns = 33, ldx = columns + 2, ldy = rows + 1 };
+    static int8_t A[rows * columns];
+    static uint8_t x[BATCH * ldx], B[columns * BATCH];
+    static int32_t bias[rows];
+    static float y[BATCH * ldy], C[rows * BATCH], multipliers[rows];
+    make_operands(A, x, rows * columns, BATCH * ldx);
+    for (int m = 0; m < rows; m++) {
+        bias[m] = 50 * m;
+        multipliers[m] = 0.001f * (m + 1);
+    }
+    for (int b = 0; b < BATCH; b++) {
+        for (int n = 0; n < columns; n++) {
+            B[n * BATCH + b] = x[b * ldx + n];
+        }
+    }
+
+    pthreadpool_t threadpool = pthreadpool_create(2);
+    qmath_output output = { .type = QMATH_OUTPUT_FLOAT, .multipliers = multipliers, .relu = 1 };
+    qmath_gemv_mt(threadpool, rows, columns, BATCH, A, x, ldx, bias, output, y, ldy);
+    qmath_gemm_mt(threadpool, rows, BATCH, columns, A, B, BATCH, bias, output, C, BATCH);
+    pthreadpool_destroy(threadpool);
+
+    int clamped = 0;
+    for (int b = 0; b < BATCH; b++) {
+        for (int m = 0; m < rows; m++) {
+            XCTAssertEqual(y[b * ldy + m], C[m * BATCH + b]);
+            XCTAssertGreaterThanOrEqual(y[b * ldy + m], 0.0f);
+            if (y[b * ldy + m] == 0) clamped++;
+        }
+    }
+    XCTAssertGreaterThan(clamped, 0);     // ReLU did clamp some of them
+}
+
+@end
@@ -0,0 +1,160 @@
+//
+//  ResultCacheTests.m
+//  GeneralNetTests
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <stdlib.h>
+#import <string.h>
+#import "resultCache.h"
+
+@interface ResultCacheTests : XCTestCase
+
+@end
+
+@implementation ResultCacheTests
+
+- (void)testCreateRejectsEmptyCaches {
+    XCTAssertTrue(result_cache_create(0, 1, 5) == NULL);
+    XCTAssertTrue(result_cache_create(16, 0, 5) == NULL);
+    XCTAssertTrue(result_cache_create(16, 1, 0) == NULL);
+}
+
+- (void)testTopKRoundTrip {
+    result_cache *cache = result_cache_create(16, 4, 3);
+    XCTAssertEqual(result_cache_top_k(cache), 3);
+
+    int indices[3];
+    float probs[3];
+    XCTAssertEqual(result_cache_lookup(cache, 42, indices, probs), 0);
+
+    const float output[6] = { 0.1f, 0.4f, 0.05f, 0.4f, 0.3f, 0.05f };
+    result_cache_insert(cache, 42, output, 6);
+    XCTAssertEqual(result_cache_lookup(cache, 42, indices, probs), 1);
+    XCTAssertEqual(indices[0], 1);      // ties keep the smaller index first
+    XCTAssertEqual(indices[1], 3);
+    XCTAssertEqual(indices[2], 4);
+    XCTAssertEqual(probs[0], 0.4f);
+    XCTAssertEqual(probs[2], 0.3f);
+
+    // fewer probabilities than k
+    result_cache_insert(cache, 43, output, 2);
+    XCTAssertEqual(result_cache_lookup(cache, 43, indices, probs), 1);
+    XCTAssertEqual(indices[0], 1);
+    XCTAssertEqual(indices[1], 0);
+    XCTAssertEqual(indices[2], -1);
+    XCTAssertEqual(probs[2], 0.0f);
+
+    // inserting a key again replaces its result
+    result_cache_insert(cache, 42, output + 3, 3);
+    XCTAssertEqual(result_cache_lookup(cache, 42, indices, probs), 1);
+    XCTAssertEqual(indices[0], 0);
+    XCTAssertEqual(indices[1], 1);
+
+    result_cache_statistics statistics;
+    result_cache_get_statistics(cache, &statistics);
+    XCTAssertEqual(statistics.hits, 3);
+    XCTAssertEqual(statistics.misses, 1);
+    XCTAssertEqual(statistics.insertions, 3);
+    XCTAssertEqual(statistics.evictions, 0);
+    XCTAssertEqual(statistics.entries, 2);
+    XCTAssertEqual(statistics.capacity, 16);
+    result_cache_destroy(cache);
+}
+
+- (void)testLeastRecentlyUsedIsEvicted {
+    // one shard of 2, with keys in the same bucket
+    result_cache *cache = result_cache_create(2, 1, 1);
+    const uint64_t a = 1, b = 1 + (1ULL << 20), c = 1 + (2ULL << 20);
+    const float prob = 1;
+    int index;
+    float value;
+    result_cache_insert(cache, a, &prob, 1);
+    result_cache_insert(cache, b, &prob, 1);
+    XCTAssertEqual(result_cache_lookup(cache, a, &index, &value), 1);
+    result_cache_insert(cache, c, &prob, 1);
+
+    XCTAssertEqual(result_cache_lookup(cache, b, &index, &value), 0);
+    XCTAssertEqual(result_cache_lookup(cache, a, &index, &value), 1);
+    XCTAssertEqual(result_cache_lookup(cache, c, &index, &value), 1);
+    result_cache_insert(cache, b, &prob, 1);
+    XCTAssertEqual(result_cache_lookup(cache, a, &index, &value), 0);
+    XCTAssertEqual(result_cache_lookup(cache, c, &index, &value), 1);
+    XCTAssertEqual(result_cache_lookup(cache, b, &index, &value), 1);
+
+    result_cache_statistics statistics;
+    result_cache_get_statistics(cache, &statistics);
+    XCTAssertEqual(statistics.evictions, 2);
+    XCTAssertEqual(statistics.entries, 2);
+
+    result_cache_clear(cache);
+    XCTAssertEqual(result_cache_lookup(cache, b, &index, &value), 0);
+    result_cache_reset_statistics(cache);
+    result_cache_get_statistics(cache, &statistics);
+    XCTAssertEqual(statistics.hits + statistics.misses + statistics.insertions + statistics.evictions, 0);
+    XCTAssertEqual(statistics.entries, 0);
+    result_cache_destroy(cache);
+}
+
+- (void)testHashMatchesXXH64 {
+    const char *text = "Nobody inspects the spammish repetition";
+    XCTAssertEqual(result_cache_hash("", 0, 0), 0xef46db3751d8e999ULL);
+    XCTAssertEqual(result_cache_hash("abc", 3, 0), 0x44bc2cf5ad770999ULL);
+    XCTAssertEqual(result_cache_hash(text, strlen(text), 0), 0xfbcea83c8a378bf1ULL);
+
+    // every tail length around the 32-byte blocks, and a flipped bit anywhere, change the hash
+    uint8_t data[72];
+    for (int i = 0; i < 72; i++) data[i] = (uint8_t)(i * 7);
+    for (size_t size = 28; size <= 72; size++) {
+        XCTAssertNotEqual(result_cache_hash(data, size, 0), result_cache_hash(data, size - 1, 0));
+    }
+    const uint64_t hash = result_cache_hash(data, 72, 0);
+    XCTAssertNotEqual(result_cache_hash(data, 72, 1), hash);
+    for (int i = 0; i < 72; i++) {
+        data[i] ^= 1;
+        XCTAssertNotEqual(result_cache_hash(data, 72, 0), hash);
+        data[i] ^= 1;
+    }
+}
+
+- (void)testPerceptualHashIgnoresLayout {
+    // a bright ridge over a dark valley, in RGB and in BGRA at twice the size with padded rows
+    enum { width = 48, height = 40 };
+    static uint8_t rgb[height][width][3], bgra[height * 2][width * 2 * 4 + 16];
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t level = (uint8_t)(y < height / 2? 200 - 5 * abs(x - 12) : 45 + 5 * abs(x - 12));
+            rgb[y][x][0] = level;
+            rgb[y][x][1] = level / 2;
+            rgb[y][x][2] = 255 - level;
+        }
+    }
+    for (int y = 0; y < height * 2; y++) {
+        for (int x = 0; x < width * 2; x++) {
+            const uint8_t *pixel = rgb[y / 2][x / 2];
+            bgra[y][x * 4] = pixel[2];
+            bgra[y][x * 4 + 1] = pixel[1];
+            bgra[y][x * 4 + 2] = pixel[0];
+            bgra[y][x * 4 + 3] = 255;
+        }
+    }
+    const uint64_t hash = result_cache_perceptual_hash(&rgb[0][0][0], width, height, width * 3, PREPROCESS_RGB);
+    XCTAssertEqual(result_cache_perceptual_hash(bgra[0], width * 2, height * 2, sizeof(bgra[0]), PREPROCESS_BGRA), hash);
+
+    // the picture mirrored is another one
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width / 2; x++) {
+            for (int c = 0; c < 3; c++) {
+                uint8_t swap = rgb[y][x][c];
+                rgb[y][x][c] = rgb[y][width - 1 - x][c];
+                rgb[y][width - 1 - x][c] = swap;
+            }
+        }
+    }
+    XCTAssertNotEqual(result_cache_perceptual_hash(&rgb[0][0][0], width, height, width * 3, PREPROCESS_RGB), hash);
+}
+
+@end
@@ -0,0 +1,92 @@
+//
+//  SPSCRingTests.m
+//  GeneralNetTests
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <pthread.h>
+#import "spscRing.h"
+
+@interface SPSCRingTests : XCTestCase
+
+@end
+
+@implementation SPSCRingTests
+
+#define ITEMS_COUNT 200000
+
+static void *produce(void *ring) {
+    for (int i = 0; i < ITEMS_COUNT; i++) {
+        spsc_ring_push(ring, i);
+    }
+    return NULL;
+}
+
+- (void)testCapacityIsRoundedUp {
+    spsc_ring ring;
+    XCTAssertEqual(spsc_ring_init(&ring, 5), 0);
+    for (int i = 0; i < 8; i++) {
+        XCTAssertTrue(spsc_ring_try_push(&ring, i));
+    }
+    XCTAssertFalse(spsc_ring_try_push(&ring, 8));
+
+    int item = -1;
+    XCTAssertTrue(spsc_ring_try_pop(&ring, &item));
+    XCTAssertEqual(item, 0);
+    XCTAssertTrue(spsc_ring_try_push(&ring, 8));
+    XCTAssertFalse(spsc_ring_try_push(&ring, 9));
+    spsc_ring_destroy(&ring);
+}
+
+- (void)testEmptyRing {
+    spsc_ring ring;
+    XCTAssertEqual(spsc_ring_init(&ring, 1), 0);
+    int item = -1;
+    XCTAssertFalse(spsc_ring_try_pop(&ring, &item));
+    XCTAssertEqual(item, -1);
+
+    XCTAssertTrue(spsc_ring_try_push(&ring, 42));
+    XCTAssertFalse(spsc_ring_try_push(&ring, 43));
+    XCTAssertEqual(spsc_ring_pop(&ring), 42);
+    XCTAssertFalse(spsc_ring_try_pop(&ring, &item));
+    spsc_ring_destroy(&ring);
+    XCTAssertTrue(ring.items == NULL);
+}
+
+- (void)testOrderIsKeptAcrossWrapping {
+    spsc_ring ring;
+    XCTAssertEqual(spsc_ring_init(&ring, 4), 0);
+    // 3 items at a time move the positions around the 4 slots
+    int next = 0, expected = 0;
+    for (int round = 0; round < 100; round++) {
+        for (int i = 0; i < 3; i++) XCTAssertTrue(spsc_ring_try_push(&ring, next++));
+        for (int i = 0; i < 3; i++) XCTAssertEqual(spsc_ring_pop(&ring), expected++);
+    }
+    int item;
+    XCTAssertFalse(spsc_ring_try_pop(&ring, &item));
+    XCTAssertEqual(expected, next);
+    spsc_ring_destroy(&ring);
+}
+
+- (void)testProducerAndConsumerThreads {
+    spsc_ring ring;
+    XCTAssertEqual(spsc_ring_init(&ring, 16), 0);
+    pthread_t producer;
+    XCTAssertEqual(pthread_create(&producer, NULL, produce, &ring), 0);
+
+    int outOfOrder = 0;
+    for (int i = 0; i < ITEMS_COUNT; i++) {
+        if (spsc_ring_pop(&ring) != i) outOfOrder++;
+    }
+    pthread_join(producer, NULL);
+    XCTAssertEqual(outOfOrder, 0);
+
+    int item;
+    XCTAssertFalse(spsc_ring_try_pop(&ring, &item));
+    spsc_ring_destroy(&ring);
+}
+
+@end
@@ -0,0 +1,219 @@
+//
+//  VectorMathTests.m
+//  GeneralNetTests
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <math.h>
+#import <stdlib.h>
+#import <string.h>
+#import "vectorMath.h"
+
+@interface VectorMathTests : XCTestCase
+
+@end
+
+@implementation VectorMathTests
+
+// lengths up to 67 go through full vectors of every width and all of their tails
+#define MAX_LENGTH 67
+#define SENTINEL -12345.0f
+
+// error of y in units of the last place of exact rounded to float, as the bounds in vectorMath.h are given
+static double ulp_error(float y, double exact) {
+    int exponent;
+    frexp(exact, &exponent);
+    double ulp = fabs(exact) < ldexp(1, -125)? ldexp(1, -149) : ldexp(1, exponent - 24);
+    return fabs(y - exact) / ulp;
+}
+
+static void make_inputs(float *x, size_t n, float low, float high) {
+    unsigned int state = 2017;
+    for (size_t i = 0; i < n; i++) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        x[i] = low + (high - low) * (state >> 8) / 16777216.0f;
+    }
+}
+
+- (void)testElementWiseMatchesScalarCode {
+    float a[MAX_LENGTH], b[MAX_LENGTH], y[MAX_LENGTH + 1];
+    make_inputs(a, MAX_LENGTH, -4, 4);
+    make_inputs(b, MAX_LENGTH, 0.5f, 3);
+    for (size_t n = 0; n <= MAX_LENGTH; n++) {
+        y[n] = SENTINEL;
+        vmath_relu(a, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], a[i] > 0? a[i] : 0);
+        vmath_add(a, b, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], a[i] + b[i]);
+        vmath_div(a, b, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], a[i] / b[i]);
+        vmath_square(a, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], a[i] * a[i]);
+        vmath_add_scalar(a, 0.25f, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], a[i] + 0.25f);
+        vmath_scale(a, -3, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], a[i] * -3);
+        vmath_scale_add(a, 0.5f, 2, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqualWithAccuracy(y[i], a[i] * 0.5f + 2, 1e-6);
+        vmath_fill(y, 7, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], 7);
+        vmath_axpy(a, 2, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqualWithAccuracy(y[i], 7 + 2 * a[i], 1e-6);
+        XCTAssertEqual(y[n], SENTINEL, @"n = %zu", n);
+
+        // in place
+        memcpy(y, a, n * sizeof(float));
+        vmath_relu(y, y, n);
+        for (size_t i = 0; i < n; i++) XCTAssertEqual(y[i], a[i] > 0? a[i] : 0);
+
+        double sum = 0;
+        float max = -INFINITY;
+        for (size_t i = 0; i < n; i++) {
+            sum += a[i];
+            if (a[i] > max) max = a[i];
+        }
+        XCTAssertEqualWithAccuracy(vmath_sum(a, n), sum, 1e-5);
+        XCTAssertEqual(vmath_max(a, n), max);
+    }
+}
+
+- (void)testExpIsWithinItsBound {
+    enum { count = 1 << 20 };
+    float *x = malloc(count * sizeof(float)), *y = malloc(count * sizeof(float));
+    for (int i = 0; i < count; i++) {
+        x[i] = -87.3f + (88.7f + 87.3f) * i / (count - 1);
+    }
+    vmath_exp(x, y, count);
+    double worst = 0;
+    for (int i = 0; i < count; i++) {
+        worst = fmax(worst, ulp_error(y[i], exp((double)x[i])));
+    }
+    XCTAssertLessThanOrEqual(worst, 1.01);
+
+    float specials[5] = { 88.75f, INFINITY, -104, -INFINITY, NAN };
+    vmath_exp(specials, specials, 5);
+    XCTAssertEqual(specials[0], INFINITY);
+    XCTAssertEqual(specials[1], INFINITY);
+    XCTAssertEqual(specials[2], 0.0f);
+    XCTAssertEqual(specials[3], 0.0f);
+    XCTAssertTrue(isnan(specials[4]));
+    free(x);
+    free(y);
+}
+
+- (void)testLogIsWithinItsBound {
+    // every 1021st float from the smallest subnormal to the largest normal
+    enum { count = 0x7f800000 / 1021 };
+    float *x = malloc(count * sizeof(float)), *y = malloc(count * sizeof(float));
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t bits = 1 + i * 1021;
+        memcpy(&x[i], &bits, sizeof(float));
+    }
+    vmath_log(x, y, count);
+    double worst = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (x[i] != 1) worst = fmax(worst, ulp_error(y[i], log((double)x[i])));
+    }
+    XCTAssertLessThanOrEqual(worst, 0.85);
+
+    float specials[5] = { 0, -1, INFINITY, NAN, 1 };
+    vmath_log(specials, specials, 5);
+    XCTAssertEqual(specials[0], -INFINITY);
+    XCTAssertTrue(isnan(specials[1]));
+    XCTAssertEqual(specials[2], INFINITY);
+    XCTAssertTrue(isnan(specials[3]));
+    XCTAssertEqual(specials[4], 0.0f);
+    free(x);
+    free(y);
+}
+
+- (void)testPowOfLocalResponseNormalization {
+    // (k + alpha / n * sum of squares) ^ -beta with k = 1 and beta = 0.75, and other exponents with |e * log2(x)| <= 1.5
+    enum { count = 1 << 16 };
+    static float x[count], e[count], y[count];
+    for (int i = 0; i < count; i++) {
+        x[i] = 1 + 3.0f * i / (count - 1);
+        e[i] = i % 2? -0.75f : 0.5f;
+    }
+    double worst = 0;
+    vmath_pow_scalar(x, -0.75f, y, count);
+    for (int i = 0; i < count; i++) {
+        worst = fmax(worst, ulp_error(y[i], pow((double)x[i], -0.75)));
+    }
+    XCTAssertLessThanOrEqual(worst, 2.1);
+
+    worst = 0;
+    vmath_pow(x, e, y, count);
+    for (int i = 0; i < count; i++) {
+        worst = fmax(worst, ulp_error(y[i], pow((double)x[i], (double)e[i])));
+    }
+    XCTAssertLessThanOrEqual(worst, 2.4);
+}
+
+- (void)testThreadedVersionsMatch {
+    const size_t n = 3 * VMATH_MT_THRESHOLD + 5;
+    float *a = malloc(n * sizeof(float)), *b = malloc(n * sizeof(float));
+    float *y = malloc(n * sizeof(float)), *z = malloc(n * sizeof(float));
+    make_inputs(a, n, -2, 2);
+    make_inputs(b, n, 0.5f, 2);
+    pthreadpool_t threadpool = pthreadpool_create(4);
+
+    vmath_exp(a, y, n);
+    vmath_exp_mt(threadpool, a, z, n);
+    XCTAssertEqual(memcmp(y, z, n * sizeof(float)), 0);
+    vmath_log(b, y, n);
+    vmath_log_mt(threadpool, b, z, n);
+    XCTAssertEqual(memcmp(y, z, n * sizeof(float)), 0);
+    vmath_pow(b, a, y, n);
+    vmath_pow_mt(threadpool, b, a, z, n);
+    XCTAssertEqual(memcmp(y, z, n * sizeof(float)), 0);
+    vmath_div(a, b, y, n);
+    vmath_div_mt(threadpool, a, b, z, n);
+    XCTAssertEqual(memcmp(y, z, n * sizeof(float)), 0);
+    vmath_scale_add(a, 3, 1, y, n);
+    vmath_scale_add_mt(threadpool, a, 3, 1, z, n);
+    XCTAssertEqual(memcmp(y, z, n * sizeof(float)), 0);
+
+    // only the order of additions differs
+    XCTAssertEqualWithAccuracy(vmath_sum_mt(threadpool, b, n), vmath_sum(b, n), vmath_sum(b, n) * 1e-5);
+    XCTAssertEqual(vmath_max_mt(threadpool, a, n), vmath_max(a, n));
+    XCTAssertEqual(vmath_max_mt(threadpool, a, 0), -INFINITY);
+
+    pthreadpool_destroy(threadpool);
+    free(a);
+    free(b);
+    free(y);
+    free(z);
+}
+
+- (void)testSgemvAddsToY {
+    enum { rows = 37, columns = 45 };
+    static float A[rows * columns], x[columns], y[rows], expected[rows];
+    make_inputs(A, rows * columns, -1, 1);
+    make_inputs(x, columns, -1, 1);
+    for (int m = 0; m < rows; m++) {
+        y[m] = expected[m] = 0.5f * m;
+        for (int n = 0; n < columns; n++) {
+            expected[m] += A[m * columns + n] * x[n];
+        }
+    }
+    vmath_sgemv(rows, columns, A, x, y);
+    for (int m = 0; m < rows; m++) {
+        XCTAssertEqualWithAccuracy(y[m], expected[m], 1e-4);
+    }
+
+    pthreadpool_t threadpool = pthreadpool_create(4);
+    for (int m = 0; m < rows; m++) y[m] = 0.5f * m;
+    vmath_sgemv_mt(threadpool, rows, columns, A, x, y);
+    pthreadpool_destroy(threadpool);
+    for (int m = 0; m < rows; m++) {
+        XCTAssertEqualWithAccuracy(y[m], expected[m], 1e-4);
+    }
+}
+
+@end
@@ -0,0 +1,130 @@
+//
+//  WeightContainerTests.m
+//  GeneralNetTests
+//
+//  Created by Lun on 2017/9/23.
+//  Copyright © 2017年 Lun. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#import <string.h>
+#import <zlib.h>
+#import "weightContainer.h"
+
+@interface WeightContainerTests : XCTestCase
+
+@end
+
+@implementation WeightContainerTests
+
+#define RAW_SIZE (100 * 4 + 12 + 64 * 4)
+#define CHUNKS_COUNT 3
+
+// raw floats of three layers, the one in the middle is stored
+static const size_t raw_offsets[CHUNKS_COUNT + 1] = { 0, 100 * 4, 100 * 4 + 12, RAW_SIZE };
+static const uint32_t codecs[CHUNKS_COUNT] = { WEIGHT_CODEC_SHUFFLE_DEFLATE, WEIGHT_CODEC_STORED, WEIGHT_CODEC_SHUFFLE_DEFLATE };
+
+static void make_raw(uint8_t *raw) {
+    float *floats = (float *)raw;
+    for (int i = 0; i < RAW_SIZE / 4; i++) {
+        floats[i] = (i % 7 - 3) * 0.01f;
+    }
+}
+
+// as Convert/compress_weights.py writes it, returns the size of the container
+static size_t make_container(uint8_t *container, size_t capacity, const uint8_t *raw) {
+    weight_container_header *header = (weight_container_header *)container;
+    weight_container_chunk *chunks = (weight_container_chunk *)(header + 1);
+    size_t size = sizeof(weight_container_header) + CHUNKS_COUNT * sizeof(weight_container_chunk);
+    for (int i = 0; i < CHUNKS_COUNT; i++) {
+        size_t raw_size = raw_offsets[i + 1] - raw_offsets[i];
+        chunks[i] = (weight_container_chunk){ .codec = codecs[i], .raw_offset = raw_offsets[i], .raw_size = raw_size, .offset = size };
+        if (codecs[i] == WEIGHT_CODEC_STORED) {
+            memcpy(container + size, raw + raw_offsets[i], raw_size);
+            chunks[i].size = raw_size;
+        } else {
+            uint8_t planes[RAW_SIZE];
+            const size_t count = raw_size / sizeof(float);
+            for (size_t j = 0; j < raw_size; j++) {
+                planes[j % sizeof(float) * count + j / sizeof(float)] = raw[raw_offsets[i] + j];
+            }
+            uLongf compressed_size = (uLongf)(capacity - size);
+            compress2(container + size, &compressed_size, planes, (uLong)raw_size, 9);
+            chunks[i].size = compressed_size;
+        }
+        size = (size + (size_t)chunks[i].size + 7) / 8 * 8;
+    }
+    *header = (weight_container_header){
+        .magic = WEIGHT_CONTAINER_MAGIC,
+        .version = WEIGHT_CONTAINER_VERSION,
+        .chunk_count = CHUNKS_COUNT,
+        .raw_size = RAW_SIZE,
+        .file_size = size,
+    };
+    return size;
+}
+
+- (void)testRoundTrip {
+    static uint8_t raw[RAW_SIZE], container[2 * RAW_SIZE], decompressed[RAW_SIZE];
+    make_raw(raw);
+    size_t size = make_container(container, sizeof(container), raw);
+    XCTAssertTrue(weight_container_is_container(container, size));
+    XCTAssertFalse(weight_container_is_container(raw, RAW_SIZE));
+    XCTAssertFalse(weight_container_is_container(container, sizeof(weight_container_header) - 1));
+    XCTAssertTrue(weight_container_check(container, size) == NULL);
+
+    pthreadpool_t threadpool = pthreadpool_create(2);
+    XCTAssertEqual(weight_container_decompress(threadpool, container, decompressed), 0);
+    XCTAssertEqual(memcmp(decompressed, raw, RAW_SIZE), 0);
+
+    // a corrupted chunk is reported rather than decompressed into garbage
+    weight_container_chunk *chunks = (weight_container_chunk *)((weight_container_header *)container + 1);
+    container[chunks[2].offset + chunks[2].size / 2] ^= 0xff;
+    XCTAssertEqual(weight_container_decompress(threadpool, container, decompressed), -1);
+    pthreadpool_destroy(threadpool);
+}
+
+- (void)testChunksCoverTheRawFileOnce {
+    static uint8_t raw[RAW_SIZE], container[2 * RAW_SIZE];
+    make_raw(raw);
+    size_t size = make_container(container, sizeof(container), raw);
+    weight_container_header *header = (weight_container_header *)container;
+    weight_container_chunk *chunks = (weight_container_chunk *)(header + 1);
+
+    XCTAssertTrue(weight_container_check(container, size - 1) != NULL);
+    header->version++;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    header->version--;
+    header->chunk_count = (uint32_t)(size / sizeof(weight_container_chunk));
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    header->chunk_count = CHUNKS_COUNT - 1;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    header->chunk_count = CHUNKS_COUNT;
+    header->raw_size += 4;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    header->raw_size -= 4;
+    XCTAssertTrue(weight_container_check(container, size) == NULL);
+
+    chunks[1].raw_offset -= 4;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    chunks[1].raw_offset += 4;
+    chunks[2].offset = size;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    chunks[2].offset = UINT64_MAX;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    make_container(container, sizeof(container), raw);
+    chunks[1].size--;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    chunks[1].size++;
+    chunks[1].codec = WEIGHT_CODEC_SHUFFLE_DEFLATE;     // 12 bytes are whole floats, 2 are not
+    XCTAssertTrue(weight_container_check(container, size) == NULL);
+    chunks[1].raw_size -= 2;
+    chunks[2].raw_offset -= 2;
+    chunks[2].raw_size += 2;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+    make_container(container, sizeof(container), raw);
+    chunks[0].codec = 2;
+    XCTAssertTrue(weight_container_check(container, size) != NULL);
+}
+
+@end